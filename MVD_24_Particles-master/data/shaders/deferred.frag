@@ -27,13 +27,48 @@ layout (std140) uniform u_lights_ubo
 };
 
 uniform vec3 u_cam_pos;
-uniform sampler2D u_tex_position;
+uniform sampler2D u_tex_depth;
+uniform mat4 u_inv_vp;
+uniform vec2 u_render_scale; //part of the gbuffer covered by the scene
 uniform sampler2D u_tex_normal;
 uniform sampler2D u_tex_albedo;
 
 //shadows
 uniform sampler2D u_shadow_map[MAX_LIGHTS];
 
+//sampler arrays may only be indexed with constant expressions, and the light
+//index here is a loop variable, so select the shadow map explicitly
+float shadowMapDepth(int light_index, vec2 uv) {
+    switch (light_index) {
+        case 0: return texture(u_shadow_map[0], uv).r;
+        case 1: return texture(u_shadow_map[1], uv).r;
+        case 2: return texture(u_shadow_map[2], uv).r;
+        case 3: return texture(u_shadow_map[3], uv).r;
+        case 4: return texture(u_shadow_map[4], uv).r;
+        case 5: return texture(u_shadow_map[5], uv).r;
+        case 6: return texture(u_shadow_map[6], uv).r;
+        case 7: return texture(u_shadow_map[7], uv).r;
+    }
+    return 1.0;
+}
+
+//octahedral normal decoding, inverse of encodeNormal in gbuffer.frag
+vec3 decodeNormal(vec2 f) {
+    f = f * 2.0 - 1.0;
+    vec3 n = vec3(f.x, f.y, 1.0 - abs(f.x) - abs(f.y));
+    float t = clamp(-n.z, 0.0, 1.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+//world position from depth buffer and inverse view projection
+vec3 reconstructPosition(vec2 uv, float depth) {
+    vec4 ndc = vec4(uv * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+    vec4 world = u_inv_vp * ndc;
+    return world.xyz / world.w;
+}
+
 float random(vec4 seed4){
     float dot_product = dot(seed4, vec4(12.9898,78.233,45.164,94.673));
     return fract(sin(dot_product) * 43758.5453);
@@ -68,13 +103,14 @@ float shadowCalculationPoisson(vec4 fragment_light_space, float NdotL, int light
         
         float bias = max(0.05 * (1.0 - NdotL), 0.005);
 
-        vec2 texel_size = 1.0 / textureSize(u_shadow_map[light_index], 0);
+        //all shadow maps share the same resolution
+        vec2 texel_size = 1.0 / textureSize(u_shadow_map[0], 0);
         for (int i = 0;i < 4; i++){
             
             int index = int(4*random(vec4(gl_FragCoord.xyy, i))) % 4;
             
-            float poisson_depth = texture( u_shadow_map[light_index],
-                                          proj_coords.xy + poissonDisk[index] * texel_size).r;
+            float poisson_depth = shadowMapDepth(light_index,
+                                          proj_coords.xy + poissonDisk[index] * texel_size);
             
             shadow += current_depth - bias > poisson_depth ? 1.0 : 0.0;
         }
@@ -87,9 +123,14 @@ float shadowCalculationPoisson(vec4 fragment_light_space, float NdotL, int light
 
 void main() {
     //read textures
-    vec3 position = texture(u_tex_position, v_uv).xyz;
-    vec3 N = texture(u_tex_normal, v_uv).xyz;
-    vec4 albedo_spec = texture(u_tex_albedo, v_uv);
+    vec2 tex_uv = v_uv * u_render_scale;
+    float depth = texture(u_tex_depth, tex_uv).r;
+    //nothing was written here, background stays as cleared
+    if (depth == 1.0)
+        discard;
+    vec3 position = reconstructPosition(v_uv, depth);
+    vec3 N = decodeNormal(texture(u_tex_normal, tex_uv).xy);
+    vec4 albedo_spec = texture(u_tex_albedo, tex_uv);
     
     //lighting
     vec3 V = normalize(u_cam_pos - position);
@@ -8,10 +8,27 @@ in vec2 v_uv;
 in vec3 v_normal;
 in vec3 v_vertex_world_pos;
 
-uniform int u_use_diffuse_map;
+//material uniforms, laid out as MaterialBlock
+layout (std140) uniform u_material_ubo
+{
+    vec3 u_ambient;
+    float u_specular_gloss;
+    vec3 u_diffuse;
+    float u_normal_factor;
+    vec3 u_specular;
+    float u_max_height;
+    vec2 u_uv_scale;
+    int u_use_diffuse_map;
+    int u_use_diffuse_map_2;
+    int u_use_diffuse_map_3;
+    int u_use_normal_map;
+    int u_use_specular_map;
+    int u_use_reflection_map;
+    int u_use_noise_map;
+    int u_use_transparency_map;
+};
+
 uniform sampler2D u_diffuse_map;
-uniform vec3 u_diffuse;
-uniform vec3 u_specular;
 
 void main(){
 	
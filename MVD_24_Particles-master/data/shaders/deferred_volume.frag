@@ -2,7 +2,7 @@
 
 //light structs and uniforms
 struct Light {
-    vec4 position;
+    vec4 position; // w is light volume radius
     vec4 direction;
     vec4 color;
     float linear_att;
@@ -18,7 +18,7 @@ struct Light {
 
 out vec4 fragColor;
 
-uniform int u_light_id;
+flat in int v_light_id;
 
 const int MAX_LIGHTS = 8;
 layout (std140) uniform u_lights_ubo
@@ -27,13 +27,48 @@ layout (std140) uniform u_lights_ubo
 };
 
 uniform vec3 u_cam_pos;
-uniform sampler2D u_tex_position;
+uniform sampler2D u_tex_depth;
+uniform mat4 u_inv_vp;
+uniform vec2 u_render_scale; //part of the gbuffer covered by the scene
 uniform sampler2D u_tex_normal;
 uniform sampler2D u_tex_albedo;
 
 //shadows
 uniform sampler2D u_shadow_map[MAX_LIGHTS];
 
+//sampler arrays may only be indexed with constant expressions, and the light
+//id now varies per instance, so select the shadow map explicitly
+float shadowMapDepth(int light_index, vec2 uv) {
+    switch (light_index) {
+        case 0: return texture(u_shadow_map[0], uv).r;
+        case 1: return texture(u_shadow_map[1], uv).r;
+        case 2: return texture(u_shadow_map[2], uv).r;
+        case 3: return texture(u_shadow_map[3], uv).r;
+        case 4: return texture(u_shadow_map[4], uv).r;
+        case 5: return texture(u_shadow_map[5], uv).r;
+        case 6: return texture(u_shadow_map[6], uv).r;
+        case 7: return texture(u_shadow_map[7], uv).r;
+    }
+    return 1.0;
+}
+
+//octahedral normal decoding, inverse of encodeNormal in gbuffer.frag
+vec3 decodeNormal(vec2 f) {
+    f = f * 2.0 - 1.0;
+    vec3 n = vec3(f.x, f.y, 1.0 - abs(f.x) - abs(f.y));
+    float t = clamp(-n.z, 0.0, 1.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+//world position from depth buffer and inverse view projection
+vec3 reconstructPosition(vec2 uv, float depth) {
+    vec4 ndc = vec4(uv * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+    vec4 world = u_inv_vp * ndc;
+    return world.xyz / world.w;
+}
+
 float random(vec4 seed4){
     float dot_product = dot(seed4, vec4(12.9898,78.233,45.164,94.673));
     return fract(sin(dot_product) * 43758.5453);
@@ -68,13 +103,14 @@ float shadowCalculationPoisson(vec4 fragment_light_space, float NdotL, int light
         
         float bias = max(0.0005 * (1.0 - NdotL), 0.0005);
 
-        vec2 texel_size = 1.0 / textureSize(u_shadow_map[light_index], 0);
+        //all shadow maps share the same resolution
+        vec2 texel_size = 1.0 / textureSize(u_shadow_map[0], 0);
         for (int i = 0;i < 4; i++){
             
             int index = int(4*random(vec4(gl_FragCoord.xyy, i))) % 4;
             
-            float poisson_depth = texture( u_shadow_map[light_index],
-                                          proj_coords.xy + poissonDisk[index] * texel_size).r;
+            float poisson_depth = shadowMapDepth(light_index,
+                                          proj_coords.xy + poissonDisk[index] * texel_size);
             
             shadow += current_depth - bias > poisson_depth ? 1.0 : 0.0;
         }
@@ -89,11 +125,16 @@ void main() {
     
     
     //calculate texture coordinate
-    vec2 uv = gl_FragCoord.xy / textureSize(u_tex_position, 0).xy;
+    vec2 uv = gl_FragCoord.xy / textureSize(u_tex_depth, 0).xy;
 
     //read textures
-    vec3 position = texture(u_tex_position, uv).xyz;
-    vec3 N = texture(u_tex_normal, uv).xyz;
+    float depth = texture(u_tex_depth, uv).r;
+    //nothing was written here, background stays as cleared
+    if (depth == 1.0)
+        discard;
+    //screen uv of the scaled viewport, for reconstruction
+    vec3 position = reconstructPosition(uv / u_render_scale, depth);
+    vec3 N = decodeNormal(texture(u_tex_normal, uv).xy);
     vec4 albedo_spec = texture(u_tex_albedo, uv);
     
     vec3 final_color = vec3(0);
@@ -102,42 +143,45 @@ void main() {
     float spot_cone_intensity = 1.0;
 
     //light vectors
-    vec3 L = -normalize(lights[u_light_id].direction.xyz); 
+    vec3 L = -normalize(lights[v_light_id].direction.xyz); 
     vec3 R = reflect(-L,N);
     vec3 V = normalize(u_cam_pos - position); 
 
-    if (lights[u_light_id].type > 0) {
+    if (lights[v_light_id].type > 0) {
     
-        vec3 point_to_light = lights[u_light_id].position.xyz - position;
+        vec3 point_to_light = lights[v_light_id].position.xyz - position;
         L = normalize(point_to_light);
 
         // soft spot cone
-        if (lights[u_light_id].type == 2) {
-            vec3 D = normalize(lights[u_light_id].direction.xyz);
+        if (lights[v_light_id].type == 2) {
+            vec3 D = normalize(lights[v_light_id].direction.xyz);
             float cos_theta = dot(D, -L);
 
-            float numer = cos_theta - lights[u_light_id].spot_outer_cosine;
-            float denom = lights[u_light_id].spot_inner_cosine - lights[u_light_id].spot_outer_cosine;
+            float numer = cos_theta - lights[v_light_id].spot_outer_cosine;
+            float denom = lights[v_light_id].spot_inner_cosine - lights[v_light_id].spot_outer_cosine;
             spot_cone_intensity = 1 - clamp(numer/denom, 0.0, 1.0);
 
         }
         
         //attenuation
         float distance = length(point_to_light);
-        attenuation = 1.0 / (1.0 + lights[u_light_id].linear_att * distance + lights[u_light_id].quadratic_att * (distance * distance));
+        //volume mesh is a conservative bound, skip pixels outside the real radius
+        if (distance > lights[v_light_id].position.w)
+            discard;
+        attenuation = 1.0 / (1.0 + lights[v_light_id].linear_att * distance + lights[v_light_id].quadratic_att * (distance * distance));
     }
 
     //diffuse shading
     float NdotL = max(0.0, dot(N, L));
-    vec3 diffuse_color = NdotL * albedo_spec.xyz * lights[u_light_id].color.xyz;
+    vec3 diffuse_color = NdotL * albedo_spec.xyz * lights[v_light_id].color.xyz;
     //specular
     float RdotV = max(0.0, dot(R, V)); 
     RdotV = pow(RdotV, 30.0);
-    vec3 specular_color = RdotV * albedo_spec.w * lights[u_light_id].color.xyz;
+    vec3 specular_color = RdotV * albedo_spec.w * lights[v_light_id].color.xyz;
     
-    vec4 position_light_space = lights[u_light_id].view_projection * vec4(position, 1.0);
+    vec4 position_light_space = lights[v_light_id].view_projection * vec4(position, 1.0);
     
-    float shadow = (lights[u_light_id].cast_shadow == 1 ? shadowCalculationPoisson(position_light_space, NdotL, u_light_id) : 0.0);
+    float shadow = (lights[v_light_id].cast_shadow == 1 ? shadowCalculationPoisson(position_light_space, NdotL, v_light_id) : 0.0);
 
     final_color = ((diffuse_color + specular_color) * attenuation * spot_cone_intensity) * (1.0 - shadow);
 
@@ -1,8 +1,65 @@
 #version 330
 layout(location = 0) in vec3 a_vertex;
+layout(location = 5) in int a_light_id; //one instance per light
 
-uniform mat4 u_mvp;
+//light structs and uniforms
+struct Light {
+    vec4 position; // w is light volume radius
+    vec4 direction;
+    vec4 color;
+    float linear_att;
+    float quadratic_att;
+    float spot_inner_cosine;
+    float spot_outer_cosine;
+    mat4 view_projection;
+    int type; // 0 - directional; 1 - point; 2 - spot
+    int cast_shadow; // 0 - false; 1 - true
+};
+
+const int MAX_LIGHTS = 8;
+layout (std140) uniform u_lights_ubo
+{
+    Light lights[MAX_LIGHTS];
+};
+
+uniform mat4 u_vp;
+
+flat out int v_light_id;
 
 void main() {
-    gl_Position = u_mvp * vec4(a_vertex, 1);
+    v_light_id = a_light_id;
+    Light light = lights[a_light_id];
+
+    //directional lights are drawn with the screen quad, no transform
+    if (light.type == 0) {
+        gl_Position = vec4(a_vertex, 1);
+        return;
+    }
+
+    float radius = light.position.w;
+    vec3 world_pos;
+
+    if (light.type == 1) {
+        //unit sphere scaled to light radius
+        world_pos = light.position.xyz + a_vertex * radius;
+    } else {
+        //cone.obj has its apex at the origin and opens along +y to a unit
+        //circle at y = 1. Orient +y along the light direction
+        vec3 axis = normalize(light.direction.xyz);
+        vec3 helper = abs(axis.y) < 0.99 ? vec3(0, 1, 0) : vec3(1, 0, 0);
+        vec3 side = normalize(cross(helper, axis));
+        vec3 up = cross(axis, side);
+
+        //base radius from outer cone angle; 1.06 makes the 10 sided base
+        //enclose the circle rather than be inscribed in it
+        float cos_outer = max(light.spot_outer_cosine, 0.01);
+        float base_radius = 1.06 * radius * sqrt(1.0 - cos_outer * cos_outer) / cos_outer;
+
+        world_pos = light.position.xyz
+                  + axis * (a_vertex.y * radius)
+                  + side * (a_vertex.x * base_radius)
+                  + up * (a_vertex.z * base_radius);
+    }
+
+    gl_Position = u_vp * vec4(world_pos, 1);
 }
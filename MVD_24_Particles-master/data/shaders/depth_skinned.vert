@@ -0,0 +1,24 @@
+#version 330
+
+layout(location = 0) in vec3 a_vertex;
+layout(location = 3) in vec4 a_vertex_weights;
+layout(location = 4) in vec4 a_vertex_jointids;
+
+uniform mat4 u_vp;
+
+//same palette as phong_anim.vert
+const int MAX_JOINTS = 96;
+layout (std140) uniform u_skin_ubo
+{
+    mat4 u_skin_palette[MAX_JOINTS];
+};
+
+void main() {
+    vec4 vertex4 = vec4(a_vertex, 1.0);
+    vec4 final_vert = vec4(0.0);
+    for(int i = 0; i < 4; i++){
+        int j_id = int(a_vertex_jointids[i]);
+        final_vert += a_vertex_weights[i] * u_skin_palette[j_id] * vertex4;
+    }
+    gl_Position = u_vp * final_vert;
+}
@@ -1,25 +1,36 @@
 #version 330
-//these outs correspond to the three color buffers
-layout (location = 0) out vec3 g_position;
-layout (location = 1) out vec3 g_normal;
-layout (location = 2) out vec4 g_albedo;
+//these outs correspond to the two color buffers, position comes from depth
+layout (location = 0) out vec2 g_normal;
+layout (location = 1) out vec4 g_albedo;
 //data from vertex shader
 in vec2 v_uv;
 in vec3 v_normal;
 in vec3 v_cam_dir;
 in vec3 v_vertex_world_pos;
-//we need to upload these uniforms from material
-uniform int u_use_diffuse_map;
+//material uniforms, laid out as MaterialBlock
+layout (std140) uniform u_material_ubo
+{
+    vec3 u_ambient;
+    float u_specular_gloss;
+    vec3 u_diffuse;
+    float u_normal_factor;
+    vec3 u_specular;
+    float u_max_height;
+    vec2 u_uv_scale;
+    int u_use_diffuse_map;
+    int u_use_diffuse_map_2;
+    int u_use_diffuse_map_3;
+    int u_use_normal_map;
+    int u_use_specular_map;
+    int u_use_reflection_map;
+    int u_use_noise_map;
+    int u_use_transparency_map;
+};
+
 uniform sampler2D u_diffuse_map;
-uniform int u_use_normal_map;
 uniform sampler2D u_normal_map;
-uniform int u_use_specular_map;
 uniform sampler2D u_specular_map;
 
-uniform vec3 u_diffuse;
-uniform vec3 u_specular;
-uniform float u_normal_factor;
-uniform vec2 u_uv_scale;
 
 //given a normal vector, a position vector, and uv coordinates
 //creates a mat3 which represents tangent space for
@@ -52,16 +63,26 @@ mat3 cotangent_frame(vec3 N, vec3 p, vec2 uv)
 vec3 perturbNormal( vec3 N, vec3 P, vec2 texcoord, vec3 normal_sample )
 {
     
-    normal_sample = normal_sample * 2.0 - 1.0;
+    //xy only, so two channel (BC5) normal maps work too. z is rebuilt
+    normal_sample.xy = normal_sample.xy * 2.0 - 1.0;
+    normal_sample.z = sqrt(max(0.0, 1.0 - dot(normal_sample.xy, normal_sample.xy)));
     mat3 TBN = cotangent_frame(N, -P, texcoord);
     return normalize(TBN * normal_sample);
 }
 
+//octahedral normal encoding, maps unit vector to [0,1]^2
+//http://jcgt.org/published/0003/02/01/
+vec2 octWrap(vec2 v) {
+    return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 encodeNormal(vec3 n) {
+    n /= (abs(n.x) + abs(n.y) + abs(n.z));
+    n.xy = n.z >= 0.0 ? n.xy : octWrap(n.xy);
+    return n.xy * 0.5 + 0.5;
+}
 
 void main() {
-    //store the vertex world position
-    g_position = v_vertex_world_pos;
-    
     //scale uvs
     vec2 s_uv = v_uv * u_uv_scale;
     
@@ -72,7 +93,7 @@ void main() {
         N = mix(N, Nmap, u_normal_factor);
     }
     //store the vertex normal
-    g_normal = N;
+    g_normal = encodeNormal(normalize(N));
     
     
     //compress specular to one number
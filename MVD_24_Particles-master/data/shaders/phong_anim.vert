@@ -13,10 +13,12 @@ uniform mat4 u_normal_matrix;
 uniform vec3 u_cam_pos;
 
 
-uniform mat4 u_skin_bind_matrix;
+//joint palette: global joint matrix * inverse bind * skin bind
 const int MAX_JOINTS = 96;
-uniform mat4 u_joint_pos_matrices[MAX_JOINTS];
-uniform mat4 u_joint_bind_matrices[MAX_JOINTS];
+layout (std140) uniform u_skin_ubo
+{
+    mat4 u_skin_palette[MAX_JOINTS];
+};
 out vec2 v_uv;
 out vec3 v_normal;
 out vec3 v_vertex_world_pos;
@@ -42,17 +44,12 @@ void main(){
     
     //TODO: skeletal animation here
 
-	vec4 vertex4_bsm = u_skin_bind_matrix * vertex4;
-
 	//for all potential bones
 	for(int i = 0; i < 4; i++){
 		int j_id = int(a_vertex_jointids[i]);
 
 		//final equation
-		final_vert += a_vertex_weights[i] *
-		u_joint_pos_matrices[j_id] *
-		u_joint_bind_matrices[j_id] *
-		vertex4_bsm;
+		final_vert += a_vertex_weights[i] * u_skin_palette[j_id] * vertex4;
 	}
     
     //final_vert = vertex4;
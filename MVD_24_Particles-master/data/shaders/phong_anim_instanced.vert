@@ -0,0 +1,68 @@
+#version 330
+
+layout(location = 0) in vec3 a_vertex;
+layout(location = 1) in vec2 a_uv;
+layout(location = 2) in vec3 a_normal;
+layout(location = 3) in vec4 a_vertex_weights;
+layout(location = 4) in vec4 a_vertex_jointids;
+
+//per instance: world matrix (locations 5-8) and clip playback
+layout(location = 5) in mat4 a_model;
+//x: first row of the clip, y: number of frames,
+//z: frames per second, w: frame offset
+layout(location = 9) in vec4 a_anim;
+
+uniform mat4 u_vp;
+uniform vec3 u_cam_pos;
+uniform float u_time;
+
+//baked palettes, one row per frame and three texels per joint
+//holding the top three rows of its matrix
+uniform sampler2D u_anim_texture;
+
+out vec2 v_uv;
+out vec3 v_normal;
+out vec3 v_vertex_world_pos;
+out vec3 v_cam_dir;
+
+out float v_color;
+
+mat4 bakedJoint(int joint, int row) {
+    vec4 r0 = texelFetch(u_anim_texture, ivec2(joint * 3, row), 0);
+    vec4 r1 = texelFetch(u_anim_texture, ivec2(joint * 3 + 1, row), 0);
+    vec4 r2 = texelFetch(u_anim_texture, ivec2(joint * 3 + 2, row), 0);
+    return transpose(mat4(r0, r1, r2, vec4(0.0, 0.0, 0.0, 1.0)));
+}
+
+void main(){
+
+    //uvs
+    v_uv = a_uv;
+
+    //frame of this instance, blends towards the next one (looping)
+    int num_frames = int(a_anim.y);
+    float frame = mod(u_time * a_anim.z + a_anim.w, a_anim.y);
+    int frame0 = int(frame);
+    int row0 = int(a_anim.x) + frame0;
+    int row1 = int(a_anim.x) + (frame0 + 1) % num_frames;
+    float t = fract(frame);
+
+    //skin matrix from the weighted joints of both frames
+    mat4 skin = mat4(0.0);
+    for(int i = 0; i < 4; i++){
+        float w = a_vertex_weights[i];
+        if (w == 0.0) continue;
+        int j_id = int(a_vertex_jointids[i]);
+        skin += (w * (1.0 - t)) * bakedJoint(j_id, row0) + (w * t) * bakedJoint(j_id, row1);
+    }
+
+    mat4 model_skin = a_model * skin;
+    vec4 world_vert = model_skin * vec4(a_vertex, 1.0);
+
+    v_vertex_world_pos = world_vert.xyz;
+    v_normal = mat3(model_skin) * a_normal;
+    v_cam_dir = u_cam_pos - world_vert.xyz;
+
+    //output vertex to NDC
+    gl_Position = u_vp * world_vert;
+}
@@ -3,21 +3,19 @@
 layout(location = 0) in vec3 a_vertex;
 layout(location = 1) in vec2 a_uv;
 layout(location = 2) in vec3 a_normal;
-layout(location = 3) in vec3 a_blend0;
-layout(location = 4) in vec3 a_blend1;
-layout(location = 5) in vec3 a_blend2;
-layout(location = 6) in vec3 a_blend3;
-layout(location = 7) in vec3 a_blend4;
-layout(location = 8) in vec3 a_blend5;
-layout(location = 9) in vec3 a_blend6;
-layout(location = 10) in vec3 a_blend7;
+//first delta of this vertex and number of deltas
+layout(location = 3) in ivec2 a_blend_range;
 
 uniform mat4 u_mvp;
 uniform mat4 u_model;
 uniform mat4 u_normal_matrix;
 uniform vec3 u_cam_pos;
 
-const int MAX_BLEND_SHAPES = 8;
+//sparse deltas grouped by vertex: quantized dx, dy, dz and shape index
+uniform isamplerBuffer u_blend_deltas;
+
+//weight * quantization scale of each shape, 0 for inactive shapes
+const int MAX_BLEND_SHAPES = 32;
 uniform float[MAX_BLEND_SHAPES] u_blend_weights;
 
 out vec2 v_uv;
@@ -27,20 +25,15 @@ out vec3 v_cam_dir;
 
 void main(){
 
-    //vec3[MAX_BLEND_SHAPES] mod_vertices;
-    
-    vec3 offset0 =  a_blend0 - a_vertex;
-    vec3 offset1 = a_blend1 - a_vertex;
+    //most vertices are moved by no shape and skip the loop
+    vec3 mod_vertex = a_vertex;
+    for (int i = 0; i < a_blend_range.y; i++) {
+        ivec4 delta = texelFetch(u_blend_deltas, a_blend_range.x + i);
+        float weight = u_blend_weights[delta.w];
+        if (weight != 0.0)
+            mod_vertex += vec3(delta.xyz) * weight;
+    }
 
-    vec3 mod_vertex = a_vertex + offset0 * u_blend_weights[0]
-                               + offset1 * u_blend_weights[1];
-    
-    
-    
-    
-    
-    
-    
 	v_uv = a_uv;
 	//rotate normal & tangent
 	v_normal = (u_normal_matrix * vec4(a_normal, 1.0)).xyz;
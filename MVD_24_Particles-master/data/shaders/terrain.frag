@@ -12,34 +12,37 @@ in vec3 v_cam_dir;
 in vec3 v_vertex_world_pos;
 out vec4 fragColor;
 
-//basic material uniforms
-uniform vec3 u_ambient;
-uniform vec3 u_diffuse;
-uniform vec3 u_specular;
-uniform float u_specular_gloss;
-
-//geometry uniforms
-uniform float u_max_height;
+//material uniforms, laid out as MaterialBlock
+layout (std140) uniform u_material_ubo
+{
+    vec3 u_ambient;
+    float u_specular_gloss;
+    vec3 u_diffuse;
+    float u_normal_factor;
+    vec3 u_specular;
+    float u_max_height;
+    vec2 u_uv_scale;
+    int u_use_diffuse_map;
+    int u_use_diffuse_map_2;
+    int u_use_diffuse_map_3;
+    int u_use_normal_map;
+    int u_use_specular_map;
+    int u_use_reflection_map;
+    int u_use_noise_map;
+    int u_use_transparency_map;
+};
 
 //texture uniforms
-uniform vec2 u_uv_scale;
-uniform int u_use_diffuse_map;
 uniform sampler2D u_diffuse_map;
-uniform int u_use_diffuse_map_2;
 uniform sampler2D u_diffuse_map_2;
-uniform int u_use_diffuse_map_3;
 uniform sampler2D u_diffuse_map_3;
 
-uniform int u_use_normal_map;
 uniform sampler2D u_normal_map;
-uniform int u_use_specular_map;
 uniform sampler2D u_specular_map;
 
-uniform int u_use_noise_map;
 uniform sampler2D u_noise_map;
 
 
-uniform float u_normal_factor;
 
 
 //light structs and uniforms
@@ -120,7 +123,9 @@ mat3 cotangent_frame(vec3 N, vec3 p, vec2 uv)
 // normal_sample - the sample from the normal map
 vec3 perturbNormal( vec3 N, vec3 P, vec2 texcoord, vec3 normal_sample )
 {
-	normal_sample = normal_sample * 2.0 - 1.0;
+	//xy only, so two channel (BC5) normal maps work too. z is rebuilt
+	normal_sample.xy = normal_sample.xy * 2.0 - 1.0;
+	normal_sample.z = sqrt(max(0.0, 1.0 - dot(normal_sample.xy, normal_sample.xy)));
 	mat3 TBN = cotangent_frame(N, -P, texcoord);
 	vec3 pN = normalize(TBN * normal_sample);
 	return pN * u_normal_factor;
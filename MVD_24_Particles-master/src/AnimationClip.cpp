@@ -0,0 +1,214 @@
+//
+//  AnimationClip.cpp
+//
+#include "AnimationClip.h"
+#include <algorithm>
+#include <cmath>
+
+QuantizedQuat QuantizedQuat::encode(const lm::quat& q) {
+	auto to_short = [](float v) { return (int16_t)std::lround(std::max(-1.0f, std::min(v, 1.0f)) * 32767.0f); };
+	return { to_short(q.x), to_short(q.y), to_short(q.z), to_short(q.w) };
+}
+
+lm::quat QuantizedQuat::decode() const {
+	const float k = 1.0f / 32767.0f;
+	return lm::quat(w * k, x * k, y * k, z * k);
+}
+
+static float quatDot_(const lm::quat& a, const lm::quat& b) {
+	return a.w * b.w + a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+//lm::quat::normalize scales with operator *=, which skips z
+static lm::quat normalized_(const lm::quat& q) {
+	float inv_len = 1.0f / q.length();
+	return lm::quat(q.w * inv_len, q.x * inv_len, q.y * inv_len, q.z * inv_len);
+}
+
+//normalized lerp, takes the short way round
+static lm::quat nlerp_(const lm::quat& a, const lm::quat& b, float t) {
+	float sign = quatDot_(a, b) < 0.0f ? -1.0f : 1.0f;
+	return normalized_(lm::quat(a.w + (b.w * sign - a.w) * t,
+		a.x + (b.x * sign - a.x) * t,
+		a.y + (b.y * sign - a.y) * t,
+		a.z + (b.z * sign - a.z) * t));
+}
+
+//angle between two rotations
+static float quatAngle_(const lm::quat& a, const lm::quat& b) {
+	float d = std::min(std::abs(quatDot_(a, b)), 1.0f);
+	return 2.0f * std::acos(d);
+}
+
+//greedy key reduction: extends each segment until interpolating its ends
+//misses one of the frames in between by more than tolerance
+template <typename T, typename Lerp, typename Error>
+static std::vector<int> reduceKeys_(const std::vector<T>& values, float tolerance, Lerp lerp, Error error) {
+	std::vector<int> kept;
+	int n = (int)values.size();
+	if (n == 0) return kept;
+	kept.push_back(0);
+
+	//constant channel keeps a single key
+	bool constant = true;
+	for (int i = 1; i < n && constant; i++)
+		constant = error(values[i], values[0]) <= tolerance;
+	if (constant) return kept;
+
+	int anchor = 0;
+	for (int end = 2; end < n; end++) {
+		bool fits = true;
+		for (int k = anchor + 1; k < end && fits; k++) {
+			float t = (float)(k - anchor) / (float)(end - anchor);
+			fits = error(lerp(values[anchor], values[end], t), values[k]) <= tolerance;
+		}
+		if (!fits) {
+			anchor = end - 1;
+			kept.push_back(anchor);
+		}
+	}
+	kept.push_back(n - 1);
+	return kept;
+}
+
+//finds the key at or before frame, starting from the cursor. Playback is
+//mostly forward, so this is usually zero or one step
+static uint32_t seekKey_(const uint16_t* frames, uint32_t count, float frame, uint32_t cursor) {
+	if (cursor >= count || frames[cursor] > frame)
+		cursor = 0; //looped, or jumped backwards
+	while (cursor + 1 < count && frames[cursor + 1] <= frame)
+		cursor++;
+	return cursor;
+}
+
+void AnimationClip::decompose(const lm::mat4& m, lm::vec3& t, lm::quat& r, lm::vec3& s) {
+	t = lm::vec3(m.m[12], m.m[13], m.m[14]);
+	lm::vec3 c0(m.m[0], m.m[1], m.m[2]), c1(m.m[4], m.m[5], m.m[6]), c2(m.m[8], m.m[9], m.m[10]);
+	s = lm::vec3(c0.length(), c1.length(), c2.length());
+	//mirrored matrices keep their sign in x scale
+	if (c0.cross(c1).dot(c2) < 0.0f) s.x = -s.x;
+	if (s.x != 0.0f) c0 = c0 * (1.0f / s.x);
+	if (s.y != 0.0f) c1 = c1 * (1.0f / s.y);
+	if (s.z != 0.0f) c2 = c2 * (1.0f / s.z);
+
+	//rotation matrix to quaternion, element (row, col) is c[col][row]
+	float trace = c0.x + c1.y + c2.z;
+	if (trace > 0.0f) {
+		float k = 0.5f / std::sqrt(trace + 1.0f);
+		r = lm::quat(0.25f / k, (c1.z - c2.y) * k, (c2.x - c0.z) * k, (c0.y - c1.x) * k);
+	}
+	else if (c0.x > c1.y && c0.x > c2.z) {
+		float k = 2.0f * std::sqrt(1.0f + c0.x - c1.y - c2.z);
+		r = lm::quat((c1.z - c2.y) / k, 0.25f * k, (c1.x + c0.y) / k, (c2.x + c0.z) / k);
+	}
+	else if (c1.y > c2.z) {
+		float k = 2.0f * std::sqrt(1.0f + c1.y - c0.x - c2.z);
+		r = lm::quat((c2.x - c0.z) / k, (c1.x + c0.y) / k, 0.25f * k, (c2.y + c1.z) / k);
+	}
+	else {
+		float k = 2.0f * std::sqrt(1.0f + c2.z - c0.x - c1.y);
+		r = lm::quat((c0.y - c1.x) / k, (c2.x + c0.z) / k, (c2.y + c1.z) / k, 0.25f * k);
+	}
+	r = normalized_(r);
+}
+
+//T * R * S without the matrix products
+void AnimationClip::compose(const lm::vec3& t, const lm::quat& r, const lm::vec3& s, lm::mat4& m) {
+	m.makeRotationMatrix(r);
+	m.m[0] *= s.x; m.m[1] *= s.x; m.m[2] *= s.x;
+	m.m[4] *= s.y; m.m[5] *= s.y; m.m[6] *= s.y;
+	m.m[8] *= s.z; m.m[9] *= s.z; m.m[10] *= s.z;
+	m.m[12] = t.x; m.m[13] = t.y; m.m[14] = t.z;
+}
+
+int AnimationClip::addTrack(const std::vector<lm::mat4>& frames) {
+	AnimationTrack track;
+	int n = (int)std::min(frames.size(), (size_t)UINT16_MAX);
+	duration = std::max(duration, n * frame_time);
+	source_bytes += n * sizeof(lm::mat4);
+	source_keys += n;
+
+	std::vector<lm::vec3> t(n), s(n);
+	std::vector<lm::quat> r(n);
+	for (int i = 0; i < n; i++) {
+		decompose(frames[i], t[i], r[i], s[i]);
+		//keep neighbours in the same hemisphere so interpolation is short
+		if (i > 0 && quatDot_(r[i - 1], r[i]) < 0.0f)
+			r[i] = lm::quat(-r[i].w, -r[i].x, -r[i].y, -r[i].z);
+	}
+
+	auto vec_lerp = [](const lm::vec3& a, const lm::vec3& b, float f) { return a.lerp(b, f); };
+	auto vec_error = [](const lm::vec3& a, const lm::vec3& b) { return (a - b).length(); };
+
+	std::vector<int> kept = reduceKeys_(t, translation_tolerance, vec_lerp, vec_error);
+	track.translation = { (uint32_t)translation_keys_.size(), (uint32_t)kept.size() };
+	for (int k : kept) { translation_frames_.push_back((uint16_t)k); translation_keys_.push_back(t[k]); }
+
+	kept = reduceKeys_(r, rotation_tolerance, nlerp_, quatAngle_);
+	track.rotation = { (uint32_t)rotation_keys_.size(), (uint32_t)kept.size() };
+	for (int k : kept) { rotation_frames_.push_back((uint16_t)k); rotation_keys_.push_back(QuantizedQuat::encode(r[k])); }
+
+	kept = reduceKeys_(s, scale_tolerance, vec_lerp, vec_error);
+	track.scale = { (uint32_t)scale_keys_.size(), (uint32_t)kept.size() };
+	for (int k : kept) { scale_frames_.push_back((uint16_t)k); scale_keys_.push_back(s[k]); }
+
+	tracks.push_back(track);
+	int index = (int)tracks.size() - 1;
+
+	//measure what reduction and quantization cost at the source frames
+	TrackCursor cursor;
+	for (int i = 0; i < n; i++) {
+		lm::mat4 m;
+		sample(index, i * frame_time, cursor, m);
+		lm::vec3 st, ss; lm::quat sr;
+		decompose(m, st, sr, ss);
+		max_translation_error = std::max(max_translation_error, (st - t[i]).length());
+		max_rotation_error = std::max(max_rotation_error, quatAngle_(sr, r[i]));
+	}
+	return index;
+}
+
+bool AnimationClip::sample(int track_index, float time, TrackCursor& cursor, lm::mat4& result) const {
+	const AnimationTrack& track = tracks[track_index];
+	if (track.translation.count == 0) return false;
+	float frame = time / frame_time;
+
+	//interpolation factor between key c and c + 1 of a channel
+	auto factor = [frame](const uint16_t* frames, uint32_t count, uint32_t c) {
+		if (c + 1 >= count) return 0.0f;
+		float f = (frame - frames[c]) / (float)(frames[c + 1] - frames[c]);
+		return std::max(0.0f, std::min(f, 1.0f));
+	};
+
+	const uint16_t* tf = &translation_frames_[track.translation.first];
+	const lm::vec3* tk = &translation_keys_[track.translation.first];
+	cursor.t = seekKey_(tf, track.translation.count, frame, cursor.t);
+	float f = factor(tf, track.translation.count, cursor.t);
+	lm::vec3 t = f > 0.0f ? tk[cursor.t].lerp(tk[cursor.t + 1], f) : tk[cursor.t];
+
+	const uint16_t* rf = &rotation_frames_[track.rotation.first];
+	const QuantizedQuat* rk = &rotation_keys_[track.rotation.first];
+	cursor.r = seekKey_(rf, track.rotation.count, frame, cursor.r);
+	f = factor(rf, track.rotation.count, cursor.r);
+	lm::quat r = f > 0.0f ? nlerp_(rk[cursor.r].decode(), rk[cursor.r + 1].decode(), f) : normalized_(rk[cursor.r].decode());
+
+	const uint16_t* sf = &scale_frames_[track.scale.first];
+	const lm::vec3* sk = &scale_keys_[track.scale.first];
+	cursor.s = seekKey_(sf, track.scale.count, frame, cursor.s);
+	f = factor(sf, track.scale.count, cursor.s);
+	lm::vec3 s = f > 0.0f ? sk[cursor.s].lerp(sk[cursor.s + 1], f) : sk[cursor.s];
+
+	compose(t, r, s, result);
+	return true;
+}
+
+int AnimationClip::keyCount() const {
+	return (int)(translation_keys_.size() + rotation_keys_.size() + scale_keys_.size());
+}
+
+size_t AnimationClip::memoryBytes() const {
+	return tracks.size() * sizeof(AnimationTrack)
+		+ translation_frames_.size() * sizeof(uint16_t) + translation_keys_.size() * sizeof(lm::vec3)
+		+ rotation_frames_.size() * sizeof(uint16_t) + rotation_keys_.size() * sizeof(QuantizedQuat)
+		+ scale_frames_.size() * sizeof(uint16_t) + scale_keys_.size() * sizeof(lm::vec3);
+}
@@ -0,0 +1,86 @@
+//
+//  AnimationClip.h
+//
+//  Keyframe animation stored as translation, rotation and scale keys per
+//  track (one track per joint, or one for a whole transform).
+//  - rotations are quantized to 16 bits per component
+//  - keys which interpolation of their neighbours rebuilds within tolerance
+//    are dropped when a track is added
+//  - key times are source frame numbers, sampling is by time in seconds
+//  Clips are shared; each instance owns a ClipPlayer with its own time and
+//  key cursors, so forward playback never searches for keys.
+//
+#pragma once
+#include "includes.h"
+#include <cstdint>
+#include <vector>
+
+struct QuantizedQuat {
+	int16_t x, y, z, w;
+	static QuantizedQuat encode(const lm::quat& q);
+	lm::quat decode() const;
+};
+
+//keys [first, first + count) of one channel
+struct KeyRange {
+	uint32_t first = 0;
+	uint32_t count = 0;
+};
+
+struct AnimationTrack {
+	KeyRange translation, rotation, scale;
+};
+
+//index of the last key used, per channel
+struct TrackCursor {
+	uint32_t t = 0, r = 0, s = 0;
+};
+
+//playback state of one instance
+struct ClipPlayer {
+	int clip = -1; //index in AnimationSystem clips
+	float time = 0.0f; //seconds
+	std::vector<TrackCursor> cursors; //one per track of the clip
+};
+
+class AnimationClip {
+public:
+	std::string name;
+	float frame_time = 1.0f / 24.0f; //seconds per source frame
+	float duration = 0.0f; //seconds, the last frame is held for frame_time
+
+	//error tolerances for dropping keys
+	float translation_tolerance = 0.001f; //units
+	float rotation_tolerance = 0.0005f; //radians
+	float scale_tolerance = 0.001f;
+
+	//stats, filled by addTrack
+	size_t source_bytes = 0; //one mat4 per frame, as stored before
+	int source_keys = 0;
+	float max_translation_error = 0.0f;
+	float max_rotation_error = 0.0f;
+
+	std::vector<AnimationTrack> tracks;
+
+	//adds a track from one matrix per frame, frames may be empty for joints
+	//which are not animated. Returns the track index
+	int addTrack(const std::vector<lm::mat4>& frames);
+
+	//writes the track pose at time (seconds) to result, false if the track
+	//has no keys. cursor must belong to this track
+	bool sample(int track, float time, TrackCursor& cursor, lm::mat4& result) const;
+
+	int keyCount() const;
+	size_t memoryBytes() const;
+
+	static void decompose(const lm::mat4& m, lm::vec3& t, lm::quat& r, lm::vec3& s);
+	static void compose(const lm::vec3& t, const lm::quat& r, const lm::vec3& s, lm::mat4& m);
+
+private:
+	std::vector<uint16_t> translation_frames_;
+	std::vector<lm::vec3> translation_keys_;
+	std::vector<uint16_t> rotation_frames_;
+	std::vector<QuantizedQuat> rotation_keys_;
+	std::vector<uint16_t> scale_frames_;
+	std::vector<lm::vec3> scale_keys_;
+};
@@ -4,103 +4,419 @@
 
 #include "AnimationSystem.h"
 #include "extern.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BLEND_SHAPES_SSE2
+#endif
 
 //destructor
 AnimationSystem::~AnimationSystem() {
-
+    for (auto s : skeletons_)
+        delete s;
 }
 
 //set initial state 
-void AnimationSystem::init() {
-
+void AnimationSystem::init(JobSystem* jobs, GraphicsSystem* gs) {
+    jobs_ = jobs;
+    graphics_system_ = gs;
 }
 
 //called after loading everything
 void AnimationSystem::lateInit() {
 
-    
+    //transform animations: a single track each
+    for (auto& anim : ECS.getAllComponents<Animation>()) {
+        if (anim.keyframes.empty()) continue;
+        int clip = createClip_(ECS.getEntityName(anim.owner), anim.ms_frame, { &anim.keyframes });
+        startPlayer_(anim.player, clip);
+        //source frames are no longer needed
+        std::vector<lm::mat4>().swap(anim.keyframes);
+    }
+
+    //skinned meshes: flatten joint trees, so per frame updates never walk
+    //pointers, and build one clip per skeleton with a track per joint
+    std::unordered_map<Joint*, int> root_clip;
+    std::unordered_map<Joint*, std::vector<SkeletonAsset*>> root_skeletons;
+    for (auto& sm : ECS.getAllComponents<SkinnedMesh>()) {
+        if (!sm.root) continue;
+        if (sm.num_joints > MAX_JOINTS)
+            print("ERROR: skeleton of " + ECS.getEntityName(sm.owner) + " has more joints than MAX_JOINTS");
+        
+        //meshes with the same joints, skin bind matrix and geometry share a skeleton
+        SkeletonAsset* asset = nullptr;
+        for (SkeletonAsset* candidate : root_skeletons[sm.root]) {
+            if (candidate->geometry == sm.geometry &&
+                memcmp(candidate->skin_bind.m, sm.skin_bind_matrix.m, sizeof(candidate->skin_bind.m)) == 0)
+                asset = candidate;
+        }
+        if (!asset) {
+            asset = new SkeletonAsset();
+            if (!asset->build(sm.root, sm.num_joints, sm.skin_bind_matrix)) {
+                print("ERROR: joints of " + ECS.getEntityName(sm.owner) + " are not in chain order, parents first");
+                delete asset;
+                continue;
+            }
+            asset->geometry = sm.geometry;
+            if (graphics_system_ && sm.geometry >= 0) {
+                Geometry& geom = graphics_system_->getGeometry(sm.geometry);
+                asset->bounds_min = geom.joint_bounds_min;
+                asset->bounds_max = geom.joint_bounds_max;
+            }
+            skeletons_.push_back(asset);
+            root_skeletons[sm.root].push_back(asset);
+        }
+        sm.skeleton.init(asset);
+
+        //meshes sharing a skeleton share its clip
+        auto it = root_clip.find(sm.root);
+        if (it == root_clip.end()) {
+            std::vector<Joint*> joints;
+            sm.getAllJoints(sm.root, joints);
+            std::vector<std::vector<lm::mat4>*> tracks(sm.num_joints, nullptr);
+            for (Joint* j : joints)
+                tracks[j->index_in_chain] = &j->keyframes;
+            int clip = createClip_(ECS.getEntityName(sm.owner), sm.ms_frame, tracks);
+            it = root_clip.insert({ sm.root, clip }).first;
+            //source frames are no longer needed
+            for (Joint* j : joints)
+                std::vector<lm::mat4>().swap(j->keyframes);
+        }
+        startPlayer_(sm.player, it->second);
+        sampleSkeleton_(sm, 0.0f);
+        sm.skeleton.computePalette();
+        sm.updateBounds();
+    }
 }
 
-void AnimationSystem::update(float dt) {
-    
-	bool trigger_frame = false;
-	bool trigger_frame2 = false;
+//tracks are indexed like track_frames, null entries become empty tracks
+int AnimationSystem::createClip_(const std::string& name, float frame_ms, const std::vector<std::vector<lm::mat4>*>& track_frames) {
+    static const std::vector<lm::mat4> no_frames;
+    AnimationClip clip;
+    clip.name = name;
+    clip.frame_time = frame_ms / 1000.0f;
+    for (auto frames : track_frames)
+        clip.addTrack(frames ? *frames : no_frames);
+    clips_.push_back(std::move(clip));
+    return (int)clips_.size() - 1;
+}
 
-	//increment millisecond counter
-	ms_counter_anim += dt * 1000;
-	ms_counter_skin += dt * 1000;
+void AnimationSystem::startPlayer_(ClipPlayer& player, int clip) {
+    player.clip = clip;
+    player.time = 0.0f;
+    player.cursors.assign(clips_[clip].tracks.size(), TrackCursor());
+}
+
+//clip seconds per real second, ms_frame (speed slider in debug ui) is the
+//duration of one source frame
+float AnimationSystem::playbackRate_(const ClipPlayer& player, float ms_frame) {
+    return ms_frame > 0.0f ? clips_[player.clip].frame_time * 1000.0f / ms_frame : 0.0f;
+}
+
+//clip time dt seconds after the player's current time
+float AnimationSystem::timeAhead_(const ClipPlayer& player, float dt, float ms_frame) {
+    const AnimationClip& clip = clips_[player.clip];
+    if (clip.duration <= 0.0f) return player.time;
+    return fmodf(player.time + dt * playbackRate_(player, ms_frame), clip.duration);
+}
+
+void AnimationSystem::advancePlayer_(ClipPlayer& player, float dt, float ms_frame) {
+    player.time = timeAhead_(player, dt, ms_frame);
+}
+
+//joints without keys keep their bind pose in skeleton.local
+void AnimationSystem::sampleSkeleton_(SkinnedMesh& sm, float time) {
+    const AnimationClip& clip = clips_[sm.player.clip];
+    int num_tracks = std::min(sm.skeleton.size(), (int)clip.tracks.size());
+    for (int j = 0; j < num_tracks; j++)
+        clip.sample(j, time, sm.player.cursors[j], sm.skeleton.local[j]);
+}
+
+void AnimationSystem::update(float dt) {
 
     //animation component
     auto& anims = ECS.getAllComponents<Animation>();
     for (auto& anim : anims) {
-		
-		//if counter above threshold
-		if (ms_counter_anim >= anim.ms_frame) {
-			trigger_frame = true;
-			ms_counter_anim = 0;
-		}
-
-        //get transform
+        if (anim.player.clip < 0 || !anim.active) continue;
+        advancePlayer_(anim.player, dt, anim.ms_frame);
+        
+        //set transform to sampled pose
         Transform& transform = ECS.getComponentFromEntity<Transform>(anim.owner);
-        //if new frame
-        if (trigger_frame && anim.active) {
-            //set positions to current frame
-            transform.set(anim.keyframes[anim.curr_frame]);
-            //advance frame
-            anim.curr_frame++;
-            //loop if required
-            if (anim.curr_frame == anim.num_frames)
-                anim.curr_frame = 0;
-        }
+        lm::mat4 pose;
+        if (clips_[anim.player.clip].sample(0, anim.player.time, anim.player.cursors[0], pose))
+            transform.set(pose);
     }
     
-    //skinned mesh joints
-    auto& skinnedmeshes = ECS.getAllComponents<SkinnedMesh>();
-	for (auto& sm : skinnedmeshes) {
-		if (!sm.root) continue; //only if mesh has a joint chain!
-		//if counter above threshold
-		if (ms_counter_skin >= sm.ms_frame) {
-			trigger_frame2 = true;
-			ms_counter_skin = 0;
-		}
-		if (trigger_frame2 && sm.active == 1) {
-			incrementJointFrame_(sm.root);
-		}
-		if (sm.active == -1) {
-			restartJoints(sm.root);
-			sm.active = 1;
-		}
-    }
+    //skinned mesh joints, one job per character
+    updateSkinnedMeshes_(dt);
+    
+    //crowds sample their baked clips on the gpu, only the clock runs here
+    for (auto& crowd : ECS.getAllComponents<SkinnedCrowd>())
+        if (crowd.active) crowd.time += dt;
     
     deformBlendShapes_();
 }
 
-void AnimationSystem::incrementJointFrame_(Joint* joint) {
+//update rate from last frame's culling, see lod_settings
+int AnimationSystem::selectLOD_(const AnimationLODState& lod) {
+    if (!lod_settings.enabled) return AnimationLODFull;
+    if (!lod.visible) return lod_settings.offscreen_level;
+    for (int i = 2; i >= 0; i--)
+        if (lod.screen_size < lod_settings.screen_size[i])
+            return AnimationLODHalf + i;
+    return AnimationLODFull;
+}
+
+//advances, samples and builds the palette of one character. Writes only to
+//this mesh's player, skeleton and lod state; clips and skeleton assets are
+//read only.
+//At reduced rates the pose 'interval' frames ahead is evaluated, and the
+//palette blends towards it over those frames, so the motion has no steps
+void AnimationSystem::updateSkinnedMesh_(SkinnedMesh& sm, float dt) {
+	if (!sm.root || sm.player.clip < 0) return; //only if mesh has a joint chain!
+	bool restarted = false;
+	if (sm.active == -1) {
+		sm.player.time = 0.0f;
+		sm.active = 1;
+		restarted = true;
+	}
+	else if (sm.active == 1) {
+		advancePlayer_(sm.player, dt, sm.ms_frame);
+	}
+	else {
+		return; //stopped, palette keeps the last pose
+	}
+
+	static const int intervals[ANIMATION_LOD_COUNT] = { 1, 2, 4, 8, 0 };
+	AnimationLODState& lod = sm.anim_lod;
+	int level = selectLOD_(lod);
+
+	if (level == AnimationLODFull || restarted) {
+		lod.level = level;
+		lod.frames_left = 0;
+		sampleSkeleton_(sm, sm.player.time);
+		//palette is shared by every pass that draws this mesh this frame
+		sm.skeleton.computePalette();
+		sm.updateBounds();
+		return;
+	}
+	if (level == AnimationLODFrozen) {
+		lod.level = level;
+		//the frozen pose says nothing about where the mesh is now, so
+		//culling falls back to the bind pose box
+		sm.has_bounds = false;
+		return;
+	}
+
+	int interval = intervals[level];
+	if (lod.frames_left <= 0 || level != lod.level) {
+		//blend from the pose shown now
+		sm.skeleton.prev_palette = sm.skeleton.palette;
+		sampleSkeleton_(sm, timeAhead_(sm.player, interval * dt, sm.ms_frame));
+		sm.skeleton.computePalette(sm.skeleton.next_palette);
+		lod.level = level;
+		lod.frames_left = interval;
+	}
+	lod.frames_left--;
+	sm.skeleton.blendPalette(1.0f - (float)lod.frames_left / (float)interval);
+	sm.updateBounds();
+}
+
+int AnimationSystem::bakeClip(const SkinnedMesh& sm) {
+    if (!sm.skeleton.asset || sm.player.clip < 0) {
+        print("ERROR: " + ECS.getEntityName(sm.owner) + " has no skeleton or clip to bake");
+        return -1;
+    }
+    for (size_t i = 0; i < baked_clips_.size(); i++)
+        if (baked_clips_[i].clip == sm.player.clip && baked_clips_[i].skeleton == sm.skeleton.asset)
+            return (int)i;
     
-    //avoid updating joints that don't have any keyframes
-    if (joint->num_keyframes > 0) {
+    const AnimationClip& clip = clips_[sm.player.clip];
+    BakedClip baked;
+    baked.clip = sm.player.clip;
+    baked.skeleton = sm.skeleton.asset;
+    baked.first_row = getBakedRows();
+    baked.num_frames = std::max(1, (int)std::lround(clip.duration / clip.frame_time));
+    baked.frame_time = clip.frame_time;
+    
+    //pose every source frame with a scratch skeleton, so sm is untouched
+    Skeleton skeleton;
+    skeleton.init(sm.skeleton.asset);
+    std::vector<TrackCursor> cursors(clip.tracks.size());
+    int num_tracks = std::min(skeleton.size(), (int)clip.tracks.size());
+    int num_joints = std::min(skeleton.size(), MAX_JOINTS);
+    const int row_floats = BAKED_TEXTURE_WIDTH * 4;
+    baked_texels_.resize((size_t)(baked.first_row + baked.num_frames) * row_floats, 0.0f);
+    for (int f = 0; f < baked.num_frames; f++) {
+        for (int j = 0; j < num_tracks; j++)
+            clip.sample(j, f * clip.frame_time, cursors[j], skeleton.local[j]);
+        skeleton.computePalette();
+        lm::vec3 mn, mx;
+        if (skeleton.computeBounds(mn, mx)) {
+            baked.bounds_min = baked.has_bounds ? lm::vec3(std::min(mn.x, baked.bounds_min.x), std::min(mn.y, baked.bounds_min.y), std::min(mn.z, baked.bounds_min.z)) : mn;
+            baked.bounds_max = baked.has_bounds ? lm::vec3(std::max(mx.x, baked.bounds_max.x), std::max(mx.y, baked.bounds_max.y), std::max(mx.z, baked.bounds_max.z)) : mx;
+            baked.has_bounds = true;
+        }
+        float* row = &baked_texels_[(size_t)(baked.first_row + f) * row_floats];
+        for (int j = 0; j < num_joints; j++) {
+            //texel r holds matrix row r, the last row is always 0 0 0 1
+            const lm::mat4& m = skeleton.palette[j];
+            for (int r = 0; r < BAKED_TEXELS_PER_JOINT; r++)
+                for (int c = 0; c < 4; c++)
+                    row[(j * BAKED_TEXELS_PER_JOINT + r) * 4 + c] = m.m[c * 4 + r];
+        }
+    }
+    baked_clips_.push_back(baked);
+    return (int)baked_clips_.size() - 1;
+}
+
+void AnimationSystem::getLODCounts(int counts[ANIMATION_LOD_COUNT]) {
+    for (int i = 0; i < ANIMATION_LOD_COUNT; i++)
+        counts[i] = 0;
+    for (auto& sm : ECS.getAllComponents<SkinnedMesh>())
+        if (sm.root) counts[sm.anim_lod.level]++;
+}
+
+void AnimationSystem::updateSkinnedMeshes_(float dt) {
+    auto& skinnedmeshes = ECS.getAllComponents<SkinnedMesh>();
+    auto job = [&](int begin, int end) {
+        for (int i = begin; i < end; i++)
+            updateSkinnedMesh_(skinnedmeshes[i], dt);
+    };
+    if (jobs_)
+        jobs_->parallelFor((int)skinnedmeshes.size(), 8, job);
+    else
+        job(0, (int)skinnedmeshes.size());
+}
+
+void AnimationSystem::benchmarkPoses(int frames) {
+    int num_meshes = (int)ECS.getAllComponents<SkinnedMesh>().size();
+    if (!jobs_ || num_meshes == 0) {
+        print("ERROR: pose benchmark needs skinned meshes and a job system");
+        return;
+    }
+    int max_threads = std::max(1, (int)std::thread::hardware_concurrency());
+    int restore_threads = jobs_->getNumThreads();
+    printf("POSE EVALUATION BENCHMARK\n");
+    printf("  %d skinned meshes, %d frames\n", num_meshes, frames);
+    double single_ms = 0.0;
+    for (int threads = 1; ; threads = std::min(threads * 2, max_threads)) {
+        jobs_->init(threads);
+        updateSkinnedMeshes_(1.0f / 60.0f); //warm up
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames; i++)
+            updateSkinnedMeshes_(1.0f / 60.0f);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+        if (threads == 1) single_ms = ms;
+        printf("  %2d threads: %.3f ms/frame, speedup %.2fx\n", threads, ms, single_ms / ms);
+        if (threads == max_threads) break;
+    }
+    jobs_->init(restore_threads);
+}
+
+void AnimationSystem::benchmarkClips(int iterations) {
+    printf("ANIMATION CLIP BENCHMARK\n");
+    for (auto& clip : clips_) {
+        if (clip.tracks.empty()) continue;
+        int num_tracks = (int)clip.tracks.size();
+        std::vector<TrackCursor> cursors(num_tracks);
+        lm::mat4 pose;
+        volatile float sink = 0.0f;
         
-        joint->current_keyframe++;
-        if (joint->current_keyframe == joint->num_keyframes)
-            joint->current_keyframe = 0;
+        //forward playback at 60 fps, cursors kept between samples
+        auto start = std::chrono::steady_clock::now();
+        float time = 0.0f;
+        for (int i = 0; i < iterations; i++) {
+            time = fmodf(time + 1.0f / 60.0f, clip.duration);
+            for (int t = 0; t < num_tracks; t++)
+                if (clip.sample(t, time, cursors[t], pose)) sink += pose.m[12];
+        }
+        double sequential_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
         
-        joint->matrix = joint->keyframes[joint->current_keyframe] ;
-    }
-    for (auto& c : joint->children) {
-        incrementJointFrame_(c);
+        //random access, cursors reset every sample
+        start = std::chrono::steady_clock::now();
+        unsigned int seed = 1;
+        for (int i = 0; i < iterations; i++) {
+            seed = seed * 1664525u + 1013904223u;
+            time = (seed >> 8) / 16777216.0f * clip.duration;
+            for (int t = 0; t < num_tracks; t++) {
+                TrackCursor cursor;
+                if (clip.sample(t, time, cursor, pose)) sink += pose.m[12];
+            }
+        }
+        double random_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        
+        double samples = (double)iterations * num_tracks;
+        printf("  %s: %d tracks, %.2f s\n", clip.name.c_str(), num_tracks, clip.duration);
+        printf("    memory: %.1f KB as mat4 frames, %.1f KB compressed (%.1f%%), keys %d -> %d\n",
+            clip.source_bytes / 1024.0, clip.memoryBytes() / 1024.0,
+            clip.source_bytes ? 100.0 * clip.memoryBytes() / clip.source_bytes : 0.0,
+            clip.source_keys, clip.keyCount());
+        printf("    max error: %.5f units, %.5f rad\n", clip.max_translation_error, clip.max_rotation_error);
+        printf("    sampling: %.2f M tracks/s forward, %.2f M tracks/s random\n",
+            samples / sequential_s / 1.0e6, samples / random_s / 1.0e6);
     }
 }
 
-void AnimationSystem::restartJoints(Joint* joint) {
-	//avoid updating joints that don't have any keyframes
-	if (joint->num_keyframes > 0) {
+//adds weight * delta of every vertex of a shape to positions. Four deltas
+//are widened and scaled at a time, the adds are scattered
+static void accumulateBlendShape_(const SparseBlendShape& shape, float weight, float* positions) {
+    float k = weight * shape.scale;
+    int n = shape.size(), i = 0;
+#ifdef BLEND_SHAPES_SSE2
+    __m128 kk = _mm_set1_ps(k);
+    //int16 to float: unpack into the high halves, then shift the sign down
+    auto widen = [&](const int16_t* q) {
+        __m128i v = _mm_loadl_epi64((const __m128i*)q);
+        return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(_mm_setzero_si128(), v), 16)), kk);
+    };
+    float x[4], y[4], z[4];
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(x, widen(&shape.dx[i]));
+        _mm_storeu_ps(y, widen(&shape.dy[i]));
+        _mm_storeu_ps(z, widen(&shape.dz[i]));
+        for (int l = 0; l < 4; l++) {
+            float* p = positions + shape.vertices[i + l] * 3;
+            p[0] += x[l]; p[1] += y[l]; p[2] += z[l];
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        float* p = positions + shape.vertices[i] * 3;
+        p[0] += shape.dx[i] * k; p[1] += shape.dy[i] * k; p[2] += shape.dz[i] * k;
+    }
+}
 
-		joint->current_keyframe = 0;
-		joint->matrix = joint->keyframes[joint->current_keyframe];
-	}
-	for (auto& c : joint->children) {
-		restartJoints(c);
-	}
+//only shapes active now or at the last blend are touched: their vertices
+//are reset to the base pose, the active ones added back, and the changed
+//vertex range uploaded
+void AnimationSystem::blendOnCPU_(BlendShapes& bs, Geometry& geom, const std::vector<float>& weights) {
+    int num_shapes = (int)geom.blend_shapes.size();
+    bs.applied_weights.resize(num_shapes, 0.0f);
+    if (bs.applied_weights == weights) return;
+    if (bs.positions.empty())
+        bs.positions = geom.blend_base_positions;
+    
+    GLuint first = geom.num_vertices, last = 0;
+    for (int s = 0; s < num_shapes; s++) {
+        if (bs.applied_weights[s] == 0.0f && weights[s] == 0.0f) continue;
+        for (GLuint v : geom.blend_shapes[s].vertices) {
+            for (int k = 0; k < 3; k++)
+                bs.positions[v * 3 + k] = geom.blend_base_positions[v * 3 + k];
+            first = std::min(first, v);
+            last = std::max(last, v);
+        }
+    }
+    for (int s = 0; s < num_shapes; s++)
+        if (weights[s] != 0.0f)
+            accumulateBlendShape_(geom.blend_shapes[s], weights[s], &bs.positions[0]);
+    if (first <= last)
+        geom.updatePositions(bs.positions, first, last - first + 1);
+    bs.applied_weights = weights;
 }
 
 void AnimationSystem::deformBlendShapes_() {
@@ -112,7 +428,19 @@ void AnimationSystem::deformBlendShapes_() {
             print(error_msg);
             continue;
         }
+        if (!graphics_system_) continue;
+        Geometry& geom = graphics_system_->getGeometry(ECS.getComponentFromEntity<Mesh>(blend_comp.owner).geometry);
+        if (geom.blend_shapes.empty()) continue;
         
-        //do blending here
+        //gpu path: the vertex shader blends, the positions must be the base
+        //pose, so undo whatever the cpu path left there
+        std::vector<float> weights(geom.blend_shapes.size(), 0.0f);
+        if (blend_shapes_on_cpu) {
+            for (size_t i = 0; i < weights.size() && i < blend_comp.blend_weights.size(); i++)
+                weights[i] = blend_comp.blend_weights[i];
+        }
+        if (blend_shapes_on_cpu || blend_comp.on_cpu)
+            blendOnCPU_(blend_comp, geom, weights);
+        blend_comp.on_cpu = blend_shapes_on_cpu;
     }
 }
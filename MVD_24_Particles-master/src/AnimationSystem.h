@@ -2,23 +2,85 @@
 #include "includes.h"
 #include "Shader.h"
 #include "Components.h"
+#include "AnimationClip.h"
+#include "JobSystem.h"
+#include "GraphicsSystem.h"
+
+//update rate reduction per skinned mesh, picked from last frame's culling
+struct AnimationLODSettings {
+    bool enabled = true;
+    //visible meshes smaller than these (fraction of screen height) update
+    //at half, quarter and eighth rate
+    float screen_size[3] = { 0.3f, 0.15f, 0.05f };
+    int offscreen_level = AnimationLODFrozen;
+};
+
+//baked animation texture: one row per frame, each joint's palette matrix
+//stored as three RGBA texels (its top three rows)
+#define BAKED_TEXELS_PER_JOINT 3
+#define BAKED_TEXTURE_WIDTH (MAX_JOINTS * BAKED_TEXELS_PER_JOINT)
+
+//a clip sampled at its source frame rate into the baked texture
+struct BakedClip {
+    int clip = -1; //index in clips_
+    const SkeletonAsset* skeleton = nullptr;
+    int first_row = 0;
+    int num_frames = 0;
+    float frame_time = 0.0f;
+    //box around every baked frame
+    bool has_bounds = false;
+    lm::vec3 bounds_min, bounds_max;
+};
 
 class AnimationSystem {
 public:
     ~AnimationSystem();
-    void init();
+    void init(JobSystem* jobs, GraphicsSystem* gs);
     void lateInit();
     void update(float dt);
     
+    //prints memory per clip and sampling throughput
+    void benchmarkClips(int iterations);
+    //times skinned pose evaluation of the current scene with 1, 2, 4... threads
+    void benchmarkPoses(int frames);
+    
+    //samples the clip of a skinned mesh into the baked texture data, once per
+    //clip and skeleton. Returns the baked clip index, -1 on error
+    int bakeClip(const SkinnedMesh& sm);
+    const BakedClip& getBakedClip(int index) const { return baked_clips_[index]; }
+    const std::vector<SkeletonAsset*>& getSkeletons() const { return skeletons_; }
+    //RGBA float texels, BAKED_TEXTURE_WIDTH by getBakedRows()
+    const std::vector<float>& getBakedTexels() const { return baked_texels_; }
+    int getBakedRows() const { return (int)(baked_texels_.size() / (BAKED_TEXTURE_WIDTH * 4)); }
+    
+    AnimationLODSettings lod_settings;
+    
+    //blend shapes are evaluated in the vertex shader; this blends them on
+    //the cpu instead and uploads the moved positions (e.g. software gl)
+    bool blend_shapes_on_cpu = false;
+    void getLODCounts(int counts[ANIMATION_LOD_COUNT]);
+    
 private:
-    GLuint curr_frame_ = 0;
-    float ms_per_frame_ = 41.666f;
-    float ms_counter_anim = 0;
-	float ms_counter_skin = 0;
+    JobSystem* jobs_ = nullptr;
+    GraphicsSystem* graphics_system_ = nullptr;
+    
+    //compressed clips and flattened skeletons, shared by every instance
+    std::vector<AnimationClip> clips_;
+    std::vector<SkeletonAsset*> skeletons_;
+    std::vector<BakedClip> baked_clips_;
+    std::vector<float> baked_texels_;
     
-    void incrementJointFrame_(Joint* joint);
-	void restartJoints(Joint* joint);
+    int createClip_(const std::string& name, float frame_ms, const std::vector<std::vector<lm::mat4>*>& track_frames);
+    void startPlayer_(ClipPlayer& player, int clip);
+    float playbackRate_(const ClipPlayer& player, float ms_frame);
+    float timeAhead_(const ClipPlayer& player, float dt, float ms_frame);
+    void advancePlayer_(ClipPlayer& player, float dt, float ms_frame);
+    void sampleSkeleton_(SkinnedMesh& sm, float time);
+    int selectLOD_(const AnimationLODState& lod);
+    void updateSkinnedMesh_(SkinnedMesh& sm, float dt);
+    void updateSkinnedMeshes_(float dt);
     
     void deformBlendShapes_();
+    void blendOnCPU_(BlendShapes& bs, Geometry& geom, const std::vector<float>& weights);
     
 };
@@ -0,0 +1,386 @@
+//
+//  AssetCooker.cpp
+//
+#include "AssetCooker.h"
+#include "ColladaAsset.h"
+#include "ObjParser.h"
+#include "Parsers.h"
+#include "ResourceManager.h"
+#include "SectorStreamer.h"
+#include "rapidjson/document.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <map>
+
+namespace {
+
+std::string extension(const std::string& filename) {
+	size_t dot = filename.find_last_of('.');
+	std::string ext = dot == std::string::npos ? "" : filename.substr(dot);
+	for (char& c : ext) c = (char)tolower(c);
+	return ext;
+}
+
+//one sector's file as it is put together
+struct SectorBuilder {
+	SectorInfo info;
+	std::vector<uint32_t> geometries;
+	std::vector<SectorTexture> textures;
+	std::vector<SectorMaterial> materials;
+	std::vector<SectorEntity> entities;
+	std::string strings;
+	std::map<std::string, uint32_t> string_offsets;
+	//level names -> index in this sector
+	std::map<std::string, int> geometry_index, texture_index, material_index;
+
+	uint32_t addString(const std::string& s) {
+		auto found = string_offsets.find(s);
+		if (found != string_offsets.end())
+			return found->second;
+		uint32_t offset = (uint32_t)strings.size();
+		strings += s;
+		strings.push_back('\0');
+		string_offsets[s] = offset;
+		return offset;
+	}
+
+	std::vector<char> data() const {
+		SectorHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, "MVDC", 4);
+		header.version = SECTOR_VERSION;
+		header.x = info.x;
+		header.z = info.z;
+		header.num_geometries = (uint32_t)geometries.size();
+		header.num_textures = (uint32_t)textures.size();
+		header.num_materials = (uint32_t)materials.size();
+		header.num_entities = (uint32_t)entities.size();
+		header.strings_size = (uint32_t)strings.size();
+		std::vector<char> out;
+		auto append = [&out](const void* data, size_t size) {
+			out.insert(out.end(), (const char*)data, (const char*)data + size);
+		};
+		append(&header, sizeof(header));
+		append(geometries.data(), geometries.size() * sizeof(uint32_t));
+		append(textures.data(), textures.size() * sizeof(SectorTexture));
+		append(materials.data(), materials.size() * sizeof(SectorMaterial));
+		append(entities.data(), entities.size() * sizeof(SectorEntity));
+		append(strings.data(), strings.size());
+		return out;
+	}
+};
+
+void copyVec3(const rapidjson::Value& object, const char* member, float* out, float x, float y, float z) {
+	if (object.HasMember(member)) {
+		auto& v = object[member];
+		out[0] = v[0].GetFloat(); out[1] = v[1].GetFloat(); out[2] = v[2].GetFloat();
+	}
+	else {
+		out[0] = x; out[1] = y; out[2] = z;
+	}
+}
+
+} //namespace
+
+//cooked meshes go through the runtime's own cache directory, entries which
+//are already there are simply rewritten
+AssetCooker::AssetCooker() {
+	cache_.init("data/cache/");
+}
+
+bool AssetCooker::addLevel(const std::string& filename) {
+	MappedFile file;
+	if (!file.open(filename)) {
+		std::cerr << "ERROR: Could not open level " << filename << std::endl;
+		failed_++;
+		return false;
+	}
+	rapidjson::Document json;
+	json.Parse(file.data(), file.size());
+	if (json.HasParseError() || !json.IsObject() || !json.HasMember("directory")) {
+		std::cerr << "ERROR: " << filename << " is not a level" << std::endl;
+		failed_++;
+		return false;
+	}
+	bool ok = addFile(filename);
+
+	//the same members parseJSONLevel loads from
+	std::string data_dir = json["directory"].GetString();
+	if (json.HasMember("geometries")) {
+		for (auto& geometry : json["geometries"].GetArray())
+			ok &= addFile(data_dir + geometry["file"].GetString());
+	}
+	if (json.HasMember("textures")) {
+		for (auto& texture : json["textures"].GetArray()) {
+			if (texture.HasMember("files")) {
+				for (auto& face : texture["files"].GetArray())
+					ok &= addFile(data_dir + face.GetString());
+			}
+			else
+				ok &= addFile(data_dir + texture["file"].GetString());
+		}
+	}
+	if (json.HasMember("shaders")) {
+		for (auto& shader : json["shaders"].GetArray()) {
+			ok &= addFile(shader["vertex"].GetString());
+			ok &= addFile(shader["fragment"].GetString());
+		}
+	}
+	return ok;
+}
+
+//entities are placed by their global position, parents baked in. Sector
+//sizes are estimated from the cooked files, a texture or geometry shared by
+//several sectors counts in each of them
+bool AssetCooker::addWorld(const std::string& filename, float sector_size) {
+	if (sector_size <= 0.0f || !addLevel(filename))
+		return false;
+	MappedFile file;
+	rapidjson::Document json;
+	if (!file.open(filename))
+		return false;
+	json.Parse(file.data(), file.size());
+	if (!json.HasMember("entities") || !json.HasMember("materials") || !json.HasMember("shaders")) {
+		std::cerr << "ERROR: " << filename << " has no entities to cut into sectors" << std::endl;
+		failed_++;
+		return false;
+	}
+	std::string data_dir = json["directory"].GetString();
+	std::string level_key = ResourceManager::canonicalPath(filename);
+
+	//level tables by name
+	std::map<std::string, const rapidjson::Value*> geometries, textures, materials, shaders, entities;
+	if (json.HasMember("geometries"))
+		for (auto& geometry : json["geometries"].GetArray()) geometries[geometry["name"].GetString()] = &geometry;
+	if (json.HasMember("textures"))
+		for (auto& texture : json["textures"].GetArray()) textures[texture["name"].GetString()] = &texture;
+	for (auto& material : json["materials"].GetArray()) materials[material["name"].GetString()] = &material;
+	for (auto& shader : json["shaders"].GetArray()) shaders[shader["name"].GetString()] = &shader;
+	for (auto& entity : json["entities"].GetArray())
+		if (entity.HasMember("name")) entities[entity["name"].GetString()] = &entity;
+
+	//as parseJSONLevel builds them
+	auto localMatrix = [](const rapidjson::Value& entity) {
+		auto jt = entity["transform"]["translate"].GetArray();
+		auto jr = entity["transform"]["rotate"].GetArray();
+		auto js = entity["transform"]["scale"].GetArray();
+		lm::mat4 local;
+		lm::quat qR(jr[0].GetFloat()*DEG2RAD, jr[1].GetFloat()*DEG2RAD, jr[2].GetFloat()*DEG2RAD);
+		lm::mat4 R; R.makeRotationMatrix(qR);
+		local.set(local * R);
+		local.scaleLocal(js[0].GetFloat(), js[1].GetFloat(), js[2].GetFloat());
+		local.translate(jt[0].GetFloat(), jt[1].GetFloat(), jt[2].GetFloat());
+		return local;
+	};
+	auto globalMatrix = [&](const rapidjson::Value& entity) {
+		lm::mat4 global = localMatrix(entity);
+		const rapidjson::Value* child = &entity;
+		for (int depth = 0; depth < 64 && (*child)["transform"].HasMember("parent"); depth++) {
+			auto parent = entities.find((*child)["transform"]["parent"].GetString());
+			if (parent == entities.end())
+				break;
+			child = parent->second;
+			global = localMatrix(*child) * global;
+		}
+		return global;
+	};
+	auto textureFiles = [&](const rapidjson::Value& texture) {
+		std::vector<std::string> files;
+		if (texture.HasMember("files"))
+			for (auto& face : texture["files"].GetArray()) files.push_back(data_dir + face.GetString());
+		else
+			files.push_back(data_dir + texture["file"].GetString());
+		return files;
+	};
+
+	std::map<std::pair<int, int>, SectorBuilder> sectors;
+	int skipped = 0;
+	for (auto& entity : json["entities"].GetArray()) {
+		auto geometry = geometries.find(entity["geometry"].GetString());
+		auto material = materials.find(entity["material"].GetString());
+		if (geometry == geometries.end() || material == materials.end() ||
+			!shaders.count((*material->second)["shader"].GetString())) {
+			skipped++;
+			continue;
+		}
+		lm::mat4 matrix = globalMatrix(entity);
+		std::pair<int, int> cell((int)floorf(matrix.m[12] / sector_size), (int)floorf(matrix.m[14] / sector_size));
+		SectorBuilder& sector = sectors[cell];
+		if (sector.entities.empty()) {
+			memset(&sector.info, 0, sizeof(sector.info));
+			sector.info.x = cell.first;
+			sector.info.z = cell.second;
+			for (int i = 0; i < 3; i++)
+				sector.info.min[i] = sector.info.max[i] = matrix.m[12 + i];
+		}
+		for (int i = 0; i < 3; i++) {
+			sector.info.min[i] = std::min(sector.info.min[i], matrix.m[12 + i]);
+			sector.info.max[i] = std::max(sector.info.max[i], matrix.m[12 + i]);
+		}
+
+		//the geometry, material and its textures, the first time the sector uses them
+		auto geometry_index = sector.geometry_index.find(geometry->first);
+		if (geometry_index == sector.geometry_index.end()) {
+			std::string geometry_file = data_dir + (*geometry->second)["file"].GetString();
+			geometry_index = sector.geometry_index.insert({ geometry->first, (int)sector.geometries.size() }).first;
+			sector.geometries.push_back(sector.addString(geometry_file));
+			sector.info.bytes += writer_.fileBytes(geometry_file + ".mesh");
+		}
+		auto material_index = sector.material_index.find(material->first);
+		if (material_index == sector.material_index.end()) {
+			const rapidjson::Value& json_material = *material->second;
+			const rapidjson::Value& shader = *shaders[json_material["shader"].GetString()];
+			SectorMaterial cooked;
+			memset(&cooked, 0, sizeof(cooked));
+			cooked.key = sector.addString(level_key + "#" + material->first);
+			cooked.vertex = sector.addString(shader["vertex"].GetString());
+			cooked.fragment = sector.addString(shader["fragment"].GetString());
+			copyVec3(json_material, "diffuse", cooked.diffuse, 1.0f, 1.0f, 1.0f);
+			copyVec3(json_material, "specular", cooked.specular, 0.0f, 0.0f, 0.0f);
+			copyVec3(json_material, "ambient", cooked.ambient, 0.1f, 0.1f, 0.1f);
+			const char* maps[2] = { "diffuse_map", "cube_map" };
+			int32_t* indices[2] = { &cooked.diffuse_map, &cooked.cube_map };
+			for (int m = 0; m < 2; m++) {
+				*indices[m] = -1;
+				auto texture = json_material.HasMember(maps[m]) ? textures.find(json_material[maps[m]].GetString()) : textures.end();
+				if (texture == textures.end())
+					continue;
+				auto texture_index = sector.texture_index.find(texture->first);
+				if (texture_index == sector.texture_index.end()) {
+					SectorTexture cooked_texture;
+					memset(&cooked_texture, 0xff, sizeof(cooked_texture));
+					std::vector<std::string> files = textureFiles(*texture->second);
+					cooked_texture.num_files = (uint32_t)std::min(files.size(), (size_t)6);
+					for (uint32_t f = 0; f < cooked_texture.num_files; f++) {
+						cooked_texture.files[f] = sector.addString(files[f]);
+						size_t bytes = writer_.fileBytes(TextureCompression::compressedPath(files[f]));
+						sector.info.bytes += bytes ? bytes : writer_.fileBytes(files[f]);
+					}
+					texture_index = sector.texture_index.insert({ texture->first, (int)sector.textures.size() }).first;
+					sector.textures.push_back(cooked_texture);
+				}
+				*indices[m] = texture_index->second;
+			}
+			material_index = sector.material_index.insert({ material->first, (int)sector.materials.size() }).first;
+			sector.materials.push_back(cooked);
+		}
+
+		SectorEntity cooked;
+		memset(&cooked, 0, sizeof(cooked));
+		memcpy(cooked.matrix, matrix.m, sizeof(cooked.matrix));
+		cooked.name = sector.addString(entity.HasMember("name") ? entity["name"].GetString() : "");
+		cooked.geometry = geometry_index->second;
+		cooked.material = material_index->second;
+		cooked.render_mode = entity.HasMember("render_mode") && std::string(entity["render_mode"].GetString()) == "deferred" ?
+			RenderModeDeferred : RenderModeForward;
+		cooked.collider = -1;
+		if (entity.HasMember("collider") && std::string(entity["collider"]["type"].GetString()) == "Box") {
+			cooked.collider = ColliderTypeBox;
+			copyVec3(entity["collider"], "center", cooked.collider_center, 0.0f, 0.0f, 0.0f);
+			copyVec3(entity["collider"], "halfwidth", cooked.collider_halfwidth, 0.5f, 0.5f, 0.5f);
+		}
+		sector.entities.push_back(cooked);
+		sector.info.num_entities++;
+	}
+	if (skipped)
+		std::cerr << "ERROR: " << skipped << " entities of " << filename << " name a missing geometry, material or shader" << std::endl;
+
+	SectorWorldHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "MVDW", 4);
+	header.version = SECTOR_VERSION;
+	header.num_sectors = (uint32_t)sectors.size();
+	header.sector_size = sector_size;
+	std::vector<char> world((const char*)&header, (const char*)&header + sizeof(header));
+	for (auto& sector : sectors) {
+		std::vector<char> data = sector.second.data();
+		writer_.add(SectorStreamer::sectorPath(filename, sector.first.first, sector.first.second), data.data(), data.size());
+		world.insert(world.end(), (const char*)&sector.second.info, (const char*)&sector.second.info + sizeof(SectorInfo));
+	}
+	writer_.add(SectorStreamer::worldPath(filename), world.data(), world.size());
+	printf("%s: %d entities in %d sectors of %.0f units\n", filename.c_str(),
+		(int)json["entities"].Size() - skipped, (int)sectors.size(), sector_size);
+	return skipped == 0;
+}
+
+bool AssetCooker::addFile(const std::string& filename) {
+	if (!added_.insert(ResourceManager::canonicalPath(filename)).second)
+		return true;
+
+	std::string ext = extension(filename);
+	bool ok;
+	if (ext == ".obj")
+		ok = cookOBJ_(filename);
+	else if (ext == ".dae")
+		ok = cookCollada_(filename);
+	else if (ext == ".tga")
+		ok = cookTexture_(filename);
+	else
+		ok = writer_.addFile(filename, filename);
+	if (!ok)
+		failed_++;
+	return ok;
+}
+
+//the plain mesh, and the one createMultiGeometryFromFile makes if the file
+//has material groups. Sets are stored by material name, so any materials
+//list with the right names will do here
+bool AssetCooker::cookOBJ_(const std::string& filename) {
+	std::vector<float> vertices, uvs, normals;
+	std::vector<unsigned int> indices;
+	std::vector<ObjMaterialGroup> groups;
+	MeshCacheKey key = cache_.key(filename);
+	if (!key.valid || !Parsers::parseOBJ(filename, vertices, uvs, normals, indices, &groups)) {
+		std::cerr << "ERROR: Could not cook mesh " << filename << std::endl;
+		return false;
+	}
+
+	Geometry geometry;
+	std::vector<Material> materials;
+	if (!cache_.store(key, vertices, uvs, normals, indices, geometry, materials) ||
+		!writer_.addFile(filename + ".mesh", cache_.entryPath(key)))
+		return false;
+	if (groups.empty())
+		return true;
+
+	for (auto& group : groups) {
+		bool known = false;
+		for (auto& material : materials)
+			if (material.name == group.name) known = true;
+		if (!known) {
+			materials.emplace_back();
+			materials.back().name = group.name;
+		}
+	}
+	geometry.num_tris = (GLuint)(indices.size() / 3);
+	Parsers::createMaterialSets(geometry, groups, materials);
+	return cache_.store(key, vertices, uvs, normals, indices, geometry, materials, ".sets.mesh") &&
+		writer_.addFile(filename + ".sets.mesh", cache_.entryPath(key, ".sets.mesh"));
+}
+
+bool AssetCooker::cookCollada_(const std::string& filename) {
+	MeshCacheKey key = cache_.key(filename);
+	ColladaAsset asset;
+	std::string cache_path = cache_.entryPath(key, ".skin");
+	return key.valid && asset.parse(filename) && asset.save(cache_path, key.hash, key.size) &&
+		writer_.addFile(filename + ".skin", cache_path);
+}
+
+//textures the loader would upload from a KTX. Copies already newer than
+//their source are used as they are
+bool AssetCooker::cookTexture_(const std::string& filename) {
+	if (!TextureCompression::hasCompressedCopy(filename) && !Parsers::compressTexture(filename, codec))
+		return false;
+	std::string ktx_file = TextureCompression::compressedPath(filename);
+	return writer_.addFile(ktx_file, ktx_file);
+}
+
+bool AssetCooker::write(const std::string& pack_filename) {
+	if (!writer_.write(pack_filename))
+		return false;
+	printf("%s: %d files, %.2f MB from %d sources, %d failed\n", pack_filename.c_str(), writer_.numFiles(),
+		writer_.dataBytes() / 1048576.0, (int)added_.size(), failed_);
+	return failed_ == 0;
+}
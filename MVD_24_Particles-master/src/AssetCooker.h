@@ -0,0 +1,50 @@
+//
+//  AssetCooker.h
+//
+//  Builds an asset pack (see AssetPack.h) from source files, converting each
+//  to the form the engine loads fastest:
+//    .obj  -> mesh cache entries (MeshCache.h), stored as "file.obj.mesh"
+//             and, when it has usemtl groups, "file.obj.sets.mesh"
+//    .dae  -> the ColladaAsset binary copy, stored as "file.dae.skin"
+//    .tga  -> a block compressed KTX with mips (TextureCompression.h),
+//             stored under TextureCompression::compressedPath
+//    else  -> the file as it is (levels, shaders, .anim, ...)
+//  Every cooked entry is named after its source, which the runtime looks up
+//  before it would have opened the source itself. Needs no GL context.
+//
+//  addWorld also cuts a level's entities into the sectors SectorStreamer
+//  loads (see SectorStreamer.h).
+//
+#pragma once
+#include "AssetPack.h"
+#include "MeshCache.h"
+#include "TextureCompression.h"
+#include <set>
+#include <string>
+
+class AssetCooker {
+public:
+	AssetCooker();
+
+	//the level itself, and every geometry, texture (cube faces too) and
+	//shader it names
+	bool addLevel(const std::string& filename);
+	bool addFile(const std::string& filename);
+	//the level as above, plus its entities as sectors of sector_size units on
+	//the xz plane. Lights, cameras and the environment are left to the level
+	bool addWorld(const std::string& filename, float sector_size);
+
+	bool write(const std::string& pack_filename);
+
+	TextureCodec codec = TextureCodecAuto;
+
+private:
+	AssetPackWriter writer_;
+	MeshCache cache_;
+	std::set<std::string> added_; //canonical sources
+	int failed_ = 0;
+
+	bool cookOBJ_(const std::string& filename);
+	bool cookCollada_(const std::string& filename);
+	bool cookTexture_(const std::string& filename);
+};
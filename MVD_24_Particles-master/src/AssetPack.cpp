@@ -0,0 +1,185 @@
+//
+//  AssetPack.cpp
+//
+#include "AssetPack.h"
+#include "ResourceManager.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+const char ASSET_PACK_MAGIC[4] = { 'M', 'V', 'D', 'P' };
+
+size_t aligned(size_t bytes) { return (bytes + ASSET_PACK_ALIGNMENT - 1) & ~(size_t)(ASSET_PACK_ALIGNMENT - 1); }
+
+} //namespace
+
+const AssetPack* AssetPack::mounted_ = nullptr;
+
+//64 bit FNV-1a
+uint64_t AssetPack::hashPath(const std::string& canonical_path) {
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (unsigned char c : canonical_path)
+		h = (h ^ c) * 0x100000001b3ull;
+	return h;
+}
+
+bool AssetPack::open(const std::string& filename) {
+	close();
+	if (!file_.open(filename))
+		return false;
+
+	//the table and names must lie inside the file, entries are checked on lookup
+	const AssetPackHeader* header = (const AssetPackHeader*)file_.data();
+	size_t table_end = sizeof(AssetPackHeader) + (file_.size() >= sizeof(AssetPackHeader) ?
+		(size_t)header->table_size * sizeof(AssetPackEntry) : 0);
+	if (file_.size() < sizeof(AssetPackHeader) || memcmp(header->magic, ASSET_PACK_MAGIC, 4) != 0 ||
+		header->version != ASSET_PACK_VERSION || header->table_size == 0 ||
+		(header->table_size & (header->table_size - 1)) != 0 || table_end > file_.size() ||
+		header->names_offset < table_end || header->names_offset + header->names_size > file_.size()) {
+		std::cerr << "ERROR: " << filename << " is not an asset pack this build can read" << std::endl;
+		file_.close();
+		return false;
+	}
+	header_ = header;
+	table_ = (const AssetPackEntry*)(file_.data() + sizeof(AssetPackHeader));
+	return true;
+}
+
+void AssetPack::close() {
+	if (mounted_ == this)
+		mounted_ = nullptr;
+	file_.close();
+	header_ = nullptr;
+	table_ = nullptr;
+}
+
+bool AssetPack::find(const std::string& path, const char*& data, size_t& size) const {
+	if (!header_)
+		return false;
+	std::string key = ResourceManager::canonicalPath(path);
+	uint64_t hash = hashPath(key);
+	uint32_t mask = header_->table_size - 1;
+	const char* names = file_.data() + header_->names_offset;
+	for (uint32_t i = (uint32_t)hash & mask, probes = 0; probes < header_->table_size; i = (i + 1) & mask, probes++) {
+		const AssetPackEntry& entry = table_[i];
+		if (entry.name_length == 0)
+			return false;
+		if (entry.hash != hash || entry.name_length != key.size() ||
+			(uint64_t)entry.name_offset + entry.name_length > header_->names_size ||
+			memcmp(names + entry.name_offset, key.data(), key.size()) != 0)
+			continue;
+		if (entry.offset > file_.size() || entry.size > file_.size() - entry.offset)
+			return false;
+		data = file_.data() + entry.offset;
+		size = (size_t)entry.size;
+		return true;
+	}
+	return false;
+}
+
+bool AssetPack::contains(const std::string& path) const {
+	const char* data;
+	size_t size;
+	return find(path, data, size);
+}
+
+void AssetPackWriter::add(const std::string& path, const char* data, size_t size) {
+	std::string key = ResourceManager::canonicalPath(path);
+	for (File& file : files_) {
+		if (file.path == key) {
+			file.data.assign(data, data + size);
+			return;
+		}
+	}
+	files_.push_back({ key, std::vector<char>(data, data + size) });
+}
+
+bool AssetPackWriter::addFile(const std::string& path, const std::string& filename) {
+	std::ifstream file(filename, std::ios::binary);
+	if (!file.is_open()) {
+		std::cerr << "ERROR: Could not read " << filename << " for the asset pack" << std::endl;
+		return false;
+	}
+	std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	add(path, data.data(), data.size());
+	return true;
+}
+
+size_t AssetPackWriter::dataBytes() const {
+	size_t total = 0;
+	for (const File& file : files_)
+		total += file.data.size();
+	return total;
+}
+
+size_t AssetPackWriter::fileBytes(const std::string& path) const {
+	std::string key = ResourceManager::canonicalPath(path);
+	for (const File& file : files_)
+		if (file.path == key) return file.data.size();
+	return 0;
+}
+
+bool AssetPackWriter::write(const std::string& filename) const {
+	AssetPackHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, ASSET_PACK_MAGIC, 4);
+	header.version = ASSET_PACK_VERSION;
+	header.num_entries = (uint32_t)files_.size();
+	header.table_size = 1;
+	while (header.table_size < files_.size() * 2)
+		header.table_size *= 2;
+
+	std::string names;
+	for (const File& file : files_)
+		names += file.path;
+	header.names_offset = sizeof(AssetPackHeader) + header.table_size * sizeof(AssetPackEntry);
+	header.names_size = names.size();
+
+	std::vector<AssetPackEntry> table(header.table_size);
+	memset(table.data(), 0, table.size() * sizeof(AssetPackEntry));
+	size_t offset = aligned((size_t)(header.names_offset + header.names_size));
+	uint32_t name_offset = 0;
+	for (const File& file : files_) {
+		uint64_t hash = AssetPack::hashPath(file.path);
+		uint32_t i = (uint32_t)hash & (header.table_size - 1);
+		while (table[i].name_length != 0)
+			i = (i + 1) & (header.table_size - 1);
+		table[i].hash = hash;
+		table[i].offset = offset;
+		table[i].size = file.data.size();
+		table[i].name_offset = name_offset;
+		table[i].name_length = (uint32_t)file.path.size();
+		name_offset += (uint32_t)file.path.size();
+		offset = aligned(offset + file.data.size());
+	}
+
+	//write beside the pack and rename, so a crash never leaves half of one
+	std::string temp_path = filename + ".tmp";
+	std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+	if (!out.is_open()) {
+		std::cerr << "ERROR: Could not write asset pack " << temp_path << std::endl;
+		return false;
+	}
+	static const char zeros[ASSET_PACK_ALIGNMENT] = { 0 };
+	out.write((const char*)&header, sizeof(header));
+	out.write((const char*)table.data(), table.size() * sizeof(AssetPackEntry));
+	out.write(names.data(), names.size());
+	size_t written = (size_t)(header.names_offset + header.names_size);
+	for (const File& file : files_) {
+		out.write(zeros, aligned(written) - written);
+		written = aligned(written);
+		out.write(file.data.data(), file.data.size());
+		written += file.data.size();
+	}
+	out.close();
+	if (!out) {
+		std::cerr << "ERROR: Could not write asset pack " << temp_path << std::endl;
+		std::remove(temp_path.c_str());
+		return false;
+	}
+	std::remove(filename.c_str());
+	return std::rename(temp_path.c_str(), filename.c_str()) == 0;
+}
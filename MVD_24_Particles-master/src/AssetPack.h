@@ -0,0 +1,87 @@
+//
+//  AssetPack.h
+//
+//  One file holding many, written by the cooker (see AssetCooker.h). While
+//  a pack is mounted, MappedFile::open finds files in it before looking on
+//  disk, and hands out views into the pack's own mapping: reading a packed
+//  file copies nothing, and the whole set costs a single open.
+//
+//  Layout, little endian:
+//    AssetPackHeader
+//    table: table_size AssetPackEntry, open addressed on the hash of the
+//           canonical path (see ResourceManager::canonicalPath), linear
+//           probing. Empty slots have name_length 0
+//    names: the paths, not terminated
+//    data:  every file starts on an ASSET_PACK_ALIGNMENT boundary
+//
+#pragma once
+#include "MappedFile.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//bump whenever the layout changes
+#define ASSET_PACK_VERSION 1
+#define ASSET_PACK_ALIGNMENT 64
+
+struct AssetPackHeader {
+	char magic[4]; //"MVDP"
+	uint32_t version;
+	uint32_t num_entries;
+	uint32_t table_size; //power of two, at least twice num_entries
+	uint64_t names_offset;
+	uint64_t names_size;
+};
+
+struct AssetPackEntry {
+	uint64_t hash;
+	uint64_t offset;
+	uint64_t size;
+	uint32_t name_offset; //into names
+	uint32_t name_length;
+};
+
+class AssetPack {
+public:
+	~AssetPack() { close(); }
+	bool open(const std::string& filename);
+	void close();
+	bool isOpen() const { return file_.isOpen(); }
+	int numEntries() const { return header_ ? (int)header_->num_entries : 0; }
+
+	//the file stored under path, if there is one
+	bool find(const std::string& path, const char*& data, size_t& size) const;
+	bool contains(const std::string& path) const;
+
+	//the pack MappedFile::open looks in, nullptr for none
+	static void mount(const AssetPack* pack) { mounted_ = pack; }
+	static const AssetPack* mounted() { return mounted_; }
+
+	static uint64_t hashPath(const std::string& canonical_path);
+
+private:
+	MappedFile file_;
+	const AssetPackHeader* header_ = nullptr;
+	const AssetPackEntry* table_ = nullptr;
+	static const AssetPack* mounted_;
+};
+
+//collects files in memory and writes them out as a pack
+class AssetPackWriter {
+public:
+	//a second file under the same path replaces the first
+	void add(const std::string& path, const char* data, size_t size);
+	bool addFile(const std::string& path, const std::string& filename);
+	bool write(const std::string& filename) const;
+	size_t dataBytes() const;
+	//of the file added under path, 0 if there is none
+	size_t fileBytes(const std::string& path) const;
+	int numFiles() const { return (int)files_.size(); }
+
+private:
+	struct File {
+		std::string path; //canonical
+		std::vector<char> data;
+	};
+	std::vector<File> files_;
+};
@@ -0,0 +1,766 @@
+//
+//  ColladaAsset.cpp
+//
+#include "ColladaAsset.h"
+#include "MappedFile.h"
+#include "TextParsing.h"
+#include "tinyxml2.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+
+using namespace tinyxml2;
+
+namespace {
+
+const char COLLADA_CACHE_MAGIC[4] = { 'M', 'V', 'D', 'C' };
+
+//attribute or "" if it is missing
+std::string attribute(XMLElement* element, const char* name) {
+	const char* value = element ? element->Attribute(name) : nullptr;
+	return value ? value : "";
+}
+
+//url attributes reference ids as "#id"
+std::string urlTarget(XMLElement* element, const char* name) {
+	std::string url = attribute(element, name);
+	if (!url.empty() && url[0] == '#') url.erase(0, 1);
+	return url;
+}
+
+//collada writes matrices row major, we are column major
+bool readMatrix(XMLElement* element, lm::mat4& matrix) {
+	std::vector<float> floats;
+	if (!element || !readFloatList(element->GetText(), floats) || floats.size() < 16)
+		return false;
+	matrix = lm::mat4(&floats[0]);
+	matrix.transpose();
+	return true;
+}
+
+//the joint tree below node, depth first. bind poses are looked up by name
+bool readJointNode(XMLElement* node, int parent, std::vector<ColladaJoint>& joints,
+	std::unordered_map<std::string, lm::mat4>& bonename_bindpose) {
+
+	int index = (int)joints.size();
+	joints.emplace_back();
+	ColladaJoint& joint = joints.back();
+	joint.name = attribute(node, "name");
+	joint.id = attribute(node, "id");
+	joint.parent = parent;
+	joint.bind_pose = bonename_bindpose[joint.name];
+	if (!readMatrix(node->FirstChildElement("matrix"), joint.matrix)) {
+		std::cout << "ERROR: Joints transforms/matrices must be 'baked' by exporter" << std::endl;
+		return false;
+	}
+	for (XMLElement* child = node->FirstChildElement("node"); child; child = child->NextSiblingElement("node")) {
+		if (attribute(child, "type") == "JOINT" && !readJointNode(child, index, joints, bonename_bindpose))
+			return false;
+	}
+	return true;
+}
+
+//per controller, until the joints are known
+struct SkinWeights {
+	int geometry = -1;
+	std::vector<std::string> bone_names;
+	std::vector<lm::vec4> weights; //per original (collada) vertex
+	std::vector<lm::ivec4> bones; //into bone_names, -1 for none
+};
+
+//keeps the four largest weights of a vertex, renormalized if any were dropped
+void addInfluence(lm::vec4& weights, lm::ivec4& bones, int bone, float weight, bool& dropped) {
+	int slot = -1;
+	for (int k = 0; k < 4 && slot < 0; k++)
+		if (bones.value_[k] < 0) slot = k;
+	if (slot < 0) {
+		dropped = true;
+		slot = 0;
+		for (int k = 1; k < 4; k++)
+			if (weights.value_[k] < weights.value_[slot]) slot = k;
+		if (weights.value_[slot] >= weight) return;
+	}
+	weights.value_[slot] = weight;
+	bones.value_[slot] = bone;
+}
+
+bool readGeometry(XMLElement* geom, ColladaGeometry& out, std::vector<unsigned int>& orig_indices) {
+	out.id = attribute(geom, "id");
+
+	//only one mesh element per geometry is supported
+	XMLElement* mesh_element = geom->FirstChildElement("mesh");
+	if (!mesh_element) {
+		std::cout << "ERROR: Collada geometry " << out.id << " has no mesh" << std::endl;
+		return false;
+	}
+
+	//source arrays (positions, normals, uvs...) by id
+	std::unordered_map<std::string, std::vector<float>> sources;
+	for (XMLElement* source = mesh_element->FirstChildElement("source"); source; source = source->NextSiblingElement("source")) {
+		XMLElement* float_array = source->FirstChildElement("float_array");
+		if (!float_array) continue;
+		std::vector<float>& floats = sources[attribute(source, "id")];
+		if (!readFloatList(float_array->GetText(), floats)) {
+			std::cout << "ERROR: Collada float array is not valid in geometry " << out.id << std::endl;
+			return false;
+		}
+	}
+
+	//the position data is special for some unfathomable reason
+	//and needs an extra mapping
+	XMLElement* vertices_element = mesh_element->FirstChildElement("vertices");
+	std::string vertices_id = attribute(vertices_element, "id");
+	std::string positions_id = urlTarget(vertices_element ? vertices_element->FirstChildElement("input") : nullptr, "source");
+
+	//only triangles, or mixed triangles/quads
+	bool polylist = false;
+	XMLElement* index_element = mesh_element->FirstChildElement("triangles");
+	if (!index_element) {
+		index_element = mesh_element->FirstChildElement("polylist");
+		polylist = true;
+	}
+	if (!index_element) {
+		std::cout << "ERROR: No triangle or polylist was found in Collada file" << std::endl;
+		return false;
+	}
+
+	//which stream each index of a corner refers to
+	const std::vector<float> empty;
+	const std::vector<float>* positions = &empty;
+	const std::vector<float>* normals = &empty;
+	const std::vector<float>* uvs = &empty;
+	int position_offset = -1, normal_offset = -1, uv_offset = -1, stride = 1;
+	for (XMLElement* input = index_element->FirstChildElement("input"); input; input = input->NextSiblingElement("input")) {
+		std::string semantic = attribute(input, "semantic");
+		std::string source = urlTarget(input, "source");
+		int offset = input->IntAttribute("offset");
+		stride = std::max(stride, offset + 1);
+		if (semantic == "VERTEX") {
+			positions = &sources[source == vertices_id ? positions_id : source];
+			position_offset = offset;
+		}
+		else if (semantic == "NORMAL") {
+			normals = &sources[source];
+			normal_offset = offset;
+		}
+		else if (semantic == "TEXCOORD" && uv_offset < 0) {
+			uvs = &sources[source];
+			uv_offset = offset;
+		}
+	}
+	if (position_offset < 0) {
+		std::cout << "ERROR: Collada geometry " << out.id << " has no vertex input" << std::endl;
+		return false;
+	}
+
+	int num_faces = index_element->IntAttribute("count");
+	std::vector<unsigned int> vcounts;
+	if (polylist && !readUIntList(index_element->FirstChildElement("vcount") ?
+		index_element->FirstChildElement("vcount")->GetText() : nullptr, vcounts)) {
+		std::cout << "ERROR: Collada vcount is not valid in geometry " << out.id << std::endl;
+		return false;
+	}
+	std::vector<unsigned int> p;
+	XMLElement* p_element = index_element->FirstChildElement("p");
+	if (!p_element || !readUIntList(p_element->GetText(), p)) {
+		std::cout << "ERROR: Collada index list is not valid in geometry " << out.id << std::endl;
+		return false;
+	}
+
+	//one opengl vertex per distinct (position, normal, uv) corner, in order
+	//of first use. orig_indices keeps the collada position of each, which
+	//skin weights are given for
+	std::unordered_map<uint64_t, unsigned int> index_map;
+	index_map.reserve(p.size() / stride);
+	std::vector<unsigned int> face;
+	size_t cursor = 0;
+	for (int f = 0; f < num_faces; f++) {
+		unsigned int corners = polylist ? (f < (int)vcounts.size() ? vcounts[f] : 0) : 3;
+		if (cursor + (size_t)corners * stride > p.size()) {
+			std::cout << "ERROR: Collada index list is too short in geometry " << out.id << std::endl;
+			return false;
+		}
+		face.clear();
+		for (unsigned int c = 0; c < corners; c++, cursor += stride) {
+			unsigned int pos = p[cursor + position_offset];
+			unsigned int norm = normal_offset >= 0 ? p[cursor + normal_offset] : 0;
+			unsigned int uv = uv_offset >= 0 ? p[cursor + uv_offset] : 0;
+			if ((size_t)pos * 3 + 2 >= positions->size() ||
+				(normal_offset >= 0 && (size_t)norm * 3 + 2 >= normals->size()) ||
+				(uv_offset >= 0 && (size_t)uv * 2 + 1 >= uvs->size())) {
+				std::cout << "ERROR: Collada index out of range in geometry " << out.id << std::endl;
+				return false;
+			}
+			uint64_t key = ((uint64_t)pos << 42) ^ ((uint64_t)norm << 21) ^ (uint64_t)uv;
+			if (pos >= (1u << 21) || norm >= (1u << 21) || uv >= (1u << 21)) {
+				std::cout << "ERROR: Collada geometry " << out.id << " is too large" << std::endl;
+				return false;
+			}
+			auto found = index_map.find(key);
+			if (found == index_map.end()) {
+				unsigned int next = (unsigned int)orig_indices.size();
+				index_map.emplace(key, next);
+				out.vertices.insert(out.vertices.end(), &(*positions)[pos * 3], &(*positions)[pos * 3] + 3);
+				if (normal_offset >= 0) out.normals.insert(out.normals.end(), &(*normals)[norm * 3], &(*normals)[norm * 3] + 3);
+				else out.normals.insert(out.normals.end(), 3, 0.0f);
+				if (uv_offset >= 0) out.uvs.insert(out.uvs.end(), &(*uvs)[uv * 2], &(*uvs)[uv * 2] + 2);
+				else out.uvs.insert(out.uvs.end(), 2, 0.0f);
+				orig_indices.push_back(pos);
+				face.push_back(next);
+			}
+			else
+				face.push_back(found->second);
+		}
+		//fan, so a quad makes (0, 1, 2) (3, 0, 2)
+		if (face.size() >= 3) {
+			out.indices.insert(out.indices.end(), face.begin(), face.begin() + 3);
+			for (size_t i = 3; i < face.size(); i++) {
+				out.indices.push_back(face[i]);
+				out.indices.push_back(face[0]);
+				out.indices.push_back(face[i - 1]);
+			}
+		}
+	}
+	return true;
+}
+
+bool readController(XMLElement* controller, const std::unordered_map<std::string, int>& geometry_ids,
+	SkinWeights& skin, lm::mat4& bind_shape_matrix,
+	std::unordered_map<std::string, lm::mat4>& bonename_bindpose) {
+
+	std::string controller_id = attribute(controller, "id");
+	XMLElement* skin_element = controller->FirstChildElement("skin");
+	if (!skin_element) return true;
+	auto geometry = geometry_ids.find(urlTarget(skin_element, "source"));
+	if (geometry == geometry_ids.end()) {
+		std::cout << "ERROR: Collada controller " << controller_id << " skins a missing geometry" << std::endl;
+		return false;
+	}
+	skin.geometry = geometry->second;
+
+	//raw source data: bone names, bind poses and weights
+	int bone_count = -1;
+	std::vector<float> bind_pose_raw, vertex_weights_raw;
+	for (XMLElement* source = skin_element->FirstChildElement("source"); source; source = source->NextSiblingElement("source")) {
+		XMLElement* technique_common = source->FirstChildElement("technique_common");
+		XMLElement* accessor = technique_common ? technique_common->FirstChildElement("accessor") : nullptr;
+		std::string type = attribute(accessor ? accessor->FirstChildElement("param") : nullptr, "type");
+		if (type == "name") {
+			XMLElement* name_array = source->FirstChildElement("Name_array");
+			if (!name_array) continue;
+			bone_count = name_array->IntAttribute("count");
+			readWordList(name_array->GetText(), skin.bone_names);
+		}
+		else if (type == "float4x4" || type == "float") {
+			XMLElement* float_array = source->FirstChildElement("float_array");
+			if (float_array && !readFloatList(float_array->GetText(), type == "float" ? vertex_weights_raw : bind_pose_raw)) {
+				std::cout << "ERROR: Collada float array is not valid in controller " << controller_id << std::endl;
+				return false;
+			}
+		}
+	}
+
+	//overall bind matrix
+	if (!readMatrix(skin_element->FirstChildElement("bind_shape_matrix"), bind_shape_matrix)) {
+		std::cout << "ERROR: Collada parser couldn't find bind matrix for controller " << controller_id << std::endl;
+		return false;
+	}
+	//individual bind poses
+	if (bone_count < 0 || (int)skin.bone_names.size() < bone_count || (int)bind_pose_raw.size() < bone_count * 16) {
+		std::cout << "ERROR: Collada parser didn't parse controller bones correctly" << std::endl;
+		return false;
+	}
+	for (int i = 0; i < bone_count; i++) {
+		lm::mat4 bind_pose(&bind_pose_raw[i * 16]);
+		bind_pose.transpose();
+		bonename_bindpose[skin.bone_names[i]] = bind_pose;
+	}
+
+	//weights are given per original vertex, as vcount (joint, weight) pairs
+	XMLElement* vertex_weights = skin_element->FirstChildElement("vertex_weights");
+	int num_vertices = vertex_weights ? vertex_weights->IntAttribute("count") : 0;
+	std::vector<unsigned int> vcount, v;
+	if (!vertex_weights ||
+		!readUIntList(vertex_weights->FirstChildElement("vcount") ? vertex_weights->FirstChildElement("vcount")->GetText() : nullptr, vcount) ||
+		!readUIntList(vertex_weights->FirstChildElement("v") ? vertex_weights->FirstChildElement("v")->GetText() : nullptr, v) ||
+		(int)vcount.size() < num_vertices) {
+		std::cout << "ERROR: Collada vertex weights are not valid in controller " << controller_id << std::endl;
+		return false;
+	}
+	skin.weights.assign(num_vertices, lm::vec4(0, 0, 0, 0));
+	skin.bones.assign(num_vertices, lm::ivec4(-1, -1, -1, -1));
+	size_t cursor = 0;
+	int num_dropped = 0;
+	for (int i = 0; i < num_vertices; i++) {
+		bool dropped = false;
+		for (unsigned int j = 0; j < vcount[i]; j++, cursor += 2) {
+			if (cursor + 1 >= v.size() || v[cursor] >= skin.bone_names.size() || v[cursor + 1] >= vertex_weights_raw.size()) {
+				std::cout << "ERROR: Collada vertex weight out of range in controller " << controller_id << std::endl;
+				return false;
+			}
+			addInfluence(skin.weights[i], skin.bones[i], (int)v[cursor], vertex_weights_raw[v[cursor + 1]], dropped);
+		}
+		if (dropped) {
+			lm::vec4& w = skin.weights[i];
+			float sum = w.x + w.y + w.z + w.w;
+			if (sum > 0.0f) w = lm::vec4(w.x / sum, w.y / sum, w.z / sum, w.w / sum);
+			num_dropped++;
+		}
+	}
+	if (num_dropped)
+		std::cout << "Collada controller " << controller_id << ": " << num_dropped << " vertices kept their 4 strongest joints" << std::endl;
+	return true;
+}
+
+//binary copy helpers, every block padded to 4 bytes
+class CacheWriter {
+public:
+	explicit CacheWriter(std::ofstream& file) : file_(file) {}
+	void u32(uint32_t value) { file_.write((const char*)&value, 4); }
+	void u64(uint64_t value) { file_.write((const char*)&value, 8); }
+	void bytes(const void* data, size_t size) {
+		static const char zeros[4] = { 0, 0, 0, 0 };
+		if (size) file_.write((const char*)data, size);
+		file_.write(zeros, ((size + 3) & ~(size_t)3) - size);
+	}
+	void string(const std::string& s) { u32((uint32_t)s.size()); bytes(s.data(), s.size()); }
+	void matrix(const lm::mat4& m) { bytes(m.m, sizeof(float) * 16); }
+	template <typename T>
+	void array(const std::vector<T>& v) { u32((uint32_t)v.size()); bytes(v.data(), v.size() * sizeof(T)); }
+private:
+	std::ofstream& file_;
+};
+
+//reads stop (ok_ false) at the first one past the end
+class CacheReader {
+public:
+	CacheReader(const char* data, size_t size) : p_(data), end_(data + size) {}
+	bool ok() const { return ok_; }
+	bool atEnd() const { return p_ == end_; }
+	uint32_t u32() { uint32_t v = 0; read_(&v, 4, 4); return v; }
+	uint64_t u64() { uint64_t v = 0; read_(&v, 8, 8); return v; }
+	//a count of records at least min_size bytes each, 0 (and not ok) when
+	//that many can't be in what is left
+	uint32_t count(size_t min_size) {
+		uint32_t n = u32();
+		if (!check_((size_t)n * min_size)) return 0;
+		return n;
+	}
+	void string(std::string& s) {
+		uint32_t size = u32();
+		if (!check_(padded_(size))) return;
+		s.assign(p_, size);
+		p_ += padded_(size);
+	}
+	void matrix(lm::mat4& m) { read_(m.m, sizeof(float) * 16, sizeof(float) * 16); }
+	template <typename T>
+	void array(std::vector<T>& v) {
+		uint32_t count = u32();
+		size_t size = (size_t)count * sizeof(T);
+		if (!check_(padded_(size))) return;
+		v.resize(count);
+		if (size) memcpy((void*)v.data(), p_, size);
+		p_ += padded_(size);
+	}
+private:
+	const char* p_;
+	const char* end_;
+	bool ok_ = true;
+	static size_t padded_(size_t size) { return (size + 3) & ~(size_t)3; }
+	bool check_(size_t size) {
+		if (!ok_ || (size_t)(end_ - p_) < size) ok_ = false;
+		return ok_;
+	}
+	void read_(void* out, size_t size, size_t step) {
+		if (!check_(step)) return;
+		memcpy(out, p_, size);
+		p_ += step;
+	}
+};
+
+} //namespace
+
+bool ColladaAsset::parse(const std::string& filename) {
+
+	//load document and check for errors
+	XMLDocument doc;
+	doc.LoadFile(filename.c_str());
+	if (doc.Error()) {
+		std::cout << "ERROR: Collada file not valid:" << std::endl;
+		std::cout << doc.ErrorStr() << std::endl;
+		return false;
+	}
+	XMLElement* root = doc.FirstChildElement("COLLADA");
+	if (!root) {
+		std::cout << "ERROR: Collada file does not contain root COLLADA node" << std::endl;
+		return false;
+	}
+
+	/***** GEOMETRIES ******/
+	std::unordered_map<std::string, int> geometry_ids;
+	std::vector<std::vector<unsigned int>> orig_indices;
+	XMLElement* lib_geometries = root->FirstChildElement("library_geometries");
+	if (lib_geometries) {
+		for (XMLElement* geom = lib_geometries->FirstChildElement("geometry"); geom; geom = geom->NextSiblingElement("geometry")) {
+			geometries.emplace_back();
+			orig_indices.emplace_back();
+			if (!readGeometry(geom, geometries.back(), orig_indices.back()))
+				return false;
+			geometry_ids[geometries.back().id] = (int)geometries.size() - 1;
+		}
+	}
+	else
+		std::cout << "Collada file has no geometries!" << std::endl;
+
+	/***** MATERIALS - EFFECTS ******/
+	//nodes reference a material, which references an effect. One engine
+	//material is made per effect
+	std::unordered_map<std::string, std::string> materialID_effectID;
+	XMLElement* library_materials = root->FirstChildElement("library_materials");
+	if (library_materials) {
+		for (XMLElement* material = library_materials->FirstChildElement("material"); material; material = material->NextSiblingElement("material"))
+			materialID_effectID[attribute(material, "id")] = urlTarget(material->FirstChildElement("instance_effect"), "url");
+	}
+	std::unordered_map<std::string, int> effect_ids;
+	XMLElement* lib_effects = root->FirstChildElement("library_effects");
+	if (lib_effects) {
+		for (XMLElement* effect = lib_effects->FirstChildElement("effect"); effect; effect = effect->NextSiblingElement("effect")) {
+			ColladaMaterial material;
+			material.effect_id = attribute(effect, "id");
+			//lambert or phong diffuse colour
+			XMLElement* technique = effect->FirstChildElement("profile_COMMON");
+			technique = technique ? technique->FirstChildElement("technique") : nullptr;
+			XMLElement* shading = technique ? technique->FirstChildElement("lambert") : nullptr;
+			if (technique && !shading) shading = technique->FirstChildElement("phong");
+			XMLElement* diffuse = shading ? shading->FirstChildElement("diffuse") : nullptr;
+			XMLElement* color = diffuse ? diffuse->FirstChildElement("color") : nullptr;
+			std::vector<float> df;
+			if (color && readFloatList(color->GetText(), df) && df.size() >= 3)
+				material.diffuse = lm::vec3(df[0], df[1], df[2]);
+			effect_ids[material.effect_id] = (int)materials.size();
+			materials.push_back(material);
+		}
+	}
+	else
+		std::cout << "Collada file has no materials! Using whatever material we find..." << std::endl;
+
+	/*** LIBRARY CONTROLLERS - SKINS ***/
+	std::unordered_map<std::string, lm::mat4> bonename_bindpose;
+	std::unordered_map<std::string, int> controller_ids;
+	std::vector<SkinWeights> skins;
+	std::vector<lm::mat4> bind_shape_matrices;
+	XMLElement* lib_controllers = root->FirstChildElement("library_controllers");
+	if (lib_controllers) {
+		for (XMLElement* controller = lib_controllers->FirstChildElement("controller"); controller; controller = controller->NextSiblingElement("controller")) {
+			SkinWeights skin;
+			lm::mat4 bind_shape_matrix;
+			if (!readController(controller, geometry_ids, skin, bind_shape_matrix, bonename_bindpose))
+				return false;
+			if (skin.geometry < 0) continue;
+			controller_ids[attribute(controller, "id")] = (int)skins.size();
+			skins.push_back(skin);
+			bind_shape_matrices.push_back(bind_shape_matrix);
+		}
+	}
+
+	/*** VISUAL SCENES ***/
+	XMLElement* lib_vis_scenes = root->FirstChildElement("library_visual_scenes");
+	XMLElement* vis_scene = lib_vis_scenes ? lib_vis_scenes->FirstChildElement("visual_scene") : nullptr;
+	if (!vis_scene) {
+		std::cout << "Collada file does not contain a visual scene" << std::endl;
+		return true;
+	}
+	std::vector<std::string> skeleton_ids; //per node
+	for (XMLElement* child = vis_scene->FirstChildElement("node"); child; child = child->NextSiblingElement("node")) {
+
+		//joint chain: index of each joint is its depth first order
+		if (attribute(child, "type") == "JOINT") {
+			if (!readJointNode(child, -1, joints, bonename_bindpose))
+				return false;
+			continue;
+		}
+
+		//regular node with either geometry or skin
+		ColladaNode node;
+		node.name = attribute(child, "name");
+		XMLElement* matrix_element = child->FirstChildElement("matrix");
+		if (matrix_element) {
+			if (attribute(matrix_element, "sid") != "transform" || !readMatrix(matrix_element, node.transform)) {
+				std::cout << "ERROR: Collada parser couldn't find transform matrix for node " << node.name << std::endl;
+				return false;
+			}
+			node.has_transform = true;
+		}
+
+		XMLElement* bind_material = nullptr;
+		std::string skeleton_id;
+		XMLElement* instance_controller = child->FirstChildElement("instance_controller");
+		XMLElement* instance_geometry = child->FirstChildElement("instance_geometry");
+		if (instance_controller) {
+			auto controller = controller_ids.find(urlTarget(instance_controller, "url"));
+			if (controller == controller_ids.end()) {
+				std::cout << "ERROR: Collada node " << node.name << " uses a missing controller" << std::endl;
+				return false;
+			}
+			node.skinned = true;
+			node.geometry = skins[controller->second].geometry;
+			node.skin_bind_matrix = bind_shape_matrices[controller->second];
+			XMLElement* skeleton = instance_controller->FirstChildElement("skeleton");
+			if (skeleton && skeleton->GetText()) {
+				std::vector<std::string> words;
+				readWordList(skeleton->GetText(), words);
+				if (!words.empty()) skeleton_id = words[0][0] == '#' ? words[0].substr(1) : words[0];
+			}
+			bind_material = instance_controller->FirstChildElement("bind_material");
+		}
+		else if (instance_geometry) {
+			auto geometry = geometry_ids.find(urlTarget(instance_geometry, "url"));
+			if (geometry == geometry_ids.end()) {
+				std::cout << "ERROR: Collada node " << node.name << " uses a missing geometry" << std::endl;
+				return false;
+			}
+			node.geometry = geometry->second;
+			bind_material = instance_geometry->FirstChildElement("bind_material");
+		}
+
+		XMLElement* technique_common = bind_material ? bind_material->FirstChildElement("technique_common") : nullptr;
+		if (technique_common) {
+			std::string target = urlTarget(technique_common->FirstChildElement("instance_material"), "target");
+			auto effect = materialID_effectID.find(target);
+			auto material = effect != materialID_effectID.end() ? effect_ids.find(effect->second) : effect_ids.end();
+			if (material != effect_ids.end())
+				node.material = material->second;
+			else
+				std::cout << "ERROR: couldn't find the material for node " << node.name << std::endl;
+		}
+		nodes.push_back(node);
+		skeleton_ids.push_back(skeleton_id);
+	}
+
+	//link skinned nodes to their root joint
+	std::unordered_map<std::string, int> joint_ids, joint_names;
+	for (int j = 0; j < (int)joints.size(); j++) {
+		joint_ids[joints[j].id] = j;
+		joint_names[joints[j].name] = j;
+	}
+	for (size_t n = 0; n < nodes.size(); n++) {
+		if (skeleton_ids[n].empty()) continue;
+		auto joint = joint_ids.find(skeleton_ids[n]);
+		if (joint != joint_ids.end()) nodes[n].root_joint = joint->second;
+		else std::cout << "ERROR: Skeleton " << skeleton_ids[n] << " of node " << nodes[n].name << " not found" << std::endl;
+	}
+
+	//skin weights move from original vertices to opengl vertices, with
+	//bones named by the controller turned into indices in chain
+	for (SkinWeights& skin : skins) {
+		ColladaGeometry& geometry = geometries[skin.geometry];
+		if (!geometry.weights.empty()) continue; //already skinned by another controller
+		std::vector<int> bone_joint(skin.bone_names.size(), 0);
+		for (size_t b = 0; b < skin.bone_names.size(); b++) {
+			auto joint = joint_names.find(skin.bone_names[b]);
+			if (joint != joint_names.end()) bone_joint[b] = joint->second;
+			else std::cout << "ERROR: Collada skin uses missing joint " << skin.bone_names[b] << std::endl;
+		}
+		const std::vector<unsigned int>& orig = orig_indices[skin.geometry];
+		geometry.weights.assign(orig.size(), lm::vec4(0, 0, 0, 0));
+		geometry.joint_ids.assign(orig.size(), lm::ivec4(0, 0, 0, 0));
+		for (size_t i = 0; i < orig.size(); i++) {
+			if (orig[i] >= skin.weights.size()) continue;
+			geometry.weights[i] = skin.weights[orig[i]];
+			for (int k = 0; k < 4; k++) {
+				int bone = skin.bones[orig[i]].value_[k];
+				geometry.joint_ids[i].value_[k] = bone >= 0 ? bone_joint[bone] : 0;
+			}
+		}
+	}
+
+	/*** LIBRARY ANIMATIONS ***/
+	XMLElement* lib_anims = root->FirstChildElement("library_animations");
+	if (!lib_anims) return true;
+	has_animation = true;
+
+	for (XMLElement* anim = lib_anims->FirstChildElement("animation"); anim; anim = anim->NextSiblingElement("animation")) {
+		//the first channel names the joint and the sampler, whose output
+		//source holds the keyframe matrices
+		XMLElement* channel = anim->FirstChildElement("channel");
+		if (!channel) { std::cout << "ERROR: collada animation node does not have channel node" << std::endl; return false; }
+		std::string sampler_id = urlTarget(channel, "source");
+		std::string target = attribute(channel, "target");
+		std::string joint_id = target.substr(0, target.find('/'));
+
+		std::string output_id;
+		for (XMLElement* sampler = anim->FirstChildElement("sampler"); sampler; sampler = sampler->NextSiblingElement("sampler")) {
+			if (attribute(sampler, "id") != sampler_id) continue;
+			for (XMLElement* input = sampler->FirstChildElement("input"); input; input = input->NextSiblingElement("input"))
+				if (attribute(input, "semantic") == "OUTPUT") output_id = urlTarget(input, "source");
+		}
+
+		auto joint = joint_ids.find(joint_id);
+		if (joint == joint_ids.end()) {
+			std::cout << "ERROR: collada animation targets missing joint " << joint_id << std::endl;
+			return false;
+		}
+		std::vector<float>& keyframes = joints[joint->second].keyframes;
+		keyframes.clear();
+		for (XMLElement* source = anim->FirstChildElement("source"); source; source = source->NextSiblingElement("source")) {
+			if (attribute(source, "id") != output_id) continue;
+			XMLElement* float_array = source->FirstChildElement("float_array");
+			if (float_array && !readFloatList(float_array->GetText(), keyframes)) {
+				std::cout << "ERROR: keyframes for joint " << joint_id << " are not valid!!" << std::endl;
+				return false;
+			}
+		}
+		if (keyframes.size() % 16 != 0) {
+			std::cout << "ERROR: keyframes for joint " << joint_id << " are not valid!!" << std::endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool ColladaAsset::save(const std::string& filename, uint64_t source_hash, uint64_t source_size) const {
+
+	//write beside the entry and rename, so a crash never leaves half of one
+	std::string temp_path = filename + ".tmp";
+	std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		std::cerr << "ERROR: Could not write collada cache file " << temp_path << std::endl;
+		return false;
+	}
+	CacheWriter out(file);
+	out.bytes(COLLADA_CACHE_MAGIC, 4);
+	out.u32(COLLADA_CACHE_VERSION);
+	out.u64(source_hash);
+	out.u64(source_size);
+	out.u32(has_animation ? 1 : 0);
+
+	out.u32((uint32_t)geometries.size());
+	for (const ColladaGeometry& g : geometries) {
+		out.string(g.id);
+		out.array(g.vertices);
+		out.array(g.uvs);
+		out.array(g.normals);
+		out.array(g.indices);
+		out.array(g.weights);
+		out.array(g.joint_ids);
+	}
+	out.u32((uint32_t)materials.size());
+	for (const ColladaMaterial& m : materials) {
+		out.string(m.effect_id);
+		out.bytes(m.diffuse.value_, sizeof(float) * 3);
+	}
+	out.u32((uint32_t)joints.size());
+	for (const ColladaJoint& j : joints) {
+		out.string(j.name);
+		out.string(j.id);
+		out.u32((uint32_t)j.parent);
+		out.matrix(j.matrix);
+		out.matrix(j.bind_pose);
+		out.array(j.keyframes);
+	}
+	out.u32((uint32_t)nodes.size());
+	for (const ColladaNode& n : nodes) {
+		out.string(n.name);
+		out.u32((n.has_transform ? 1 : 0) | (n.skinned ? 2 : 0));
+		out.matrix(n.transform);
+		out.matrix(n.skin_bind_matrix);
+		out.u32((uint32_t)n.geometry);
+		out.u32((uint32_t)n.root_joint);
+		out.u32((uint32_t)n.material);
+	}
+	file.close();
+	if (!file) {
+		std::cerr << "ERROR: Could not write collada cache file " << temp_path << std::endl;
+		std::remove(temp_path.c_str());
+		return false;
+	}
+	std::remove(filename.c_str());
+	return std::rename(temp_path.c_str(), filename.c_str()) == 0;
+}
+
+bool ColladaAsset::load(const std::string& filename, uint64_t source_hash, uint64_t source_size) {
+	MappedFile file;
+	if (!file.open(filename))
+		return false;
+	if (!load(file.data(), file.size(), &source_hash, &source_size)) {
+		*this = ColladaAsset();
+		return false;
+	}
+	return true;
+}
+
+bool ColladaAsset::load(const char* data, size_t size, const uint64_t* source_hash, const uint64_t* source_size) {
+	CacheReader in(data, size);
+	uint32_t magic = in.u32();
+	if (!in.ok() || memcmp(&magic, COLLADA_CACHE_MAGIC, 4) != 0 || in.u32() != COLLADA_CACHE_VERSION)
+		return false;
+	uint64_t hash = in.u64(), bytes = in.u64();
+	if ((source_hash && hash != *source_hash) || (source_size && bytes != *source_size))
+		return false;
+	has_animation = in.u32() != 0;
+
+	//smallest record of each: its strings and arrays empty
+	geometries.resize(in.ok() ? in.count(7 * 4) : 0);
+	for (ColladaGeometry& g : geometries) {
+		in.string(g.id);
+		in.array(g.vertices);
+		in.array(g.uvs);
+		in.array(g.normals);
+		in.array(g.indices);
+		in.array(g.weights);
+		in.array(g.joint_ids);
+		if (!in.ok()) break;
+	}
+	materials.resize(in.ok() ? in.count(4 + 3 * 4) : 0);
+	for (ColladaMaterial& m : materials) {
+		in.string(m.effect_id);
+		for (int k = 0; k < 3; k++) {
+			uint32_t bits = in.u32();
+			memcpy(&m.diffuse.value_[k], &bits, 4);
+		}
+		if (!in.ok()) break;
+	}
+	joints.resize(in.ok() ? in.count(3 * 4 + 2 * 64 + 4) : 0);
+	for (ColladaJoint& j : joints) {
+		in.string(j.name);
+		in.string(j.id);
+		j.parent = (int)in.u32();
+		in.matrix(j.matrix);
+		in.matrix(j.bind_pose);
+		in.array(j.keyframes);
+		if (!in.ok()) break;
+	}
+	nodes.resize(in.ok() ? in.count(2 * 4 + 2 * 64 + 3 * 4) : 0);
+	for (ColladaNode& n : nodes) {
+		in.string(n.name);
+		uint32_t flags = in.u32();
+		n.has_transform = (flags & 1) != 0;
+		n.skinned = (flags & 2) != 0;
+		in.matrix(n.transform);
+		in.matrix(n.skin_bind_matrix);
+		n.geometry = (int)in.u32();
+		n.root_joint = (int)in.u32();
+		n.material = (int)in.u32();
+		if (!in.ok()) break;
+	}
+
+	//indices between the records, which createColladaAsset_ follows as they are
+	bool indices_ok = true;
+	for (size_t i = 0; i < joints.size(); i++)
+		if (joints[i].parent < -1 || joints[i].parent >= (int)i) indices_ok = false; //parents come first
+	for (const ColladaNode& n : nodes) {
+		if (n.geometry < -1 || n.geometry >= (int)geometries.size() ||
+			n.material < -1 || n.material >= (int)materials.size() ||
+			n.root_joint < -1 || n.root_joint >= (int)joints.size())
+			indices_ok = false;
+	}
+
+	if (!in.ok() || !in.atEnd() || !indices_ok) {
+		std::cerr << "ERROR: Collada cache entry is damaged" << std::endl;
+		*this = ColladaAsset();
+		return false;
+	}
+	return true;
+}
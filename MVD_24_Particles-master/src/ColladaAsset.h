@@ -0,0 +1,75 @@
+//
+//  ColladaAsset.h
+//
+//  Everything Parsers::parseCollada takes from a .dae file, as plain data:
+//  geometries with their skin weights, materials, the joint tree with its
+//  keyframes and the scene nodes which use them. It is read from the xml
+//  (numeric arrays are parsed in place) or from its binary copy in the mesh
+//  cache, and the engine objects are then created from it.
+//
+//  Binary copy, read through a single mapping:
+//    "MVDC", version, source hash and size (as MeshCacheHeader)
+//    then each array as a uint32 count and its elements, strings as a
+//    uint32 length and their bytes, every block padded to 4 bytes
+//
+#pragma once
+#include "includes.h"
+#include <cstdint>
+#include <vector>
+
+//bump whenever the binary layout changes
+#define COLLADA_CACHE_VERSION 1
+
+struct ColladaGeometry {
+	std::string id;
+	std::vector<float> vertices, uvs, normals;
+	std::vector<unsigned int> indices;
+	//skin, one entry per vertex when a controller uses the geometry.
+	//joint ids are indices in the joint chain
+	std::vector<lm::vec4> weights;
+	std::vector<lm::ivec4> joint_ids;
+};
+
+struct ColladaMaterial {
+	std::string effect_id;
+	lm::vec3 diffuse;
+};
+
+//joints are stored depth first, in the order of the file, so their index
+//here is also their index in chain
+struct ColladaJoint {
+	std::string name;
+	std::string id;
+	int parent = -1;
+	lm::mat4 matrix;
+	lm::mat4 bind_pose;
+	std::vector<float> keyframes; //16 per frame, as Joint::setKeyFrames takes them
+};
+
+//a scene node which is not a joint, one entity each
+struct ColladaNode {
+	std::string name;
+	bool has_transform = false;
+	lm::mat4 transform;
+	int geometry = -1; //into geometries
+	bool skinned = false;
+	lm::mat4 skin_bind_matrix;
+	int root_joint = -1; //into joints
+	int material = -1; //into materials
+};
+
+struct ColladaAsset {
+	std::vector<ColladaGeometry> geometries;
+	std::vector<ColladaMaterial> materials;
+	std::vector<ColladaJoint> joints;
+	std::vector<ColladaNode> nodes;
+	bool has_animation = false;
+
+	//from the xml, false (with a message) if the file cannot be used
+	bool parse(const std::string& filename);
+	//binary copy, only loaded if it was written from the same source
+	bool save(const std::string& filename, uint64_t source_hash, uint64_t source_size) const;
+	bool load(const std::string& filename, uint64_t source_hash, uint64_t source_size);
+	//from memory (an asset pack entry), the source is only checked if given
+	bool load(const char* data, size_t size, const uint64_t* source_hash = nullptr, const uint64_t* source_size = nullptr);
+};
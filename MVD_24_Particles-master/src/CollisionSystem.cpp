@@ -31,6 +31,7 @@ void CollisionSystem::update(float dt) {
             //test all other colliders
             for (size_t j = 0; j < colliders.size(); j++) {
                 if (j == i) continue; // no self-test
+                if (!ECS.entities[colliders[j].owner].active) continue; // unloaded sector
                 
                 //if box
                 if (colliders[j].collider_type == ColliderTypeBox) {
@@ -16,8 +16,11 @@
 //
 #pragma once
 #include "includes.h"
+#include "AnimationClip.h"
 #include <vector>
 #include <functional>
+#include <algorithm>
+#include <cmath>
 #include "Shader.h"
 
 /**** COMPONENTS ****/
@@ -122,6 +125,9 @@ struct Light : public Camera {
 	int resolution;
     int cast_shadow;
 	float radius = 0;
+	//inputs radius was last calculated for, see updateRadius
+	float radius_linear_att = 0, radius_quadratic_att = 0;
+	lm::vec3 radius_color;
     
     Light() {
         type = LightTypeDirectional;
@@ -141,6 +147,16 @@ struct Light : public Camera {
 		radius = (-linear_att + std::sqrtf(linear_att * linear_att - 
 			4.0f * quadratic_att * (1.0f - (256.0f / 5.0f) * lightMax)))
 			/ (2.0f * quadratic_att);
+		radius_linear_att = linear_att;
+		radius_quadratic_att = quadratic_att;
+		radius_color = color;
+	}
+
+	//recalculates radius only if attenuation or colour changed since last time
+	void updateRadius() {
+		if (linear_att != radius_linear_att || quadratic_att != radius_quadratic_att ||
+			color.x != radius_color.x || color.y != radius_color.y || color.z != radius_color.z)
+			calculateRadius();
 	}
 };
 
@@ -226,10 +242,9 @@ struct Animation : public Component {
     std::string name = "";
     GLint target_transform = -1;
     GLuint num_frames = 0;
-    GLuint curr_frame = 0;
-    float ms_frame = 0;
-    float ms_counter = 0;
-    std::vector<lm::mat4> keyframes;
+    float ms_frame = 0; //playback speed, clip plays at its source rate when equal to source ms
+    std::vector<lm::mat4> keyframes; //source frames, moved into a clip by AnimationSystem::lateInit
+    ClipPlayer player;
 	bool active = true;
 };
 
@@ -258,13 +273,152 @@ struct Joint {
     }
 };
 
+#define MAX_JOINTS 96 //must match phong_anim.vert and depth_skinned.vert
+
+//joint hierarchy flattened at load, as arrays indexed by index_in_chain.
+//joints are numbered parent-before-child, so global matrices resolve in one
+//forward loop with no recursion or allocation. Read only once built, and
+//shared by every instance of the same asset
+struct SkeletonAsset {
+    std::vector<int> parents; //-1 for a root
+    std::vector<lm::mat4> bind_local; //pose of joints which are not animated
+    std::vector<lm::mat4> inverse_bind; //joint inverse bind * skin bind matrix
+    lm::mat4 skin_bind;
+    //bind pose bounds of the vertices each joint moves, from the skinned
+    //geometry (so assets are per geometry too). Empty joints have min > max
+    int geometry = -1;
+    std::vector<lm::vec3> bounds_min, bounds_max;
+    
+    int size() const { return (int)parents.size(); }
+    
+    //Skeleton::computePalette walks the joints in index order, so every
+    //parent must come before its children. False when they don't, or an
+    //index is outside num_joints
+    bool build(Joint* root, int num_joints, const lm::mat4& skin_bind_matrix) {
+        skin_bind = skin_bind_matrix;
+        parents.assign(num_joints, -1);
+        bind_local.assign(num_joints, lm::mat4());
+        inverse_bind.assign(num_joints, skin_bind);
+        return addJoint_(root);
+    }
+    
+private:
+    bool addJoint_(Joint* joint) {
+        int j = joint->index_in_chain;
+        int parent = joint->parent ? joint->parent->index_in_chain : -1;
+        if (j < 0 || j >= size() || parent >= j)
+            return false;
+        parents[j] = parent;
+        bind_local[j] = joint->matrix;
+        inverse_bind[j] = joint->bind_pose_matrix * inverse_bind[j];
+        for (auto& c : joint->children)
+            if (!addJoint_(c)) return false;
+        return true;
+    }
+};
+
+//pose buffers of one instance, only ever written by that instance's job
+struct Skeleton {
+    const SkeletonAsset* asset = nullptr;
+    std::vector<lm::mat4> local; //current pose of each joint
+    std::vector<lm::mat4> global;
+    std::vector<lm::mat4> palette; //global * inverse_bind, uploaded as is
+    
+    //reduced rate animation blends palette from prev_palette to next_palette
+    std::vector<lm::mat4> prev_palette;
+    std::vector<lm::mat4> next_palette;
+    
+    int size() const { return (int)local.size(); }
+    
+    void init(const SkeletonAsset* a) {
+        asset = a;
+        local = a->bind_local;
+        global.assign(a->size(), lm::mat4());
+        palette.assign(a->size(), lm::mat4());
+        prev_palette.assign(a->size(), lm::mat4());
+        next_palette.assign(a->size(), lm::mat4());
+        computePalette();
+    }
+    
+    void computePalette() { computePalette(palette); }
+    void computePalette(std::vector<lm::mat4>& out) {
+        const std::vector<int>& parents = asset->parents;
+        for (size_t i = 0; i < local.size(); i++) {
+            global[i] = parents[i] < 0 ? local[i] : global[parents[i]] * local[i];
+            out[i] = global[i] * asset->inverse_bind[i];
+        }
+    }
+    
+    //box around the current pose: each joint's bounds moved by its palette
+    //matrix. Every skinned vertex is a weighted mix of its joints' moved
+    //positions, so it lies inside. Space is the palette's output space
+    bool computeBounds(lm::vec3& out_min, lm::vec3& out_max) const {
+        out_min = lm::vec3(1e30f, 1e30f, 1e30f);
+        out_max = lm::vec3(-1e30f, -1e30f, -1e30f);
+        bool any = false;
+        int n = std::min((int)palette.size(), (int)asset->bounds_min.size());
+        for (int j = 0; j < n; j++) {
+            const lm::vec3& mn = asset->bounds_min[j];
+            const lm::vec3& mx = asset->bounds_max[j];
+            if (mn.x > mx.x) continue;
+            const float* m = palette[j].m;
+            float c[3] = { (mn.x + mx.x) * 0.5f, (mn.y + mx.y) * 0.5f, (mn.z + mx.z) * 0.5f };
+            float h[3] = { (mx.x - mn.x) * 0.5f, (mx.y - mn.y) * 0.5f, (mx.z - mn.z) * 0.5f };
+            float lo[3], hi[3];
+            for (int r = 0; r < 3; r++) {
+                //row r of the matrix, element (r, c) is m[c * 4 + r]
+                float center = m[12 + r] + m[r] * c[0] + m[4 + r] * c[1] + m[8 + r] * c[2];
+                float half = std::abs(m[r]) * h[0] + std::abs(m[4 + r]) * h[1] + std::abs(m[8 + r]) * h[2];
+                lo[r] = center - half;
+                hi[r] = center + half;
+            }
+            out_min = lm::vec3(std::min(out_min.x, lo[0]), std::min(out_min.y, lo[1]), std::min(out_min.z, lo[2]));
+            out_max = lm::vec3(std::max(out_max.x, hi[0]), std::max(out_max.y, hi[1]), std::max(out_max.z, hi[2]));
+            any = true;
+        }
+        return any;
+    }
+    
+    //palette = lerp(prev_palette, next_palette, t), per matrix element
+    void blendPalette(float t) {
+        for (size_t i = 0; i < palette.size(); i++)
+            for (int k = 0; k < 16; k++)
+                palette[i].m[k] = prev_palette[i].m[k] + (next_palette[i].m[k] - prev_palette[i].m[k]) * t;
+    }
+};
+
+//animation update rate of one instance
+enum AnimationLODLevel {
+    AnimationLODFull = 0,
+    AnimationLODHalf,
+    AnimationLODQuarter,
+    AnimationLODEighth,
+    AnimationLODFrozen,
+    ANIMATION_LOD_COUNT
+};
+
+struct AnimationLODState {
+    int level = AnimationLODFull;
+    int frames_left = 0; //frames until next evaluation
+    //written by GraphicsSystem when the mesh is culled, read next frame
+    bool visible = true;
+    float screen_size = 1.0f; //bounding sphere diameter / screen height
+};
+
 struct SkinnedMesh : public Mesh {
     lm::mat4 skin_bind_matrix;
-    Joint* root;
+    Joint* root = nullptr;
     int num_joints = -1;
 	float ms_frame = 41.6666;
-	float ms_counter = 0;
 	int active;
+    Skeleton skeleton; //set up by AnimationSystem::lateInit
+    ClipPlayer player; //one track per joint, indexed like the skeleton
+    AnimationLODState anim_lod;
+    //box around the current pose, in the space the palette skins to
+    bool has_bounds = false;
+    lm::vec3 bounds_min, bounds_max;
+    void updateBounds() { has_bounds = skeleton.computeBounds(bounds_min, bounds_max); }
+    GLuint palette_ubo = 0; //skeleton.palette on the gpu, one upload per frame
     void getAllJoints(Joint* current, std::vector<Joint*>& all_joints) {
         all_joints.push_back(current);
         for (auto& c : current->children)
@@ -272,10 +426,44 @@ struct SkinnedMesh : public Mesh {
     }
 };
 
+//many copies of one skinned mesh drawn with a single instanced call. Poses
+//are read from the baked animation texture in the vertex shader, so copies
+//cost no cpu skinning and no palette upload
+struct SkinnedCrowd : public Component {
+    int geometry = -1;
+    int material = -1;
+    //rows of the clip in the baked animation texture, see AnimationSystem::bakeClip
+    int clip_first_row = 0;
+    int clip_num_frames = 0;
+    float clip_frame_time = 1.0f / 24.0f;
+    //box around every frame of the clip, before the instance transform
+    bool has_clip_bounds = false;
+    lm::vec3 clip_bounds_min, clip_bounds_max;
+    float time = 0.0f; //seconds, advanced by AnimationSystem
+    bool active = true;
+    //per instance, local to the owner's transform
+    std::vector<lm::mat4> transforms;
+    std::vector<float> time_offsets; //seconds
+    std::vector<float> speeds; //playback rate multiplier
+    
+    void addInstance(const lm::mat4& transform, float time_offset, float speed = 1.0f) {
+        transforms.push_back(transform);
+        time_offsets.push_back(time_offset);
+        speeds.push_back(speed);
+    }
+    int size() const { return (int)transforms.size(); }
+};
+
 struct BlendShapes : public Component {
     std::vector<std::string> blend_names;
     std::vector<float> blend_weights;
     
+    //cpu evaluation state, written by AnimationSystem. It rewrites the mesh
+    //geometry, so meshes sharing a geometry show the same blend
+    bool on_cpu = false; //geometry positions already hold the blend
+    std::vector<float> applied_weights; //weights in the geometry positions
+    std::vector<float> positions;
+    
     void addShape(std::string name) {
         blend_names.push_back(name);
         blend_weights.push_back(0.0);
@@ -308,7 +496,8 @@ std::vector<GUIText>,
 std::vector<Animation>,
 std::vector<SkinnedMesh>,
 std::vector<BlendShapes>,
-std::vector<ParticleEmitter>
+std::vector<ParticleEmitter>,
+std::vector<SkinnedCrowd>
 > ComponentArrays;
 
 //way of mapping different types to an integer value i.e.
@@ -326,8 +515,9 @@ template<> struct type2int<Animation> { enum { result = 7 }; };
 template<> struct type2int<SkinnedMesh> { enum { result = 8 }; };
 template<> struct type2int<BlendShapes> { enum { result = 9 }; };
 template<> struct type2int<ParticleEmitter> { enum { result = 10 }; };
+template<> struct type2int<SkinnedCrowd> { enum { result = 11 }; };
 //UPDATE THIS!
-const int NUM_TYPE_COMPONENTS = 11;
+const int NUM_TYPE_COMPONENTS = 12;
 
 /**** ENTITY ****/
 
@@ -1,5 +1,6 @@
 #include "ControlSystem.h"
 #include "extern.h"
+#include <fstream>
 
 //set initial state of input system
 void ControlSystem::init() {
@@ -13,6 +14,12 @@ void ControlSystem::key_mouse_callback(int key_button, int action, int mods) {
 	if (action == GLFW_PRESS) input[key_button] = true;
 	if (action == GLFW_RELEASE) input[key_button] = false;
 
+	//toggle camera path recording
+	if (key_button == GLFW_KEY_F9 && action == GLFW_PRESS) {
+		if (recording_) stopRecording("data/assets/recorded.campath");
+		else startRecording();
+	}
+
 }
 
 //called from hardware input (via game)
@@ -25,6 +32,10 @@ void ControlSystem::updateMousePosition(int new_x, int new_y) {
 
 //called once per frame
 void ControlSystem::update(float dt) {
+	if (control_type == ControlTypePath) {
+		updatePath(dt);
+		return;
+	}
 	if (control_type == ControlTypeFPS) {
 		updateFPS(dt);
 	}
@@ -32,6 +43,13 @@ void ControlSystem::update(float dt) {
 		updateFree(dt);
 	}
 
+	//store camera pose once per frame while recording
+	if (recording_) {
+		Camera& camera = ECS.getComponentInArray<Camera>(ECS.main_camera);
+		recorded_path_.keys.push_back({ record_time_, camera.position, camera.forward });
+		record_time_ += dt;
+	}
+
 	//check if switch to Debug cam
 	if (input[GLFW_KEY_O] == true) {
 		ECS.main_camera = 0; //debug cam is 0
@@ -174,4 +192,82 @@ void ControlSystem::updateFPS(float dt) {
 	//check if switch to Debug cam
 	if (input[GLFW_KEY_O] == true) ECS.main_camera = 0; //debug cam is 0
 	if (input[GLFW_KEY_P] == true) ECS.main_camera = 1;
-}
\ No newline at end of file
+}
+//moves main camera along the current camera path, time only advances by dt
+//so a fixed dt gives exactly the same frames every run
+void ControlSystem::updatePath(float dt) {
+	Camera& camera = ECS.getComponentInArray<Camera>(ECS.main_camera);
+	Transform& transform = ECS.getComponentFromEntity<Transform>(camera.owner);
+
+	lm::vec3 position, forward;
+	camera_path_.sample(path_time_, position, forward);
+	transform.position(position);
+	camera.position = position;
+	camera.forward = forward;
+
+	path_time_ += dt;
+}
+
+void ControlSystem::playCameraPath(const CameraPath& path) {
+	camera_path_ = path;
+	path_time_ = 0.0f;
+	control_type = ControlTypePath;
+}
+
+void ControlSystem::startRecording() {
+	recorded_path_.keys.clear();
+	record_time_ = 0.0f;
+	recording_ = true;
+	print("Recording camera path...");
+}
+
+//writes recording in the format read by Parsers::parseCameraPath
+bool ControlSystem::stopRecording(std::string filename) {
+	recording_ = false;
+	std::ofstream file(filename);
+	if (!file.is_open()) {
+		std::cout << "ERROR: could not write camera path " << filename << "\n";
+		return false;
+	}
+	file << "# time px py pz fx fy fz\n";
+	for (auto& key : recorded_path_.keys) {
+		file << key.time << " " << key.position.x << " " << key.position.y << " " << key.position.z << " "
+			<< key.forward.x << " " << key.forward.y << " " << key.forward.z << "\n";
+	}
+	std::cout << "Camera path saved to " << filename << " (" << recorded_path_.keys.size() << " keys)\n";
+	return true;
+}
+
+//uniform Catmull-Rom through the keys, clamped at both ends
+void CameraPath::sample(float t, lm::vec3& position, lm::vec3& forward) const {
+	if (keys.empty()) return;
+	if (keys.size() == 1 || t <= keys.front().time) {
+		position = keys.front().position; forward = keys.front().forward;
+		return;
+	}
+	if (t >= keys.back().time) {
+		position = keys.back().position; forward = keys.back().forward;
+		return;
+	}
+
+	//find segment [i, i+1] containing t
+	size_t i = 0;
+	while (i + 2 < keys.size() && keys[i + 1].time <= t) i++;
+	const CameraPathKey& k0 = keys[i > 0 ? i - 1 : i];
+	const CameraPathKey& k1 = keys[i];
+	const CameraPathKey& k2 = keys[i + 1];
+	const CameraPathKey& k3 = keys[i + 2 < keys.size() ? i + 2 : i + 1];
+
+	float span = k2.time - k1.time;
+	float u = span > 0.0f ? (t - k1.time) / span : 0.0f;
+	float u2 = u * u, u3 = u2 * u;
+	//catmull-rom basis weights
+	float w0 = -0.5f * u3 + u2 - 0.5f * u;
+	float w1 = 1.5f * u3 - 2.5f * u2 + 1.0f;
+	float w2 = -1.5f * u3 + 2.0f * u2 + 0.5f * u;
+	float w3 = 0.5f * u3 - 0.5f * u2;
+
+	position = k0.position * w0 + k1.position * w1 + k2.position * w2 + k3.position * w3;
+	forward = k0.forward * w0 + k1.forward * w1 + k2.forward * w2 + k3.forward * w3;
+	forward.normalize();
+}
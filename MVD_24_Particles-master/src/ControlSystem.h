@@ -2,6 +2,7 @@
 #include "includes.h"
 #include "Components.h"
 #include <map>
+#include <vector>
 
 //struct to store mouse state
 struct Mouse {
@@ -13,7 +14,22 @@ struct Mouse {
 enum ControlType {
 	ControlTypeFree,
 	ControlTypeFPS,
-	ControlTypeOrbit
+	ControlTypeOrbit,
+	ControlTypePath
+};
+
+//camera path for repeatable benchmark runs. Keys are sampled with a
+//Catmull-Rom spline, so both a few hand placed keys and a dense recording work
+struct CameraPathKey {
+	float time;
+	lm::vec3 position;
+	lm::vec3 forward;
+};
+
+struct CameraPath {
+	std::vector<CameraPathKey> keys;
+	float duration() const { return keys.empty() ? 0.0f : keys.back().time; }
+	void sample(float t, lm::vec3& position, lm::vec3& forward) const;
 };
 
 //System which manages all our controls
@@ -29,6 +45,12 @@ public:
 	//current active control type
 	ControlType control_type = ControlTypeFPS;
 
+	//camera path playback (drives main camera) and recording (F9 toggles)
+	void playCameraPath(const CameraPath& path);
+	bool isCameraPathFinished() { return path_time_ >= camera_path_.duration(); }
+	void startRecording();
+	bool stopRecording(std::string filename);
+
 	//public functions to get key and mouse
 	bool GetKey(int code) { return input[code]; }
 	bool GetButton(int code) { return input[code]; }
@@ -57,4 +79,12 @@ private:
 	//function to update entity movement
 	void updateFree(float dt);
 	void updateFPS(float dt);
+	void updatePath(float dt);
+
+	//camera path
+	CameraPath camera_path_;
+	float path_time_ = 0.0f;
+	bool recording_ = false;
+	CameraPath recorded_path_;
+	float record_time_ = 0.0f;
 };
@@ -33,8 +33,9 @@ void DebugSystem::lateInit() {
 	createRay_();
 
 	//create texture for light icon
-	icon_light_texture_ = Parsers::parseTexture("data/assets/icon_light.tga");
-	icon_camera_texture_ = Parsers::parseTexture("data/assets/icon_camera.tga");
+	ResourceManager& resources = graphics_system_->getResources();
+	icon_light_texture_ = resources.texture(resources.loadTexture("data/assets/icon_light.tga"));
+	icon_camera_texture_ = resources.texture(resources.loadTexture("data/assets/icon_camera.tga"));
 
 	//picking collider
 	ent_picking_ray_ = ECS.createEntity("picking_ray");
@@ -165,34 +166,6 @@ void DebugSystem::createJointGeometry_() {
     
 }
 
-//Recursive function which traverses joint tree depth first
-//multiplies each joint model matrix by that of it's parent
-//(to create a 'world' matrix for each joint), then copies
-//that world matrix to an array of floats (all_matrices) which
-//stores all of the joint matrices, one after another
-//this float array is passed to the shader as a uniform
-// Params:
-//--------
-// - current: the current joint, should pass root joint at first call
-// - current_model: the current global model matrix (pass identity at first call
-// - all_matrices: a vector which MUST BE of size 16 * num_joints
-// - joint_count: integer passed by reference, used to track where we are in joint chain
-void DebugSystem::getJointWorldMatrices_(Joint* current,
-                                         lm::mat4 current_model,
-                                         std::vector<float>& all_matrices,
-                                         int& joint_count) {
-    
-    lm::mat4 joint_global_model = current_model * current->matrix;
-    
-    for (int i = 0; i < 16; i++)
-        all_matrices[joint_count * 16 + i] = joint_global_model.m[i];
-    
-    for (auto& c : current->children) {
-        joint_count++;
-        getJointWorldMatrices_(c, joint_global_model, all_matrices, joint_count);
-    }
-}
-
 //function that draws joints to screen
 void DebugSystem::drawJoints_() {
     
@@ -204,18 +177,14 @@ void DebugSystem::drawJoints_() {
     
     //skinned_meshes size must be same as joints_vaos size
     for (size_t i = 0; i < skinnedmeshes.size(); i++) {
-        if (!skinnedmeshes[i].root) continue; //only draw if has joint chain
+        Skeleton& skeleton = skinnedmeshes[i].skeleton;
+        if (skeleton.size() == 0) continue; //only draw if has joint chain
         
         //find uniform location (it is an array
         GLint u_model = glGetUniformLocation(joint_shader_->program, "u_model");
         
-        //create float vector and fill it with mvps for each joint
-        std::vector<float> all_matrices(skinnedmeshes[i].num_joints * 16, 0);
-        int joint_counter = 0;
-        getJointWorldMatrices_(skinnedmeshes[i].root, lm::mat4(), all_matrices, joint_counter);
-        
-        //send to shader
-        glUniformMatrix4fv(u_model, skinnedmeshes[i].num_joints, GL_FALSE, &all_matrices[0]);
+        //global joint matrices were computed by the animation system
+        glUniformMatrix4fv(u_model, skeleton.size(), GL_FALSE, skeleton.global[0].m);
         
         joint_shader_->setUniform(U_VP, cam.view_projection);
         
@@ -285,6 +254,7 @@ void DebugSystem::drawColliders_() {
     //draw all colliders
     auto& colliders = ECS.getAllComponents<Collider>();
     for (auto& cc : colliders) {
+        if (!ECS.entities[cc.owner].active) continue;
         //get transform for collider
         Transform& tc = ECS.getComponentFromEntity<Transform>(cc.owner);
         //get the colliders local model matrix in order to draw correctly
@@ -643,6 +613,15 @@ void DebugSystem::updateimGUI_(float dt) {
 			BlendShapes& blend_comp = ECS.getComponentFromEntity<BlendShapes>(ECS.getEntity("toon"));
 			ImGui::SliderFloat("Happy", &blend_comp.blend_weights[0], 0, 1, 0);
 			ImGui::SliderFloat("Angry", &blend_comp.blend_weights[1], 0, 1, 0);
+			if (animation_system_)
+				ImGui::Checkbox("Blend on CPU", &animation_system_->blend_shapes_on_cpu);
+			Geometry& blend_geom = graphics_system_->getGeometry(ECS.getComponentFromEntity<Mesh>(ECS.getEntity("toon")).geometry);
+			size_t num_deltas = 0;
+			for (auto& shape : blend_geom.blend_shapes)
+				num_deltas += shape.vertices.size();
+			ImGui::Text("%d shapes, %d vertices, %d deltas", (int)blend_geom.blend_shapes.size(), (int)blend_geom.num_vertices, (int)num_deltas);
+			ImGui::Text("Memory: %.1f KB (dense %.1f KB)", blend_geom.blendShapeBytes() / 1024.0f,
+				blend_geom.blend_shapes.size() * blend_geom.num_vertices * 3 * sizeof(float) / 1024.0f);
 
 			ImGui::TreePop();
 		}
@@ -655,7 +634,7 @@ void DebugSystem::updateimGUI_(float dt) {
 				string animName = ECS.getEntityName(anim.owner);
 				if (ImGui::TreeNode(animName.c_str())) {
 					if (ImGui::RadioButton("Start", (bool)true)) {
-						anim.curr_frame = 0;
+						anim.player.time = 0.0f;
 						anim.active = true;
 					}
 					ImGui::SameLine();
@@ -725,6 +704,77 @@ void DebugSystem::updateimGUI_(float dt) {
 			if (ImGui::RadioButton("Volumetric lighting", (bool)true)) {
 				graphics_system_->renderMode = false;
 			}
+			if (ImGui::Button("G-buffer fill rate benchmark")) {
+				graphics_system_->runGbufferBenchmark = true;
+			}
+			ImGui::TreePop();
+		}
+
+		if (governor_ && ImGui::TreeNode("Performance Governor")) {
+			ImGui::Checkbox("Enabled", &governor_->enabled);
+			ImGui::SliderFloat("Budget (ms)", &governor_->budget_ms, 4.0f, 50.0f);
+			ImGui::Text("Average frame: %.2f ms", governor_->getAverageMs());
+			int level = governor_->getLevel();
+			//manual control only when the governor is not driving it
+			if (!governor_->enabled && ImGui::SliderInt("Level", &level, 0, (int)governor_->levels.size() - 1))
+				governor_->setLevel(level);
+			else if (governor_->enabled)
+				ImGui::Text("Level: %d / %d", level, (int)governor_->levels.size() - 1);
+			ImGui::Text("Render scale: %.2f", graphics_system_->getRenderScale());
+			ImGui::Text("Particles: %.0f%%", governor_->levels[level].particle_scale * 100.0f);
+			ImGui::Text("Shadows: %d px, every %d frames", graphics_system_->getShadowResolution(), graphics_system_->getShadowInterval());
+			ImGui::Text("Texture LOD bias: %.1f", graphics_system_->getLodBias());
+			ImGui::Text("Last change: %s", governor_->getLastDecision().c_str());
+			ImGui::TreePop();
+		}
+
+		if (ImGui::TreeNode("Resources")) {
+			//sizes are read back from GL only while this is open
+			ResourceManager& resources = graphics_system_->getResources();
+			resources.updateMemory();
+			const char* type_names[] = { "Textures", "Geometries", "Shaders", "Materials" };
+			std::vector<ResourceInfo> infos;
+			resources.getResources(infos);
+			size_t total = 0;
+			for (int type = 0; type < RESOURCE_TYPE_COUNT; type++)
+				total += resources.totalBytes((ResourceType)type);
+			ImGui::Text("Total: %.2f MB, %d loads shared", total / 1048576.0f, resources.numReused());
+			for (int type = 0; type < RESOURCE_TYPE_COUNT; type++) {
+				char label[64];
+				snprintf(label, sizeof(label), "%s: %d, %.2f MB###%s", type_names[type], resources.count((ResourceType)type),
+					resources.totalBytes((ResourceType)type) / 1048576.0f, type_names[type]);
+				if (ImGui::TreeNode(label)) {
+					ImGui::Columns(3, type_names[type]);
+					ImGui::Text("Key"); ImGui::NextColumn();
+					ImGui::Text("Refs"); ImGui::NextColumn();
+					ImGui::Text("KB"); ImGui::NextColumn();
+					for (auto& info : infos) {
+						if (info.type != type) continue;
+						ImGui::Text("%s", info.key.c_str()); ImGui::NextColumn();
+						ImGui::Text("%d", info.ref_count); ImGui::NextColumn();
+						ImGui::Text("%.1f", info.bytes / 1024.0f); ImGui::NextColumn();
+					}
+					ImGui::Columns(1);
+					ImGui::TreePop();
+				}
+			}
+			ImGui::TreePop();
+		}
+
+		if (animation_system_ && ImGui::TreeNode("Animation LOD")) {
+			AnimationLODSettings& lod = animation_system_->lod_settings;
+			ImGui::Checkbox("Enabled", &lod.enabled);
+			ImGui::SliderFloat("Half rate below", &lod.screen_size[0], 0.0f, 1.0f);
+			ImGui::SliderFloat("Quarter rate below", &lod.screen_size[1], 0.0f, 1.0f);
+			ImGui::SliderFloat("Eighth rate below", &lod.screen_size[2], 0.0f, 1.0f);
+			const char* levels[] = { "Full", "Half", "Quarter", "Eighth", "Frozen" };
+			ImGui::Combo("Off screen", &lod.offscreen_level, levels, IM_ARRAYSIZE(levels));
+			int counts[ANIMATION_LOD_COUNT];
+			animation_system_->getLODCounts(counts);
+			for (int i = 0; i < ANIMATION_LOD_COUNT; i++)
+				ImGui::Text("%s: %d", levels[i], counts[i]);
+			ImGui::Text("Crowd instances drawn: %d in %d calls", graphics_system_->getCrowdInstancesDrawn(),
+				(int)ECS.getAllComponents<SkinnedCrowd>().size());
 			ImGui::TreePop();
 		}
 
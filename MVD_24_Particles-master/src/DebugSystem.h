@@ -3,6 +3,8 @@
 #include "Shader.h"
 #include <vector>
 #include "GraphicsSystem.h"
+#include "QualityGovernor.h"
+#include "AnimationSystem.h"
 
 
 struct TransformNode {
@@ -39,6 +41,8 @@ public:
 	float spot_outer = 10.0;
 
 	void setActive(bool a);
+	void setGovernor(QualityGovernor* qg) { governor_ = qg; }
+	void setAnimationSystem(AnimationSystem* as) { animation_system_ = as; }
 
 	//public imGUI functions
 	bool isShowGUI() { return show_imGUI_; };
@@ -50,6 +54,8 @@ public:
 private:
 	//graphics system pointer
 	GraphicsSystem* graphics_system_;
+	QualityGovernor* governor_ = nullptr;
+	AnimationSystem* animation_system_ = nullptr;
 	
 	//bools to draw or not
     bool active_;
@@ -108,10 +114,6 @@ private:
     std::vector<GLuint> joints_vaos_;
     std::vector<GLuint> joints_chain_counts_;
     void createJointGeometry_();
-    void getJointWorldMatrices_(Joint* current,
-                                lm::mat4 current_model,
-                                std::vector<float>& all_matrices,
-                                int& joint_count);
     Shader* joint_shader_;
 	
 };
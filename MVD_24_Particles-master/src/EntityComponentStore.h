@@ -3,9 +3,35 @@
 #include <vector>
 #include <unordered_map>
 #include <map>
+#include <algorithm>
+#include <type_traits>
 
 using namespace std;
 
+/**** PREFAB ****/
+
+//an entity to stamp out many times (see EntityComponentStore::instantiate):
+//the components each copy starts with, at most one of each type. Every
+//prefab has a transform, which is applied after the instance's own
+struct Prefab {
+    string name; //copies are called name_0, name_1...
+    ComponentArrays components;
+    
+    Prefab(string a_name = "") : name(a_name) { add<Transform>(); }
+    
+    //sets the component copies start with, and returns it to fill in
+    template<typename T>
+    T& add() {
+        vector<T>& the_vec = get<vector<T>>(components);
+        the_vec.assign(1, T());
+        return the_vec[0];
+    }
+    template<typename T>
+    bool has() const { return !get<vector<T>>(components).empty(); }
+    template<typename T>
+    T& getComponent() { return get<vector<T>>(components).at(0); }
+};
+
 /**** ENTITY COMPONENT STORE ****/
 
 //the entity component manager is a global struct that contains an array of
@@ -72,6 +98,33 @@ struct EntityComponentStore {
         return the_vec.back(); // return pointer to new component
     }
     
+    //creates count copies of prefab at once, and returns the id of the first
+    //(the others follow it). Each array grows once, and the copies of each
+    //component sit next to each other in it. Copy i is moved by
+    //transforms[i] when there are transforms. Copies are named after the
+    //prefab plus an instance number, which carries on from one call to the
+    //next for the same name: "floor_0", "floor_1"...
+    int instantiate(const Prefab& prefab, int count, const vector<lm::mat4>& transforms = vector<lm::mat4>()) {
+        if (count <= 0)
+            return -1;
+        int first = (int)entities.size();
+        int& next_instance = prefab_instances_[prefab.name];
+        reserveFor_(entities, count);
+        for (int i = 0; i < count; i++)
+            entities.emplace_back(prefab.name + "_" + to_string(next_instance + i));
+        next_instance += count;
+        copyPrefab_<0>(prefab, first, count);
+        
+        if (!transforms.empty()) {
+            const int transform_type = type2int<Transform>::result;
+            vector<Transform>& all_transforms = get<vector<Transform>>(components);
+            const lm::mat4& local = get<vector<Transform>>(prefab.components)[0];
+            for (int i = 0; i < count && i < (int)transforms.size(); i++)
+                all_transforms[entities[first + i].components[transform_type]].set(transforms[i] * local);
+        }
+        return first;
+    }
+    
     //return reference to component at id in array
     template<typename T>
     T& getComponentInArray(int an_id) {
@@ -132,4 +185,38 @@ struct EntityComponentStore {
     //stores main camera id
     int main_camera = -1;
     
+private:
+    //instances made so far of each prefab name, for unique names
+    std::unordered_map<std::string, int> prefab_instances_;
+
+    //at least doubling, so many small batches still grow geometrically
+    template<typename T>
+    static void reserveFor_(vector<T>& the_vec, int count) {
+        if (the_vec.capacity() < the_vec.size() + count)
+            the_vec.reserve(std::max(the_vec.size() + count, the_vec.capacity() * 2));
+    }
+    
+    //instantiate's copies of each component type the prefab has, one array
+    //of ComponentArrays at a time (their order is type2int's)
+    template<size_t I>
+    typename std::enable_if<(I == std::tuple_size<ComponentArrays>::value)>::type
+    copyPrefab_(const Prefab&, int, int) {}
+    
+    template<size_t I>
+    typename std::enable_if<(I < std::tuple_size<ComponentArrays>::value)>::type
+    copyPrefab_(const Prefab& prefab, int first_entity, int count) {
+        const auto& source = get<I>(prefab.components);
+        if (!source.empty()) {
+            auto& the_vec = get<I>(components);
+            int first = (int)the_vec.size();
+            reserveFor_(the_vec, count);
+            the_vec.insert(the_vec.end(), (size_t)count, source[0]);
+            for (int i = 0; i < count; i++) {
+                the_vec[first + i].owner = first_entity + i;
+                entities[first_entity + i].components[I] = first + i;
+            }
+        }
+        copyPrefab_<I + 1>(prefab, first_entity, count);
+    }
+    
 };
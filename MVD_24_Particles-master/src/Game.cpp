@@ -12,6 +12,7 @@
 #include "SpawnControllerScript.h"
 #include "NavmeshScript.h"
 #include "MoveScript.h"
+#include <chrono>
 
 
 Game::Game() {
@@ -22,29 +23,46 @@ Game::Game() {
 void Game::init(int w, int h) {
 
 	window_width_ = w; window_height_ = h;
+	auto init_start = std::chrono::high_resolution_clock::now();
 	//******* INIT SYSTEMS *******
 
+	//worker threads first, systems may split work across them
+	job_system_.init();
+	Parsers::setJobSystem(&job_system_);
+
+	//cooked assets, if there are any (see AssetCooker.h), are read from the
+	//pack before loose files
+	if (pack_.open("data/assets.pack")) {
+		AssetPack::mount(&pack_);
+		std::cout << "Mounted data/assets.pack, " << pack_.numEntries() << " files" << std::endl;
+	}
+
 	//init systems except debug, which needs info about scene
 	control_system_.init();
 	graphics_system_.init(window_width_, window_height_, "data/assets/");
+	graphics_system_.setProfiler(&profiler_);
+	//textures bind as placeholders until their levels stream in
+	graphics_system_.getTextureStreamer().init();
+	Parsers::setTextureStreamer(&graphics_system_.getTextureStreamer());
+	Parsers::setResourceManager(&graphics_system_.getResources());
 	debug_system_.init(&graphics_system_);
     script_system_.init(&control_system_);
 	gui_system_.init(window_width_, window_height_);
-    animation_system_.init();
+    animation_system_.init(&job_system_, &graphics_system_);
 	particle_system_.init();
     
     graphics_system_.screen_background_color = lm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
     createFreeCamera_(13.614, 16, 32, -0.466, -0.67, -0.579);
 
 	/******** SHADERS **********/
-	Shader* blend_shader = graphics_system_.loadShader("data/shaders/phong_blend.vert", "data/shaders/phong.frag");
-	Shader* cubemap_shader = graphics_system_.loadShader("data/shaders/cubemap.vert", "data/shaders/cubemap.frag");
-	Shader* terrain_shader = graphics_system_.loadShader("data/shaders/phong.vert", "data/shaders/terrain.frag");
-	Shader* blend2_shader = graphics_system_.loadShader("data/shaders/phong_blend.vert", "data/shaders/phong.frag");
-	Shader* phong_shader = graphics_system_.loadShader("data/shaders/phong.vert", "data/shaders/phong.frag");
-	Shader* animation_shader = graphics_system_.loadShader("data/shaders/phong_anim.vert", "data/shaders/phong.frag");
-	Shader* tileset_shader = graphics_system_.loadShader("data/shaders/tileset.vert", "data/shaders/tileset.frag");
-	Shader* reflection_shader = graphics_system_.loadShader("data/shaders/reflection.vert", "data/shaders/reflection.frag");
+	Shader* blend_shader = loadShader_("data/shaders/phong_blend.vert", "data/shaders/phong.frag");
+	Shader* cubemap_shader = loadShader_("data/shaders/cubemap.vert", "data/shaders/cubemap.frag");
+	Shader* terrain_shader = loadShader_("data/shaders/phong.vert", "data/shaders/terrain.frag");
+	Shader* blend2_shader = loadShader_("data/shaders/phong_blend.vert", "data/shaders/phong.frag");
+	Shader* phong_shader = loadShader_("data/shaders/phong.vert", "data/shaders/phong.frag");
+	Shader* animation_shader = loadShader_("data/shaders/phong_anim.vert", "data/shaders/phong.frag");
+	Shader* tileset_shader = loadShader_("data/shaders/tileset.vert", "data/shaders/tileset.frag");
+	Shader* reflection_shader = loadShader_("data/shaders/reflection.vert", "data/shaders/reflection.frag");
 
 	
 	createBlendShape(blend2_shader);
@@ -56,10 +74,10 @@ void Game::init(int w, int h) {
 	ECS.getComponentFromEntity<Transform>(floor_entity).translate(0.0f, -0.02f, 0.0f);
 	ECS.getComponentFromEntity<Transform>(floor_entity).scale(0.25, 1.0, 0.25);
 	Mesh& floor_mesh = ECS.createComponentForEntity<Mesh>(floor_entity);
-	floor_mesh.geometry = graphics_system_.createGeometryFromFile("data/assets/floor_40x40.obj");
+	floor_mesh.geometry = loadGeometry_("data/assets/floor_40x40.obj");
 	floor_mesh.material = graphics_system_.createMaterial();
 	graphics_system_.getMaterial(floor_mesh.material).shader_id = phong_shader->program;
-	graphics_system_.getMaterial(floor_mesh.material).diffuse_map = Parsers::parseTexture("data/assets/block_blue.tga");
+	graphics_system_.getMaterial(floor_mesh.material).diffuse_map = loadTexture_("data/assets/block_blue.tga");
 	
 	createAIexample(phong_shader);
 	addSimpleAnimation(phong_shader);
@@ -98,8 +116,25 @@ void Game::init(int w, int h) {
     animation_system_.lateInit();
     debug_system_.lateInit();
 
+	//quality ladder needs shadow maps and textures to exist
+	governor_.init(&graphics_system_, &particle_system_);
+	debug_system_.setGovernor(&governor_);
+	debug_system_.setAnimationSystem(&animation_system_);
+
 	debug_system_.setActive(true);
 
+	//the scene as it starts, restored by restart()
+	snapshot_.init(&graphics_system_, &animation_system_);
+	snapshot_.capture(start_snapshot_);
+
+	//startup is cold when meshes were imported from text, warm when all came from the cache
+	std::chrono::duration<double, std::milli> init_time = std::chrono::high_resolution_clock::now() - init_start;
+	MeshCache& mesh_cache = graphics_system_.getMeshCache();
+	std::cout << "Startup (" << (mesh_cache.misses ? "cold" : "warm") << "): " << init_time.count() << " ms" << std::endl;
+	mesh_cache.printStats();
+	graphics_system_.getShaderCache().printStats();
+	printf("Materials: %d, %d distinct parameter blocks\n", (int)graphics_system_.getMaterials().size(), graphics_system_.numMaterialBlocks());
+	printf("Scene snapshot: %.2f MB captured in %.2f ms\n", start_snapshot_.size() / 1048576.0, snapshot_.last_ms);
 }
 
 //update each system in turn
@@ -107,33 +142,97 @@ void Game::update(float dt) {
 
 	if (ECS.getAllComponents<Camera>().size() == 0) {print("There is no camera set!"); return;}
 
+	//adjust quality from recent frame times before anything is drawn
+	governor_.update();
+
 	//update input
+	profiler_.beginCPU("control");
 	control_system_.update(dt);
+	profiler_.endCPU("control");
 
 	//collision
+	profiler_.beginCPU("collision");
 	collision_system_.update(dt);
+	profiler_.endCPU("collision");
 
     //animation
+	profiler_.beginCPU("animation");
     animation_system_.update(dt);
+	profiler_.endCPU("animation");
     
 	//scripts
+	profiler_.beginCPU("scripts");
 	script_system_.update(dt);
+	profiler_.endCPU("scripts");
+
+	//sectors in and out of range of the camera, before anything is drawn
+	profiler_.beginCPU("streaming");
+	sector_streamer_.update(dt);
+	profiler_.endCPU("streaming");
 
 	//render
+	profiler_.beginCPU("graphics");
 	graphics_system_.update(dt);
+	profiler_.endCPU("graphics");
     
 	if (graphics_system_.particlesOn) {
 		//particles
-		particle_system_.update();
+		profiler_.beginCPU("particles");
+		profiler_.beginGPU("particles");
+		particle_system_.update(dt);
+		profiler_.endGPU("particles");
+		profiler_.endCPU("particles");
 	}
     
 	//gui
+	profiler_.beginCPU("gui");
 	gui_system_.update(dt);
+	profiler_.endCPU("gui");
 
 	//debug
+	profiler_.beginCPU("debug");
 	debug_system_.update(dt);
+	profiler_.endCPU("debug");
    
 }
+
+//snapshots never hold loaded sectors: their resources belong to the
+//streamer, which unloads them first and opens the world again after. Its
+//pooled entities are saved inactive, and taken from the restored ECS when
+//the ECS is replaced
+bool Game::withoutStreaming_(bool replaces_ecs, const std::function<bool()>& action) {
+	std::string world = sector_streamer_.world();
+	if (!world.empty())
+		sector_streamer_.close();
+	bool ok = action();
+	if (ok && replaces_ecs)
+		sector_streamer_.adoptEntities();
+	if (!world.empty())
+		sector_streamer_.open(world, &graphics_system_);
+	return ok;
+}
+
+bool Game::restart() {
+	return withoutStreaming_(true, [this]() { return snapshot_.restore(start_snapshot_.data(), start_snapshot_.size()); });
+}
+
+bool Game::saveSnapshot(std::string filename) {
+	return withoutStreaming_(false, [this, &filename]() { return snapshot_.save(filename); });
+}
+
+bool Game::loadSnapshot(std::string filename) {
+	return withoutStreaming_(true, [this, &filename]() { return snapshot_.load(filename); });
+}
+
+//loads a camera path and hands the main camera over to it
+bool Game::playCameraPath(std::string filename) {
+	CameraPath path;
+	if (!Parsers::parseCameraPath(filename, path))
+		return false;
+	control_system_.playCameraPath(path);
+	return true;
+}
+
 //update game viewports
 void Game::update_viewports(int window_width, int window_height) {
 	window_width_ = window_width;
@@ -147,6 +246,22 @@ void Game::update_viewports(int window_width, int window_height) {
 	graphics_system_.updateMainViewport(window_width_, window_height_);
 }
 
+//the scene's files are loaded once and kept for the life of the game
+GLint Game::loadTexture_(const std::string& filename) {
+	ResourceManager& resources = graphics_system_.getResources();
+	return resources.texture(resources.loadTexture(filename));
+}
+
+int Game::loadGeometry_(const std::string& filename, bool material_sets) {
+	ResourceManager& resources = graphics_system_.getResources();
+	return resources.geometry(resources.loadGeometry(filename, material_sets));
+}
+
+Shader* Game::loadShader_(const std::string& vertex, const std::string& fragment) {
+	ResourceManager& resources = graphics_system_.getResources();
+	return resources.shader(resources.loadShader(vertex, fragment));
+}
+
 Material& Game::createMaterial(GLuint shader_program) {
     int mat_index = graphics_system_.createMaterial();
     Material& ref_mat = graphics_system_.getMaterial(mat_index);
@@ -157,14 +272,15 @@ Material& Game::createMaterial(GLuint shader_program) {
 void Game::createSkybox(Shader* cubemap_shader){
 	
 	//environment
-	int cubemap_geom = graphics_system_.createGeometryFromFile("data/assets/cubemap.obj");
+	int cubemap_geom = loadGeometry_("data/assets/cubemap.obj");
 	
 	std::vector<std::string> daily_cube{
 		"data/assets/skybox/right.tga","data/assets/skybox/left.tga",
 		"data/assets/skybox/top.tga","data/assets/skybox/bottom.tga",
 		"data/assets/skybox/front.tga", "data/assets/skybox/back.tga" };
 	
-	graphics_system_.setEnvironment(Parsers::parseCubemap(daily_cube),
+	ResourceManager& resources = graphics_system_.getResources();
+	graphics_system_.setEnvironment(resources.texture(resources.loadCubemap(daily_cube)),
 		cubemap_geom, cubemap_shader->program);
 
 }
@@ -182,9 +298,9 @@ void Game::createTerrain(Shader* terrain_shader) {
 	mat_terrain.name = "terrain";
 	mat_terrain.shader_id = terrain_shader->program;
 	mat_terrain.specular = lm::vec3(0, 0, 0);
-	mat_terrain.diffuse_map = Parsers::parseTexture("data/assets/terrain/grass01.tga");
-	mat_terrain.diffuse_map_2 = Parsers::parseTexture("data/assets/terrain/cliffs.tga");
-	mat_terrain.normal_map = Parsers::parseTexture("data/assets/terrain/grass01_n.tga");
+	mat_terrain.diffuse_map = loadTexture_("data/assets/terrain/grass01.tga");
+	mat_terrain.diffuse_map_2 = loadTexture_("data/assets/terrain/cliffs.tga");
+	mat_terrain.normal_map = loadTexture_("data/assets/terrain/grass01_n.tga");
 	//read texture, pass optional variables to get pointer to pixel data
 	mat_terrain.noise_map = Parsers::parseTexture("data/assets/terrain/heightmap1.tga",
 		&noise_image_data,
@@ -223,9 +339,9 @@ void Game::createBlendShape(Shader* blend_shader) {
 	mat_toon.name = "toon";
 	mat_toon.shader_id = blend_shader->program;
 	mat_toon.specular = lm::vec3(1, 1, 1);
-	mat_toon.diffuse_map = Parsers::parseTexture("data/assets/toon/toon_base_Body_Diffuse.tga");
-	mat_toon.transparency_map = Parsers::parseTexture("data/assets/toon/toon_base_Body_Opacity.tga");
-	mat_toon.normal_map = Parsers::parseTexture("data/assets/toon/toon_base_Body_Normal.tga");
+	mat_toon.diffuse_map = loadTexture_("data/assets/toon/toon_base_Body_Diffuse.tga");
+	mat_toon.transparency_map = loadTexture_("data/assets/toon/toon_base_Body_Opacity.tga");
+	mat_toon.normal_map = loadTexture_("data/assets/toon/toon_base_Body_Normal.tga");
 
 	int toon_ent = ECS.createEntity("toon");
 	Mesh& toon_mesh = ECS.createComponentForEntity<Mesh>(toon_ent);
@@ -268,7 +384,7 @@ void Game::addSimpleAnimation(Shader* phong_shader){
 
 	int ball_ent = ECS.createEntity("ball");
 	Mesh& ball_mesh = ECS.createComponentForEntity<Mesh>(ball_ent);
-	ball_mesh.geometry = graphics_system_.createGeometryFromFile("data/assets/ball.obj");
+	ball_mesh.geometry = loadGeometry_("data/assets/ball.obj");
 	ball_mesh.material = graphics_system_.createMaterial();
 	graphics_system_.getMaterial(ball_mesh.material).shader_id = phong_shader->program;
 
@@ -287,13 +403,13 @@ void Game::createMaterialSetExample(Shader* phong_shader){
 	//whole bunch of materials!
 	Parsers::parseMTL("data/assets/nanosuit/", "nanosuit.mtl", graphics_system_.getMaterials(), phong_shader->program);
 
-	int suit_geom = graphics_system_.createMultiGeometryFromFile("data/assets/nanosuit/nanosuit.obj");
+	int suit_geom = loadGeometry_("data/assets/nanosuit/nanosuit.obj", true);
 	
 	//basic blue material
 	int mat_blue_check_index = graphics_system_.createMaterial();
 	Material& mat_blue_check = graphics_system_.getMaterial(mat_blue_check_index);
 	mat_blue_check.shader_id = phong_shader->program;
-	mat_blue_check.diffuse_map = Parsers::parseTexture("data/assets/block_blue.tga");
+	mat_blue_check.diffuse_map = loadTexture_("data/assets/block_blue.tga");
 	mat_blue_check.specular = lm::vec3(0, 0, 0);
 
 	//suit 
@@ -312,13 +428,13 @@ void Game::createMaterialSetExample(Shader* phong_shader){
 void Game::createAIexample(Shader * shader){
 
 	//geometries
-	int floor_geom_id = graphics_system_.createGeometryFromFile("data/assets/floor_5x5.obj");
-	int teapot_geom_id = graphics_system_.createGeometryFromFile("data/assets/teapot_small.obj");
+	int floor_geom_id = loadGeometry_("data/assets/floor_5x5.obj");
+	int teapot_geom_id = loadGeometry_("data/assets/teapot_small.obj");
 
 	//materials and textures
 	int red_mat_id = graphics_system_.createMaterial();
 	graphics_system_.getMaterial(red_mat_id).name = "red_mat_id";
-	graphics_system_.getMaterial(red_mat_id).diffuse_map = Parsers::parseTexture("data/assets/red.tga");;
+	graphics_system_.getMaterial(red_mat_id).diffuse_map = loadTexture_("data/assets/red.tga");;
 	graphics_system_.getMaterial(red_mat_id).shader_id = shader->program;
 	graphics_system_.getMaterial(red_mat_id).specular = lm::vec3(0, 0, 0);
 
@@ -326,7 +442,7 @@ void Game::createAIexample(Shader * shader){
 
 	int green_mat_id = graphics_system_.createMaterial();
 	graphics_system_.getMaterial(green_mat_id).name = "green_mat_id";
-	graphics_system_.getMaterial(green_mat_id).diffuse_map = Parsers::parseTexture("data/assets/green.tga");;
+	graphics_system_.getMaterial(green_mat_id).diffuse_map = loadTexture_("data/assets/green.tga");;
 	graphics_system_.getMaterial(green_mat_id).shader_id = shader->program;
 	graphics_system_.getMaterial(green_mat_id).specular = lm::vec3(0, 0, 0);
 
@@ -334,7 +450,7 @@ void Game::createAIexample(Shader * shader){
 
 	int white_mat_id = graphics_system_.createMaterial();
 	graphics_system_.getMaterial(white_mat_id).name = "white_mat_id";
-	graphics_system_.getMaterial(white_mat_id).diffuse_map = Parsers::parseTexture("data/assets/white.tga");;
+	graphics_system_.getMaterial(white_mat_id).diffuse_map = loadTexture_("data/assets/white.tga");;
 	graphics_system_.getMaterial(white_mat_id).shader_id = shader->program;
 	graphics_system_.getMaterial(white_mat_id).specular = lm::vec3(0, 0, 0);
 
@@ -342,7 +458,7 @@ void Game::createAIexample(Shader * shader){
 
 	int purple_mat_id = graphics_system_.createMaterial();
 	graphics_system_.getMaterial(purple_mat_id).name = "purple_mat_id";
-	graphics_system_.getMaterial(purple_mat_id).diffuse_map = Parsers::parseTexture("data/assets/block_purple.tga");;
+	graphics_system_.getMaterial(purple_mat_id).diffuse_map = loadTexture_("data/assets/block_purple.tga");;
 	graphics_system_.getMaterial(purple_mat_id).shader_id = shader->program;
 	graphics_system_.getMaterial(purple_mat_id).specular = lm::vec3(0, 0, 0);
 
@@ -350,7 +466,7 @@ void Game::createAIexample(Shader * shader){
 
 	int black_mat_id = graphics_system_.createMaterial();
 	graphics_system_.getMaterial(black_mat_id).name = "black_mat_id";
-	graphics_system_.getMaterial(black_mat_id).diffuse_map = Parsers::parseTexture("data/assets/block_teal.tga");;
+	graphics_system_.getMaterial(black_mat_id).diffuse_map = loadTexture_("data/assets/block_teal.tga");;
 	graphics_system_.getMaterial(black_mat_id).shader_id = shader->program;
 	graphics_system_.getMaterial(black_mat_id).specular = lm::vec3(0, 0, 0);
 
@@ -358,20 +474,21 @@ void Game::createAIexample(Shader * shader){
 
 	//******* CREATE ENTITIES AND ADD COMPONENTS *******//
 
-	//generates floor tiles 
+	//generates floor tiles floor_0 to floor_95, from one prefab
+	Prefab tile("floor");
+	tile.getComponent<Transform>().scaleLocal(0.5, 0.5, 0.5);
+	Mesh& tile_mesh = tile.add<Mesh>();
+	tile_mesh.geometry = floor_geom_id;
+	tile_mesh.material = black_mat_id;
+	std::vector<lm::mat4> tile_transforms;
 	for (int i = 0; i < 12; i++) {
 		for (int j = 0; j < 8; j++) {
-			int tag = (i * 8) + j;
-			int num = ECS.createEntity("floor_" + to_string(tag));
-			Transform& trans = ECS.createComponentForEntity<Transform>(num);
+			lm::mat4 trans;
 			trans.translate(lm::vec3(15.0 - i * 2.5, 0.0, - 10 - j * 2.5));
-			trans.scaleLocal(0.5, 0.5, 0.5);
-			Mesh& mesh = ECS.createComponentForEntity<Mesh>(num);
-			mesh.geometry = floor_geom_id;
-			mesh.material = black_mat_id;
-			cout << mesh.geometry << " " << mesh.material << endl;
+			tile_transforms.push_back(trans);
 		}
 	}
+	ECS.instantiate(tile, (int)tile_transforms.size(), tile_transforms);
 
 	//generates character to go throw grid
 	int teapot = ECS.createEntity("teapot");
@@ -408,6 +525,72 @@ void Game::createAIexample(Shader * shader){
 
 }
 
+//stress scene: copies every loaded skinned mesh count times. Copies share
+//geometry, skeleton and clip, and start at different times in the clip
+int Game::createAnimationCrowd(int count) {
+	std::vector<SkinnedMesh> sources = ECS.getAllComponents<SkinnedMesh>();
+	int created = 0;
+	for (auto& source : sources) {
+		if (!source.root) continue;
+		for (int i = 0; i < count; i++) {
+			int ent = ECS.createEntity(ECS.getEntityName(source.owner) + "_" + std::to_string(i));
+			SkinnedMesh& sm = ECS.createComponentForEntity<SkinnedMesh>(ent);
+			int owner = sm.owner, index = sm.index;
+			sm = source;
+			sm.owner = owner; sm.index = index;
+			sm.palette_ubo = 0; //each copy uploads its own palette
+			sm.player.time = (i * 0.137f) - (int)(i * 0.137f);
+			created++;
+		}
+	}
+	return created;
+}
+
+//instanced crowd: count copies of every loaded skinned mesh on a grid next
+//to it, each mesh drawn with one call from its baked clip
+int Game::createSkinnedCrowd(int count) {
+	int created = 0;
+	size_t num_sources = ECS.getAllComponents<SkinnedMesh>().size();
+	for (size_t s = 0; s < num_sources; s++) {
+		//creating entities below may move the component arrays
+		const SkinnedMesh& source = ECS.getAllComponents<SkinnedMesh>()[s];
+		if (!source.root) continue;
+		int baked = animation_system_.bakeClip(source);
+		if (baked < 0) continue;
+		const BakedClip& clip = animation_system_.getBakedClip(baked);
+		std::string name = ECS.getEntityName(source.owner) + "_crowd";
+		lm::mat4 source_matrix = ECS.getComponentFromEntity<Transform>(source.owner).getGlobalMatrix(ECS.getAllComponents<Transform>());
+		const AABB& aabb = graphics_system_.getGeometry(source.geometry).aabb;
+		int geometry = source.geometry, material = source.material;
+
+		int ent = ECS.createEntity(name);
+		ECS.getComponentFromEntity<Transform>(ent).set(source_matrix);
+		SkinnedCrowd& crowd = ECS.createComponentForEntity<SkinnedCrowd>(ent);
+		crowd.geometry = geometry;
+		crowd.material = material;
+		crowd.clip_first_row = clip.first_row;
+		crowd.clip_num_frames = clip.num_frames;
+		crowd.clip_frame_time = clip.frame_time;
+		crowd.has_clip_bounds = clip.has_bounds;
+		crowd.clip_bounds_min = clip.bounds_min;
+		crowd.clip_bounds_max = clip.bounds_max;
+
+		//grid in the mesh's own units, one bounding box apart
+		int side = (int)ceil(sqrt((float)count));
+		float spacing_x = aabb.half_width.x * 3.0f, spacing_z = aabb.half_width.z * 3.0f;
+		float duration = clip.num_frames * clip.frame_time;
+		for (int i = 0; i < count; i++) {
+			lm::mat4 transform;
+			transform.translate(((i % side) + 1) * spacing_x, 0.0f, (i / side) * spacing_z);
+			float phase = (i * 0.137f) - (int)(i * 0.137f);
+			crowd.addInstance(transform, phase * duration, 0.8f + 0.4f * phase);
+		}
+		created += count;
+	}
+	graphics_system_.setAnimationTexture(animation_system_.getBakedTexels(), BAKED_TEXTURE_WIDTH, animation_system_.getBakedRows());
+	return created;
+}
+
 int Game::createFreeCamera_(float px, float py, float pz, float fx, float fy, float fz) {
 	int ent_player = ECS.createEntity("PlayerFree");
 	Camera& player_cam = ECS.createComponentForEntity<Camera>(ent_player);
@@ -14,6 +14,13 @@
 #include "GUISystem.h"
 #include "AnimationSystem.h"
 #include "ParticleSystem.h"
+#include "Profiler.h"
+#include "QualityGovernor.h"
+#include "JobSystem.h"
+#include "AssetPack.h"
+#include "SectorStreamer.h"
+#include "SceneSnapshot.h"
+#include <functional>
 //#include "ParticleEmitter.h"
 
 
@@ -37,6 +44,11 @@ public:
 		if (key == GLFW_KEY_0 && action == GLFW_PRESS && mods == GLFW_MOD_ALT)
 			debug_system_.toggleimGUI();
 
+		//F5 restarts the scene, F6 and F7 save and load a quick snapshot
+		if (key == GLFW_KEY_F5 && action == GLFW_PRESS) restart();
+		if (key == GLFW_KEY_F6 && action == GLFW_PRESS) saveSnapshot("data/cache/quick.snapshot");
+		if (key == GLFW_KEY_F7 && action == GLFW_PRESS) loadSnapshot("data/cache/quick.snapshot");
+
 		if (!debug_system_.isShowGUI())
 			control_system_.key_mouse_callback(key, action, mods);
 	}
@@ -50,8 +62,31 @@ public:
 	}
 	void update_viewports(int window_width, int window_height);
 
+	//benchmarking
+	bool playCameraPath(std::string filename);
+	bool isCameraPathFinished() { return control_system_.isCameraPathFinished(); }
+	//scene state as it was after init, or as saved (see SceneSnapshot.h)
+	bool restart();
+	bool saveSnapshot(std::string filename);
+	bool loadSnapshot(std::string filename);
+	//streams the sectors cooked from level around the camera (see SectorStreamer.h)
+	bool loadWorld(std::string level) { return sector_streamer_.open(level, &graphics_system_); }
+	FrameProfiler& getProfiler() { return profiler_; }
+	//blocks until every streamed texture is resident
+	void finishLoading() { graphics_system_.getTextureStreamer().finish(); }
+	QualityGovernor& getGovernor() { return governor_; }
+	void benchmarkAnimation(int iterations) { animation_system_.benchmarkClips(iterations); }
+	void benchmarkPoses(int frames) { animation_system_.benchmarkPoses(frames); }
+	int createAnimationCrowd(int count);
+	int createSkinnedCrowd(int count);
+
 private:
+	FrameProfiler profiler_;
+	QualityGovernor governor_;
+	AssetPack pack_; //outlives the systems reading from it
+	JobSystem job_system_;
 	GraphicsSystem graphics_system_;
+	SectorStreamer sector_streamer_; //its worker reads through graphics_system_
 	ControlSystem control_system_;
     DebugSystem debug_system_;
     CollisionSystem collision_system_;
@@ -59,6 +94,9 @@ private:
 	GUISystem gui_system_;
     AnimationSystem animation_system_;
     ParticleSystem particle_system_;
+	SceneSnapshot snapshot_;
+	std::vector<char> start_snapshot_; //for restart()
+	bool withoutStreaming_(bool replaces_ecs, const std::function<bool()>& action);
     
     //particles
     ParticleEmitter* particle_emitter_;
@@ -66,6 +104,9 @@ private:
 	int createFreeCamera_(float, float, float, float, float, float);
 	int createPlayer_(float aspect, ControlSystem& sys);
     Material& createMaterial(GLuint shader_program);
+	GLint loadTexture_(const std::string& filename);
+	int loadGeometry_(const std::string& filename, bool material_sets = false);
+	Shader* loadShader_(const std::string& vertex, const std::string& fragment);
 	void createSkybox(Shader* shader);
 	void createTerrain(Shader* shader);
 	void createBlendShape(Shader* shader);
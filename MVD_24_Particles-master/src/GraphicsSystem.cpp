@@ -3,11 +3,16 @@
 //
 #include "GraphicsSystem.h"
 #include "Parsers.h"
+#include "AssetPack.h"
 #include "extern.h"
 #include <algorithm>
+#include <chrono>
+#include <cstring>
 
 //destructor
 GraphicsSystem::~GraphicsSystem() {
+	texture_streamer_.shutdown();
+	Shader::setCache(nullptr);
 	//delete shader pointers
 	for (auto shader_pair : shaders_) {
 		if (shader_pair.second)
@@ -20,6 +25,7 @@ void GraphicsSystem::init(int window_width, int window_height, std::string asset
 
 	screen_background_color = lm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
     updateMainViewport(window_width, window_height);
+    resources_.init(this);
     
     //enable culling and depth test
     glEnable(GL_DEPTH_TEST);
@@ -39,6 +45,19 @@ void GraphicsSystem::init(int window_width, int window_height, std::string asset
 	//generate light ubo
 	glGenBuffers(1, &light_ubo_);
 
+	//and the material ubo, blocks are bound by range so start on the alignment
+	glGenBuffers(1, &material_ubo_);
+	GLint alignment = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	material_stride_ = ((sizeof(MaterialBlock) + alignment - 1) / alignment) * alignment;
+
+	//imported meshes are kept in binary beside the assets
+	mesh_cache_.init("data/cache/");
+	//and linked programs, shaders compile on the driver's threads when it can
+	shader_cache_.init("data/cache/");
+	Shader::setCache(&shader_cache_);
+	Shader::initCompiler();
+
 
 	//screen space geometry
 	Geometry ss_geom;
@@ -50,6 +69,11 @@ void GraphicsSystem::init(int window_width, int window_height, std::string asset
     
     cone_volume_geom_ = createGeometryFromFile("data/assets/cone.obj");
 
+    //light volumes read their light id per instance (location 5)
+    geometries_[screen_space_geom_].addInstanceIdBuffer(5, MAX_LIGHTS);
+    geometries_[sphere_volume_geom_].addInstanceIdBuffer(5, MAX_LIGHTS);
+    geometries_[cone_volume_geom_].addInstanceIdBuffer(5, MAX_LIGHTS);
+
     //screen space texture shader
     screen_space_shader_ = new Shader("data/shaders/screen.vert", "data/shaders/screen.frag");
     
@@ -58,12 +82,20 @@ void GraphicsSystem::init(int window_width, int window_height, std::string asset
 
 	//shadow map shader
 	depth_shader_ = new Shader("data/shaders/depth.vert", "data/shaders/depth.frag");
+	depth_skinned_shader_ = new Shader("data/shaders/depth_skinned.vert", "data/shaders/depth.frag");
+
+	//instanced skinning from baked animation
+	crowd_shader_ = new Shader("data/shaders/phong_anim_instanced.vert", "data/shaders/phong.frag");
+	crowd_depth_shader_ = new Shader("data/shaders/phong_anim_instanced.vert", "data/shaders/depth.frag");
 
     //gbuffer stuff
     gbuffer_shader_ = new Shader("data/shaders/gbuffer.vert", "data/shaders/gbuffer.frag");
     deferred_shader_ = new Shader("data/shaders/deferred.vert", "data/shaders/deferred.frag");
     deferred_volume_shader_ = new Shader("data/shaders/deferred_volume.vert", "data/shaders/deferred_volume.frag");
     gbuffer_.initGbuffer(window_width, window_height);
+
+    //low resolution scene target, same size as gbuffer
+    frame_.initColor(window_width, window_height);
 	
 }
 
@@ -71,43 +103,135 @@ void GraphicsSystem::init(int window_width, int window_height, std::string asset
 void GraphicsSystem::lateInit() {
 	// sort meshes initially
     sortMeshes_();
+    updateMaterialBuffer_();
 
 	//create shadow buffers depending on number of lights
-	for (size_t i = 0; i < ECS.getAllComponents<Light>().size(); i++) {
-		shadow_frame_[i].initDepth(2048, 2048);
+	initShadowFrames_();
+
+	//apply current bias to textures loaded with the scene
+	setLodBias(lod_bias_);
+}
+
+//(re)creates one shadow map per light at shadow_resolution_
+void GraphicsSystem::initShadowFrames_() {
+	for (int i = 0; i < num_shadow_frames_; i++) {
+		glDeleteTextures(1, &(shadow_frame_[i].color_textures[0]));
+		glDeleteFramebuffers(1, &(shadow_frame_[i].framebuffer));
+	}
+	num_shadow_frames_ = (int)std::min(ECS.getAllComponents<Light>().size(), (size_t)MAX_LIGHTS);
+	for (int i = 0; i < num_shadow_frames_; i++) {
+		shadow_frame_[i].initDepth(shadow_resolution_, shadow_resolution_);
+	}
+	//new maps are empty, so render them next frame
+	shadow_frame_counter_ = 0;
+}
+
+void GraphicsSystem::setRenderScale(float scale) {
+	render_scale_ = std::max(0.25f, std::min(scale, 1.0f));
+}
+
+void GraphicsSystem::setShadowQuality(int resolution, int update_interval) {
+	shadow_interval_ = std::max(1, update_interval);
+	if (resolution == shadow_resolution_)
+		return;
+	shadow_resolution_ = resolution;
+	//before lateInit there are no shadow maps to resize yet
+	if (num_shadow_frames_ > 0)
+		initShadowFrames_();
+}
+
+void GraphicsSystem::setLodBias(float bias) {
+	lod_bias_ = bias;
+	for (auto& mat : materials_) {
+		int maps[] = { mat.diffuse_map, mat.diffuse_map_2, mat.diffuse_map_3, mat.normal_map,
+			mat.specular_map, mat.transparency_map, mat.noise_map };
+		for (int tex : maps) {
+			if (tex < 0) continue;
+			glBindTexture(GL_TEXTURE_2D, tex);
+			glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_LOD_BIAS, lod_bias_);
+		}
 	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
 
+//upscales the low resolution scene to the screen, depth too so later passes
+//(particles, debug) can still depth test against the scene
+void GraphicsSystem::resolveSceneToScreen_() {
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, frame_.framebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, render_width_, render_height_, 0, 0, viewport_width_, viewport_height_, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	glBlitFramebuffer(0, 0, render_width_, render_height_, 0, 0, viewport_width_, viewport_height_, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, viewport_width_, viewport_height_);
 }
 
 void GraphicsSystem::update(float dt) {
     
+	//textures decoded since last frame, within the upload budget
+	texture_streamer_.update();
+	//programs the driver has finished linking
+	Shader::pollPending();
+	//materials created or edited since last frame
+	updateMaterialBuffer_();
+
+	if (runGbufferBenchmark) {
+		benchmarkGbufferFillRate_(200);
+		runGbufferBenchmark = false;
+	}
+
 	updateAllCameras_();
 
 	if (needUpdateLights)
 		updateLights_();
+
+	//joint palettes, shared by shadow and forward passes
+	uploadSkinPalettes_();
+
+	//size of the scene viewport this frame
+	render_width_ = std::max(1, (int)(viewport_width_ * render_scale_));
+	render_height_ = std::max(1, (int)(viewport_height_ * render_scale_));
     
 	/* SHADOW PASS FOR ALL LIGHTS */
-	glCullFace(GL_FRONT);
-	useShader(depth_shader_);
-	const auto& lights = ECS.getAllComponents<Light>();
-	for (size_t i = 0; i < lights.size(); i++) {
-		shadow_frame_[i].bindAndClear();
-		auto& mesh_components = ECS.getAllComponents<Mesh>();
-		for (auto &curr_comp : mesh_components) {
-			renderDepth_(curr_comp, lights[i]);
+	//maps are kept between frames, so they can be refreshed less often
+	if (shadow_frame_counter_++ % shadow_interval_ == 0) {
+		beginPass_("shadows");
+		glEnable(GL_DEPTH_TEST);
+		glCullFace(GL_FRONT);
+		const auto& lights = ECS.getAllComponents<Light>();
+		for (int i = 0; i < (int)lights.size() && i < num_shadow_frames_; i++) {
+			shadow_frame_[i].bindAndClear();
+			useShader(depth_shader_);
+			auto& mesh_components = ECS.getAllComponents<Mesh>();
+			for (auto &curr_comp : mesh_components) {
+				if (!ECS.entities[curr_comp.owner].active)
+					continue;
+				renderDepth_(curr_comp, lights[i]);
+			}
+			useShader(depth_skinned_shader_);
+			for (auto &curr_comp : ECS.getAllComponents<SkinnedMesh>()) {
+				renderSkinnedDepth_(curr_comp, lights[i]);
+			}
+			useShader(crowd_depth_shader_);
+			for (auto &crowd : ECS.getAllComponents<SkinnedCrowd>()) {
+				renderCrowd_(crowd, crowd_depth_shader_, lights[i].view_projection);
+			}
 		}
+		glCullFace(GL_BACK);
+		endPass_("shadows");
 	}
-	glCullFace(GL_BACK);
 
     /* GBUFFER PASS */
+    beginPass_("gbuffer");
     gbuffer_.bindAndClear(screen_background_color);
+    glViewport(0, 0, render_width_, render_height_);
     useShader(gbuffer_shader_);
     for (auto &mesh : ECS.getAllComponents<Mesh>()) {
-        if (mesh.render_mode != RenderModeDeferred)
+        if (mesh.render_mode != RenderModeDeferred || !ECS.entities[mesh.owner].active)
             continue;
         checkMaterial_(mesh);
         renderMeshComponent_(mesh);
     }
+    endPass_("gbuffer");
     
 	/* SCREEN BUFFER */
 	bindAndClearScreen_();
@@ -115,17 +239,20 @@ void GraphicsSystem::update(float dt) {
     
     /* GBUFFER OR LIGHT VOLUMES */
 	
+	beginPass_("lighting");
 	if (renderMode) {
 		renderGbuffer();
 	} else {
 		renderLightVolumes();
 	}
+	endPass_("lighting");
 
     /* FORWARD RENDERING */
+    beginPass_("forward");
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glEnable(GL_BLEND);
     for (auto &mesh : ECS.getAllComponents<Mesh>()) {
-        if (mesh.render_mode != RenderModeForward)
+        if (mesh.render_mode != RenderModeForward || !ECS.entities[mesh.owner].active)
             continue;
         checkShaderAndMaterial_(mesh);
         renderMeshComponent_(mesh);
@@ -136,11 +263,19 @@ void GraphicsSystem::update(float dt) {
         checkShaderAndMaterial_(skinnedmesh);
         renderSkinnedMeshComponent_(skinnedmesh);
     }
+    renderSkinnedCrowds_();
+    endPass_("forward");
     
 	//if button change opacity value
 
     /* ENVIRONMENT */
+    beginPass_("environment");
     renderEnvironment_();
+    endPass_("environment");
+
+    /* UPSCALE */
+    if (sceneFramebuffer_() != 0)
+        resolveSceneToScreen_();
     
 	/* VIEW FRAMES */
     //previewTextureViewport(gbuffer_.color_textures[0]);
@@ -163,101 +298,115 @@ void GraphicsSystem::previewTextureViewport(GLuint texture_id) {
 
 void GraphicsSystem::renderLightVolumes() {
     
+    //find lights whose volume touches the view frustum, and upload their ids
+    cullLightVolumes_();
+    lm::mat4 view_projection = ECS.getComponentInArray<Camera>(ECS.main_camera).view_projection;
+    
+    //copy gbuffer depth to screen first, so volumes can be tested against the scene
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, gbuffer_.framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, sceneFramebuffer_());
+    glBlitFramebuffer(0, 0, render_width_, render_height_, 0, 0, render_width_, render_height_, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer_());
+    
     //activate shader
     useShader(deferred_volume_shader_);
     
     //set uniforms common for all light passes
-    auto lights = ECS.getAllComponents<Light>();
+    auto& lights = ECS.getAllComponents<Light>();
     for (size_t i = 0; i < lights.size(); i++) {
         //this static cast assumes shadowmap enums are consecutive
         UniformID new_enum = static_cast<UniformID>((int)U_SHADOW_MAP0 + (int)i);
         shader_->setTexture(new_enum, shadow_frame_[i].color_textures[0], (int)i);
     }
     shader_->setUniformBlock(U_LIGHTS_UBO, LIGHTS_BINDING_POINT);
-    shader_->setTexture(U_TEX_POSITION, gbuffer_.color_textures[0], 8);
+    shader_->setTexture(U_TEX_DEPTH, gbuffer_.color_textures[0], 8);
     shader_->setTexture(U_TEX_NORMAL, gbuffer_.color_textures[1], 9);
     shader_->setTexture(U_TEX_ALBEDO, gbuffer_.color_textures[2], 10);
     shader_->setUniform(U_CAM_POS, ECS.getComponentInArray<Camera>(ECS.main_camera).position);
+    shader_->setUniform(U_VP, view_projection);
+    //world position is reconstructed from depth
+    lm::mat4 inv_view_projection = view_projection;
+    inv_view_projection.inverse();
+    shader_->setUniform(U_INV_VP, inv_view_projection);
+    shader_->setUniform(U_RENDER_SCALE, lm::vec2((float)render_width_ / gbuffer_.width, (float)render_height_ / gbuffer_.height));
     
     glBlendFunc(GL_ONE, GL_ONE);
     glEnable(GL_BLEND);
     glDepthMask(GL_FALSE);
 
-    //render directional 
-    for (size_t i = 0; i < lights.size(); i++) {
-        if (lights[i].type == 0) {
-            //set light id
-            shader_->setUniform(U_LIGHT_ID,(int)i);
-            //mvp is simple identity pass through
-            lm::mat4 mvp;
-            shader_->setUniform(U_MVP, mvp);
-            //draw
-            geometries_[screen_space_geom_].render();
-        }
-    }
-    
-    for (size_t i = 0; i < lights.size(); i++) {
-        if (lights[i].type == 2) {
-            //set light id
-            shader_->setUniform(U_LIGHT_ID,(int)i);
-            
-            //set u_mvp
-            lm::vec3 light_pos = ECS.getComponentFromEntity<Transform>(lights[i].owner).position();
-            lm::mat4 model;
-            
-            float cone_width_scale =
-                lights[i].radius * tanf(DEG2RAD*lights[i].spot_outer*2);
-            
-            model.scale(cone_width_scale, lights[i].radius, cone_width_scale);
-           
-            lm::vec3 minus = lights[i].forward.normalize();
-            
-            float angle = minus.dot(lm::vec3(0,1,0));
-            lm::vec3 axis = lm::vec3(0,1,0).cross(minus);
-            
-            lm::mat4 rotate_matrix;
-            rotate_matrix.makeRotationMatrix(angle*4, axis);
-            model = rotate_matrix * model;
-            model.translate(light_pos);
-            
-            lm::mat4 view_projection = ECS.getComponentInArray<Camera>(ECS.main_camera).view_projection;
-            lm::mat4 mvp = view_projection * model;
-            shader_->setUniform(U_MVP, mvp);
-            //draw
-            glCullFace(GL_FRONT);
-            geometries_[cone_volume_geom_].render();
-            glCullFace(GL_BACK);
-        }
-    }
+    //render directional lights as one instanced full screen quad
+    glDisable(GL_DEPTH_TEST);
+    geometries_[screen_space_geom_].renderInstanced((GLsizei)visible_directional_lights_.size());
+    glEnable(GL_DEPTH_TEST);
     
-    //now render point lights
-    for (size_t i = 0; i < lights.size(); i++) {
-        if (lights[i].type != 1)
-            continue;
-        //set light id
-        shader_->setUniform(U_LIGHT_ID,(int)i);
+    GLsizei num_points = (GLsizei)visible_point_lights_.size();
+    GLsizei num_spots = (GLsizei)visible_spot_lights_.size();
+    if (num_points + num_spots > 0) {
+        //back faces at or behind the scene surface, so pixels inside a volume
+        //pass and the camera may be inside it too. Pixels in front of the
+        //volume also pass but are discarded by the radius test in the shader,
+        //so volumes may overlap freely and need no stencil
+        glDepthFunc(GL_GEQUAL);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_FRONT);
         
-        //set u_mvp
-        lm::vec3 light_pos = ECS.getComponentFromEntity<Transform>(lights[i].owner).position();
-        lm::mat4 model;
-        model.scale(lights[i].radius, lights[i].radius, lights[i].radius);
-        model.translate(light_pos);
-        lm::mat4 view_projection = ECS.getComponentInArray<Camera>(ECS.main_camera).view_projection;
-        lm::mat4 mvp = view_projection * model;
-        shader_->setUniform(U_MVP, mvp);
+        geometries_[sphere_volume_geom_].renderInstanced(num_points);
+        geometries_[cone_volume_geom_].renderInstanced(num_spots);
         
-        //draw
-        glCullFace(GL_FRONT);
-        geometries_[sphere_volume_geom_].render();
         glCullFace(GL_BACK);
+        glDepthFunc(GL_LEQUAL);
     }
+    
     glDisable(GL_BLEND);
     glDepthMask(GL_TRUE);
+}
+
+//sorts lights by type into the instance lists, discarding point and spot
+//lights whose bounding sphere is outside the camera frustum
+void GraphicsSystem::cullLightVolumes_() {
+    visible_directional_lights_.clear();
+    visible_point_lights_.clear();
+    visible_spot_lights_.clear();
     
-    //blit depth
-    glBindFramebuffer(GL_READ_FRAMEBUFFER, gbuffer_.framebuffer);
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0); // write to default framebuffer
-    glBlitFramebuffer(0, 0, viewport_width_, viewport_height_, 0, 0, viewport_width_, viewport_height_, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    lm::mat4& view_projection = ECS.getComponentInArray<Camera>(ECS.main_camera).view_projection;
+    auto& lights = ECS.getAllComponents<Light>();
+    for (size_t i = 0; i < lights.size() && i < MAX_LIGHTS; i++) {
+        Light& l = lights[i];
+        if (l.type == LightTypeDirectional) {
+            visible_directional_lights_.push_back((GLint)i);
+            continue;
+        }
+        lm::vec3 light_pos = ECS.getComponentFromEntity<Transform>(l.owner).position();
+        if (!sphereInFrustum_(light_pos, l.radius, view_projection))
+            continue;
+        if (l.type == LightTypePoint)
+            visible_point_lights_.push_back((GLint)i);
+        else
+            visible_spot_lights_.push_back((GLint)i);
+    }
+    
+    geometries_[screen_space_geom_].updateInstanceIds(visible_directional_lights_);
+    geometries_[sphere_volume_geom_].updateInstanceIds(visible_point_lights_);
+    geometries_[cone_volume_geom_].updateInstanceIds(visible_spot_lights_);
+}
+
+//tests a sphere against the six planes of a view projection matrix
+//(spot lights are tested with the sphere that bounds their cone)
+bool GraphicsSystem::sphereInFrustum_(const lm::vec3& center, float radius, const lm::mat4& vp) {
+    //matrix is column major, so row r is (m[r], m[4+r], m[8+r], m[12+r])
+    for (int r = 0; r < 3; r++) {
+        for (int sign = -1; sign <= 1; sign += 2) {
+            lm::vec3 n(vp.m[3] + sign * vp.m[r],
+                       vp.m[7] + sign * vp.m[4 + r],
+                       vp.m[11] + sign * vp.m[8 + r]);
+            float d = vp.m[15] + sign * vp.m[12 + r];
+            float length = n.length();
+            if (length <= 0.0f) continue;
+            if ((n.dot(center) + d) / length < -radius)
+                return false;
+        }
+    }
+    return true;
 }
 
 void GraphicsSystem::renderGbuffer() {
@@ -277,19 +426,125 @@ void GraphicsSystem::renderGbuffer() {
     shader_->setUniform(U_NUM_LIGHTS,
                                  (int)ECS.getAllComponents<Light>().size());
     
-    //gbuffer textures
-    shader_->setTexture(U_TEX_POSITION, gbuffer_.color_textures[0], 8);
+    //gbuffer textures, world position is reconstructed from depth
+    Camera& cam = ECS.getComponentInArray<Camera>(ECS.main_camera);
+    lm::mat4 inv_view_projection = cam.view_projection;
+    inv_view_projection.inverse();
+    shader_->setTexture(U_TEX_DEPTH, gbuffer_.color_textures[0], 8);
     shader_->setTexture(U_TEX_NORMAL, gbuffer_.color_textures[1], 9);
     shader_->setTexture(U_TEX_ALBEDO, gbuffer_.color_textures[2], 10);
-    shader_->setUniform(U_CAM_POS, ECS.getComponentInArray<Camera>(ECS.main_camera).position);
+    shader_->setUniform(U_INV_VP, inv_view_projection);
+    shader_->setUniform(U_CAM_POS, cam.position);
+    shader_->setUniform(U_RENDER_SCALE, lm::vec2((float)render_width_ / gbuffer_.width, (float)render_height_ / gbuffer_.height));
     
     //draw
     geometries_[screen_space_geom_].render();
     
     //blit depth
     glBindFramebuffer(GL_READ_FRAMEBUFFER, gbuffer_.framebuffer);
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0); // write to default framebuffer
-    glBlitFramebuffer(0, 0, viewport_width_, viewport_height_, 0, 0, viewport_width_, viewport_height_, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, sceneFramebuffer_());
+    glBlitFramebuffer(0, 0, render_width_, render_height_, 0, 0, render_width_, render_height_, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer_());
+}
+
+//measures gbuffer bandwidth at screen resolution using GPU timer queries:
+//'write' fills every target with a full screen quad, 'read' samples all targets
+//like a lighting pass. Compares the old layout (RGB16F position, RGB16F normal,
+//RGBA8 albedo, D24S8) against the current one (D24S8, RG16 normal, RGBA8 albedo)
+void GraphicsSystem::benchmarkGbufferFillRate_(int iterations) {
+    GLsizei w = viewport_width_, h = viewport_height_;
+    
+    //shaders are compiled on first run only
+    if (!bench_write_shader_[0]) {
+        bench_write_shader_[0] = loadShader(screen_vertex_shader_, bench_write_legacy_fragment_shader_, true);
+        bench_write_shader_[1] = loadShader(screen_vertex_shader_, bench_write_compact_fragment_shader_, true);
+        bench_read_shader_[0] = loadShader(screen_vertex_shader_, bench_read_legacy_fragment_shader_, true);
+        bench_read_shader_[1] = loadShader(screen_vertex_shader_, bench_read_compact_fragment_shader_, true);
+    }
+    
+    //old layout, allocated only for the benchmark
+    Framebuffer legacy;
+    legacy.width = w; legacy.height = h;
+    glGenFramebuffers(1, &(legacy.framebuffer));
+    glBindFramebuffer(GL_FRAMEBUFFER, legacy.framebuffer);
+    GLenum legacy_formats[3] = { GL_RGB16F, GL_RGB16F, GL_RGBA8 };
+    GLenum legacy_attachments[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+    for (int i = 0; i < 3; i++) {
+        glGenTextures(1, &(legacy.color_textures[i]));
+        glBindTexture(GL_TEXTURE_2D, legacy.color_textures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, legacy_formats[i], w, h, 0, GL_RGBA, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, legacy_attachments[i], GL_TEXTURE_2D, legacy.color_textures[i], 0);
+    }
+    glDrawBuffers(3, legacy_attachments);
+    GLuint legacy_rbo;
+    glGenRenderbuffers(1, &legacy_rbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, legacy_rbo);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, w, h);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, legacy_rbo);
+    
+    Framebuffer compact;
+    compact.initGbuffer(w, h);
+    
+    Framebuffer* targets[2] = { &legacy, &compact };
+    const char* names[2] = { "old (pos+normal+albedo)", "compact (depth+oct normal+albedo)" };
+    int bytes_per_pixel[2] = { 6 + 6 + 4 + 4, 4 + 4 + 4 };
+    
+    lm::mat4 inv_view_projection = ECS.getComponentInArray<Camera>(ECS.main_camera).view_projection;
+    inv_view_projection.inverse();
+    
+    GLuint queries[2];
+    glGenQueries(2, queries);
+    glDisable(GL_BLEND);
+    glDepthFunc(GL_ALWAYS); //make every iteration write depth
+    
+    double mpixels = (double)w * h * iterations / 1000000.0;
+    std::cout << "GBUFFER FILL RATE " << w << "x" << h << ", " << iterations << " passes\n";
+    for (int l = 0; l < 2; l++) {
+        glFinish();
+        
+        //write
+        glBindFramebuffer(GL_FRAMEBUFFER, targets[l]->framebuffer);
+        glViewport(0, 0, w, h);
+        useShader(bench_write_shader_[l]);
+        glBeginQuery(GL_TIME_ELAPSED, queries[0]);
+        for (int i = 0; i < iterations; i++)
+            geometries_[screen_space_geom_].render();
+        glEndQuery(GL_TIME_ELAPSED);
+        
+        //read
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        useShader(bench_read_shader_[l]);
+        if (l == 0) shader_->setTexture(U_SCREEN_TEXTURE, targets[l]->color_textures[0], 8);
+        else shader_->setTexture(U_TEX_DEPTH, targets[l]->color_textures[0], 8);
+        shader_->setTexture(U_TEX_NORMAL, targets[l]->color_textures[1], 9);
+        shader_->setTexture(U_TEX_ALBEDO, targets[l]->color_textures[2], 10);
+        shader_->setUniform(U_INV_VP, inv_view_projection);
+        glBeginQuery(GL_TIME_ELAPSED, queries[1]);
+        for (int i = 0; i < iterations; i++)
+            geometries_[screen_space_geom_].render();
+        glEndQuery(GL_TIME_ELAPSED);
+        
+        GLuint64 write_ns = 0, read_ns = 0;
+        glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &write_ns);
+        glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &read_ns);
+        std::cout << "  " << names[l] << ": " << bytes_per_pixel[l] << " bytes/pixel"
+            << ", write " << write_ns / 1000000.0 << " ms (" << mpixels / (write_ns / 1.0e9) << " Mpix/s)"
+            << ", read " << read_ns / 1000000.0 << " ms (" << mpixels / (read_ns / 1.0e9) << " Mpix/s)\n";
+    }
+    
+    //restore state and free temporaries
+    glDepthFunc(GL_LEQUAL);
+    glEnable(GL_BLEND);
+    glDeleteQueries(2, queries);
+    glDeleteRenderbuffers(1, &legacy_rbo);
+    glDeleteTextures(3, legacy.color_textures);
+    glDeleteTextures(3, compact.color_textures);
+    glDeleteFramebuffers(1, &(legacy.framebuffer));
+    glDeleteFramebuffers(1, &(compact.framebuffer));
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    resetShaderAndMaterial_();
 }
 
 //renders a mesh from a Light/Camera, only setting its MVP
@@ -306,8 +561,17 @@ void GraphicsSystem::renderDepth_(Mesh& comp, const Light& light) {
 
 }
 
+//as renderDepth_, but the vertex shader skins with the mesh's palette
+void GraphicsSystem::renderSkinnedDepth_(SkinnedMesh& comp, const Light& light) {
+	if (!comp.palette_ubo || !skinnedInFrustum_(comp, light.view_projection)) return;
+	bindSkinPalette_(comp, depth_skinned_shader_);
+	depth_skinned_shader_->setUniform(U_VP, light.view_projection);
+	geometries_[comp.geometry].render();
+}
+
 //renders a given mesh component
-void GraphicsSystem::renderMeshComponent_(Mesh& comp) {
+//cull - false if the caller has already culled the mesh
+void GraphicsSystem::renderMeshComponent_(Mesh& comp, bool cull) {
 
 	//get components and geom
 	Transform& transform = ECS.getComponentFromEntity<Transform>(comp.owner);
@@ -319,10 +583,13 @@ void GraphicsSystem::renderMeshComponent_(Mesh& comp) {
 	lm::mat4 mvp_matrix = cam.view_projection * model_matrix;
 
 	//view frustum culling
-	if (!BBInFrustum_(geom.aabb, mvp_matrix)) {
+	if (cull && !BBInFrustum_(geom.aabb, mvp_matrix)) {
 		return;
 	}
 
+	if (texture_streamer_.numPending() > 0)
+		reportTextureSizes_(comp, geom, model_matrix, cam);
+
 	//normal matrix
 	lm::mat4 normal_matrix = model_matrix;
 	normal_matrix.inverse();
@@ -334,10 +601,16 @@ void GraphicsSystem::renderMeshComponent_(Mesh& comp) {
 	shader_->setUniform(U_NORMAL_MATRIX, normal_matrix);
 	shader_->setUniform(U_CAM_POS, cam.position);
     
-    //blend shapes
-    if (ECS.hasComponent<BlendShapes>(comp.owner)) {
+    //blend shapes: weights carry the quantization scale of each shape, and
+    //are all zero when the cpu has already blended the positions
+    if (ECS.hasComponent<BlendShapes>(comp.owner) && !geom.blend_shapes.empty()) {
         BlendShapes& bs = ECS.getComponentFromEntity<BlendShapes>(comp.owner);
-        shader_->setUniformFloatArray(U_BLEND_WEIGHTS, &(bs.blend_weights[0]), (int)bs.blend_weights.size());
+        float weights[MAX_BLEND_SHAPES] = { 0.0f };
+        int num_shapes = (int)std::min(bs.blend_weights.size(), geom.blend_shapes.size());
+        for (int i = 0; i < num_shapes && !bs.on_cpu; i++)
+            weights[i] = bs.blend_weights[i] * geom.blend_shapes[i].scale;
+        shader_->setUniformFloatArray(U_BLEND_WEIGHTS, weights, MAX_BLEND_SHAPES);
+        shader_->setTextureBuffer(U_BLEND_DELTAS, geom.blend_delta_texture, BLEND_TEXTURE_UNIT);
     }
 
     //draw raw geom if no material sets
@@ -350,7 +623,7 @@ void GraphicsSystem::renderMeshComponent_(Mesh& comp) {
                 continue;
             //set current material id of set
             current_material_ = geom.material_set_ids[i];
-            setMaterialUniforms();
+            bindMaterial_();
             //render current set
             geom.render(i);
         }
@@ -359,55 +632,185 @@ void GraphicsSystem::renderMeshComponent_(Mesh& comp) {
             if (materials_[geom.material_set_ids[i]].transparency_map == -1) // skip non-transparent
                 continue;
             current_material_ = geom.material_set_ids[i];
-            setMaterialUniforms();
+            bindMaterial_();
             geom.render(i);
         }
     }
 }
 
-void GraphicsSystem::getJointMatrices(Joint* current,
-                      lm::mat4 current_model,
-                      std::vector<float>& pos_matrices,
-                      std::vector<float>& bind_matrices,
-                      int& joint_count) {
-    
-    lm::mat4 joint_global_model = current_model * current->matrix;
-    lm::mat4 joint_global_bind = current->bind_pose_matrix;
-    
-    for (int i = 0; i < 16; i++) {
-        pos_matrices[joint_count * 16 + i] = joint_global_model.m[i];
-        bind_matrices[joint_count * 16 + i] = joint_global_bind.m[i];
+//tells the streamer how many pixels across the mesh's bounding sphere
+//covers, for every texture of the materials it is drawn with
+void GraphicsSystem::reportTextureSizes_(const Mesh& comp, const Geometry& geom, const lm::mat4& model_matrix, const Camera& cam) {
+	lm::mat4 world = model_matrix;
+	lm::vec3 center = world * geom.aabb.center;
+	float scale = std::max(world.right().length(), std::max(world.top().length(), world.front().length()));
+	float radius = geom.aabb.half_width.length() * scale;
+	float distance = std::max((center - cam.position).length(), 0.001f);
+	float pixels = radius / (distance * tan(cam.fov * 0.5f)) * render_height_;
+
+	auto report = [&](int mat_id) {
+		if (mat_id < 0 || mat_id >= (int)materials_.size()) return;
+		const Material& mat = materials_[mat_id];
+		int maps[] = { mat.diffuse_map, mat.diffuse_map_2, mat.diffuse_map_3, mat.cube_map, mat.normal_map,
+			mat.specular_map, mat.transparency_map, mat.noise_map };
+		for (int tex : maps)
+			if (tex >= 0) texture_streamer_.setScreenSize(tex, pixels);
+	};
+	if (geom.material_sets.size() == 0)
+		report(comp.material);
+	for (int mat_id : geom.material_set_ids)
+		report(mat_id);
+}
+
+//copies every skeleton palette to its ubo, once per frame. Buffers are
+//allocated at MAX_JOINTS on first use so the whole block is always bound
+void GraphicsSystem::uploadSkinPalettes_() {
+    for (auto& sm : ECS.getAllComponents<SkinnedMesh>()) {
+        int num_joints = std::min(sm.skeleton.size(), MAX_JOINTS);
+        if (num_joints == 0) continue;
+        if (!sm.palette_ubo) {
+            glGenBuffers(1, &sm.palette_ubo);
+            glBindBuffer(GL_UNIFORM_BUFFER, sm.palette_ubo);
+            glBufferData(GL_UNIFORM_BUFFER, MAX_JOINTS * sizeof(lm::mat4), NULL, GL_DYNAMIC_DRAW);
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, sm.palette_ubo);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, num_joints * sizeof(lm::mat4), &(sm.skeleton.palette[0]));
     }
-    
-    for (auto& c : current->children) {
-        joint_count++;
-        getJointMatrices(c, joint_global_model, pos_matrices, bind_matrices, joint_count);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void GraphicsSystem::bindSkinPalette_(SkinnedMesh& comp, Shader* shader) {
+    glBindBufferBase(GL_UNIFORM_BUFFER, SKIN_BINDING_POINT, comp.palette_ubo);
+    shader->setUniformBlock(U_SKIN_UBO, SKIN_BINDING_POINT);
+}
+
+//culls with the box around the current pose when the animation system has
+//one, else with the bind pose box, which animation can leave
+bool GraphicsSystem::skinnedInFrustum_(SkinnedMesh& comp, const lm::mat4& view_projection) {
+    if (comp.has_bounds) {
+        AABB box;
+        box.center = (comp.bounds_min + comp.bounds_max) * 0.5f;
+        box.half_width = (comp.bounds_max - comp.bounds_min) * 0.5f;
+        return AABBInFrustum_(box, view_projection);
     }
+    lm::mat4 model_matrix = ECS.getComponentFromEntity<Transform>(comp.owner).getGlobalMatrix(ECS.getAllComponents<Transform>());
+    return BBInFrustum_(geometries_[comp.geometry].aabb, view_projection * model_matrix);
 }
 
 void GraphicsSystem::renderSkinnedMeshComponent_(SkinnedMesh& comp) {
     
-    //set joint bind poses
+    if (!comp.palette_ubo) return;
     Camera& cam = ECS.getComponentInArray<Camera>(ECS.main_camera);
     
-    GLint u_joint_pos_matrices = glGetUniformLocation(shader_->program, "u_joint_pos_matrices");
-    GLint u_joint_bind_matrices = glGetUniformLocation(shader_->program, "u_joint_bind_matrices");
-    
-    //create float vector and fill it with matrices for each joint
-    std::vector<float> p_m(comp.num_joints * 16, 0);
-    std::vector<float> b_m(comp.num_joints * 16, 0);
-    
-    int joint_counter = 0;
-    getJointMatrices(comp.root, lm::mat4(), p_m, b_m, joint_counter);
-    
-    //send to shader
-    glUniformMatrix4fv(u_joint_pos_matrices, comp.num_joints, GL_FALSE, &p_m[0]);
-    glUniformMatrix4fv(u_joint_bind_matrices, comp.num_joints, GL_FALSE, &b_m[0]);
+    //culling result and size on screen, used by next frame's animation LOD
+    comp.anim_lod.visible = skinnedInFrustum_(comp, cam.view_projection);
+    lm::vec3 center;
+    float radius;
+    if (comp.has_bounds) {
+        center = (comp.bounds_min + comp.bounds_max) * 0.5f;
+        radius = (comp.bounds_max - comp.bounds_min).length() * 0.5f;
+    }
+    else {
+        Geometry& geom = geometries_[comp.geometry];
+        lm::mat4 model_matrix = ECS.getComponentFromEntity<Transform>(comp.owner).getGlobalMatrix(ECS.getAllComponents<Transform>());
+        center = model_matrix * geom.aabb.center;
+        float scale = std::max(model_matrix.right().length(), std::max(model_matrix.top().length(), model_matrix.front().length()));
+        radius = geom.aabb.half_width.length() * scale;
+    }
+    float distance = std::max((center - cam.position).length(), 0.001f);
+    comp.anim_lod.screen_size = radius / (distance * tan(cam.fov * 0.5f));
+    if (!comp.anim_lod.visible) return;
     
-    shader_->setUniform(U_SKIN_BIND_MATRIX, comp.skin_bind_matrix);
+    //palette already holds joint and bind matrices
+    bindSkinPalette_(comp, shader_);
     shader_->setUniform(U_VP, cam.view_projection);
     
-    renderMeshComponent_(comp);
+    renderMeshComponent_(comp, false);
+}
+
+void GraphicsSystem::setAnimationTexture(const std::vector<float>& texels, int width, int height) {
+    if (texels.empty()) return;
+    GLint max_size = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+    if (width > max_size || height > max_size) {
+        std::cout << "ERROR: baked animation texture " << width << "x" << height << " exceeds GL_MAX_TEXTURE_SIZE " << max_size << std::endl;
+        return;
+    }
+    if (!anim_texture_)
+        glGenTextures(1, &anim_texture_);
+    glBindTexture(GL_TEXTURE_2D, anim_texture_);
+    //read with texelFetch only, so no filtering or mips
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, &(texels[0]));
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+//fills the crowd geometry's instance buffer with the instances inside the
+//view_projection frustum: world matrix, then first row, frame count, frames
+//per second and frame offset of the baked clip. Returns the instance count
+int GraphicsSystem::updateCrowdInstances_(SkinnedCrowd& crowd, const lm::mat4& view_projection) {
+    Geometry& geom = geometries_[crowd.geometry];
+    if (!geom.instance_data_vbo)
+        geom.addInstanceDataBuffer(CROWD_INSTANCE_LOCATION, 5);
+    
+    lm::mat4 owner_matrix = ECS.getComponentFromEntity<Transform>(crowd.owner).getGlobalMatrix(ECS.getAllComponents<Transform>());
+    float fps = 1.0f / crowd.clip_frame_time;
+    //box around every frame of the clip, the bind pose box if there is none
+    AABB box = geom.aabb;
+    if (crowd.has_clip_bounds) {
+        box.center = (crowd.clip_bounds_min + crowd.clip_bounds_max) * 0.5f;
+        box.half_width = (crowd.clip_bounds_max - crowd.clip_bounds_min) * 0.5f;
+    }
+    crowd_instance_data_.clear();
+    int count = 0;
+    for (int i = 0; i < crowd.size(); i++) {
+        lm::mat4 model_matrix = owner_matrix * crowd.transforms[i];
+        if (!BBInFrustum_(box, view_projection * model_matrix))
+            continue;
+        crowd_instance_data_.insert(crowd_instance_data_.end(), model_matrix.m, model_matrix.m + 16);
+        crowd_instance_data_.push_back((float)crowd.clip_first_row);
+        crowd_instance_data_.push_back((float)crowd.clip_num_frames);
+        crowd_instance_data_.push_back(fps * crowd.speeds[i]);
+        crowd_instance_data_.push_back(fps * crowd.time_offsets[i]);
+        count++;
+    }
+    geom.updateInstanceData(crowd_instance_data_);
+    return count;
+}
+
+//draws every visible instance of a crowd with the current shader, which
+//must be shader (material uniforms are set by the caller if needed)
+void GraphicsSystem::renderCrowd_(SkinnedCrowd& crowd, Shader* shader, const lm::mat4& view_projection) {
+    if (!anim_texture_ || crowd.geometry < 0 || crowd.clip_num_frames <= 0) return;
+    int count = updateCrowdInstances_(crowd, view_projection);
+    if (count == 0) return;
+    shader->setTexture(U_ANIM_TEXTURE, anim_texture_, ANIM_TEXTURE_UNIT);
+    shader->setUniform(U_VP, view_projection);
+    shader->setUniform(U_TIME, crowd.time);
+    geometries_[crowd.geometry].renderInstanced(count);
+    if (shader == crowd_shader_)
+        crowd_instances_drawn_ += count;
+}
+
+void GraphicsSystem::renderSkinnedCrowds_() {
+    crowd_instances_drawn_ = 0;
+    auto& crowds = ECS.getAllComponents<SkinnedCrowd>();
+    if (crowds.empty() || !anim_texture_) return;
+    Camera& cam = ECS.getComponentInArray<Camera>(ECS.main_camera);
+    useShader(crowd_shader_);
+    current_material_ = -1;
+    material_shader_ = nullptr;
+    for (auto& crowd : crowds) {
+        if (crowd.material >= 0 && crowd.material != current_material_) {
+            current_material_ = crowd.material;
+            bindMaterial_();
+        }
+        shader_->setUniform(U_CAM_POS, cam.position);
+        renderCrowd_(crowd, crowd_shader_, cam.view_projection);
+    }
 }
 
 //render the skybox as a cubemap
@@ -428,6 +831,9 @@ void GraphicsSystem::renderEnvironment_() {
     view_matrix.m[12] = view_matrix.m[13] = view_matrix.m[14] = 0; view_matrix.m[15] = 1;
     lm::mat4 vp_matrix = cam.projection_matrix * view_matrix;
 
+    //the sky covers the screen
+    texture_streamer_.setScreenSize(environment_tex_, (float)render_height_);
+
     //set vp uniform and texture
 	shader_->setUniform(U_OPACITY, opacity);
     shader_->setUniform(U_VP, vp_matrix);
@@ -461,7 +867,7 @@ void GraphicsSystem::checkShaderAndMaterial_(Mesh& mesh) {
     //set material uniforms if required
     if (current_material_ != mesh.material) {
         current_material_ = mesh.material;
-        setMaterialUniforms();
+        bindMaterial_();
     }
 }
 
@@ -469,67 +875,25 @@ void GraphicsSystem::checkMaterial_(Mesh& mesh) {
     //set material uniforms if required
     if (current_material_ != mesh.material) {
         current_material_ = mesh.material;
-        setMaterialUniforms();
+        bindMaterial_();
     }
 }
 
-//sets uniforms for current material and current shader
-void GraphicsSystem::setMaterialUniforms() {
-    Material& mat = materials_[current_material_];
-
-    //material uniforms
-	shader_->setUniform(U_AMBIENT, mat.ambient);
-	shader_->setUniform(U_DIFFUSE, mat.diffuse);
-	shader_->setUniform(U_SPECULAR, mat.specular);
-	shader_->setUniform(U_SPECULAR_GLOSS, mat.specular_gloss);
-    shader_->setUniform(U_UV_SCALE, mat.uv_scale);
-    shader_->setUniform(U_NORMAL_FACTOR, mat.normal_factor);
-    shader_->setUniform(U_MAX_HEIGHT, mat.height);
-
-    //texture uniforms - diffuse
-    if (mat.diffuse_map != -1){
-        shader_->setUniform(U_USE_DIFFUSE_MAP, 1);
-        shader_->setTexture(U_DIFFUSE_MAP, mat.diffuse_map, 8);
-    } else shader_->setUniform(U_USE_DIFFUSE_MAP, 0);
-    
-    //add extra diffuse maps
-    if (mat.diffuse_map_2 != -1) {
-        shader_->setUniform(U_USE_DIFFUSE_MAP_2, 1);
-        shader_->setTexture(U_DIFFUSE_MAP_2, mat.diffuse_map_2, 9);
-    }
-    else shader_->setUniform(U_USE_DIFFUSE_MAP_2, 0);
-    if (mat.diffuse_map_3 != -1) {
-        shader_->setUniform(U_USE_DIFFUSE_MAP_3, 1);
-        shader_->setTexture(U_DIFFUSE_MAP_3, mat.diffuse_map_3, 10);
-    }
-    else shader_->setUniform(U_USE_DIFFUSE_MAP_3, 0);
-    //normal
-    if (mat.normal_map != -1) {
-        shader_->setUniform(U_USE_NORMAL_MAP, 1);
-        shader_->setTexture(U_NORMAL_MAP, mat.normal_map, 11);
-    } else shader_->setUniform(U_USE_NORMAL_MAP, 0);
-    //specular
-    if (mat.specular_map != -1) {
-        shader_->setUniform(U_USE_SPECULAR_MAP, 1);
-        shader_->setTexture(U_SPECULAR_MAP, mat.specular_map, 12);
-    } else shader_->setUniform(U_USE_SPECULAR_MAP, 0);
-    //reflection
-    if (mat.cube_map) {
-        shader_->setUniform(U_USE_REFLECTION_MAP, 1);
-        shader_->setTextureCube(U_SKYBOX, mat.cube_map, 13);
-    } else shader_->setUniform(U_USE_REFLECTION_MAP, 0);
-    //noise map
-    if (mat.noise_map != -1) {
-        shader_->setUniform(U_USE_NOISE_MAP, 1);
-        shader_->setTexture(U_NOISE_MAP, mat.noise_map, 14);
-    }
-    else shader_->setUniform(U_USE_NOISE_MAP, 0);
-    //noise map
-    if (mat.transparency_map != -1) {
-        shader_->setUniform(U_USE_TRANSPARENCY_MAP, 1);
-        shader_->setTexture(U_TRANSPARENCY_MAP, mat.transparency_map, 15);
-    }
-    else shader_->setUniform(U_USE_TRANSPARENCY_MAP, 0);
+//sets what depends on the shader rather than the material: which units the
+//material maps are read from, shadow maps and lights
+void GraphicsSystem::setShaderUniforms_() {
+    material_shader_ = shader_;
+    current_material_slot_ = -1;
+
+    shader_->setUniformBlock(U_MATERIAL_UBO, MATERIAL_BINDING_POINT);
+    shader_->setUniform(U_DIFFUSE_MAP, 8);
+    shader_->setUniform(U_DIFFUSE_MAP_2, 9);
+    shader_->setUniform(U_DIFFUSE_MAP_3, 10);
+    shader_->setUniform(U_NORMAL_MAP, 11);
+    shader_->setUniform(U_SPECULAR_MAP, 12);
+    shader_->setUniform(U_SKYBOX, 13);
+    shader_->setUniform(U_NOISE_MAP, 14);
+    shader_->setUniform(U_TRANSPARENCY_MAP, 15);
 
 	auto lights = ECS.getAllComponents<Light>();
 	for (size_t i = 0; i < lights.size(); i++) {
@@ -548,9 +912,91 @@ void GraphicsSystem::setMaterialUniforms() {
 	shader_->setUniform(U_NUM_LIGHTS, (int)lights.size());
 }
 
+//binds current material for current shader: its parameter block, unless
+//the last material had the same one, and its textures
+void GraphicsSystem::bindMaterial_() {
+    if (shader_ != material_shader_)
+        setShaderUniforms_();
+    //created since the start of the frame
+    if (current_material_ >= (int)material_slots_.size())
+        updateMaterialBuffer_();
+    Material& mat = materials_[current_material_];
+
+    int slot = material_slots_[current_material_];
+    if (slot != current_material_slot_) {
+        glBindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_BINDING_POINT, material_ubo_,
+            slot * material_stride_, sizeof(MaterialBlock));
+        current_material_slot_ = slot;
+    }
+
+    //maps the block says are unused are not read, their units keep whatever
+    //the last material left
+    auto bind = [](GLuint unit, GLenum target, int texture) {
+        if (texture == -1) return;
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(target, texture);
+    };
+    bind(8, GL_TEXTURE_2D, mat.diffuse_map);
+    bind(9, GL_TEXTURE_2D, mat.diffuse_map_2);
+    bind(10, GL_TEXTURE_2D, mat.diffuse_map_3);
+    bind(11, GL_TEXTURE_2D, mat.normal_map);
+    bind(12, GL_TEXTURE_2D, mat.specular_map);
+    bind(13, GL_TEXTURE_CUBE_MAP, mat.cube_map);
+    bind(14, GL_TEXTURE_2D, mat.noise_map);
+    bind(15, GL_TEXTURE_2D, mat.transparency_map);
+}
+
+//uploads the parameter blocks again if any material was added or changed.
+//Blocks are hashed by content and each distinct one stored once, so
+//materials that differ only in textures share a slot
+void GraphicsSystem::updateMaterialBuffer_() {
+    bool changed = material_blocks_.size() != materials_.size();
+    material_blocks_.resize(materials_.size());
+    for (size_t i = 0; i < materials_.size(); i++) {
+        MaterialBlock block = materials_[i].parameterBlock();
+        if (memcmp(&block, &material_blocks_[i], sizeof(MaterialBlock)) != 0) {
+            material_blocks_[i] = block;
+            changed = true;
+        }
+    }
+    if (!changed)
+        return;
+
+    std::vector<MaterialBlock> slots;
+    std::unordered_map<uint64_t, int> slot_of_hash;
+    material_slots_.resize(materials_.size());
+    for (size_t i = 0; i < materials_.size(); i++) {
+        const MaterialBlock& block = material_blocks_[i];
+        //64 bit FNV-1a
+        uint64_t hash = 0xcbf29ce484222325ull;
+        const unsigned char* bytes = (const unsigned char*)&block;
+        for (size_t b = 0; b < sizeof(MaterialBlock); b++)
+            hash = (hash ^ bytes[b]) * 0x100000001b3ull;
+
+        auto found = slot_of_hash.find(hash);
+        if (found != slot_of_hash.end() && memcmp(&slots[found->second], &block, sizeof(MaterialBlock)) == 0) {
+            material_slots_[i] = found->second;
+            continue;
+        }
+        material_slots_[i] = (int)slots.size();
+        slot_of_hash.emplace(hash, (int)slots.size());
+        slots.push_back(block);
+    }
+
+    std::vector<char> data(slots.size() * material_stride_, 0);
+    for (size_t i = 0; i < slots.size(); i++)
+        memcpy(&data[i * material_stride_], &slots[i], sizeof(MaterialBlock));
+    glBindBuffer(GL_UNIFORM_BUFFER, material_ubo_);
+    glBufferData(GL_UNIFORM_BUFFER, data.size(), data.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    num_material_slots_ = (int)slots.size();
+    //ranges bound from the old storage are gone
+    current_material_slot_ = -1;
+}
+
 //updates light ubo
 void GraphicsSystem::updateLights_() {
-	const std::vector<Light>& lights = ECS.getAllComponents<Light>();
+	std::vector<Light>& lights = ECS.getAllComponents<Light>();
 
 	// 3 * vec4, 4 * float, 1 x matrix, 1 * int, which is blocked out to 16 bytes
 	GLsizeiptr size_lights_ubo = (16 + 16 + 16 + 16 + 16 + 64) * lights.size();
@@ -563,11 +1009,14 @@ void GraphicsSystem::updateLights_() {
 	for (auto& l : lights) {
 		Transform& lt = ECS.getComponentFromEntity<Transform>(l.owner);
 
+		//attenuation or colour may have changed since the light was created
+		l.updateRadius();
+
 		float spot_inner_cosine = cos((l.spot_inner*DEG2RAD) / 2.0f);
 		float spot_outer_cosine = cos((l.spot_outer*DEG2RAD) / 2.0f);
 
 		GLfloat light_data[16] = {
-			lt.m[12], lt.m[13], lt.m[14], 0.0,
+			lt.m[12], lt.m[13], lt.m[14], l.radius, //w is light volume radius
 			l.direction.x, l.direction.y, l.direction.z, 0.0,
 			l.color.x, l.color.y, l.color.z, 0.0,
 			l.linear_att,l.quadratic_att,spot_inner_cosine,spot_outer_cosine
@@ -591,48 +1040,30 @@ void GraphicsSystem::updateLights_() {
 	needUpdateLights = false;
 }
 
-//This function executes two sorts:
-// i) sorts materials array by shader_id
-// ii) sorts Mesh components by material id
-//the result is that the mesh component array is
-//ordered by both shader and material
+//sorts Mesh components by the shader of their material, then by material,
+//so the mesh component array is ordered by both shader and material.
+//materials_ itself keeps its order: material ids are held all over (mesh
+//components, material sets, resource handles) and must stay valid
 void GraphicsSystem::sortMeshes_() {
 
-	//sort materials by shader id
-	//first we store the old index of each material in materials_ array
-	for (size_t i = 0; i < materials_.size(); i++)
-		materials_[i].index = (int)i; // 'index' is a new property of Material
-
-	//second, we sort materials by shader_id
-	std::sort(materials_.begin(), materials_.end(), [](const Material& a, const Material& b) {
-		return a.shader_id < b.shader_id;
-	});
-    
-	//now we map old indices to new indices
-	std::map<int, int> old_new;
-	for (size_t i = 0; i < materials_.size(); i++) {
-		old_new[materials_[i].index] = (int)i;
-	}
-
-	//now we swap index of materials in all meshes
-	auto& meshes = ECS.getAllComponents<Mesh>();
-	for (auto& mesh : meshes) {
-		int old_index = mesh.material;
-		int new_index = old_new[old_index];
-		mesh.material = new_index;
-	}
-
 	//store old mesh indices
+	auto& meshes = ECS.getAllComponents<Mesh>();
 	for (size_t i = 0; i < meshes.size(); i++)
 		meshes[i].index = (int)i;
 
-	//short meshes by material id
-	std::sort(meshes.begin(), meshes.end(), [](const Mesh& a, const Mesh& b) {
+	//sort meshes by shader, then material id
+	auto shader_of = [this](int material) {
+		return material >= 0 && material < (int)materials_.size() ? materials_[material].shader_id : -1;
+	};
+	std::sort(meshes.begin(), meshes.end(), [&shader_of](const Mesh& a, const Mesh& b) {
+		int shader_a = shader_of(a.material), shader_b = shader_of(b.material);
+		if (shader_a != shader_b)
+			return shader_a < shader_b;
 		return a.material < b.material;
 	});
 
-	//clear map and refill with mesh index map
-	old_new.clear();
+	//map old mesh indices to new ones
+	std::map<int, int> old_new;
     old_new[-1] = -1; //makes sure entities without mesh stay without mesh!
 	for (size_t i = 0; i < meshes.size(); i++) {
 		old_new[meshes[i].index] = (int)i;
@@ -652,6 +1083,7 @@ void GraphicsSystem::resetShaderAndMaterial_() {
 	
 	useShader((GLuint)0);
 	current_material_ = -1;
+	material_shader_ = nullptr;
 }
 
 //update cameras
@@ -662,10 +1094,10 @@ void GraphicsSystem::updateAllCameras_() {
 }
 
 void GraphicsSystem::bindAndClearScreen_() {
-	glViewport(0, 0, viewport_width_, viewport_height_);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, render_width_, render_height_);
+	glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer_());
 	glClearColor(screen_background_color.x, screen_background_color.y, screen_background_color.z, screen_background_color.w);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 }
 
 //change shader only if need to - note shader object must be in shaders_ map
@@ -730,13 +1162,41 @@ Shader* GraphicsSystem::loadShader(std::string vs, std::string fs, bool compile_
 	return new_shader;
 }
 
+void GraphicsSystem::unloadShader(GLuint program) {
+	auto found = shaders_.find(program);
+	if (found == shaders_.end()) return;
+	if (shader_ == found->second)
+		useShader((Shader*)nullptr);
+	glDeleteProgram(program);
+	delete found->second;
+	shaders_.erase(found);
+}
+
+Shader* GraphicsSystem::getShader(GLuint program) {
+	auto found = shaders_.find(program);
+	return found == shaders_.end() ? nullptr : found->second;
+}
+
 //create a new material and return pointer to it
 int GraphicsSystem::createMaterial() {
+    if (!free_materials_.empty()) {
+        int mat_id = free_materials_.back();
+        free_materials_.pop_back();
+        materials_[mat_id] = Material();
+        materials_[mat_id].index = mat_id;
+        return mat_id;
+    }
     materials_.emplace_back();
     materials_.back().index = (int)materials_.size() - 1;
     return (int)materials_.size() - 1;
 }
 
+void GraphicsSystem::releaseMaterial(int mat_id) {
+    materials_.at(mat_id) = Material();
+    materials_[mat_id].index = mat_id;
+    free_materials_.push_back(mat_id);
+}
+
 //create a geometry in the graphics system array
 int GraphicsSystem::createGeometry(std::vector<float>& vertices,
                                    std::vector<float>& uvs,
@@ -753,59 +1213,121 @@ int GraphicsSystem::createGeometry(std::vector<float>& vertices,
 //create geometry from
 //returns index in geometry array with stored geometry data
 int GraphicsSystem::createGeometryFromFile(std::string filename) {
+    return importGeometry_(filename, false);
+}
+
+//as createGeometryFromFile, with material sets from the obj's usemtl lines
+int GraphicsSystem::createMultiGeometryFromFile(std::string filename) {
+    return importGeometry_(filename, true);
+}
+
+//loads the cooked copy of an obj from the mounted asset pack, or the cached
+//copy if it is current, otherwise parses the text and writes the cache for
+//next time
+int GraphicsSystem::importGeometry_(std::string filename, bool multi) {
+    GeometryImport import;
+    import.filename = filename;
+    import.multi = multi;
+    readGeometry(import, Parsers::getJobSystem());
+    return uploadGeometry(import);
+}
+
+//touches nothing but the mesh cache's settings and the files, so imports
+//can be read on several threads at once (with jobs nullptr)
+bool GraphicsSystem::readGeometry(GeometryImport& import, JobSystem* jobs) {
+    if (import.failed || import.entry || import.parsed)
+        return !import.failed;
+    auto start = std::chrono::high_resolution_clock::now();
+    const std::string& filename = import.filename;
     
-    std::vector<GLfloat> vertices, uvs, normals;
-    std::vector<GLuint> indices;
     //check for supported format
-    std::string ext = filename.substr(filename.size() - 4, 4);
-    if (ext == ".obj" || ext == ".OBJ")
-    {
-        //fill it with data from object
-        if (Parsers::parseOBJ(filename, vertices, uvs, normals, indices)) {
-        
-            //generate the OpenGL buffers and create geometry
-			Geometry new_geom(vertices, uvs, normals, indices);
-            geometries_.emplace_back(new_geom);
-
-            return (int)geometries_.size() - 1;
+    std::string ext = filename.size() >= 4 ? filename.substr(filename.size() - 4, 4) : "";
+    if (ext != ".obj" && ext != ".OBJ") {
+        std::cerr << "ERROR: Unsupported mesh format when creating geometry" << std::endl;
+        import.failed = true;
+        return false;
+    }
+    
+    //files without material groups are only cooked as the plain mesh
+    const AssetPack* pack = AssetPack::mounted();
+    if (pack && ((import.multi && pack->find(filename + ".sets.mesh", import.entry, import.entry_size)) ||
+                 pack->find(filename + ".mesh", import.entry, import.entry_size)) &&
+        !mesh_cache_.checkEntry(import.entry, import.entry_size))
+        import.entry = nullptr;
+    
+    if (!import.entry) {
+        if (!import.key.valid)
+            import.key = mesh_cache_.key(filename);
+        if (mesh_cache_.enabled && import.key.valid && import.cached.open(mesh_cache_.entryPath(import.key, import.multi ? ".sets.mesh" : ".mesh")) &&
+            mesh_cache_.checkEntry(import.cached.data(), import.cached.size(), &import.key)) {
+            import.entry = import.cached.data();
+            import.entry_size = import.cached.size();
         }
+        else
+            import.cached.close();
+    }
+    
+    if (import.entry) {
+        //fault the pages in here rather than during the upload
+        volatile char touch = 0;
+        for (size_t i = 0; i < import.entry_size; i += 4096)
+            touch = touch ^ import.entry[i];
+    }
+    else if (!import.key.valid || import.key.size <= import.parse_limit) {
+        MappedFile source;
+        if (source.open(filename) && ObjParser::parse(source.data(), source.size(), import.vertices, import.uvs,
+                                                      import.normals, import.indices, import.multi ? &import.groups : nullptr, jobs))
+            import.parsed = true;
         else {
-            std::cerr << "ERROR: Could not parse mesh file" << std::endl;
-            return -1;
+            std::cerr << "ERROR: Could not parse mesh file " << filename << std::endl;
+            import.failed = true;
         }
     }
-    else {
-        std::cerr << "ERROR: Unsupported mesh format when creating geometry" << std::endl;
-        return -1;
-    }
-    
+    import.read_ms += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    return !import.failed;
 }
 
-
-
-
-int GraphicsSystem::createMultiGeometryFromFile(std::string filename) {
+int GraphicsSystem::uploadGeometry(GeometryImport& import) {
+    //text left for later by parse_limit
+    if (!import.failed && !import.entry && !import.parsed) {
+        import.parse_limit = (size_t)-1;
+        readGeometry(import, Parsers::getJobSystem());
+    }
+    if (import.failed)
+        return -1;
     
-    std::vector<GLfloat> vertices, uvs, normals;
-    std::vector<GLuint> indices;
-    //check for supported format
-    std::string ext = filename.substr(filename.size() - 4, 4);
-    if (ext == ".obj" || ext == ".OBJ")
-    {
-        //fill it with data from object
-        if (int p = Parsers::parseOBJ_multi(filename, geometries_, materials_) ) {
-            return p;
-        }
-        else {
-            std::cerr << "ERROR: Could not parse mesh file" << std::endl;
+    auto start = std::chrono::high_resolution_clock::now();
+    Geometry new_geom;
+    bool hit = import.entry != nullptr;
+    if (hit) {
+        if (!mesh_cache_.loadEntry(import.entry, import.entry_size, new_geom, materials_, nullptr, import.multi))
             return -1;
-        }
     }
     else {
-        std::cerr << "ERROR: Unsupported mesh format when creating geometry" << std::endl;
-        return -1;
+        //generate the OpenGL buffers and create geometry
+        new_geom.createVertexArrays(import.vertices, import.uvs, import.normals, import.indices);
+        if (import.multi)
+            Parsers::createMaterialSets(new_geom, import.groups, materials_);
+        mesh_cache_.store(import.key, import.vertices, import.uvs, import.normals, import.indices, new_geom, materials_,
+                          import.multi ? ".sets.mesh" : ".mesh");
     }
-    
+    int geom_id = (int)geometries_.size();
+    if (!free_geometries_.empty()) {
+        geom_id = free_geometries_.back();
+        free_geometries_.pop_back();
+        geometries_[geom_id] = new_geom;
+    }
+    else
+        geometries_.push_back(new_geom);
+    import.upload_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    if (hit) { mesh_cache_.hits++; mesh_cache_.hit_ms += import.read_ms + import.upload_ms; }
+    else { mesh_cache_.misses++; mesh_cache_.miss_ms += import.read_ms + import.upload_ms; }
+    return geom_id;
+}
+
+void GraphicsSystem::releaseGeometry(int geom_id) {
+    geometries_.at(geom_id).destroy();
+    free_geometries_.push_back(geom_id);
 }
 
 //create terrain geometry and adds to geometry array
@@ -8,7 +8,13 @@
 #include "GraphicsUtilities.h"
 #include <unordered_map>
 #include "ControlSystem.h"
+#include "Profiler.h"
+#include "MeshCache.h"
+#include "ShaderCache.h"
+#include "TextureStreamer.h"
+#include "ResourceManager.h"
 
+class JobSystem;
 
 #define MAX_LIGHTS 8
 
@@ -26,6 +32,10 @@ public:
 
     //shader loader
 	Shader* loadShader(std::string vs_path, std::string fs_path, bool compile_direct = false);
+	//deletes the program and its Shader object
+	void unloadShader(GLuint program);
+	//nullptr if no shader loaded here has that program
+	Shader* getShader(GLuint program);
 
     //set the environment
     void setEnvironment(GLuint tex_id, int geom_id, GLuint program);
@@ -37,14 +47,30 @@ public:
 	//rendertype 
 	bool renderMode = false;
 
+	//gbuffer fill rate benchmark, runs at the start of the next frame
+	bool runGbufferBenchmark = false;
+
+	//quality knobs, driven by QualityGovernor
+	void setRenderScale(float scale);
+	float getRenderScale() { return render_scale_; }
+	void setShadowQuality(int resolution, int update_interval);
+	int getShadowResolution() { return shadow_resolution_; }
+	int getShadowInterval() { return shadow_interval_; }
+	void setLodBias(float bias);
+	float getLodBias() { return lod_bias_; }
+
 	//control animations
 	bool ball_anim = true;
 	bool human_anim = true;
 
 	//materials
     int createMaterial();
+    //resets it and lets createMaterial hand the index out again
+    void releaseMaterial(int mat_id);
 	Material& getMaterial(int mat_id) { return materials_.at(mat_id); }
     std::vector<Material>& getMaterials() { return materials_;}
+    //distinct parameter blocks among the materials, as of the last frame
+    int numMaterialBlocks() const { return num_material_slots_; }
     
     //geometry
     Geometry& getGeometry(int geom_id) { return geometries_.at(geom_id); }
@@ -53,20 +79,48 @@ public:
                        std::vector<float>& uvs,
                        std::vector<float>& normals,
                        std::vector<unsigned int>& indices);
+    //obj files, through the binary mesh cache
     int createGeometryFromFile(std::string filename);
     int createMultiGeometryFromFile(std::string filename);
+    //the same in two halves, see GeometryImport. readGeometry is safe on any
+    //thread when jobs is nullptr, uploadGeometry needs the GL context
+    bool readGeometry(GeometryImport& import, JobSystem* jobs);
+    int uploadGeometry(GeometryImport& import);
+    //destroys it and lets uploadGeometry hand the index out again
+    void releaseGeometry(int geom_id);
+    MeshCache& getMeshCache() { return mesh_cache_; }
+    ShaderCache& getShaderCache() { return shader_cache_; }
+    //textures loading in the background, uploaded at the start of update
+    TextureStreamer& getTextureStreamer() { return texture_streamer_; }
+    //files loaded once and shared, see ResourceManager.h
+    ResourceManager& getResources() { return resources_; }
     int createTerrainGeometry(int resolution, float step, float max_height, ImageData& height_map);
 
+	//skinned crowds: RGBA float palettes baked by AnimationSystem::bakeClip
+	void setAnimationTexture(const std::vector<float>& texels, int width, int height);
+	int getCrowdInstancesDrawn() { return crowd_instances_drawn_; }
+
 	//lights update
 	bool needUpdateLights = true;
 	void createLight(int type);
+
+	//per pass gpu timings
+	void setProfiler(FrameProfiler* profiler) { profiler_ = profiler; }
     
 private:
+	FrameProfiler* profiler_ = nullptr;
+	void beginPass_(const char* name) { if (profiler_) profiler_->beginGPU(name); }
+	void endPass_(const char* name) { if (profiler_) profiler_->endGPU(name); }
+
     //resources
     std::string assets_folder_;
 	std::unordered_map<GLint, Shader*> shaders_; //compiled id, pointer
     std::vector<Geometry> geometries_;
     std::vector<Material> materials_;
+    std::vector<int> free_geometries_, free_materials_; //released, to be reused
+    MeshCache mesh_cache_;
+    ShaderCache shader_cache_;
+    int importGeometry_(std::string filename, bool multi);
 
     //viewport
     int viewport_width_, viewport_height_;
@@ -76,9 +130,21 @@ private:
 	void useShader(Shader* s);
 	void useShader(GLuint p);
 
-	//materials stuff
+	//materials stuff: the parameter blocks of all materials are kept in one
+	//uniform buffer, each distinct block once. Changing material binds its
+	//block's range (if it is another block) and its textures
     GLint current_material_ = -1;
-    void setMaterialUniforms();
+    GLuint MATERIAL_BINDING_POINT = 3;
+    GLuint material_ubo_ = 0;
+    GLsizeiptr material_stride_ = 0; //block size rounded up to the offset alignment
+    std::vector<MaterialBlock> material_blocks_; //per material, as last uploaded
+    std::vector<int> material_slots_; //per material, its block in material_ubo_
+    int num_material_slots_ = 0;
+    int current_material_slot_ = -1;
+    Shader* material_shader_ = nullptr; //shader the per shader uniforms were set for
+    void updateMaterialBuffer_();
+    void setShaderUniforms_();
+    void bindMaterial_();
 
 	//sorting and checking and abstracting
 	void sortMeshes_();
@@ -99,13 +165,35 @@ private:
 	//framebuffers
 	Shader* screen_space_shader_;
 	int screen_space_geom_;
-	Framebuffer frame_;
+	Framebuffer frame_; //scene target when rendering below screen resolution
+
+	//dynamic resolution: scene is drawn into the lower left render_width_ x
+	//render_height_ of frame_/gbuffer_, then upscaled to the screen
+	float render_scale_ = 1.0f;
+	int render_width_ = 0, render_height_ = 0;
+	GLuint sceneFramebuffer_() { return render_scale_ < 1.0f ? frame_.framebuffer : 0; }
+	void resolveSceneToScreen_();
 
 	//shadowing
 	Shader* depth_shader_ = nullptr;
+	Shader* depth_skinned_shader_ = nullptr;
 	Shader* screen_depth_shader_ = nullptr;
 	Framebuffer shadow_frame_[MAX_LIGHTS];
+	int num_shadow_frames_ = 0;
+	int shadow_resolution_ = 2048;
+	int shadow_interval_ = 1; //render shadow maps every n frames
+	int shadow_frame_counter_ = 0;
+	void initShadowFrames_();
+
+	//texture mip bias applied to all material textures
+	float lod_bias_ = 0.0f;
+
+	//streamed textures get their priority from how big they are drawn
+	TextureStreamer texture_streamer_;
+	ResourceManager resources_;
+	void reportTextureSizes_(const Mesh& comp, const Geometry& geom, const lm::mat4& model_matrix, const Camera& cam);
 	void renderDepth_(Mesh& comp, const Light& light);
+	void renderSkinnedDepth_(SkinnedMesh& comp, const Light& light);
     
     //gbuffer
     Shader* gbuffer_shader_ = nullptr;
@@ -116,22 +204,47 @@ private:
     void renderLightVolumes();
     int sphere_volume_geom_;
     int cone_volume_geom_;
+    void benchmarkGbufferFillRate_(int iterations);
+    Shader* bench_write_shader_[2] = { nullptr, nullptr }; //0 - old layout, 1 - compact
+    Shader* bench_read_shader_[2] = { nullptr, nullptr };
+
+    //light volumes are drawn instanced, one instance per visible light
+    std::vector<GLint> visible_directional_lights_;
+    std::vector<GLint> visible_point_lights_;
+    std::vector<GLint> visible_spot_lights_;
+    void cullLightVolumes_();
+    bool sphereInFrustum_(const lm::vec3& center, float radius, const lm::mat4& view_projection);
     
     //cubemap/environment
     int cube_map_geom_ = -1;
     GLuint environment_program_ = 0;
     GLuint environment_tex_ = 0;
     
-    //bones/skinnning
-    void getJointMatrices(Joint* current,
-                     lm::mat4 current_model,
-                     std::vector<float>& pos_matrices,
-                     std::vector<float>& bind_matrices,
-                     int& joint_count);
+    //bones/skinnning: palettes are computed by AnimationSystem, uploaded
+    //once per frame and bound for every pass which draws the mesh
+    GLuint SKIN_BINDING_POINT = 2;
+    void uploadSkinPalettes_();
+    void bindSkinPalette_(SkinnedMesh& comp, Shader* shader);
+    bool skinnedInFrustum_(SkinnedMesh& comp, const lm::mat4& view_projection);
+    
+    //skinned crowds: one instanced draw per crowd, poses read from the
+    //baked animation texture. Instance data is rebuilt for each pass from
+    //the instances inside that pass's frustum
+    const GLuint CROWD_INSTANCE_LOCATION = 5; //model matrix, then playback
+    const GLuint ANIM_TEXTURE_UNIT = 16; //0-7 shadow maps, 8-15 material maps
+    const GLuint BLEND_TEXTURE_UNIT = 17; //sparse blend shape deltas
+    Shader* crowd_shader_ = nullptr;
+    Shader* crowd_depth_shader_ = nullptr;
+    GLuint anim_texture_ = 0;
+    std::vector<float> crowd_instance_data_;
+    int crowd_instances_drawn_ = 0;
+    int updateCrowdInstances_(SkinnedCrowd& crowd, const lm::mat4& view_projection);
+    void renderCrowd_(SkinnedCrowd& crowd, Shader* shader, const lm::mat4& view_projection);
     
     //rendering
-    void renderMeshComponent_(Mesh& comp);
+    void renderMeshComponent_(Mesh& comp, bool cull = true);
     void renderSkinnedMeshComponent_(SkinnedMesh& comp);
+    void renderSkinnedCrowds_();
     void renderEnvironment_();
     void previewTextureViewport(GLuint texture_id);
     
@@ -185,4 +298,61 @@ private:
 		"void main() {\n"
 		"}\n";
 
+	//gbuffer benchmark shaders, old layout writes world position explicitly
+	const char* bench_write_legacy_fragment_shader_ =
+		"#version 330\n"
+		"in vec2 v_uv;\n"
+		"layout(location = 0) out vec3 g_position;\n"
+		"layout(location = 1) out vec3 g_normal;\n"
+		"layout(location = 2) out vec4 g_albedo;\n"
+		"void main() {\n"
+		"   g_position = vec3(v_uv * 100.0, 10.0);\n"
+		"   g_normal = normalize(vec3(v_uv, 1.0));\n"
+		"   g_albedo = vec4(v_uv, 0.5, 0.5);\n"
+		"}\n";
+
+	const char* bench_write_compact_fragment_shader_ =
+		"#version 330\n"
+		"in vec2 v_uv;\n"
+		"layout(location = 0) out vec2 g_normal;\n"
+		"layout(location = 1) out vec4 g_albedo;\n"
+		"void main() {\n"
+		"   g_normal = v_uv;\n"
+		"   g_albedo = vec4(v_uv, 0.5, 0.5);\n"
+		"}\n";
+
+	const char* bench_read_legacy_fragment_shader_ =
+		"#version 330\n"
+		"in vec2 v_uv;\n"
+		"layout(location = 0) out vec4 fragColor;\n"
+		"uniform sampler2D u_screen_texture;\n" //position
+		"uniform sampler2D u_tex_normal;\n"
+		"uniform sampler2D u_tex_albedo;\n"
+		"void main() {\n"
+		"   vec3 position = texture(u_screen_texture, v_uv).xyz;\n"
+		"   vec3 N = texture(u_tex_normal, v_uv).xyz;\n"
+		"   vec4 albedo = texture(u_tex_albedo, v_uv);\n"
+		"   fragColor = vec4(albedo.xyz * max(0.0, dot(N, normalize(-position))), 1.0);\n"
+		"}\n";
+
+	const char* bench_read_compact_fragment_shader_ =
+		"#version 330\n"
+		"in vec2 v_uv;\n"
+		"layout(location = 0) out vec4 fragColor;\n"
+		"uniform sampler2D u_tex_depth;\n"
+		"uniform sampler2D u_tex_normal;\n"
+		"uniform sampler2D u_tex_albedo;\n"
+		"uniform mat4 u_inv_vp;\n"
+		"void main() {\n"
+		"   vec4 world = u_inv_vp * vec4(v_uv * 2.0 - 1.0, texture(u_tex_depth, v_uv).r * 2.0 - 1.0, 1.0);\n"
+		"   vec3 position = world.xyz / world.w;\n"
+		"   vec2 f = texture(u_tex_normal, v_uv).xy * 2.0 - 1.0;\n"
+		"   vec3 N = vec3(f, 1.0 - abs(f.x) - abs(f.y));\n"
+		"   float t = clamp(-N.z, 0.0, 1.0);\n"
+		"   N.xy += vec2(N.x >= 0.0 ? -t : t, N.y >= 0.0 ? -t : t);\n"
+		"   N = normalize(N);\n"
+		"   vec4 albedo = texture(u_tex_albedo, v_uv);\n"
+		"   fragColor = vec4(albedo.xyz * max(0.0, dot(N, normalize(-position))), 1.0);\n"
+		"}\n";
+
 };
@@ -1,4 +1,7 @@
 #include "GraphicsUtilities.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 
 // ****** GEOMETRY ***** //
 
@@ -9,7 +12,7 @@ Geometry::Geometry(std::vector<float>& vertices, std::vector<float>& uvs, std::v
 
 void Geometry::render() {
 	glBindVertexArray(vao);
-	glDrawElements(GL_TRIANGLES, num_tris * 3, GL_UNSIGNED_INT, 0);
+	glDrawElements(GL_TRIANGLES, num_tris * 3, index_type, 0);
 	glBindVertexArray(0);
 }
 
@@ -20,7 +23,7 @@ void Geometry::render(int set) {
     //if first set, draw from start to "end of set 0" (* 3 to convert from triangles
     //to indices)
     if (set == 0)
-        glDrawElements(GL_TRIANGLES, material_sets[set] * 3, GL_UNSIGNED_INT, 0);
+        glDrawElements(GL_TRIANGLES, material_sets[set] * 3, index_type, 0);
     else {
         //start triangle is end triangle of previous set
         GLuint start_index = material_sets[set - 1] * 3;
@@ -31,12 +34,68 @@ void Geometry::render(int set) {
         
         glDrawElements(GL_TRIANGLES, //things to draw
                        count, //number of indices
-                       GL_UNSIGNED_INT, //format of indices
-                       (void*)(start_index * sizeof(GLuint))); //pointer to start!
+                       index_type, //format of indices
+                       (void*)(uintptr_t)((size_t)start_index * index_size)); //pointer to start!
     }
     glBindVertexArray(0);
 }
 
+//draws the whole geometry num_instances times, instance attributes must have
+//been added with addInstanceIdBuffer
+void Geometry::renderInstanced(GLsizei num_instances) {
+    if (num_instances <= 0) return;
+    glBindVertexArray(vao);
+    glDrawElementsInstanced(GL_TRIANGLES, num_tris * 3, index_type, 0, num_instances);
+    glBindVertexArray(0);
+}
+
+//creates a dynamic buffer of integer ids which advances once per instance
+//(e.g. index of a light in the light ubo)
+int Geometry::addInstanceIdBuffer(GLuint attrib_location, GLsizei max_instances) {
+    glBindVertexArray(vao);
+    glGenBuffers(1, &instance_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, max_instances * sizeof(GLint), NULL, GL_DYNAMIC_DRAW);
+    glEnableVertexAttribArray(attrib_location);
+    glVertexAttribIPointer(attrib_location, 1, GL_INT, 0, 0);
+    glVertexAttribDivisor(attrib_location, 1);
+    glBindVertexArray(0);
+    return 1;
+}
+
+//uploads the ids for the next instanced draw
+void Geometry::updateInstanceIds(const std::vector<GLint>& ids) {
+    if (!instance_vbo || ids.empty()) return;
+    glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, ids.size() * sizeof(GLint), &(ids[0]));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+//creates an empty interleaved buffer of per instance vec4s, sized on upload
+int Geometry::addInstanceDataBuffer(GLuint first_location, int num_vec4) {
+    GLsizei stride = num_vec4 * 4 * sizeof(float);
+    glBindVertexArray(vao);
+    glGenBuffers(1, &instance_data_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, instance_data_vbo);
+    for (int i = 0; i < num_vec4; i++) {
+        glEnableVertexAttribArray(first_location + i);
+        glVertexAttribPointer(first_location + i, 4, GL_FLOAT, GL_FALSE, stride, (GLvoid*)(i * 4 * sizeof(float)));
+        glVertexAttribDivisor(first_location + i, 1);
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return 1;
+}
+
+//uploads the instance data for the next instanced draw. The old storage is
+//orphaned, so a draw still reading it never stalls the upload
+void Geometry::updateInstanceData(const std::vector<float>& data) {
+    if (!instance_data_vbo || data.empty()) return;
+    glBindBuffer(GL_ARRAY_BUFFER, instance_data_vbo);
+    glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(float), &(data[0]), GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
 void Geometry::createMaterialSet(int tri_count, int material_id) {
     material_sets.push_back(tri_count);
     material_set_ids.push_back(material_id);
@@ -49,10 +108,11 @@ void Geometry::createVertexArrays(std::vector<float>& vertices, std::vector<floa
 	glGenVertexArrays(1, &vao);
 	glBindVertexArray(vao);
 	GLuint vbo;
-	//positions
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	//positions, kept to be rewritten by cpu blend shapes
+	glGenBuffers(1, &position_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, position_vbo);
 	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &(vertices[0]), GL_STATIC_DRAW);
+	num_vertices = (GLuint)vertices.size() / 3;
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
 	//texture coords
@@ -83,6 +143,55 @@ void Geometry::createVertexArrays(std::vector<float>& vertices, std::vector<floa
 	setAABB(vertices);
 }
 
+//half_uvs: two half floats per uv, snorm_normals: four normalized shorts per
+//normal (w unused), index_bytes: 2 or 4
+void Geometry::createPackedVertexArrays(const float* vertices, const void* uvs, const void* normals, GLuint vertex_count,
+                                        const void* indices, GLuint index_count, GLuint index_bytes,
+                                        bool half_uvs, bool snorm_normals) {
+    
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+	GLuint vbo;
+	//positions
+	glGenBuffers(1, &position_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, position_vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertex_count * 3 * sizeof(float), vertices, GL_STATIC_DRAW);
+	num_vertices = vertex_count;
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	//texture coords
+	glGenBuffers(1, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertex_count * 2 * (half_uvs ? sizeof(GLushort) : sizeof(float)), uvs, GL_STATIC_DRAW);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 2, half_uvs ? GL_HALF_FLOAT : GL_FLOAT, GL_FALSE, 0, 0);
+	//normals
+	glGenBuffers(1, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	if (snorm_normals) {
+		glBufferData(GL_ARRAY_BUFFER, vertex_count * 4 * sizeof(GLshort), normals, GL_STATIC_DRAW);
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 3, GL_SHORT, GL_TRUE, 4 * sizeof(GLshort), 0);
+	}
+	else {
+		glBufferData(GL_ARRAY_BUFFER, vertex_count * 3 * sizeof(float), normals, GL_STATIC_DRAW);
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	}
+	//indices
+	GLuint ibo;
+	glGenBuffers(1, &ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_count * index_bytes, indices, GL_STATIC_DRAW);
+	//unbind
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+
+	index_size = index_bytes;
+	index_type = index_bytes == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	num_tris = index_count / 3;
+}
+
 int Geometry::createTerrain(int resolution, float step, float the_max_height, ImageData& height_map){
     //set max_height of geometry
     max_terrain_height = the_max_height;
@@ -233,6 +342,30 @@ int Geometry::addVertexWeights(std::vector<lm::vec4>& vertex_weights,
         ids[i*4+3] = (float)vertex_jointids[i].w;
     }
     
+    //per joint bounds, from the positions already on the gpu
+    std::vector<float> positions(vertex_weights.size() * 3);
+    if (!positions.empty() && vertex_weights.size() <= num_vertices) {
+        glBindBuffer(GL_ARRAY_BUFFER, position_vbo);
+        glGetBufferSubData(GL_ARRAY_BUFFER, 0, positions.size() * sizeof(float), &(positions[0]));
+        joint_bounds_min.clear();
+        joint_bounds_max.clear();
+        for (size_t i = 0; i < vertex_weights.size(); i++) {
+            lm::vec3 p(positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2]);
+            for (int k = 0; k < 4; k++) {
+                if (weights[i * 4 + k] <= 0.0f || ids[i * 4 + k] < 0.0f) continue;
+                size_t j = (size_t)ids[i * 4 + k];
+                if (j >= joint_bounds_min.size()) {
+                    joint_bounds_min.resize(j + 1, lm::vec3(1e30f, 1e30f, 1e30f));
+                    joint_bounds_max.resize(j + 1, lm::vec3(-1e30f, -1e30f, -1e30f));
+                }
+                lm::vec3& mn = joint_bounds_min[j];
+                lm::vec3& mx = joint_bounds_max[j];
+                mn = lm::vec3(std::min(mn.x, p.x), std::min(mn.y, p.y), std::min(mn.z, p.z));
+                mx = lm::vec3(std::max(mx.x, p.x), std::max(mx.y, p.y), std::max(mx.z, p.z));
+            }
+        }
+    }
+    
     
     glBindVertexArray(vao);
     GLuint vbo;
@@ -253,24 +386,190 @@ int Geometry::addVertexWeights(std::vector<lm::vec4>& vertex_weights,
     return 1;
 }
 
-int Geometry::addBlendShape(std::vector<float>& blend_offsets) {
+//blend_positions holds the target shape, one position per vertex in the same
+//order as the geometry. Only vertices which move more than a quantization
+//step are stored
+int Geometry::addBlendShape(std::vector<float>& blend_positions) {
     
-    //increase blend shape counter
-    num_blend_shapes++;
+    if (blend_positions.size() != num_vertices * 3) {
+        std::cout << "ERROR: blend shape has " << blend_positions.size() / 3 << " vertices, geometry has " << num_vertices << std::endl;
+        return -1;
+    }
+    if (blend_shapes.size() >= MAX_BLEND_SHAPES) {
+        std::cout << "ERROR: geometry already has MAX_BLEND_SHAPES blend shapes" << std::endl;
+        return -1;
+    }
     
-    //attribute location is 2 (positions(0) + normals(1) + uvs(2)) + num_blend_shapes
-    GLuint new_attrib_location = 2 + num_blend_shapes;
+    //the first shape reads back the unblended positions
+    if (blend_base_positions.empty()) {
+        blend_base_positions.resize(num_vertices * 3);
+        glBindBuffer(GL_ARRAY_BUFFER, position_vbo);
+        glGetBufferSubData(GL_ARRAY_BUFFER, 0, blend_base_positions.size() * sizeof(float), &(blend_base_positions[0]));
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
     
-    glBindVertexArray(vao);
-    GLuint vbo;
+    SparseBlendShape shape;
+    float max_delta = 0.0f;
+    for (size_t i = 0; i < blend_positions.size(); i++)
+        max_delta = std::max(max_delta, std::abs(blend_positions[i] - blend_base_positions[i]));
+    shape.scale = max_delta / 32767.0f;
+    
+    if (max_delta > 0.0f) {
+        float inv_scale = 1.0f / shape.scale;
+        for (GLuint v = 0; v < num_vertices; v++) {
+            int16_t q[3];
+            for (int k = 0; k < 3; k++)
+                q[k] = (int16_t)std::lround((blend_positions[v * 3 + k] - blend_base_positions[v * 3 + k]) * inv_scale);
+            if (q[0] == 0 && q[1] == 0 && q[2] == 0)
+                continue;
+            shape.vertices.push_back(v);
+            shape.dx.push_back(q[0]);
+            shape.dy.push_back(q[1]);
+            shape.dz.push_back(q[2]);
+        }
+    }
+    blend_shapes.push_back(std::move(shape));
+    updateBlendShapeBuffers();
     
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, blend_offsets.size() * sizeof(float), &(blend_offsets[0]), GL_STATIC_DRAW);
-    glEnableVertexAttribArray(new_attrib_location);
-    glVertexAttribPointer(new_attrib_location, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    return (int)blend_shapes.size() - 1;
+}
+
+//regroups every shape's deltas by vertex for the vertex shader, which then
+//only loops over the deltas of its own vertex
+void Geometry::updateBlendShapeBuffers() {
+    
+    //per vertex ranges, from a count of deltas per vertex
+    std::vector<GLint> ranges(num_vertices * 2, 0);
+    for (auto& shape : blend_shapes)
+        for (GLuint v : shape.vertices)
+            ranges[v * 2 + 1]++;
+    GLint total = 0;
+    for (GLuint v = 0; v < num_vertices; v++) {
+        ranges[v * 2] = total;
+        total += ranges[v * 2 + 1];
+    }
     
-    return 1;
+    std::vector<int16_t> texels(std::max(total, 1) * 4, 0);
+    std::vector<GLint> next(num_vertices);
+    for (GLuint v = 0; v < num_vertices; v++)
+        next[v] = ranges[v * 2];
+    for (size_t s = 0; s < blend_shapes.size(); s++) {
+        const SparseBlendShape& shape = blend_shapes[s];
+        for (int i = 0; i < shape.size(); i++) {
+            int16_t* texel = &texels[next[shape.vertices[i]]++ * 4];
+            texel[0] = shape.dx[i];
+            texel[1] = shape.dy[i];
+            texel[2] = shape.dz[i];
+            texel[3] = (int16_t)s;
+        }
+    }
+    
+    glBindVertexArray(vao);
+    if (!blend_range_vbo)
+        glGenBuffers(1, &blend_range_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, blend_range_vbo);
+    glBufferData(GL_ARRAY_BUFFER, ranges.size() * sizeof(GLint), &(ranges[0]), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(3);
+    glVertexAttribIPointer(3, 2, GL_INT, 0, 0);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    
+    if (!blend_delta_buffer) {
+        glGenBuffers(1, &blend_delta_buffer);
+        glGenTextures(1, &blend_delta_texture);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, blend_delta_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, texels.size() * sizeof(int16_t), &(texels[0]), GL_STATIC_DRAW);
+    glBindTexture(GL_TEXTURE_BUFFER, blend_delta_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA16I, blend_delta_buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+//gpu bytes for blend shapes: deltas plus one range per vertex
+size_t Geometry::blendShapeBytes() const {
+    size_t deltas = 0;
+    for (auto& shape : blend_shapes)
+        deltas += shape.vertices.size();
+    return deltas * 4 * sizeof(int16_t) + (blend_shapes.empty() ? 0 : num_vertices * 2 * sizeof(GLint));
+}
+
+void Geometry::updatePositions(const std::vector<float>& positions, GLuint first_vertex, GLuint count) {
+    if (!position_vbo || count == 0) return;
+    glBindBuffer(GL_ARRAY_BUFFER, position_vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, first_vertex * 3 * sizeof(float), count * 3 * sizeof(float), &(positions[first_vertex * 3]));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+//buffers are not all kept in members, so they are read back from the vao
+void Geometry::collectBuffers(std::vector<GLuint>& buffers) const {
+    buffers.clear();
+    if (!vao) return;
+    GLint max_attribs = 0, buffer = 0;
+    glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &max_attribs);
+    glBindVertexArray(vao);
+    for (GLint i = 0; i < max_attribs; i++) {
+        glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &buffer);
+        if (buffer) buffers.push_back(buffer);
+    }
+    glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &buffer);
+    if (buffer) buffers.push_back(buffer);
+    glBindVertexArray(0);
+    if (blend_delta_buffer) buffers.push_back(blend_delta_buffer);
+    std::sort(buffers.begin(), buffers.end());
+    buffers.erase(std::unique(buffers.begin(), buffers.end()), buffers.end());
+}
+
+size_t Geometry::gpuBytes() const {
+    std::vector<GLuint> buffers;
+    collectBuffers(buffers);
+    size_t total = 0;
+    for (GLuint buffer : buffers) {
+        GLint size = 0;
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
+        total += size;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return total;
+}
+
+void Geometry::destroy() {
+    std::vector<GLuint> buffers;
+    collectBuffers(buffers);
+    if (!buffers.empty())
+        glDeleteBuffers((GLsizei)buffers.size(), buffers.data());
+    if (blend_delta_texture)
+        glDeleteTextures(1, &blend_delta_texture);
+    if (vao)
+        glDeleteVertexArrays(1, &vao);
+    *this = Geometry();
+}
+
+/*******************
+ * MATERIAL *
+ ******************/
+
+MaterialBlock Material::parameterBlock() const {
+    MaterialBlock block;
+    memset(&block, 0, sizeof(block));
+    block.ambient[0] = ambient.x; block.ambient[1] = ambient.y; block.ambient[2] = ambient.z;
+    block.diffuse[0] = diffuse.x; block.diffuse[1] = diffuse.y; block.diffuse[2] = diffuse.z;
+    block.specular[0] = specular.x; block.specular[1] = specular.y; block.specular[2] = specular.z;
+    block.specular_gloss = specular_gloss;
+    block.normal_factor = normal_factor;
+    block.max_height = height;
+    block.uv_scale[0] = uv_scale.x;
+    block.uv_scale[1] = uv_scale.y;
+    block.use_diffuse_map = diffuse_map != -1;
+    block.use_diffuse_map_2 = diffuse_map_2 != -1;
+    block.use_diffuse_map_3 = diffuse_map_3 != -1;
+    block.use_normal_map = normal_map != -1;
+    block.use_specular_map = specular_map != -1;
+    block.use_reflection_map = cube_map != -1;
+    block.use_noise_map = noise_map != -1;
+    block.use_transparency_map = transparency_map != -1;
+    return block;
 }
 
 /*******************
@@ -369,45 +668,36 @@ void Framebuffer::initGbuffer(GLsizei w, GLsizei h) {
     //create and bind
     glGenFramebuffers(1, &(framebuffer));
     glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-    //position
+    //depth + stencil, sampled to reconstruct world position (no position texture)
     glGenTextures(1, &(color_textures[0]));
     glBindTexture(GL_TEXTURE_2D, color_textures[0]);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color_textures[0], 0);
-    
-    //normal
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width, height, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, color_textures[0], 0);
+    
+    //normal, octahedral encoded in two 16 bit channels
     glGenTextures(1, &(color_textures[1]));
     glBindTexture(GL_TEXTURE_2D, color_textures[1]);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, color_textures[1], 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16, width, height, 0, GL_RG, GL_UNSIGNED_SHORT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color_textures[1], 0);
     
     //diffuse + specular (in A channel)
     glGenTextures(1, &(color_textures[2]));
     glBindTexture(GL_TEXTURE_2D, color_textures[2]);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, color_textures[2], 0);
-    
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, color_textures[2], 0);
     
     // - tell OpenGL which color attachments we'll use
     // (of this framebuffer) for rendering
-    unsigned int attachments[3] = { GL_COLOR_ATTACHMENT0,
-        GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
-    glDrawBuffers(3, attachments);
-    
-    unsigned int rbo;
-    glGenRenderbuffers(1, &rbo);
-    glBindRenderbuffer(GL_RENDERBUFFER, rbo);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
-    glBindRenderbuffer(GL_RENDERBUFFER, 0);
-    
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
-                              GL_RENDERBUFFER, rbo);
+    unsigned int attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, attachments);
     
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
         std::cout << "ERROR::Framebuffer is not complete!" << std::endl;
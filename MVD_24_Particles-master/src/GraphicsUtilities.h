@@ -2,6 +2,7 @@
 #include "includes.h"
 #include "Shader.h"
 #include "Components.h"
+#include <cstdint>
 struct AABB {
 	lm::vec3 center;
 	lm::vec3 half_width;
@@ -26,6 +27,18 @@ struct ImageData {
     }
 };
 
+//must match MAX_BLEND_SHAPES in phong_blend.vert
+#define MAX_BLEND_SHAPES 32
+
+//one blend shape, only the vertices it moves. Deltas are quantized to
+//16 bits per axis, delta = q * scale
+struct SparseBlendShape {
+    float scale = 0.0f;
+    std::vector<GLuint> vertices;
+    std::vector<int16_t> dx, dy, dz;
+    int size() const { return (int)vertices.size(); }
+};
+
 struct Geometry {
     
     //constructors
@@ -37,6 +50,10 @@ struct Geometry {
 	GLuint vao;
 	GLuint num_tris;
 	AABB aabb;
+	GLuint position_vbo = 0;
+	GLuint num_vertices = 0;
+	GLenum index_type = GL_UNSIGNED_INT;
+	GLuint index_size = sizeof(GLuint);
     
     //material sets
     void createMaterialSet(int tri_count, int material_id);
@@ -46,9 +63,24 @@ struct Geometry {
     //rendering
     void render();
     void render(int set);
+    void renderInstanced(GLsizei num_instances);
+
+    //instancing - one integer per instance, read with a divisor of 1
+    GLuint instance_vbo = 0;
+    int addInstanceIdBuffer(GLuint attrib_location, GLsizei max_instances);
+    void updateInstanceIds(const std::vector<GLint>& ids);
+    //instancing - num_vec4 float vec4 attributes per instance, from
+    //first_location on (a mat4 takes four locations)
+    GLuint instance_data_vbo = 0;
+    int addInstanceDataBuffer(GLuint first_location, int num_vec4);
+    void updateInstanceData(const std::vector<float>& data);
 
 	//geometry, arrays and AABB
 	void createVertexArrays(std::vector<float>& vertices, std::vector<float>& uvs, std::vector<float>& normals, std::vector<unsigned int>& indices);
+    //from packed streams (see MeshCache), does not set the AABB
+    void createPackedVertexArrays(const float* vertices, const void* uvs, const void* normals, GLuint vertex_count,
+                                  const void* indices, GLuint index_count, GLuint index_bytes,
+                                  bool half_uvs, bool snorm_normals);
     int createPlaneGeometry();
 	void setAABB(std::vector<GLfloat>& vertices);
     
@@ -58,12 +90,46 @@ struct Geometry {
     lm::vec3 calculateTerrainNormal(ImageData& height_map, int x, int y);
     
     //animation
+    //bind pose bounds of the vertices each joint moves, indexed like the
+    //joint ids. Joints which move no vertex have min > max
+    std::vector<lm::vec3> joint_bounds_min, joint_bounds_max;
     int addVertexWeights(std::vector<lm::vec4>& vertex_weights,
                          std::vector<lm::ivec4>& vertex_jointids);
-    GLuint num_blend_shapes = 0;
-    int addBlendShape(std::vector<float>& blend_offsets);
-    std::vector<float> blend_weights;
+    //blend shapes are stored sparsely, see SparseBlendShape. The gpu copy is
+    //grouped by vertex: a texture buffer of (dx, dy, dz, shape) int16 texels,
+    //and a (first, count) range into it per vertex at attribute 3
+    std::vector<SparseBlendShape> blend_shapes;
+    std::vector<float> blend_base_positions; //unblended, for cpu evaluation
+    GLuint blend_range_vbo = 0;
+    GLuint blend_delta_buffer = 0;
+    GLuint blend_delta_texture = 0;
+    int addBlendShape(std::vector<float>& blend_positions);
+    void updateBlendShapeBuffers();
+    size_t blendShapeBytes() const;
+    //rewrites count vertex positions from first_vertex (cpu blend shapes)
+    void updatePositions(const std::vector<float>& positions, GLuint first_vertex, GLuint count);
 
+    //every buffer the vao reads from, plus the blend shape deltas
+    void collectBuffers(std::vector<GLuint>& buffers) const;
+    size_t gpuBytes() const;
+    //deletes the vao and its buffers, leaving an empty geometry
+    void destroy();
+
+};
+
+//a material's parameters as the shaders read them: std140 layout of
+//u_material_ubo, so it can be copied straight into the material buffer
+struct MaterialBlock {
+	GLfloat ambient[3];
+	GLfloat specular_gloss;
+	GLfloat diffuse[3];
+	GLfloat normal_factor;
+	GLfloat specular[3];
+	GLfloat max_height;
+	GLfloat uv_scale[2];
+	GLint use_diffuse_map, use_diffuse_map_2, use_diffuse_map_3, use_normal_map;
+	GLint use_specular_map, use_reflection_map, use_noise_map, use_transparency_map;
+	GLint padding[2];
 };
 
 struct Material {
@@ -106,6 +172,10 @@ struct Material {
         uv_scale = lm::vec2(1.0f, 1.0f);
         height = 0.0f;
 	}
+
+	//everything but the textures themselves, materials differing only in
+	//those have the same block
+	MaterialBlock parameterBlock() const;
 };
 
 struct Framebuffer {
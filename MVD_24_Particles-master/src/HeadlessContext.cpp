@@ -0,0 +1,120 @@
+//
+//  HeadlessContext.cpp
+//
+#include "HeadlessContext.h"
+
+#ifdef __linux__
+
+//creates a pbuffer the size of the viewport, so framebuffer 0 exists and has
+//the same depth/stencil format as the gbuffer (needed for depth blits)
+bool HeadlessContext::init(int width, int height) {
+
+	//prefer the surfaceless platform, it needs no X or wayland server
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay)
+		display_ = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (display_ == EGL_NO_DISPLAY)
+		display_ = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	EGLint major, minor;
+	if (display_ == EGL_NO_DISPLAY || !eglInitialize(display_, &major, &minor)) {
+		std::cerr << "HEADLESS ERROR: could not initialise EGL display" << std::endl;
+		return false;
+	}
+
+	const EGLint config_attribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+		EGL_DEPTH_SIZE, 24, EGL_STENCIL_SIZE, 8,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint num_configs = 0;
+	if (!eglChooseConfig(display_, config_attribs, &config, 1, &num_configs) || num_configs == 0) {
+		std::cerr << "HEADLESS ERROR: no EGL pbuffer config with RGBA8/D24S8" << std::endl;
+		return false;
+	}
+
+	const EGLint pbuffer_attribs[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+	surface_ = eglCreatePbufferSurface(display_, config, pbuffer_attribs);
+	if (surface_ == EGL_NO_SURFACE) {
+		std::cerr << "HEADLESS ERROR: could not create EGL pbuffer" << std::endl;
+		return false;
+	}
+
+	eglBindAPI(EGL_OPENGL_API);
+	const EGLint context_attribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	context_ = eglCreateContext(display_, config, EGL_NO_CONTEXT, context_attribs);
+	if (context_ == EGL_NO_CONTEXT) {
+		std::cerr << "HEADLESS ERROR: could not create OpenGL 3.3 core context" << std::endl;
+		return false;
+	}
+
+	if (!eglMakeCurrent(display_, surface_, surface_, context_)) {
+		std::cerr << "HEADLESS ERROR: could not make EGL context current" << std::endl;
+		return false;
+	}
+
+	backend_name_ = "EGL " + std::to_string(major) + "." + std::to_string(minor) + " pbuffer";
+	return true;
+}
+
+void HeadlessContext::swapBuffers() {
+	eglSwapBuffers(display_, surface_);
+}
+
+void HeadlessContext::shutdown() {
+	if (display_ == EGL_NO_DISPLAY)
+		return;
+	eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (context_ != EGL_NO_CONTEXT) eglDestroyContext(display_, context_);
+	if (surface_ != EGL_NO_SURFACE) eglDestroySurface(display_, surface_);
+	eglTerminate(display_);
+	display_ = EGL_NO_DISPLAY;
+	surface_ = EGL_NO_SURFACE;
+	context_ = EGL_NO_CONTEXT;
+}
+
+#else
+
+//no EGL on this platform, fall back to a window which is never shown
+bool HeadlessContext::init(int width, int height) {
+	if (!glfwInit())
+		return false;
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	window_ = glfwCreateWindow(width, height, "headless", NULL, NULL);
+	if (!window_) {
+		std::cerr << "HEADLESS ERROR: could not create hidden GLFW window" << std::endl;
+		glfwTerminate();
+		return false;
+	}
+	glfwMakeContextCurrent(window_);
+	glfwSwapInterval(0);
+	backend_name_ = "hidden GLFW window";
+	return true;
+}
+
+void HeadlessContext::swapBuffers() {
+	glfwSwapBuffers(window_);
+}
+
+void HeadlessContext::shutdown() {
+	if (!window_)
+		return;
+	glfwDestroyWindow(window_);
+	glfwTerminate();
+	window_ = nullptr;
+}
+
+#endif
@@ -0,0 +1,33 @@
+//
+//  HeadlessContext.h
+//
+//  Offscreen OpenGL 3.3 core context for benchmark and CI runs, so the
+//  renderer can run on machines without a display or GPU.
+//  - Linux: EGL pbuffer (surfaceless platform if available), which also
+//    works with Mesa llvmpipe. Link with -lEGL.
+//  - elsewhere: invisible GLFW window
+//
+#pragma once
+#include "includes.h"
+
+#ifdef __linux__
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+class HeadlessContext {
+public:
+	~HeadlessContext() { shutdown(); }
+	bool init(int width, int height);
+	void swapBuffers();
+	void shutdown();
+	std::string getBackendName() { return backend_name_; }
+private:
+	std::string backend_name_;
+#ifdef __linux__
+	EGLDisplay display_ = EGL_NO_DISPLAY;
+	EGLSurface surface_ = EGL_NO_SURFACE;
+	EGLContext context_ = EGL_NO_CONTEXT;
+#endif
+	GLFWwindow* window_ = nullptr;
+};
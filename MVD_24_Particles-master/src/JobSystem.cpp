@@ -0,0 +1,108 @@
+//
+//  JobSystem.cpp
+//
+#include "JobSystem.h"
+#include <algorithm>
+
+JobSystem::~JobSystem() {
+	shutdown();
+}
+
+void JobSystem::init(int num_threads) {
+	shutdown();
+	if (num_threads <= 0)
+		num_threads = std::max(1, (int)std::thread::hardware_concurrency());
+	quit_ = false;
+	for (int i = 0; i < num_threads - 1; i++)
+		workers_.emplace_back(&JobSystem::workerLoop_, this);
+}
+
+void JobSystem::shutdown() {
+	wait();
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		quit_ = true;
+	}
+	start_cv_.notify_all();
+	for (auto& t : workers_)
+		t.join();
+	workers_.clear();
+}
+
+void JobSystem::parallelFor(int count, int batch_size, const std::function<void(int, int)>& fn) {
+	if (count <= 0) return;
+	batch_size = std::max(1, batch_size);
+
+	//not worth waking anyone, or they are busy with begin's loop
+	if (workers_.empty() || count <= batch_size || running_) {
+		fn(0, count);
+		return;
+	}
+
+	start_(count, batch_size, &fn);
+	wait();
+}
+
+void JobSystem::begin(int count, int batch_size, std::function<void(int, int)> fn) {
+	wait();
+	if (count <= 0) return;
+
+	//nobody to hand it to
+	if (workers_.empty()) {
+		fn(0, count);
+		return;
+	}
+	begun_fn_ = std::move(fn);
+	start_(count, std::max(1, batch_size), &begun_fn_);
+}
+
+//calling thread works too, then waits for the stragglers
+void JobSystem::wait() {
+	if (!running_) return;
+	runBatches_();
+	std::unique_lock<std::mutex> lock(mutex_);
+	done_cv_.wait(lock, [this] { return busy_workers_ == 0; });
+	fn_ = nullptr;
+	begun_fn_ = nullptr;
+	running_ = false;
+}
+
+void JobSystem::start_(int count, int batch_size, const std::function<void(int, int)>* fn) {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		fn_ = fn;
+		count_ = count;
+		batch_size_ = batch_size;
+		next_ = 0;
+		busy_workers_ = (int)workers_.size();
+		generation_++;
+	}
+	running_ = true;
+	start_cv_.notify_all();
+}
+
+void JobSystem::runBatches_() {
+	for (;;) {
+		int begin = next_.fetch_add(batch_size_);
+		if (begin >= count_) break;
+		(*fn_)(begin, std::min(begin + batch_size_, count_));
+	}
+}
+
+void JobSystem::workerLoop_() {
+	unsigned int seen_generation = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			start_cv_.wait(lock, [&] { return quit_ || generation_ != seen_generation; });
+			if (quit_) return;
+			seen_generation = generation_;
+		}
+		runBatches_();
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			busy_workers_--;
+		}
+		done_cv_.notify_one();
+	}
+}
@@ -0,0 +1,57 @@
+//
+//  JobSystem.h
+//
+//  Small fixed thread pool for data parallel loops. parallelFor splits a
+//  range into batches which worker threads (and the calling thread) pull
+//  from a shared counter, and returns once every batch has run.
+//  One loop runs at a time and it must be started from the main thread.
+//
+//  begin starts a loop on the workers only and returns, so the main thread
+//  can get on with something else (GL work while files are parsed); wait
+//  then helps with what is left. A parallelFor started in between runs on
+//  the calling thread alone.
+//
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobSystem {
+public:
+	~JobSystem();
+
+	//num_threads counts the calling thread, 0 uses every hardware thread
+	void init(int num_threads = 0);
+	void shutdown();
+	int getNumThreads() const { return (int)workers_.size() + 1; }
+
+	//calls fn(begin, end) for batches of at most batch_size indices in [0, count)
+	void parallelFor(int count, int batch_size, const std::function<void(int, int)>& fn);
+	void begin(int count, int batch_size, std::function<void(int, int)> fn);
+	void wait();
+	bool running() const { return running_; }
+
+private:
+	std::vector<std::thread> workers_;
+	std::mutex mutex_;
+	std::condition_variable start_cv_;
+	std::condition_variable done_cv_;
+	bool quit_ = false;
+
+	//current loop, read by workers once generation_ changes
+	const std::function<void(int, int)>* fn_ = nullptr;
+	int count_ = 0;
+	int batch_size_ = 1;
+	unsigned int generation_ = 0;
+	std::atomic<int> next_{ 0 };
+	int busy_workers_ = 0;
+	bool running_ = false; //a loop was started and not yet waited for
+	std::function<void(int, int)> begun_fn_; //begin's fn, fn_ points here
+
+	void start_(int count, int batch_size, const std::function<void(int, int)>* fn);
+	void workerLoop_();
+	void runBatches_();
+};
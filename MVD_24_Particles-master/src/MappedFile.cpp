@@ -0,0 +1,117 @@
+//
+//  MappedFile.cpp
+//
+#include "MappedFile.h"
+#include "AssetPack.h"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+bool MappedFile::open(const std::string& filename) {
+	close();
+	const AssetPack* pack = AssetPack::mounted();
+	if (pack && pack->find(filename, data_, size_)) {
+		is_open_ = true;
+		in_pack_ = true;
+		return true;
+	}
+	return openFile_(filename);
+}
+
+#ifdef _WIN32
+
+bool MappedFile::openFile_(const std::string& filename) {
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size)) {
+		CloseHandle(file);
+		return false;
+	}
+	file_ = file;
+	size_ = (size_t)size.QuadPart;
+	is_open_ = true;
+	//empty files can't be mapped, but are valid
+	if (size_ == 0) {
+		data_ = "";
+		return true;
+	}
+	mapping_ = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping_)
+		data_ = (const char*)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+	if (!data_) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close() {
+	if (data_ && size_ > 0 && !in_pack_)
+		UnmapViewOfFile(data_);
+	if (mapping_)
+		CloseHandle(mapping_);
+	if (file_)
+		CloseHandle(file_);
+	data_ = nullptr;
+	mapping_ = nullptr;
+	file_ = nullptr;
+	size_ = 0;
+	is_open_ = false;
+	in_pack_ = false;
+}
+
+#else
+
+bool MappedFile::openFile_(const std::string& filename) {
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		::close(fd);
+		return false;
+	}
+	size_ = (size_t)st.st_size;
+	is_open_ = true;
+	//empty files can't be mapped, but are valid
+	if (size_ == 0) {
+		::close(fd);
+		data_ = "";
+		return true;
+	}
+	void* p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+	//the mapping keeps its own reference to the file
+	::close(fd);
+	if (p == MAP_FAILED) {
+		size_ = 0;
+		is_open_ = false;
+		return false;
+	}
+	madvise(p, size_, MADV_SEQUENTIAL);
+	data_ = (const char*)p;
+	return true;
+}
+
+void MappedFile::close() {
+	if (data_ && size_ > 0 && !in_pack_)
+		munmap((void*)data_, size_);
+	data_ = nullptr;
+	size_ = 0;
+	is_open_ = false;
+	in_pack_ = false;
+}
+
+#endif
@@ -0,0 +1,35 @@
+//
+//  MappedFile.h
+//
+//  Read only view of a whole file. The file is memory mapped, so nothing is
+//  copied up front and pages are read on first touch. Files in the mounted
+//  asset pack (see AssetPack.h) are found there first, as views into it.
+//
+#pragma once
+#include <cstddef>
+#include <string>
+
+class MappedFile {
+public:
+	MappedFile() {}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	bool open(const std::string& filename);
+	void close();
+	bool isOpen() const { return is_open_; }
+	const char* data() const { return data_; }
+	size_t size() const { return size_; }
+
+private:
+	bool is_open_ = false;
+	bool in_pack_ = false; //not ours to unmap
+	const char* data_ = nullptr;
+	size_t size_ = 0;
+	bool openFile_(const std::string& filename);
+#ifdef _WIN32
+	void* file_ = nullptr;
+	void* mapping_ = nullptr;
+#endif
+};
@@ -0,0 +1,294 @@
+//
+//  MeshCache.cpp
+//
+#include "MeshCache.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace {
+
+const char MESH_CACHE_MAGIC[4] = { 'M', 'V', 'D', 'M' };
+
+size_t padded(size_t bytes) { return (bytes + 3) & ~(size_t)3; }
+
+//64 bit FNV-1a, over 8 byte words and then the tail bytes
+uint64_t hashBytes(const char* data, size_t size) {
+	const uint64_t prime = 0x100000001b3ull;
+	uint64_t h = 0xcbf29ce484222325ull;
+	size_t words = size / 8;
+	for (size_t i = 0; i < words; i++) {
+		uint64_t word;
+		memcpy(&word, data + i * 8, 8);
+		h = (h ^ word) * prime;
+	}
+	for (size_t i = words * 8; i < size; i++)
+		h = (h ^ (unsigned char)data[i]) * prime;
+	return h;
+}
+
+//round to nearest, magnitudes under the smallest normal half flush to zero
+uint16_t floatToHalf(float f) {
+	uint32_t x;
+	memcpy(&x, &f, 4);
+	uint16_t sign = (uint16_t)((x >> 16) & 0x8000);
+	uint32_t mantissa = x & 0x7fffff;
+	int exponent = (int)((x >> 23) & 0xff);
+	if (exponent == 0xff) return sign | 0x7c00 | (mantissa ? 0x200 : 0); //inf, nan
+	exponent += 15 - 127;
+	if (exponent >= 31) return sign | 0x7c00;
+	if (exponent <= 0) return sign;
+	uint16_t h = (uint16_t)(sign | (exponent << 10) | (mantissa >> 13));
+	uint32_t rest = mantissa & 0x1fff;
+	if (rest > 0x1000 || (rest == 0x1000 && (h & 1))) h++; //a carry into the exponent is still right
+	return h;
+}
+
+int16_t floatToSnorm16(float f) {
+	f = std::max(-1.0f, std::min(1.0f, f));
+	return (int16_t)std::lround(f * 32767.0f);
+}
+
+template <typename T>
+void writeBlock(std::ofstream& file, const T* data, size_t count) {
+	size_t bytes = count * sizeof(T);
+	if (bytes) file.write((const char*)data, bytes);
+	static const char zeros[4] = { 0, 0, 0, 0 };
+	file.write(zeros, padded(bytes) - bytes);
+}
+
+} //namespace
+
+void MeshCache::init(std::string directory, bool quantize) {
+	directory_ = directory;
+	quantize_ = quantize;
+	if (!directory_.empty() && directory_.back() != '/' && directory_.back() != '\\')
+		directory_ += "/";
+#ifdef _WIN32
+	_mkdir(directory_.c_str());
+#else
+	mkdir(directory_.c_str(), 0755);
+#endif
+}
+
+//hashes the source file, key.valid is false if it cannot be read
+MeshCacheKey MeshCache::key(const std::string& source_file) {
+	MeshCacheKey key;
+	key.source = source_file;
+	MappedFile source;
+	if (!source.open(source_file))
+		return key;
+	key.hash = hashBytes(source.data(), source.size());
+	key.size = source.size();
+	key.valid = true;
+	return key;
+}
+
+std::string MeshCache::entryPath(const MeshCacheKey& key, const char* extension) {
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx", (unsigned long long)key.hash);
+	return directory_ + name + extension;
+}
+
+bool MeshCache::load(const MeshCacheKey& key, Geometry& geometry, const std::vector<Material>& materials,
+	const char* extension) {
+	if (!enabled || !key.valid)
+		return false;
+	MappedFile file;
+	if (!file.open(entryPath(key, extension)))
+		return false;
+	return loadEntry(file.data(), file.size(), geometry, materials, &key);
+}
+
+bool MeshCache::checkEntry(const char* data, size_t size, const MeshCacheKey* key) const {
+	MeshCacheHeader header;
+	EntryLayout layout;
+	return layout_(data, size, key, header, layout);
+}
+
+//stale or foreign entries just miss, the caller imports and rewrites them
+bool MeshCache::layout_(const char* data, size_t size, const MeshCacheKey* key, MeshCacheHeader& header, EntryLayout& layout) const {
+	if (size < sizeof(MeshCacheHeader))
+		return false;
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, MESH_CACHE_MAGIC, 4) != 0 || header.version != MESH_CACHE_VERSION ||
+		(key && (header.source_hash != key->hash || header.source_size != key->size)) ||
+		(header.index_size != 2 && header.index_size != 4))
+		return false;
+	layout.half_uvs = (header.flags & MESH_CACHE_HALF_UVS) != 0;
+	layout.snorm_normals = (header.flags & MESH_CACHE_SNORM_NORMALS) != 0;
+	if (layout.snorm_normals != quantize_) //written with the other setting
+		return false;
+
+	layout.sets = sizeof(MeshCacheHeader);
+	layout.names = layout.sets + header.num_material_sets * 2 * sizeof(int32_t);
+	layout.positions = layout.names + header.name_bytes;
+	layout.uvs = layout.positions + (size_t)header.num_vertices * 3 * sizeof(float);
+	layout.normals = layout.uvs + padded((size_t)header.num_vertices * 2 * (layout.half_uvs ? sizeof(uint16_t) : sizeof(float)));
+	layout.indices = layout.normals + (size_t)header.num_vertices * (layout.snorm_normals ? 4 * sizeof(int16_t) : 3 * sizeof(float));
+	size_t end = layout.indices + padded((size_t)header.num_indices * header.index_size);
+	if (end != size) {
+		std::cerr << "ERROR: Mesh cache entry for " << (key ? key->source : "a packed mesh") << " is truncated" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool MeshCache::loadEntry(const char* data, size_t size, Geometry& geometry, const std::vector<Material>& materials,
+	const MeshCacheKey* key, bool material_sets) {
+	MeshCacheHeader header;
+	EntryLayout layout;
+	if (!layout_(data, size, key, header, layout))
+		return false;
+
+	geometry.createPackedVertexArrays((const float*)(data + layout.positions),
+		data + layout.uvs, data + layout.normals, header.num_vertices,
+		data + layout.indices, header.num_indices, header.index_size,
+		layout.half_uvs, layout.snorm_normals);
+
+	lm::vec3 min(header.aabb_min[0], header.aabb_min[1], header.aabb_min[2]);
+	lm::vec3 max(header.aabb_max[0], header.aabb_max[1], header.aabb_max[2]);
+	geometry.aabb.center = lm::vec3((min.x + max.x) / 2, (min.y + max.y) / 2, (min.z + max.z) / 2);
+	geometry.aabb.half_width = lm::vec3(max.x - geometry.aabb.center.x,
+		max.y - geometry.aabb.center.y,
+		max.z - geometry.aabb.center.z);
+
+	const int32_t* sets = (const int32_t*)(data + layout.sets);
+	const char* names = data + layout.names;
+	for (uint32_t i = 0; material_sets && i < header.num_material_sets; i++) {
+		int material_id = -1;
+		int32_t name_offset = sets[i * 2 + 1];
+		if (name_offset >= 0 && (uint32_t)name_offset < header.name_bytes) {
+			for (int m = 0; m < (int)materials.size(); m++) {
+				if (materials[m].name == names + name_offset) {
+					material_id = m;
+					break;
+				}
+			}
+		}
+		geometry.createMaterialSet(sets[i * 2], material_id);
+	}
+	return true;
+}
+
+bool MeshCache::store(const MeshCacheKey& key,
+	const std::vector<float>& vertices,
+	const std::vector<float>& uvs,
+	const std::vector<float>& normals,
+	const std::vector<unsigned int>& indices,
+	const Geometry& geometry,
+	const std::vector<Material>& materials,
+	const char* extension) {
+
+	if (!enabled || !key.valid)
+		return false;
+
+	MeshCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MESH_CACHE_MAGIC, 4);
+	header.version = MESH_CACHE_VERSION;
+	header.source_hash = key.hash;
+	header.source_size = key.size;
+	header.num_vertices = (uint32_t)(vertices.size() / 3);
+	header.num_indices = (uint32_t)indices.size();
+	header.index_size = header.num_vertices <= 65536 ? 2 : 4;
+	if (uvs.size() != header.num_vertices * 2 || normals.size() != header.num_vertices * 3)
+		return false;
+
+	//aabb as Geometry::setAABB finds it
+	for (int k = 0; k < 3; k++) {
+		header.aabb_min[k] = 1000000.0f;
+		header.aabb_max[k] = -1000000.0f;
+	}
+	for (size_t i = 0; i < vertices.size(); i += 3) {
+		for (int k = 0; k < 3; k++) {
+			header.aabb_min[k] = std::min(header.aabb_min[k], vertices[i + k]);
+			header.aabb_max[k] = std::max(header.aabb_max[k], vertices[i + k]);
+		}
+	}
+
+	if (quantize_) {
+		header.flags |= MESH_CACHE_SNORM_NORMALS;
+		bool uvs_fit = true;
+		for (float uv : uvs)
+			if (!(std::fabs(uv) <= MESH_CACHE_HALF_UV_LIMIT)) { uvs_fit = false; break; }
+		if (uvs_fit) header.flags |= MESH_CACHE_HALF_UVS;
+	}
+
+	//material sets, names stored once each
+	std::vector<int32_t> sets;
+	std::string names;
+	header.num_material_sets = (uint32_t)geometry.material_sets.size();
+	for (size_t i = 0; i < geometry.material_sets.size(); i++) {
+		int material_id = geometry.material_set_ids[i];
+		int32_t name_offset = -1;
+		if (material_id >= 0 && material_id < (int)materials.size()) {
+			std::string name = materials[material_id].name + '\0';
+			size_t found = names.find(name);
+			if (found == std::string::npos || (found > 0 && names[found - 1] != '\0')) {
+				found = names.size();
+				names += name;
+			}
+			name_offset = (int32_t)found;
+		}
+		sets.push_back(geometry.material_sets[i]);
+		sets.push_back(name_offset);
+	}
+	header.name_bytes = (uint32_t)padded(names.size());
+
+	//write beside the entry and rename, so a crash never leaves half of one
+	std::string path = entryPath(key, extension);
+	std::string temp_path = path + ".tmp";
+	std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		std::cerr << "ERROR: Could not write mesh cache file " << temp_path << std::endl;
+		return false;
+	}
+	file.write((const char*)&header, sizeof(header));
+	writeBlock(file, sets.data(), sets.size());
+	writeBlock(file, names.data(), names.size());
+	writeBlock(file, vertices.data(), vertices.size());
+	if (header.flags & MESH_CACHE_HALF_UVS) {
+		std::vector<uint16_t> half_uvs(uvs.size());
+		for (size_t i = 0; i < uvs.size(); i++) half_uvs[i] = floatToHalf(uvs[i]);
+		writeBlock(file, half_uvs.data(), half_uvs.size());
+	}
+	else
+		writeBlock(file, uvs.data(), uvs.size());
+	if (header.flags & MESH_CACHE_SNORM_NORMALS) {
+		std::vector<int16_t> snorm_normals(header.num_vertices * 4, 0);
+		for (size_t v = 0; v < header.num_vertices; v++)
+			for (int k = 0; k < 3; k++)
+				snorm_normals[v * 4 + k] = floatToSnorm16(normals[v * 3 + k]);
+		writeBlock(file, snorm_normals.data(), snorm_normals.size());
+	}
+	else
+		writeBlock(file, normals.data(), normals.size());
+	if (header.index_size == 2) {
+		std::vector<uint16_t> short_indices(indices.begin(), indices.end());
+		writeBlock(file, short_indices.data(), short_indices.size());
+	}
+	else
+		writeBlock(file, indices.data(), indices.size());
+	file.close();
+	if (!file) {
+		std::cerr << "ERROR: Could not write mesh cache file " << temp_path << std::endl;
+		std::remove(temp_path.c_str());
+		return false;
+	}
+	std::remove(path.c_str());
+	return std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
+
+void MeshCache::printStats() {
+	std::cout << "Mesh cache: " << hits << " loaded from cache in " << hit_ms << " ms, "
+		<< misses << " imported in " << miss_ms << " ms" << std::endl;
+}
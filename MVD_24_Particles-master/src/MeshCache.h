@@ -0,0 +1,135 @@
+//
+//  MeshCache.h
+//
+//  Binary copies of imported meshes, so a text model is only parsed once.
+//  Entries are named after a hash of the source file's contents: an edited
+//  source simply misses and is imported (and written) again. A hit maps the
+//  entry and hands its streams straight to GL.
+//
+//  Entry layout, every block padded to 4 bytes:
+//    MeshCacheHeader
+//    material sets: { int32 end triangle, int32 name offset or -1 } each
+//    material names: '\0' terminated strings
+//    positions: 3 floats per vertex
+//    uvs:       2 floats, or 2 half floats with MESH_CACHE_HALF_UVS
+//    normals:   3 floats, or 4 snorm16 (w unused) with MESH_CACHE_SNORM_NORMALS
+//    indices:   uint16 when every vertex can be reached with one, else uint32
+//
+#pragma once
+#include "GraphicsUtilities.h"
+#include "MappedFile.h"
+#include "ObjParser.h"
+#include <cstdint>
+
+//bump whenever the layout changes, old entries are then rebuilt
+#define MESH_CACHE_VERSION 1
+
+//header flags
+#define MESH_CACHE_HALF_UVS 1
+#define MESH_CACHE_SNORM_NORMALS 2
+
+//uvs are only stored as half floats inside this range, where the step
+//between halves is still under a thousandth
+#define MESH_CACHE_HALF_UV_LIMIT 2.0f
+
+struct MeshCacheHeader {
+	char magic[4]; //"MVDM"
+	uint32_t version;
+	uint64_t source_hash;
+	uint64_t source_size;
+	uint32_t flags;
+	uint32_t num_vertices;
+	uint32_t num_indices;
+	uint32_t index_size; //bytes per index, 2 or 4
+	uint32_t num_material_sets;
+	uint32_t name_bytes; //padded
+	float aabb_min[3];
+	float aabb_max[3];
+};
+
+//identifies a source file's contents, see MeshCache::key
+struct MeshCacheKey {
+	std::string source;
+	uint64_t hash = 0;
+	uint64_t size = 0;
+	bool valid = false;
+};
+
+class MeshCache {
+public:
+	//entries go in directory (created if needed). quantize stores uvs and
+	//normals in 16 bits where that is close enough
+	void init(std::string directory, bool quantize = true);
+	bool enabled = true;
+
+	MeshCacheKey key(const std::string& source_file);
+
+	//where the entry for key lives. Imports with material sets are kept
+	//apart under ".sets.mesh", other importers keep their own binary copies
+	//here too, under another extension
+	std::string entryPath(const MeshCacheKey& key, const char* extension = ".mesh");
+
+	//creates geometry from the entry for key if there is a current one.
+	//Material sets are matched to materials by name (-1 when not found)
+	bool load(const MeshCacheKey& key, Geometry& geometry, const std::vector<Material>& materials,
+		const char* extension = ".mesh");
+	//the same from an entry already in memory (an asset pack). Without a key
+	//the source is not checked: the cooker wrote it from the current one.
+	//Without material_sets any sets in the entry are left out
+	bool loadEntry(const char* data, size_t size, Geometry& geometry, const std::vector<Material>& materials,
+		const MeshCacheKey* key = nullptr, bool material_sets = true);
+	//whether loadEntry would take it, without touching GL (any thread)
+	bool checkEntry(const char* data, size_t size, const MeshCacheKey* key = nullptr) const;
+
+	//writes the entry for key from the imported arrays, and the material sets
+	//of geometry (ids into materials)
+	bool store(const MeshCacheKey& key,
+		const std::vector<float>& vertices,
+		const std::vector<float>& uvs,
+		const std::vector<float>& normals,
+		const std::vector<unsigned int>& indices,
+		const Geometry& geometry,
+		const std::vector<Material>& materials,
+		const char* extension = ".mesh");
+
+	//startup report, filled in by the callers of load and store
+	int hits = 0;
+	int misses = 0;
+	double hit_ms = 0.0;
+	double miss_ms = 0.0;
+	void printStats();
+
+private:
+	std::string directory_;
+	bool quantize_ = true;
+
+	//where each block of an entry starts
+	struct EntryLayout {
+		size_t sets, names, positions, uvs, normals, indices;
+		bool half_uvs, snorm_normals;
+	};
+	bool layout_(const char* data, size_t size, const MeshCacheKey* key, MeshCacheHeader& header, EntryLayout& layout) const;
+};
+
+//an obj import in two halves, so the first can run on a worker thread:
+//GraphicsSystem::readGeometry finds a cooked or cached entry (mapped, and
+//its pages touched) or parses the text, uploadGeometry creates the GL side
+struct GeometryImport {
+	std::string filename;
+	bool multi = false; //with material sets, see createMultiGeometryFromFile
+	//text larger than this is left unparsed, for a later read with jobs
+	size_t parse_limit = (size_t)-1;
+
+	//filled in by readGeometry
+	MeshCacheKey key;
+	MappedFile cached;
+	const char* entry = nullptr; //in cached or the mounted asset pack
+	size_t entry_size = 0;
+	std::vector<float> vertices, uvs, normals;
+	std::vector<unsigned int> indices;
+	std::vector<ObjMaterialGroup> groups;
+	bool parsed = false;
+	bool failed = false;
+	double read_ms = 0.0;
+	double upload_ms = 0.0;
+};
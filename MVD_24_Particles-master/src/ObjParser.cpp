@@ -0,0 +1,276 @@
+//
+//  ObjParser.cpp
+//
+#include "ObjParser.h"
+#include "JobSystem.h"
+#include "TextParsing.h"
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+const int NO_INDEX = INT_MIN;
+
+//a face corner as read, indices 0-based. Negative obj indices count back
+//from the end of their array so far, which a chunk only knows locally; its
+//start counts are added when the chunks are joined
+struct Corner {
+	int v, t, n;
+	unsigned char relative; //bit 0 v, bit 1 t, bit 2 n
+};
+
+struct Chunk {
+	const char* begin = nullptr;
+	const char* end = nullptr;
+	std::vector<float> positions, uvs, normals;
+	std::vector<Corner> corners; //three per triangle
+	std::vector<std::pair<std::string, size_t>> groups; //usemtl name, first corner
+};
+
+inline const char* skipBlanks(const char* p, const char* end) {
+	while (p < end && isBlankChar(*p)) p++;
+	return p;
+}
+
+//reads the float after any blanks. A missing number reads as 0
+inline const char* readFloatField(const char* p, const char* end, float& value) {
+	return readFloat(skipBlanks(p, end), end, value);
+}
+
+//"v", "v/t", "v//n" or "v/t/n". counts are the chunk's array sizes so far
+const char* readCorner(const char* p, const char* end, const int counts[3], Corner& corner) {
+	int index[3] = { NO_INDEX, NO_INDEX, NO_INDEX };
+	corner.relative = 0;
+	for (int k = 0; k < 3; k++) {
+		if (k > 0) {
+			if (p >= end || *p != '/') break;
+			p++;
+		}
+		int value;
+		const char* q = readInt(p, end, value);
+		if (!q) {
+			if (k == 0) return nullptr;
+			continue; //empty slot, as in v//n
+		}
+		p = q;
+		if (value < 0) {
+			index[k] = counts[k] + value;
+			corner.relative |= (unsigned char)(1 << k);
+		}
+		else
+			index[k] = value - 1;
+	}
+	corner.v = index[0];
+	corner.t = index[1];
+	corner.n = index[2];
+	return p;
+}
+
+void parseChunk(Chunk& chunk) {
+	std::vector<Corner> polygon;
+	const char* p = chunk.begin;
+	const char* end = chunk.end;
+	while (p < end) {
+		const char* line_end = (const char*)memchr(p, '\n', end - p);
+		if (!line_end) line_end = end;
+		p = skipBlanks(p, line_end);
+		size_t length = line_end - p;
+
+		if (length >= 2 && p[0] == 'v') {
+			float f[3];
+			if (isBlankChar(p[1])) {
+				const char* q = p + 1;
+				for (int k = 0; k < 3; k++) q = readFloatField(q, line_end, f[k]);
+				chunk.positions.insert(chunk.positions.end(), f, f + 3);
+			}
+			else if (length >= 3 && p[1] == 't' && isBlankChar(p[2])) {
+				const char* q = p + 2;
+				for (int k = 0; k < 2; k++) q = readFloatField(q, line_end, f[k]);
+				chunk.uvs.insert(chunk.uvs.end(), f, f + 2);
+			}
+			else if (length >= 3 && p[1] == 'n' && isBlankChar(p[2])) {
+				const char* q = p + 2;
+				for (int k = 0; k < 3; k++) q = readFloatField(q, line_end, f[k]);
+				chunk.normals.insert(chunk.normals.end(), f, f + 3);
+			}
+		}
+		else if (length >= 2 && p[0] == 'f' && isBlankChar(p[1])) {
+			int counts[3] = { (int)chunk.positions.size() / 3, (int)chunk.uvs.size() / 2, (int)chunk.normals.size() / 3 };
+			polygon.clear();
+			const char* q = p + 1;
+			for (;;) {
+				q = skipBlanks(q, line_end);
+				Corner corner;
+				const char* r = q < line_end ? readCorner(q, line_end, counts, corner) : nullptr;
+				if (!r) break;
+				polygon.push_back(corner);
+				q = r;
+			}
+			//fan, ordered so a quad splits as (1, 2, 3) (4, 1, 3)
+			if (polygon.size() >= 3) {
+				chunk.corners.insert(chunk.corners.end(), polygon.begin(), polygon.begin() + 3);
+				for (size_t i = 3; i < polygon.size(); i++) {
+					chunk.corners.push_back(polygon[i]);
+					chunk.corners.push_back(polygon[0]);
+					chunk.corners.push_back(polygon[i - 1]);
+				}
+			}
+		}
+		else if (length > 7 && memcmp(p, "usemtl", 6) == 0 && isBlankChar(p[6])) {
+			const char* name = skipBlanks(p + 6, line_end);
+			const char* name_end = name;
+			while (name_end < line_end && !isBlankChar(*name_end)) name_end++;
+			chunk.groups.emplace_back(std::string(name, name_end), chunk.corners.size());
+		}
+		p = line_end + 1;
+	}
+}
+
+//open addressing (linear probing) map from a corner's index triplet to its
+//output vertex
+class CornerTable {
+public:
+	explicit CornerTable(size_t expected) {
+		size_t capacity = 1024;
+		while (capacity < expected * 2) capacity <<= 1;
+		slots_.assign(capacity, Slot());
+	}
+
+	//existing vertex of the triplet, or new_index once it is inserted
+	unsigned int findOrInsert(int v, int t, int n, unsigned int new_index) {
+		if ((count_ + 1) * 2 > slots_.size())
+			grow_();
+		size_t mask = slots_.size() - 1;
+		for (size_t i = hash_(v, t, n) & mask; ; i = (i + 1) & mask) {
+			Slot& slot = slots_[i];
+			if (slot.index == EMPTY) {
+				slot = { v, t, n, new_index };
+				count_++;
+				return new_index;
+			}
+			if (slot.v == v && slot.t == t && slot.n == n)
+				return slot.index;
+		}
+	}
+
+private:
+	static const unsigned int EMPTY = UINT_MAX;
+	struct Slot {
+		int v = 0, t = 0, n = 0;
+		unsigned int index = EMPTY;
+	};
+	std::vector<Slot> slots_;
+	size_t count_ = 0;
+
+	//all three indices through a splitmix64 finalizer; a position shared by
+	//many (t, n) pairs (flat shading, uv seams) must not share a home slot
+	static size_t hash_(int v, int t, int n) {
+		uint64_t h = ((uint64_t)(uint32_t)v | (uint64_t)(uint32_t)t << 32) ^ (uint32_t)n * 0x9E3779B97F4A7C15ull;
+		h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+		h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+		return (size_t)(h ^ (h >> 31));
+	}
+
+	void grow_() {
+		std::vector<Slot> old;
+		old.swap(slots_);
+		slots_.assign(old.size() * 2, Slot());
+		size_t mask = slots_.size() - 1;
+		for (const Slot& slot : old) {
+			if (slot.index == EMPTY) continue;
+			size_t i = hash_(slot.v, slot.t, slot.n) & mask;
+			while (slots_[i].index != EMPTY) i = (i + 1) & mask;
+			slots_[i] = slot;
+		}
+	}
+};
+
+} //namespace
+
+bool ObjParser::parse(const char* data, size_t size,
+	std::vector<float>& vertices, std::vector<float>& uvs, std::vector<float>& normals,
+	std::vector<unsigned int>& indices, std::vector<ObjMaterialGroup>* material_groups, JobSystem* jobs) {
+
+	vertices.clear();
+	uvs.clear();
+	normals.clear();
+	indices.clear();
+	if (material_groups) material_groups->clear();
+
+	//cut into chunks at line ends, a few per thread so they balance
+	int num_chunks = 1;
+	if (jobs && jobs->getNumThreads() > 1 && size >= PARALLEL_MIN_BYTES)
+		num_chunks = (int)std::min(size / (256 << 10), (size_t)jobs->getNumThreads() * 4);
+	std::vector<Chunk> chunks(num_chunks);
+	const char* end = data + size;
+	const char* p = data;
+	for (int i = 0; i < num_chunks; i++) {
+		chunks[i].begin = p;
+		if (i + 1 < num_chunks) {
+			const char* cut = std::max(p, data + size * (i + 1) / num_chunks);
+			const char* line_end = cut < end ? (const char*)memchr(cut, '\n', end - cut) : nullptr;
+			p = line_end ? line_end + 1 : end;
+		}
+		else
+			p = end;
+		chunks[i].end = p;
+	}
+
+	if (num_chunks > 1)
+		jobs->parallelFor(num_chunks, 1, [&](int first, int last) {
+			for (int i = first; i < last; i++) parseChunk(chunks[i]);
+		});
+	else
+		parseChunk(chunks[0]);
+
+	//join attribute arrays in file order
+	std::vector<float> positions, texcoords, vertex_normals;
+	std::vector<int> first_v(num_chunks), first_t(num_chunks), first_n(num_chunks);
+	size_t num_corners = 0;
+	for (int i = 0; i < num_chunks; i++) {
+		first_v[i] = (int)positions.size() / 3;
+		first_t[i] = (int)texcoords.size() / 2;
+		first_n[i] = (int)vertex_normals.size() / 3;
+		positions.insert(positions.end(), chunks[i].positions.begin(), chunks[i].positions.end());
+		texcoords.insert(texcoords.end(), chunks[i].uvs.begin(), chunks[i].uvs.end());
+		vertex_normals.insert(vertex_normals.end(), chunks[i].normals.begin(), chunks[i].normals.end());
+		num_corners += chunks[i].corners.size();
+	}
+	int num_v = (int)positions.size() / 3, num_t = (int)texcoords.size() / 2, num_n = (int)vertex_normals.size() / 3;
+
+	//one output vertex per distinct triplet, in order of first use
+	CornerTable table(num_v);
+	vertices.reserve(num_v * 3);
+	uvs.reserve(num_v * 2);
+	normals.reserve(num_v * 3);
+	indices.reserve(num_corners);
+	for (int c = 0; c < num_chunks; c++) {
+		const Chunk& chunk = chunks[c];
+		for (size_t g = 0; material_groups && g < chunk.groups.size(); g++)
+			material_groups->push_back({ chunk.groups[g].first, (int)((indices.size() + chunk.groups[g].second) / 3) });
+		for (const Corner& corner : chunk.corners) {
+			int v = corner.v + ((corner.relative & 1) ? first_v[c] : 0);
+			int t = corner.t == NO_INDEX ? -1 : corner.t + ((corner.relative & 2) ? first_t[c] : 0);
+			int n = corner.n == NO_INDEX ? -1 : corner.n + ((corner.relative & 4) ? first_n[c] : 0);
+			if (v < 0 || v >= num_v || (corner.t != NO_INDEX && (t < 0 || t >= num_t)) ||
+				(corner.n != NO_INDEX && (n < 0 || n >= num_n))) {
+				std::cerr << "ERROR: OBJ face uses missing vertex data (" << v + 1 << "/" << t + 1 << "/" << n + 1 << ")" << std::endl;
+				return false;
+			}
+			unsigned int next = (unsigned int)(vertices.size() / 3);
+			unsigned int index = table.findOrInsert(v, t, n, next);
+			if (index == next) {
+				vertices.insert(vertices.end(), &positions[v * 3], &positions[v * 3] + 3);
+				if (t >= 0) uvs.insert(uvs.end(), &texcoords[t * 2], &texcoords[t * 2] + 2);
+				else uvs.insert(uvs.end(), 2, 0.0f);
+				if (n >= 0) normals.insert(normals.end(), &vertex_normals[n * 3], &vertex_normals[n * 3] + 3);
+				else normals.insert(normals.end(), 3, 0.0f);
+			}
+			indices.push_back(index);
+		}
+	}
+	return true;
+}
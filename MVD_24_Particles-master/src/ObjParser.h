@@ -0,0 +1,39 @@
+//
+//  ObjParser.h
+//
+//  Wavefront OBJ reader working on a file image in memory (see MappedFile).
+//  - lines are scanned in place with no per line allocation, numbers are
+//    read with std::from_chars where the library has it
+//  - large files are cut at line ends into chunks which are parsed in
+//    parallel on the job system, then joined in file order
+//  - face corners are deduplicated on their (v, t, n) index triplet in an
+//    open addressing table, so vertices keep their order of first use
+//  Polygons are triangulated as fans; missing uvs or normals read as zero.
+//
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class JobSystem;
+
+//a usemtl line: material name and the first triangle which uses it
+struct ObjMaterialGroup {
+	std::string name;
+	int first_triangle;
+};
+
+class ObjParser {
+public:
+	//false (with a message) if a face uses an index which does not exist
+	static bool parse(const char* data, size_t size,
+		std::vector<float>& vertices,
+		std::vector<float>& uvs,
+		std::vector<float>& normals,
+		std::vector<unsigned int>& indices,
+		std::vector<ObjMaterialGroup>* material_groups = nullptr,
+		JobSystem* jobs = nullptr);
+
+	//files smaller than this are parsed on the calling thread only
+	static const size_t PARALLEL_MIN_BYTES = 1 << 20;
+};
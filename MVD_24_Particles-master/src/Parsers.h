@@ -1,8 +1,15 @@
 #pragma once
 #include "includes.h"
 #include <vector>
+#include <unordered_map>
 #include "GraphicsSystem.h"
+#include "EntityComponentStore.h"
 #include "ControlSystem.h"
+#include "JobSystem.h"
+#include "ObjParser.h"
+#include "ColladaAsset.h"
+#include "TextureCompression.h"
+#include "TextureStreamer.h"
 
 struct TGAInfo //stores info about TGA file
 {
@@ -15,6 +22,9 @@ struct TGAInfo //stores info about TGA file
 class Parsers {
 private:
 	static TGAInfo* loadTGA(std::string filename);
+	static JobSystem* jobs_;
+	static TextureStreamer* texture_streamer_;
+	static ResourceManager* resources_;
 public:
     static bool parseMTL(std::string path,
                          std::string filename,
@@ -24,7 +34,23 @@ public:
 						 std::vector<float>& vertices, 
 						 std::vector<float>& uvs, 
 						 std::vector<float>& normals,
+						 std::vector<unsigned int>& indices,
+						 std::vector<ObjMaterialGroup>* material_groups = nullptr);
+	//material sets of an OBJ's usemtl groups, ids into materials
+	static void createMaterialSets(Geometry& geometry,
+						 const std::vector<ObjMaterialGroup>& material_groups,
+						 std::vector<Material>& materials);
+	//line by line reader the fast path replaced, kept to compare against
+	static bool parseOBJ_reference(std::string filename,
+						 std::vector<float>& vertices,
+						 std::vector<float>& uvs,
+						 std::vector<float>& normals,
 						 std::vector<unsigned int>& indices);
+	//times both readers on a file and checks they agree
+	static void benchmarkOBJ(std::string filename, int iterations = 5);
+	//large OBJ files are parsed in parallel on this (optional)
+	static void setJobSystem(JobSystem* jobs) { jobs_ = jobs; }
+	static JobSystem* getJobSystem() { return jobs_; }
     static int parseOBJ_multi(std::string filename,
                          std::vector<Geometry>& geometries,
                          std::vector<Material>& materials);
@@ -32,11 +58,31 @@ public:
                                ImageData* image_data = nullptr,
                                bool keep_data = false);
     static GLuint parseCubemap(std::vector<std::string>& faces);
+    //while set, parseTexture and parseCubemap return placeholders at once
+    //and the streamer loads them. Textures kept for their data stay synchronous
+    static void setTextureStreamer(TextureStreamer* streamer) { texture_streamer_ = streamer; }
+    //while set, MTL textures are shared through it
+    static void setResourceManager(ResourceManager* resources) { resources_ = resources; }
+    //pixels of a TGA file as RGBA, bottom row first
+    static bool decodeTGA(std::string filename, std::vector<unsigned char>& rgba, int& width, int& height);
+    //offline: writes name.ktx beside a TGA, which parseTexture and
+    //parseCubemap then load instead while it is not older than the TGA
+    static bool compressTexture(std::string filename, TextureCodec codec = TextureCodecAuto);
+    //the level's prefabs are added to prefabs, when given
     static bool parseJSONLevel(std::string filename,
                                GraphicsSystem& graphics_system,
-                               ControlSystem& control_system);
+                               ControlSystem& control_system,
+                               std::unordered_map<std::string, Prefab>* prefabs = nullptr);
     static bool parseAnimation(std::string filename);
+    static bool parseCameraPath(std::string filename, CameraPath& path);
     static bool parseCollada(std::string filename,
                              Shader* shader,
                              GraphicsSystem& graphics_system);
+private:
+    static bool uploadKTX_(const std::string& filename, GLenum target);
+    static GLint loadTexture_(const std::string& filename);
+    //engine geometries, materials, joints and entities of a parsed or cached file
+    static bool createColladaAsset_(ColladaAsset& asset,
+                                    Shader* shader,
+                                    GraphicsSystem& graphics_system);
 };
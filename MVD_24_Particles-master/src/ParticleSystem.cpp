@@ -1,6 +1,7 @@
 #include "ParticleSystem.h"
 #include "extern.h"
 #include "Parsers.h"
+#include <algorithm>
 
 //HOW DOES TRANSFORM FEEDBACK WORK?
 //A transform feedback is basically a mechanism by which OpenGL can tell the 
@@ -47,6 +48,7 @@ void ParticleSystem::createParticle(ParticleEmitter& particleEm) {
 
 	glEnable(GL_PROGRAM_POINT_SIZE);
 
+	num_particles_ = particleEm.num_particles;
 	std::vector<GLfloat> vertices(particleEm.num_particles * 3, 0);
 	std::vector<GLfloat> velocities(particleEm.num_particles * 3, 0);
 	std::vector<GLfloat> ages(particleEm.num_particles, 0);
@@ -98,6 +100,7 @@ void ParticleSystem::createParticle(ParticleEmitter& particleEm) {
 	glBufferData(GL_ARRAY_BUFFER, ages.size() * sizeof(GLfloat), &(ages[0]), GL_STREAM_COPY);
 	glEnableVertexAttribArray(2); //layout location
 	glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, 0, 0);
+	age_buffers_[0] = vb_A_age;
 
 	//life buffers
 	glGenBuffers(1, &vb_A_lif); //create the buffer
@@ -149,6 +152,8 @@ void ParticleSystem::createParticle(ParticleEmitter& particleEm) {
 	glBufferData(GL_ARRAY_BUFFER, ages.size() * sizeof(GLfloat), &(ages[0]), GL_STREAM_COPY);
 	glEnableVertexAttribArray(2); //layout location
 	glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, 0, 0);
+	age_buffers_[1] = vb_B_age;
+	last_draw_count_ = (GLsizei)std::min(num_particles_, 1000);
 
 	//life buffers
 	glGenBuffers(1, &vb_B_lif); //create the buffer
@@ -166,7 +171,9 @@ void ParticleSystem::createParticle(ParticleEmitter& particleEm) {
 	//to here
 }
 
-void ParticleSystem::update() {
+void ParticleSystem::update(float dt) {
+
+	time_ += dt;
 
 	
 	glUseProgram(particle_shader_->program);
@@ -180,7 +187,7 @@ void ParticleSystem::update() {
 	lm::mat4 pos = trans;
 	particle_shader_->setUniform(U_MODEL, pos);
 	particle_shader_->setUniform(U_VP, cam.view_projection);
-	particle_shader_->setUniform(U_TIME, (float)glfwGetTime());
+	particle_shader_->setUniform(U_TIME, time_);
 	particle_shader_->setTexture(U_DIFFUSE_MAP, texture_id_, 0);
 
 	int viewport[4];
@@ -189,6 +196,19 @@ void ParticleSystem::update() {
 
 	particle_shader_->setUniform(U_HEIGHT_NEAR_PLANE, height_near_plane);
 
+	//only the first part of the buffers is fed back when scaled down. The
+	//rest is left behind by the two buffers at different frames, so when
+	//quality comes back up those particles are made to respawn rather than
+	//resume from stale state
+	GLsizei draw_count = (GLsizei)(std::min(num_particles_, 1000) * draw_scale);
+	if (draw_count > last_draw_count_) {
+		std::vector<GLfloat> expired(draw_count - last_draw_count_, -1.0e9f);
+		glBindBuffer(GL_ARRAY_BUFFER, age_buffers_[vaoSource]);
+		glBufferSubData(GL_ARRAY_BUFFER, last_draw_count_ * sizeof(GLfloat), expired.size() * sizeof(GLfloat), expired.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	last_draw_count_ = draw_count;
+
 	if (vaoSource == 0) {
 		glBindVertexArray(vaoA_);
 		glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, tfB_);
@@ -201,8 +221,7 @@ void ParticleSystem::update() {
 	}
 
 	glBeginTransformFeedback(GL_POINTS);
-
-	glDrawArrays(GL_POINTS, 0, 1000);
+	glDrawArrays(GL_POINTS, 0, draw_count);
 	glEndTransformFeedback();
 
 	glDisable(GL_BLEND);
@@ -11,11 +11,18 @@ public:
 	void init();
 	void init(int num_particles);
 	void createParticle(ParticleEmitter& particleEm);
-	void update();
+	void update(float dt);
+
+	//fraction of particles simulated and drawn, set by QualityGovernor
+	float draw_scale = 1.0f;
 private:
 	GLuint vaoA_, vaoB_;
 	GLuint tfA_, tfB_;
 	int vaoSource = 0;
+	int num_particles_ = 0;
+	GLuint age_buffers_[2] = { 0, 0 }; //of vaoA_ and vaoB_
+	GLsizei last_draw_count_ = 0;
+	float time_ = 0.0f; //accumulated dt, so fixed-step runs are repeatable
 	Shader* particle_shader_;
 	GLuint texture_id_;
 };
\ No newline at end of file
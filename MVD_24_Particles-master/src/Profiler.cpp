@@ -0,0 +1,199 @@
+//
+//  Profiler.cpp
+//
+#include "Profiler.h"
+#include <algorithm>
+#include <fstream>
+#include <cmath>
+#include "rapidjson/prettywriter.h"
+#include "rapidjson/stringbuffer.h"
+
+//queries still pending or open (windowed runs never call finish) are owned
+//by the profiler too, so delete them along with the free ones
+FrameProfiler::~FrameProfiler() {
+	std::vector<GLuint> queries = free_queries_;
+	for (auto& pq : pending_) {
+		queries.push_back(pq.begin_query);
+		queries.push_back(pq.end_query);
+	}
+	for (auto& open : gpu_open_)
+		queries.push_back(open.second);
+	if (!queries.empty())
+		glDeleteQueries((GLsizei)queries.size(), &(queries[0]));
+}
+
+void FrameProfiler::beginFrame() {
+	if (!enabled) return;
+	frame_start_ = clock_::now();
+	cpu_frame_.clear();
+}
+
+void FrameProfiler::endFrame() {
+	if (!enabled) return;
+	frame_ms_.push_back(std::chrono::duration<double, std::milli>(clock_::now() - frame_start_).count());
+	for (auto& section : cpu_frame_)
+		cpu_ms_[section.first].push_back(section.second);
+	frame_index_++;
+	resolveQueries_(false);
+}
+
+void FrameProfiler::beginCPU(const std::string& name) {
+	if (!enabled) return;
+	cpu_open_[name] = clock_::now();
+}
+
+//sections hit more than once in a frame are summed
+void FrameProfiler::endCPU(const std::string& name) {
+	if (!enabled) return;
+	auto it = cpu_open_.find(name);
+	if (it == cpu_open_.end()) return;
+	cpu_frame_[name] += std::chrono::duration<double, std::milli>(clock_::now() - it->second).count();
+	cpu_open_.erase(it);
+}
+
+void FrameProfiler::beginGPU(const std::string& name) {
+	if (!enabled) return;
+	GLuint query = getQuery_();
+	glQueryCounter(query, GL_TIMESTAMP);
+	//a section begun twice without ending drops the first timestamp
+	auto it = gpu_open_.find(name);
+	if (it != gpu_open_.end())
+		free_queries_.push_back(it->second);
+	gpu_open_[name] = query;
+}
+
+void FrameProfiler::endGPU(const std::string& name) {
+	if (!enabled) return;
+	auto it = gpu_open_.find(name);
+	if (it == gpu_open_.end()) return;
+	GLuint query = getQuery_();
+	glQueryCounter(query, GL_TIMESTAMP);
+	pending_.push_back({ frame_index_, name, it->second, query });
+	gpu_open_.erase(it);
+}
+
+void FrameProfiler::finish() {
+	if (!enabled) return;
+	glFinish();
+	resolveQueries_(true);
+}
+
+GLuint FrameProfiler::getQuery_() {
+	if (free_queries_.empty()) {
+		GLuint queries[32];
+		glGenQueries(32, queries);
+		free_queries_.insert(free_queries_.end(), queries, queries + 32);
+	}
+	GLuint query = free_queries_.back();
+	free_queries_.pop_back();
+	return query;
+}
+
+//reads back every finished query pair; queries complete in order, so stop at
+//the first one which isn't ready unless we are told to wait
+void FrameProfiler::resolveQueries_(bool wait) {
+	size_t resolved = 0;
+	for (; resolved < pending_.size(); resolved++) {
+		PendingQuery_& pq = pending_[resolved];
+		if (!wait) {
+			GLint available = 0;
+			glGetQueryObjectiv(pq.end_query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) break;
+		}
+		GLuint64 begin_ns = 0, end_ns = 0;
+		glGetQueryObjectui64v(pq.begin_query, GL_QUERY_RESULT, &begin_ns);
+		glGetQueryObjectui64v(pq.end_query, GL_QUERY_RESULT, &end_ns);
+		gpu_frames_[pq.frame][pq.name] += (end_ns - begin_ns) / 1000000.0;
+		free_queries_.push_back(pq.begin_query);
+		free_queries_.push_back(pq.end_query);
+	}
+	pending_.erase(pending_.begin(), pending_.begin() + resolved);
+}
+
+std::map<std::string, std::vector<double>> FrameProfiler::gpuSeries_() {
+	std::map<std::string, std::vector<double>> series;
+	for (auto& frame : gpu_frames_)
+		for (auto& section : frame.second)
+			series[section.first].push_back(section.second);
+	return series;
+}
+
+//nearest rank percentile, p in [0,100]
+double FrameProfiler::percentile(std::vector<double> values, double p) {
+	if (values.empty()) return 0.0;
+	std::sort(values.begin(), values.end());
+	size_t rank = (size_t)std::ceil(p / 100.0 * values.size());
+	if (rank < 1) rank = 1;
+	return values[std::min(rank, values.size()) - 1];
+}
+
+static double mean_of(const std::vector<double>& values) {
+	if (values.empty()) return 0.0;
+	double sum = 0.0;
+	for (double v : values) sum += v;
+	return sum / values.size();
+}
+
+void FrameProfiler::printSummary() {
+	printf("  frame p50: %.3f ms, p95: %.3f ms, p99: %.3f ms, max: %.3f ms\n",
+		percentile(frame_ms_, 50), percentile(frame_ms_, 95), percentile(frame_ms_, 99), percentile(frame_ms_, 100));
+	for (auto& section : cpu_ms_)
+		printf("  cpu %-12s mean %.3f ms, p95 %.3f ms\n", section.first.c_str(), mean_of(section.second), percentile(section.second, 95));
+	for (auto& section : gpuSeries_())
+		printf("  gpu %-12s mean %.3f ms, p95 %.3f ms\n", section.first.c_str(), mean_of(section.second), percentile(section.second, 95));
+}
+
+bool FrameProfiler::writeReport(const std::string& filename, float fixed_dt) {
+	std::ofstream file(filename);
+	if (!file.is_open()) {
+		std::cout << "ERROR: could not open benchmark report file " << filename << "\n";
+		return false;
+	}
+
+	std::map<std::string, std::vector<double>> gpu_ms = gpuSeries_();
+	bool csv = filename.size() >= 4 && filename.substr(filename.size() - 4) == ".csv";
+
+	if (csv) {
+		file << "group,name,samples,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n";
+		auto write_row = [&](const char* group, const std::string& name, const std::vector<double>& v) {
+			file << group << "," << name << "," << v.size() << "," << mean_of(v) << ","
+				<< percentile(v, 50) << "," << percentile(v, 95) << ","
+				<< percentile(v, 99) << "," << percentile(v, 100) << "\n";
+		};
+		write_row("frame", "total", frame_ms_);
+		for (auto& section : cpu_ms_) write_row("cpu", section.first, section.second);
+		for (auto& section : gpu_ms) write_row("gpu", section.first, section.second);
+		return true;
+	}
+
+	rapidjson::StringBuffer buffer;
+	rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+	auto write_stats = [&](const std::vector<double>& v) {
+		writer.StartObject();
+		writer.Key("samples"); writer.Uint((unsigned)v.size());
+		writer.Key("mean_ms"); writer.Double(mean_of(v));
+		writer.Key("p50_ms"); writer.Double(percentile(v, 50));
+		writer.Key("p95_ms"); writer.Double(percentile(v, 95));
+		writer.Key("p99_ms"); writer.Double(percentile(v, 99));
+		writer.Key("max_ms"); writer.Double(percentile(v, 100));
+		writer.EndObject();
+	};
+
+	writer.StartObject();
+	writer.Key("renderer"); writer.String((const char*)glGetString(GL_RENDERER));
+	writer.Key("frames"); writer.Uint((unsigned)frame_ms_.size());
+	writer.Key("fixed_dt"); writer.Double(fixed_dt);
+	writer.Key("frame"); write_stats(frame_ms_);
+	writer.Key("cpu");
+	writer.StartObject();
+	for (auto& section : cpu_ms_) { writer.Key(section.first.c_str()); write_stats(section.second); }
+	writer.EndObject();
+	writer.Key("gpu");
+	writer.StartObject();
+	for (auto& section : gpu_ms) { writer.Key(section.first.c_str()); write_stats(section.second); }
+	writer.EndObject();
+	writer.EndObject();
+
+	file << buffer.GetString() << "\n";
+	return true;
+}
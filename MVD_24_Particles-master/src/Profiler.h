@@ -0,0 +1,63 @@
+//
+//  Profiler.h
+//
+//  Per-frame CPU timings (per system) and GPU timings (per render pass) for
+//  benchmark runs. Does nothing unless enabled.
+//  - CPU sections use a steady clock
+//  - GPU sections use GL_TIMESTAMP query pairs, read back a few frames late
+//    so the profiler never stalls the pipeline
+//
+#pragma once
+#include "includes.h"
+#include <chrono>
+#include <map>
+#include <vector>
+
+class FrameProfiler {
+public:
+	~FrameProfiler();
+	bool enabled = false;
+
+	void beginFrame();
+	void endFrame();
+	void beginCPU(const std::string& name);
+	void endCPU(const std::string& name);
+	void beginGPU(const std::string& name);
+	void endGPU(const std::string& name);
+
+	//waits for outstanding GPU queries, call before writing results
+	void finish();
+
+	//writes p50/p95/p99/max for frame time and each section,
+	//format is chosen by extension (.csv, anything else is json)
+	bool writeReport(const std::string& filename, float fixed_dt);
+	void printSummary();
+
+	static double percentile(std::vector<double> values, double p);
+
+private:
+	typedef std::chrono::steady_clock clock_;
+	struct PendingQuery_ {
+		int frame;
+		std::string name;
+		GLuint begin_query;
+		GLuint end_query;
+	};
+
+	int frame_index_ = 0;
+	clock_::time_point frame_start_;
+	std::map<std::string, clock_::time_point> cpu_open_;
+	std::map<std::string, GLuint> gpu_open_;
+	std::map<std::string, double> cpu_frame_;
+
+	std::vector<double> frame_ms_;
+	std::map<std::string, std::vector<double>> cpu_ms_;
+	//frame -> section -> ms, frames are complete once all queries resolve
+	std::map<int, std::map<std::string, double>> gpu_frames_;
+
+	std::vector<PendingQuery_> pending_;
+	std::vector<GLuint> free_queries_;
+	GLuint getQuery_();
+	void resolveQueries_(bool wait);
+	std::map<std::string, std::vector<double>> gpuSeries_();
+};
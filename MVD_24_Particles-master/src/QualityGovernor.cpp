@@ -0,0 +1,84 @@
+//
+//  QualityGovernor.cpp
+//
+#include "QualityGovernor.h"
+#include "GraphicsSystem.h"
+#include "ParticleSystem.h"
+#include <algorithm>
+
+void QualityGovernor::init(GraphicsSystem* gs, ParticleSystem* ps) {
+	graphics_system_ = gs;
+	particle_system_ = ps;
+
+	//level 0 is full quality; cheapest knobs are given up first
+	levels = {
+		//scale  particles shadow_res interval lod_bias
+		{ 1.0f,   1.0f,     2048,      1,       0.0f },
+		{ 1.0f,   0.5f,     2048,      2,       0.0f },
+		{ 0.85f,  0.5f,     1024,      2,       0.5f },
+		{ 0.75f,  0.25f,    1024,      4,       1.0f },
+		{ 0.6f,   0.25f,    512,       4,       1.5f },
+		{ 0.5f,   0.1f,     512,       8,       2.0f },
+	};
+	level_ = 0;
+	applyLevel_();
+}
+
+void QualityGovernor::update() {
+	auto now = std::chrono::steady_clock::now();
+	if (!has_last_time_) {
+		last_time_ = now;
+		has_last_time_ = true;
+		return;
+	}
+	float frame_ms = std::chrono::duration<float, std::milli>(now - last_time_).count();
+	last_time_ = now;
+
+	//exponential moving average, roughly the last 10 frames
+	average_ms_ = average_ms_ == 0.0f ? frame_ms : average_ms_ * 0.9f + frame_ms * 0.1f;
+
+	if (!enabled)
+		return;
+	if (cooldown_ > 0) {
+		cooldown_--;
+		return;
+	}
+
+	if (average_ms_ > budget_ms * (1.0f + degrade_margin)) { over_count_++; under_count_ = 0; }
+	else if (average_ms_ < budget_ms * (1.0f - upgrade_margin)) { under_count_++; over_count_ = 0; }
+	else { over_count_ = 0; under_count_ = 0; }
+
+	char buffer[128];
+	if (over_count_ >= degrade_frames && level_ < (int)levels.size() - 1) {
+		snprintf(buffer, sizeof(buffer), "down to %d (%.1f ms > %.1f ms)", level_ + 1, average_ms_, budget_ms * (1.0f + degrade_margin));
+		last_decision_ = buffer;
+		setLevel(level_ + 1);
+	}
+	else if (under_count_ >= upgrade_frames && level_ > 0) {
+		snprintf(buffer, sizeof(buffer), "up to %d (%.1f ms < %.1f ms)", level_ - 1, average_ms_, budget_ms * (1.0f - upgrade_margin));
+		last_decision_ = buffer;
+		setLevel(level_ - 1);
+	}
+}
+
+void QualityGovernor::setLevel(int level) {
+	level = std::max(0, std::min(level, (int)levels.size() - 1));
+	over_count_ = 0;
+	under_count_ = 0;
+	cooldown_ = cooldown_frames;
+	if (level == level_)
+		return;
+	level_ = level;
+	applyLevel_();
+}
+
+void QualityGovernor::applyLevel_() {
+	const QualityLevel& q = levels[level_];
+	if (graphics_system_) {
+		graphics_system_->setRenderScale(q.render_scale);
+		graphics_system_->setShadowQuality(q.shadow_resolution, q.shadow_interval);
+		graphics_system_->setLodBias(q.lod_bias);
+	}
+	if (particle_system_)
+		particle_system_->draw_scale = q.particle_scale;
+}
@@ -0,0 +1,61 @@
+//
+//  QualityGovernor.h
+//
+//  Watches recent frame times against a budget and steps a quality ladder
+//  up or down. Each level sets render resolution, particle count, shadow map
+//  resolution/update rate and texture LOD bias.
+//  Hysteresis: degrade when the average is over budget + degrade_margin for
+//  a short window, upgrade only when it is under budget - upgrade_margin for
+//  a longer window, and wait cooldown_frames after any change.
+//
+#pragma once
+#include "includes.h"
+#include <chrono>
+#include <vector>
+
+class GraphicsSystem;
+class ParticleSystem;
+
+struct QualityLevel {
+	float render_scale;
+	float particle_scale;
+	int shadow_resolution;
+	int shadow_interval;
+	float lod_bias;
+};
+
+class QualityGovernor {
+public:
+	void init(GraphicsSystem* gs, ParticleSystem* ps);
+	void update(); //call once per frame, measures time since previous call
+
+	bool enabled = true;
+	float budget_ms = 1000.0f / 60.0f;
+	float degrade_margin = 0.10f; //fraction of budget
+	float upgrade_margin = 0.20f;
+	int degrade_frames = 20;
+	int upgrade_frames = 120;
+	int cooldown_frames = 30;
+
+	//read by debug ui
+	std::vector<QualityLevel> levels;
+	int getLevel() { return level_; }
+	void setLevel(int level);
+	float getAverageMs() { return average_ms_; }
+	const std::string& getLastDecision() { return last_decision_; }
+
+private:
+	GraphicsSystem* graphics_system_ = nullptr;
+	ParticleSystem* particle_system_ = nullptr;
+	std::chrono::steady_clock::time_point last_time_;
+	bool has_last_time_ = false;
+
+	int level_ = 0;
+	float average_ms_ = 0.0f;
+	int over_count_ = 0;
+	int under_count_ = 0;
+	int cooldown_ = 0;
+	std::string last_decision_ = "none";
+
+	void applyLevel_();
+};
@@ -0,0 +1,333 @@
+//
+//  ResourceManager.cpp
+//
+#include "ResourceManager.h"
+#include "GraphicsSystem.h"
+#include "Parsers.h"
+#include "Shader.h"
+#include "JobSystem.h"
+#include <unordered_set>
+
+std::string ResourceManager::canonicalPath(const std::string& path) {
+	std::vector<std::string> parts;
+	size_t start = 0;
+	while (start <= path.size()) {
+		size_t end = path.find_first_of("/\\", start);
+		if (end == std::string::npos) end = path.size();
+		std::string part = path.substr(start, end - start);
+		if (part == "..") {
+			if (!parts.empty() && parts.back() != "..") parts.pop_back();
+			else parts.push_back(part);
+		}
+		else if (!part.empty() && part != ".")
+			parts.push_back(part);
+		start = end + 1;
+	}
+	std::string result = (!path.empty() && (path[0] == '/' || path[0] == '\\')) ? "/" : "";
+	for (size_t i = 0; i < parts.size(); i++)
+		result += (i ? "/" : "") + parts[i];
+	return result;
+}
+
+int ResourceManager::find_(const std::string& key) {
+	auto found = lookup_.find(key);
+	if (found == lookup_.end())
+		return -1;
+	slots_[found->second].ref_count++;
+	num_reused_++;
+	return found->second;
+}
+
+int ResourceManager::create_(ResourceType type, const std::string& key) {
+	int slot;
+	if (!free_slots_.empty()) {
+		slot = free_slots_.back();
+		free_slots_.pop_back();
+	}
+	else {
+		slot = (int)slots_.size();
+		slots_.emplace_back();
+	}
+	Slot& new_slot = slots_[slot];
+	unsigned generation = new_slot.generation;
+	new_slot = Slot();
+	new_slot.generation = generation;
+	new_slot.type = type;
+	new_slot.key = key;
+	new_slot.ref_count = 1;
+	lookup_[key] = slot;
+	return slot;
+}
+
+TextureHandle ResourceManager::loadTexture(const std::string& filename) {
+	std::string key = canonicalPath(filename);
+	int slot = find_(key);
+	if (slot >= 0)
+		return handle_<ResourceTexture>(slot);
+
+	GLint texture_id = Parsers::parseTexture(filename);
+	if (texture_id <= 0)
+		return TextureHandle();
+	slot = create_(ResourceTexture, key);
+	slots_[slot].id = texture_id;
+	return handle_<ResourceTexture>(slot);
+}
+
+TextureHandle ResourceManager::loadCubemap(const std::vector<std::string>& faces) {
+	std::string key;
+	for (auto& face : faces)
+		key += canonicalPath(face) + "|";
+	key += "cubemap";
+	int slot = find_(key);
+	if (slot >= 0)
+		return handle_<ResourceTexture>(slot);
+
+	std::vector<std::string> files = faces;
+	GLint texture_id = Parsers::parseCubemap(files);
+	if (texture_id <= 0)
+		return TextureHandle();
+	slot = create_(ResourceTexture, key);
+	slots_[slot].id = texture_id;
+	slots_[slot].cubemap = true;
+	return handle_<ResourceTexture>(slot);
+}
+
+GeometryHandle ResourceManager::loadGeometry(const std::string& filename, bool material_sets) {
+	std::string key = canonicalPath(filename) + (material_sets ? "|material_sets" : "");
+	int slot = find_(key);
+	if (slot >= 0)
+		return handle_<ResourceGeometry>(slot);
+
+	int geom_id = material_sets ? graphics_system_->createMultiGeometryFromFile(filename) :
+		graphics_system_->createGeometryFromFile(filename);
+	if (geom_id < 0)
+		return GeometryHandle();
+	slot = create_(ResourceGeometry, key);
+	slots_[slot].id = geom_id;
+	return handle_<ResourceGeometry>(slot);
+}
+
+GeometryHandle ResourceManager::loadGeometry(GeometryImport& import) {
+	std::string key = canonicalPath(import.filename) + (import.multi ? "|material_sets" : "");
+	int slot = find_(key);
+	if (slot >= 0)
+		return handle_<ResourceGeometry>(slot);
+
+	int geom_id = graphics_system_->uploadGeometry(import);
+	if (geom_id < 0)
+		return GeometryHandle();
+	slot = create_(ResourceGeometry, key);
+	slots_[slot].id = geom_id;
+	return handle_<ResourceGeometry>(slot);
+}
+
+ShaderHandle ResourceManager::loadShader(const std::string& vertex, const std::string& fragment) {
+	std::string key = canonicalPath(vertex) + "|" + canonicalPath(fragment);
+	int slot = find_(key);
+	if (slot >= 0)
+		return handle_<ResourceShader>(slot);
+
+	Shader* new_shader = graphics_system_->loadShader(vertex, fragment);
+	slot = create_(ResourceShader, key);
+	slots_[slot].id = new_shader->program;
+	slots_[slot].shader = new_shader;
+	return handle_<ResourceShader>(slot);
+}
+
+//big files are left out of the batch and parsed in finishGeometries, with
+//every thread on each of them
+void ResourceManager::beginGeometries(const std::vector<std::string>& filenames, JobSystem* jobs) {
+	pending_geometries_.clear();
+	pending_jobs_ = jobs;
+	std::vector<GeometryImport*> imports;
+	std::unordered_set<std::string> batch_keys;
+	for (auto& filename : filenames) {
+		PendingGeometry pending;
+		pending.key = canonicalPath(filename);
+		pending.slot = find_(pending.key);
+		if (pending.slot < 0 && batch_keys.insert(pending.key).second) {
+			pending.import.reset(new GeometryImport());
+			pending.import->filename = filename;
+			if (jobs && jobs->getNumThreads() > 1)
+				pending.import->parse_limit = ObjParser::PARALLEL_MIN_BYTES;
+			imports.push_back(pending.import.get());
+		}
+		pending_geometries_.push_back(std::move(pending));
+	}
+	if (imports.empty())
+		return;
+
+	GraphicsSystem* graphics_system = graphics_system_;
+	auto read = [imports, graphics_system](int first, int last) {
+		for (int i = first; i < last; i++)
+			graphics_system->readGeometry(*imports[i], nullptr);
+	};
+	if (jobs)
+		jobs->begin((int)imports.size(), 1, read);
+	else
+		read(0, (int)imports.size());
+}
+
+void ResourceManager::finishGeometries(std::vector<GeometryHandle>& handles, std::vector<LoadTiming>* timings) {
+	if (pending_jobs_)
+		pending_jobs_->wait();
+	handles.clear();
+	for (auto& pending : pending_geometries_) {
+		int slot = pending.slot;
+		if (pending.import) {
+			int geom_id = graphics_system_->uploadGeometry(*pending.import);
+			if (geom_id >= 0) {
+				slot = create_(ResourceGeometry, pending.key);
+				slots_[slot].id = geom_id;
+			}
+			if (timings)
+				timings->push_back({ pending.key, pending.import->read_ms, pending.import->upload_ms });
+		}
+		else if (slot < 0) //earlier in the batch
+			slot = find_(pending.key);
+		handles.push_back(handle_<ResourceGeometry>(slot));
+	}
+	pending_geometries_.clear();
+	pending_jobs_ = nullptr;
+}
+
+MaterialHandle ResourceManager::createMaterial(const std::string& key, bool* created) {
+	int slot = find_(key);
+	if (created) *created = slot < 0;
+	if (slot >= 0)
+		return handle_<ResourceMaterial>(slot);
+
+	slot = create_(ResourceMaterial, key);
+	slots_[slot].id = graphics_system_->createMaterial();
+	return handle_<ResourceMaterial>(slot);
+}
+
+Shader* ResourceManager::shader(ShaderHandle handle) const {
+	return live_(handle.slot, handle.generation, ResourceShader) ? slots_[handle.slot].shader : nullptr;
+}
+
+//frees the GL side when the last reference goes. Geometry and material
+//indices go back to the GraphicsSystem for reuse, so loading and unloading
+//(sector streaming) doesn't grow its arrays. Ids kept past the release can
+//later reach another resource, handles can't: their generation is checked
+void ResourceManager::release_(int slot) {
+	if (--slots_[slot].ref_count > 0)
+		return;
+
+	Slot& freed = slots_[slot];
+	switch (freed.type) {
+	case ResourceTexture: {
+		GLuint texture_id = (GLuint)freed.id;
+		graphics_system_->getTextureStreamer().cancel(texture_id);
+		glDeleteTextures(1, &texture_id);
+		break;
+	}
+	case ResourceGeometry:
+		graphics_system_->releaseGeometry(freed.id);
+		break;
+	case ResourceShader:
+		graphics_system_->unloadShader((GLuint)freed.id);
+		break;
+	case ResourceMaterial:
+		graphics_system_->releaseMaterial(freed.id);
+		break;
+	default:
+		break;
+	}
+
+	lookup_.erase(freed.key);
+	std::vector<int> dependencies;
+	dependencies.swap(freed.dependencies);
+	freed.key.clear();
+	freed.id = -1;
+	freed.shader = nullptr;
+	freed.bytes = 0;
+	freed.generation++;
+	free_slots_.push_back(slot);
+
+	for (int dependency : dependencies)
+		release_(dependency);
+}
+
+//every level that is there, as the driver reports it. Uncompressed sizes
+//come from the component bits, so RGB8 counts 3 bytes even if stored in 4
+size_t ResourceManager::textureBytes_(const Slot& slot) const {
+	GLenum binding = slot.cubemap ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+	GLenum target = slot.cubemap ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : GL_TEXTURE_2D;
+	glBindTexture(binding, slot.id);
+	GLint max_level = 0;
+	glGetTexParameteriv(binding, GL_TEXTURE_MAX_LEVEL, &max_level);
+	size_t total = 0;
+	for (GLint level = 0; level <= std::min(max_level, 16); level++) {
+		GLint width = 0, height = 0, compressed = 0;
+		glGetTexLevelParameteriv(target, level, GL_TEXTURE_WIDTH, &width);
+		glGetTexLevelParameteriv(target, level, GL_TEXTURE_HEIGHT, &height);
+		if (width == 0 || height == 0) continue;
+		glGetTexLevelParameteriv(target, level, GL_TEXTURE_COMPRESSED, &compressed);
+		if (compressed) {
+			GLint size = 0;
+			glGetTexLevelParameteriv(target, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+			total += size;
+		}
+		else {
+			GLenum components[] = { GL_TEXTURE_RED_SIZE, GL_TEXTURE_GREEN_SIZE, GL_TEXTURE_BLUE_SIZE,
+				GL_TEXTURE_ALPHA_SIZE, GL_TEXTURE_DEPTH_SIZE, GL_TEXTURE_STENCIL_SIZE };
+			GLint bits = 0;
+			for (GLenum component : components) {
+				GLint component_bits = 0;
+				glGetTexLevelParameteriv(target, level, component, &component_bits);
+				bits += component_bits;
+			}
+			total += (size_t)width * height * bits / 8;
+		}
+	}
+	glBindTexture(binding, 0);
+	return slot.cubemap ? total * 6 : total;
+}
+
+void ResourceManager::updateMemory() {
+	for (auto& slot : slots_) {
+		if (slot.ref_count <= 0) continue;
+		switch (slot.type) {
+		case ResourceTexture:
+			slot.bytes = textureBytes_(slot);
+			break;
+		case ResourceGeometry:
+			slot.bytes = graphics_system_->getGeometry(slot.id).gpuBytes();
+			break;
+		case ResourceShader: {
+			//what the driver would hand back as a binary, when it can
+			GLint length = 0;
+			if (GLEW_ARB_get_program_binary)
+				glGetProgramiv(slot.id, GL_PROGRAM_BINARY_LENGTH, &length);
+			slot.bytes = length;
+			break;
+		}
+		default:
+			slot.bytes = sizeof(Material);
+			break;
+		}
+	}
+}
+
+void ResourceManager::getResources(std::vector<ResourceInfo>& resources) const {
+	resources.clear();
+	for (auto& slot : slots_) {
+		if (slot.ref_count > 0)
+			resources.push_back({ slot.type, slot.key, slot.ref_count, slot.bytes });
+	}
+}
+
+size_t ResourceManager::totalBytes(ResourceType type) const {
+	size_t total = 0;
+	for (auto& slot : slots_)
+		if (slot.ref_count > 0 && slot.type == type) total += slot.bytes;
+	return total;
+}
+
+int ResourceManager::count(ResourceType type) const {
+	int total = 0;
+	for (auto& slot : slots_)
+		if (slot.ref_count > 0 && slot.type == type) total++;
+	return total;
+}
@@ -0,0 +1,173 @@
+//
+//  ResourceManager.h
+//
+//  Loads textures, geometries, shaders and materials once per key: the
+//  canonical path of the file(s) plus whatever import options change the
+//  result. Loading a key again returns the same handle and adds a reference;
+//  release() drops one, and the GL objects are freed when none are left.
+//
+//  Handles are typed, and carry the generation of their slot so a handle
+//  to something already freed is refused instead of reaching whatever
+//  reused the slot. Under a handle are the ids the rest of the engine uses:
+//  GL texture names, geometry and material indices, Shader pointers.
+//
+//  A resource can hold references to others (a material to its textures and
+//  shader), which are released with it.
+//
+//  Geometries can also be loaded as a batch whose files are read and parsed
+//  on the job system while the caller carries on (see beginGeometries).
+//
+#pragma once
+#include "includes.h"
+#include "GraphicsUtilities.h"
+#include "MeshCache.h"
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+class GraphicsSystem;
+class JobSystem;
+class Shader;
+
+enum ResourceType {
+	ResourceTexture = 0,
+	ResourceGeometry,
+	ResourceShader,
+	ResourceMaterial,
+	RESOURCE_TYPE_COUNT
+};
+
+template <ResourceType T>
+struct ResourceHandle {
+	int slot = -1;
+	unsigned generation = 0;
+	bool valid() const { return slot >= 0; }
+	bool operator==(const ResourceHandle& other) const { return slot == other.slot && generation == other.generation; }
+};
+typedef ResourceHandle<ResourceTexture> TextureHandle;
+typedef ResourceHandle<ResourceGeometry> GeometryHandle;
+typedef ResourceHandle<ResourceShader> ShaderHandle;
+typedef ResourceHandle<ResourceMaterial> MaterialHandle;
+
+//a live resource, as the debug UI lists them
+struct ResourceInfo {
+	ResourceType type;
+	std::string key;
+	int ref_count;
+	size_t bytes;
+};
+
+//where a load's time went, for startup profiles
+struct LoadTiming {
+	std::string key;
+	double read_ms;   //finding, reading and parsing the file(s)
+	double upload_ms; //creating the GL side
+};
+
+class ResourceManager {
+public:
+	void init(GraphicsSystem* graphics_system) { graphics_system_ = graphics_system; }
+
+	//textures whose pixels are kept (Parsers::parseTexture keep_data) belong
+	//to the caller and don't come through here
+	TextureHandle loadTexture(const std::string& filename);
+	TextureHandle loadCubemap(const std::vector<std::string>& faces);
+	//material_sets: an OBJ's usemtl groups, see createMultiGeometryFromFile
+	GeometryHandle loadGeometry(const std::string& filename, bool material_sets = false);
+	//uploads an import read elsewhere (GraphicsSystem::readGeometry), unless
+	//its file was loaded in the meantime
+	GeometryHandle loadGeometry(GeometryImport& import);
+	ShaderHandle loadShader(const std::string& vertex, const std::string& fragment);
+	//materials have no file of their own, key is e.g. "level.json#name".
+	//created is set when the key was new and the material needs filling in
+	MaterialHandle createMaterial(const std::string& key, bool* created = nullptr);
+
+	//several geometries at once. beginGeometries returns straight away, the
+	//files not loaded yet are read and parsed on jobs (or right here without);
+	//finishGeometries waits for them and uploads on the calling thread, one
+	//handle per file in order. jobs must not be given other work in between.
+	//Timings of the files actually read are added to timings
+	void beginGeometries(const std::vector<std::string>& filenames, JobSystem* jobs);
+	void finishGeometries(std::vector<GeometryHandle>& handles, std::vector<LoadTiming>* timings = nullptr);
+
+	//what the engine knows the resource by. -1 (nullptr) for a stale handle
+	GLint texture(TextureHandle handle) const { return id_(handle.slot, handle.generation, ResourceTexture); }
+	int geometry(GeometryHandle handle) const { return id_(handle.slot, handle.generation, ResourceGeometry); }
+	Shader* shader(ShaderHandle handle) const;
+	int material(MaterialHandle handle) const { return id_(handle.slot, handle.generation, ResourceMaterial); }
+
+	template <ResourceType T> void acquire(ResourceHandle<T> handle) {
+		if (live_(handle.slot, handle.generation, T)) slots_[handle.slot].ref_count++;
+	}
+	template <ResourceType T> void release(ResourceHandle<T> handle) {
+		if (live_(handle.slot, handle.generation, T)) release_(handle.slot);
+	}
+	template <ResourceType T> int refCount(ResourceHandle<T> handle) const {
+		return live_(handle.slot, handle.generation, T) ? slots_[handle.slot].ref_count : 0;
+	}
+	//owner holds a reference to dependency until owner is freed
+	template <ResourceType T, ResourceType U> void addDependency(ResourceHandle<T> owner, ResourceHandle<U> dependency) {
+		if (!live_(owner.slot, owner.generation, T) || !live_(dependency.slot, dependency.generation, U)) return;
+		slots_[dependency.slot].ref_count++;
+		slots_[owner.slot].dependencies.push_back(dependency.slot);
+	}
+
+	//"./data\\a/../b.tga" -> "data/b.tga"
+	static std::string canonicalPath(const std::string& path);
+
+	//sizes are read back from GL, so textures still streaming grow
+	void updateMemory();
+	void getResources(std::vector<ResourceInfo>& resources) const;
+	size_t totalBytes(ResourceType type) const;
+	int count(ResourceType type) const;
+	int numReused() const { return num_reused_; }
+
+private:
+	struct Slot {
+		ResourceType type = ResourceTexture;
+		std::string key;
+		int ref_count = 0;
+		unsigned generation = 0;
+		GLint id = -1;
+		Shader* shader = nullptr;
+		bool cubemap = false;
+		size_t bytes = 0;
+		std::vector<int> dependencies;
+	};
+
+	GraphicsSystem* graphics_system_ = nullptr;
+	std::vector<Slot> slots_;
+	std::vector<int> free_slots_;
+	std::unordered_map<std::string, int> lookup_; //key -> slot
+	int num_reused_ = 0;
+
+	//the batch between beginGeometries and finishGeometries
+	struct PendingGeometry {
+		std::string key;
+		int slot = -1; //when already loaded
+		std::unique_ptr<GeometryImport> import; //first time the key is in the batch
+	};
+	std::vector<PendingGeometry> pending_geometries_;
+	JobSystem* pending_jobs_ = nullptr;
+
+	//slot already loaded under key (with a new reference), else -1
+	int find_(const std::string& key);
+	int create_(ResourceType type, const std::string& key);
+	bool live_(int slot, unsigned generation, ResourceType type) const {
+		return slot >= 0 && slot < (int)slots_.size() && slots_[slot].ref_count > 0 &&
+			slots_[slot].generation == generation && slots_[slot].type == type;
+	}
+	GLint id_(int slot, unsigned generation, ResourceType type) const {
+		return live_(slot, generation, type) ? slots_[slot].id : -1;
+	}
+	template <ResourceType T> ResourceHandle<T> handle_(int slot) const {
+		ResourceHandle<T> handle;
+		if (slot >= 0) {
+			handle.slot = slot;
+			handle.generation = slots_[slot].generation;
+		}
+		return handle;
+	}
+	void release_(int slot);
+	size_t textureBytes_(const Slot& slot) const;
+};
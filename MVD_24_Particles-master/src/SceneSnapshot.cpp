@@ -0,0 +1,391 @@
+//
+//  SceneSnapshot.cpp
+//
+#include "SceneSnapshot.h"
+#include "AnimationSystem.h"
+#include "GraphicsSystem.h"
+#include "MappedFile.h"
+#include "extern.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+
+static_assert(SNAPSHOT_NUM_TYPES == NUM_TYPE_COMPONENTS, "update SNAPSHOT_NUM_TYPES and the snapshot layout");
+
+namespace {
+
+const char SNAPSHOT_MAGIC[4] = { 'M', 'V', 'D', 'E' };
+
+//per entity, its name follows in the names block
+struct SnapshotEntity {
+	int32_t components[SNAPSHOT_NUM_TYPES];
+	uint32_t active;
+	uint32_t name_length;
+};
+
+//pointers components hold, as indices into these
+struct SnapshotHandles {
+	std::vector<Joint*> joints; //distinct skinned mesh roots, in array order
+	std::vector<SkeletonAsset*> skeletons;
+	GraphicsSystem* graphics_system = nullptr;
+
+	void build(GraphicsSystem* graphics, AnimationSystem* animation) {
+		graphics_system = graphics;
+		skeletons = animation ? animation->getSkeletons() : std::vector<SkeletonAsset*>();
+		for (auto& sm : ECS.getAllComponents<SkinnedMesh>())
+			if (sm.root && std::find(joints.begin(), joints.end(), sm.root) == joints.end())
+				joints.push_back(sm.root);
+	}
+};
+
+//writer and reader share one transfer function per component type
+struct SnapshotWriter {
+	std::vector<char>& out;
+	SnapshotHandles& handles;
+	bool ok = true;
+
+	void bytes(void* data, size_t size) { out.insert(out.end(), (const char*)data, (const char*)data + size); }
+	template <typename T> void pod(T& value) { bytes(&value, sizeof(T)); }
+	template <typename T> void array(std::vector<T>& values) {
+		uint32_t count = (uint32_t)values.size();
+		pod(count);
+		bytes(values.data(), values.size() * sizeof(T));
+	}
+	template <typename T> void count(std::vector<T>& values) {
+		uint32_t count = (uint32_t)values.size();
+		pod(count);
+	}
+	void string(std::string& s) {
+		uint32_t length = (uint32_t)s.size();
+		pod(length);
+		bytes(&s[0], s.size());
+	}
+	template <typename T> void pointer(T*& p, const std::vector<T*>& table) {
+		int32_t index = (int32_t)(std::find(table.begin(), table.end(), p) - table.begin());
+		if (!p || index == (int32_t)table.size()) index = -1;
+		pod(index);
+	}
+	template <typename T> void pointer(const T*& p, const std::vector<T*>& table) {
+		T* q = const_cast<T*>(p);
+		pointer(q, table);
+	}
+	void shader(Shader*& s) {
+		uint32_t program = s ? s->program : 0;
+		pod(program);
+	}
+};
+
+struct SnapshotReader {
+	const char* data;
+	size_t size;
+	SnapshotHandles& handles;
+	size_t at = 0;
+	bool ok = true;
+
+	void bytes(void* dest, size_t n) {
+		if (!ok || n > size - at) { ok = false; return; }
+		memcpy(dest, data + at, n);
+		at += n;
+	}
+	template <typename T> void pod(T& value) { bytes(&value, sizeof(T)); }
+	//a count the rest of the data could hold, at least min_bytes each
+	uint32_t readCount_(size_t min_bytes) {
+		uint32_t n = 0;
+		pod(n);
+		if (ok && (size_t)n > (size - at) / min_bytes) ok = false;
+		return ok ? n : 0;
+	}
+	template <typename T> void array(std::vector<T>& values) {
+		values.resize(readCount_(sizeof(T)));
+		bytes(values.data(), values.size() * sizeof(T));
+	}
+	template <typename T> void count(std::vector<T>& values) { values.resize(readCount_(1)); }
+	void string(std::string& s) {
+		s.resize(readCount_(1));
+		bytes(&s[0], s.size());
+	}
+	template <typename T> void pointer(T*& p, const std::vector<T*>& table) {
+		int32_t index = -1;
+		pod(index);
+		p = index >= 0 && index < (int32_t)table.size() ? table[index] : nullptr;
+	}
+	template <typename T> void pointer(const T*& p, const std::vector<T*>& table) {
+		T* q = nullptr;
+		pointer(q, table);
+		p = q;
+	}
+	void shader(Shader*& s) {
+		uint32_t program = 0;
+		pod(program);
+		s = program ? handles.graphics_system->getShader(program) : nullptr;
+	}
+};
+
+//plain data arrays go in one copy
+template <typename A, typename T> void transferArray(A& a, std::vector<T>& values) {
+	static_assert(std::is_trivially_copyable<T>::value, "only plain data is copied in bulk");
+	a.array(values);
+}
+
+template <typename A> void transferBase(A& a, Component& c) {
+	a.pod(c.owner);
+	a.pod(c.index);
+}
+
+template <typename A> void transfer(A& a, ClipPlayer& player) {
+	a.pod(player.clip);
+	a.pod(player.time);
+	a.array(player.cursors);
+}
+
+template <typename A> void transfer(A& a, GUIElement& c) {
+	transferBase(a, c);
+	a.pod(c.texture);
+	a.pod(c.width);
+	a.pod(c.height);
+	a.pod(c.anchor);
+	a.pod(c.offset);
+	a.pod(c.screen_bounds);
+}
+
+template <typename A> void transfer(A& a, GUIText& c) {
+	transfer(a, (GUIElement&)c);
+	a.string(c.text);
+	a.string(c.font_face);
+	a.pod(c.font_size);
+	a.pod(c.color);
+}
+
+template <typename A> void transfer(A& a, Animation& c) {
+	transferBase(a, c);
+	a.string(c.name);
+	a.pod(c.target_transform);
+	a.pod(c.num_frames);
+	a.pod(c.ms_frame);
+	a.array(c.keyframes);
+	transfer(a, c.player);
+	a.pod(c.active);
+}
+
+template <typename A> void transfer(A& a, SkinnedMesh& c) {
+	transferBase(a, c);
+	a.pod(c.geometry);
+	a.pod(c.material);
+	a.pod(c.render_mode);
+	a.pod(c.skin_bind_matrix);
+	a.pointer(c.root, a.handles.joints);
+	a.pod(c.num_joints);
+	a.pod(c.ms_frame);
+	a.pod(c.active);
+	a.pointer(c.skeleton.asset, a.handles.skeletons);
+	a.array(c.skeleton.local);
+	a.array(c.skeleton.global);
+	a.array(c.skeleton.palette);
+	a.array(c.skeleton.prev_palette);
+	a.array(c.skeleton.next_palette);
+	transfer(a, c.player);
+	a.pod(c.anim_lod);
+	a.pod(c.has_bounds);
+	a.pod(c.bounds_min);
+	a.pod(c.bounds_max);
+	a.pod(c.palette_ubo);
+}
+
+template <typename A> void transfer(A& a, BlendShapes& c) {
+	transferBase(a, c);
+	a.count(c.blend_names);
+	for (auto& name : c.blend_names)
+		a.string(name);
+	a.array(c.blend_weights);
+	a.pod(c.on_cpu);
+	a.array(c.applied_weights);
+	a.array(c.positions);
+}
+
+template <typename A> void transfer(A& a, SkinnedCrowd& c) {
+	transferBase(a, c);
+	a.pod(c.geometry);
+	a.pod(c.material);
+	a.pod(c.clip_first_row);
+	a.pod(c.clip_num_frames);
+	a.pod(c.clip_frame_time);
+	a.pod(c.has_clip_bounds);
+	a.pod(c.clip_bounds_min);
+	a.pod(c.clip_bounds_max);
+	a.pod(c.time);
+	a.pod(c.active);
+	a.array(c.transforms);
+	a.array(c.time_offsets);
+	a.array(c.speeds);
+}
+
+template <typename A, typename T> void transferEach(A& a, std::vector<T>& values) {
+	a.count(values);
+	for (auto& value : values)
+		transfer(a, value);
+}
+
+//every array, in ComponentArrays order
+template <typename A> void transferComponents(A& a, ComponentArrays& components) {
+	transferArray(a, std::get<std::vector<Transform>>(components));
+	transferArray(a, std::get<std::vector<Mesh>>(components));
+	transferArray(a, std::get<std::vector<Camera>>(components));
+	transferArray(a, std::get<std::vector<Light>>(components));
+	transferArray(a, std::get<std::vector<Collider>>(components));
+	transferEach(a, std::get<std::vector<GUIElement>>(components));
+	transferEach(a, std::get<std::vector<GUIText>>(components));
+	transferEach(a, std::get<std::vector<Animation>>(components));
+	transferEach(a, std::get<std::vector<SkinnedMesh>>(components));
+	transferEach(a, std::get<std::vector<BlendShapes>>(components));
+	std::vector<ParticleEmitter>& emitters = std::get<std::vector<ParticleEmitter>>(components);
+	transferArray(a, emitters);
+	for (auto& emitter : emitters)
+		a.shader(emitter.shader);
+	transferEach(a, std::get<std::vector<SkinnedCrowd>>(components));
+}
+
+void componentSizes(uint32_t sizes[SNAPSHOT_NUM_TYPES]) {
+	uint32_t all[] = { sizeof(Transform), sizeof(Mesh), sizeof(Camera), sizeof(Light), sizeof(Collider),
+		sizeof(GUIElement), sizeof(GUIText), sizeof(Animation), sizeof(SkinnedMesh), sizeof(BlendShapes),
+		sizeof(ParticleEmitter), sizeof(SkinnedCrowd) };
+	static_assert(sizeof(all) / sizeof(all[0]) == SNAPSHOT_NUM_TYPES, "a size per component type");
+	memcpy(sizes, all, sizeof(all));
+}
+
+//keeps callbacks of the elements there are, see SceneSnapshot.h
+template <typename T> void keepCallbacks(std::vector<T>& restored, const std::vector<T>& live) {
+	for (size_t i = 0; i < restored.size() && i < live.size(); i++)
+		restored[i].onClick = live[i].onClick;
+}
+
+double elapsedMs(std::chrono::high_resolution_clock::time_point since) {
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - since).count();
+}
+
+} //namespace
+
+void SceneSnapshot::init(GraphicsSystem* graphics_system, AnimationSystem* animation_system) {
+	graphics_system_ = graphics_system;
+	animation_system_ = animation_system;
+}
+
+void SceneSnapshot::capture(std::vector<char>& data) {
+	auto start = std::chrono::high_resolution_clock::now();
+	data.clear();
+	SnapshotHandles handles;
+	handles.build(graphics_system_, animation_system_);
+	SnapshotWriter writer{ data, handles };
+
+	SnapshotHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, 4);
+	header.version = SNAPSHOT_VERSION;
+	header.num_entities = (uint32_t)ECS.entities.size();
+	header.main_camera = ECS.main_camera;
+	componentSizes(header.component_sizes);
+	writer.pod(header);
+
+	std::vector<SnapshotEntity> entities(ECS.entities.size());
+	std::string names;
+	for (size_t i = 0; i < ECS.entities.size(); i++) {
+		memcpy(entities[i].components, ECS.entities[i].components, sizeof(entities[i].components));
+		entities[i].active = ECS.entities[i].active ? 1 : 0;
+		entities[i].name_length = (uint32_t)ECS.entities[i].name.size();
+		names += ECS.entities[i].name;
+	}
+	writer.bytes(entities.data(), entities.size() * sizeof(SnapshotEntity));
+	writer.string(names);
+
+	transferComponents(writer, ECS.components);
+	last_ms = elapsedMs(start);
+}
+
+bool SceneSnapshot::restore(const char* data, size_t size) {
+	auto start = std::chrono::high_resolution_clock::now();
+	SnapshotHandles handles;
+	handles.build(graphics_system_, animation_system_);
+	SnapshotReader reader{ data, size, handles };
+
+	SnapshotHeader header, expected;
+	reader.pod(header);
+	componentSizes(expected.component_sizes);
+	if (!reader.ok || memcmp(header.magic, SNAPSHOT_MAGIC, 4) != 0 || header.version != SNAPSHOT_VERSION ||
+		memcmp(header.component_sizes, expected.component_sizes, sizeof(expected.component_sizes)) != 0 ||
+		(size_t)header.num_entities > size / sizeof(SnapshotEntity)) {
+		std::cerr << "ERROR: Not a scene snapshot this build can restore" << std::endl;
+		return false;
+	}
+
+	//read into a store of its own, which replaces the ECS only once complete
+	std::vector<SnapshotEntity> records(header.num_entities);
+	std::string names;
+	reader.bytes(records.data(), records.size() * sizeof(SnapshotEntity));
+	reader.string(names);
+	ComponentArrays components;
+	transferComponents(reader, components);
+	if (!reader.ok || reader.at != size) {
+		std::cerr << "ERROR: Scene snapshot is incomplete" << std::endl;
+		return false;
+	}
+
+	std::vector<Entity> entities(records.size());
+	size_t name_at = 0;
+	for (size_t i = 0; i < records.size(); i++) {
+		memcpy(entities[i].components, records[i].components, sizeof(entities[i].components));
+		entities[i].active = records[i].active != 0;
+		if (records[i].name_length > names.size() - name_at) {
+			std::cerr << "ERROR: Scene snapshot is incomplete" << std::endl;
+			return false;
+		}
+		entities[i].name = names.substr(name_at, records[i].name_length);
+		name_at += records[i].name_length;
+	}
+
+	keepCallbacks(std::get<std::vector<GUIElement>>(components), ECS.getAllComponents<GUIElement>());
+	keepCallbacks(std::get<std::vector<GUIText>>(components), ECS.getAllComponents<GUIText>());
+	ECS.entities.swap(entities);
+	ECS.components.swap(components);
+	ECS.main_camera = header.main_camera;
+	last_ms = elapsedMs(start);
+	return true;
+}
+
+//written beside the file and renamed, so a crash never leaves half of one
+bool SceneSnapshot::save(const std::string& filename) {
+	std::vector<char> data;
+	capture(data);
+	std::string temp_path = filename + ".tmp";
+	std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		std::cerr << "ERROR: Could not write scene snapshot " << temp_path << std::endl;
+		return false;
+	}
+	file.write(data.data(), data.size());
+	file.close();
+	if (!file) {
+		std::cerr << "ERROR: Could not write scene snapshot " << temp_path << std::endl;
+		std::remove(temp_path.c_str());
+		return false;
+	}
+	std::remove(filename.c_str());
+	if (std::rename(temp_path.c_str(), filename.c_str()) != 0)
+		return false;
+	printf("Scene snapshot %s: %d entities, %.2f MB in %.2f ms\n", filename.c_str(), (int)ECS.entities.size(),
+		data.size() / 1048576.0, last_ms);
+	return true;
+}
+
+bool SceneSnapshot::load(const std::string& filename) {
+	MappedFile file;
+	if (!file.open(filename)) {
+		std::cerr << "ERROR: Could not open scene snapshot " << filename << std::endl;
+		return false;
+	}
+	if (!restore(file.data(), file.size()))
+		return false;
+	printf("Scene snapshot %s restored: %d entities in %.2f ms\n", filename.c_str(), (int)ECS.entities.size(), last_ms);
+	return true;
+}
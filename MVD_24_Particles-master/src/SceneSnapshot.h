@@ -0,0 +1,63 @@
+//
+//  SceneSnapshot.h
+//
+//  The whole EntityComponentStore as one binary blob, so a scene can be put
+//  back as it was at any frame without running Game::init again: transforms,
+//  animation players and poses, crowds, colliders, cameras and so on.
+//
+//  Component arrays of plain data (Transform, Mesh, Camera, Light, Collider,
+//  ParticleEmitter) are written and read back in bulk; the others field by
+//  field. Pointers become handles: Joint* the index of the root among the
+//  skinned meshes' roots, SkeletonAsset* its index in AnimationSystem and
+//  Shader* the program name.
+//
+//  Resources (geometries, materials, textures, GL buffers) are not part of
+//  it, components keep the ids they had. So a snapshot is restored into the
+//  scene it was taken from, or the same scene loaded again by the same
+//  build: the handle tables are rebuilt from it, and a snapshot whose
+//  component layout differs is refused. GUI click callbacks can't be stored,
+//  elements keep the ones they have.
+//
+//  Layout: SnapshotHeader, an entity table (per entity its component
+//  indices, active flag and name), then each component array in
+//  ComponentArrays order, prefixed by its count.
+//
+#pragma once
+#include "includes.h"
+#include <cstdint>
+#include <vector>
+
+class GraphicsSystem;
+class AnimationSystem;
+
+//bump whenever the layout changes
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_NUM_TYPES 12 //NUM_TYPE_COMPONENTS, checked in SceneSnapshot.cpp
+
+struct SnapshotHeader {
+	char magic[4]; //"MVDE"
+	uint32_t version;
+	uint32_t num_entities;
+	int32_t main_camera;
+	uint32_t component_sizes[SNAPSHOT_NUM_TYPES]; //sizeof each, a different build won't match
+};
+
+class SceneSnapshot {
+public:
+	void init(GraphicsSystem* graphics_system, AnimationSystem* animation_system);
+
+	void capture(std::vector<char>& data);
+	//replaces everything in the ECS, false (and nothing changed) if data is
+	//not a snapshot of this scene's layout
+	bool restore(const char* data, size_t size);
+
+	bool save(const std::string& filename);
+	bool load(const std::string& filename);
+
+	//how long the last capture or restore took
+	double last_ms = 0.0;
+
+private:
+	GraphicsSystem* graphics_system_ = nullptr;
+	AnimationSystem* animation_system_ = nullptr;
+};
@@ -0,0 +1,438 @@
+//
+//  SectorStreamer.cpp
+//
+#include "SectorStreamer.h"
+#include "GraphicsSystem.h"
+#include "MappedFile.h"
+#include "Shader.h"
+#include "extern.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+const char SECTOR_WORLD_MAGIC[4] = { 'M', 'V', 'D', 'W' };
+const char SECTOR_MAGIC[4] = { 'M', 'V', 'D', 'C' };
+//name of unloaded entities waiting in the pool, so a snapshot of them can
+//be recognised and pooled again after it is restored
+const char* const POOLED_ENTITY = "<sector pool>";
+
+} //namespace
+
+SectorStreamer::~SectorStreamer() {
+	shutdown();
+}
+
+std::string SectorStreamer::sectorPath(const std::string& level, int x, int z) {
+	char name[32];
+	snprintf(name, sizeof(name), "%d_%d", x, z);
+	return level + ".sectors/" + name;
+}
+
+bool SectorStreamer::open(const std::string& world, GraphicsSystem* graphics_system) {
+	shutdown();
+	for (auto& sector : sectors_)
+		if (sector->state == SectorLoaded) unload_(*sector);
+	MappedFile file;
+	if (!file.open(worldPath(world))) {
+		std::cerr << "ERROR: Could not open world " << worldPath(world) << std::endl;
+		return false;
+	}
+	SectorWorldHeader header;
+	if (file.size() >= sizeof(header))
+		memcpy(&header, file.data(), sizeof(header));
+	if (file.size() < sizeof(header) || memcmp(header.magic, SECTOR_WORLD_MAGIC, 4) != 0 ||
+		header.version != SECTOR_VERSION ||
+		file.size() != sizeof(header) + (size_t)header.num_sectors * sizeof(SectorInfo)) {
+		std::cerr << "ERROR: " << worldPath(world) << " is not a world this build can read" << std::endl;
+		return false;
+	}
+
+	graphics_system_ = graphics_system;
+	world_ = world;
+	sector_size_ = header.sector_size;
+	sectors_.clear();
+	const SectorInfo* infos = (const SectorInfo*)(file.data() + sizeof(header));
+	size_t total_bytes = 0;
+	for (uint32_t i = 0; i < header.num_sectors; i++) {
+		sectors_.emplace_back(new Sector());
+		memcpy(&sectors_.back()->info, &infos[i], sizeof(SectorInfo));
+		sectors_.back()->file = sectorPath(world, infos[i].x, infos[i].z);
+		total_bytes += (size_t)infos[i].bytes;
+	}
+	has_position_ = false;
+	quit_ = false;
+	worker_ = std::thread(&SectorStreamer::workerLoop_, this);
+	printf("World %s: %d sectors of %.0f units, %.2f MB in all\n", world.c_str(), (int)sectors_.size(),
+		sector_size_, total_bytes / 1048576.0);
+	return true;
+}
+
+//sectors stay as they are, resources are freed with everything else
+void SectorStreamer::shutdown() {
+	if (!worker_.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		quit_ = true;
+		queue_.clear();
+	}
+	queue_cv_.notify_all();
+	worker_.join();
+}
+
+void SectorStreamer::close() {
+	shutdown();
+	for (auto& sector : sectors_)
+		if (sector->state == SectorLoaded) unload_(*sector);
+	sectors_.clear();
+	geometry_refs_.clear();
+	world_.clear();
+	has_position_ = false;
+}
+
+void SectorStreamer::adoptEntities() {
+	free_entities_[0].clear();
+	free_entities_[1].clear();
+	for (size_t i = 0; i < ECS.entities.size(); i++) {
+		Entity& entity = ECS.entities[i];
+		if (entity.active || entity.name != POOLED_ENTITY || entity.components[type2int<Mesh>::result] < 0)
+			continue;
+		bool has_collider = entity.components[type2int<Collider>::result] >= 0;
+		free_entities_[has_collider ? 1 : 0].push_back((int)i);
+	}
+}
+
+int SectorStreamer::numLoaded() const {
+	int total = 0;
+	for (auto& sector : sectors_)
+		if (sector->state == SectorLoaded) total++;
+	return total;
+}
+
+size_t SectorStreamer::committedBytes() const {
+	size_t total = 0;
+	for (auto& sector : sectors_)
+		if (sector->state != SectorUnloaded) total += (size_t)sector->info.bytes;
+	return total;
+}
+
+//on the xz plane, 0 inside the sector's bounds
+float SectorStreamer::distance_(const Sector& sector, const lm::vec3& point) const {
+	float dx = std::max(std::max(sector.info.min[0] - point.x, point.x - sector.info.max[0]), 0.0f);
+	float dz = std::max(std::max(sector.info.min[2] - point.z, point.z - sector.info.max[2]), 0.0f);
+	return sqrtf(dx * dx + dz * dz);
+}
+
+void SectorStreamer::update(float dt) {
+	if (!isActive() || ECS.main_camera < 0)
+		return;
+
+	//velocity from the camera's movement, smoothed so a single jump doesn't
+	//throw the prefetch point across the world
+	lm::vec3 position = ECS.getComponentInArray<Camera>(ECS.main_camera).position;
+	if (has_position_ && dt > 0.0f) {
+		float blend = std::min(dt * 4.0f, 1.0f);
+		velocity_ = velocity_ * (1.0f - blend) + (position - last_position_) * (blend / dt);
+	}
+	last_position_ = position;
+	has_position_ = true;
+	lm::vec3 ahead = position + velocity_ * prefetch_seconds;
+
+	//out of range: cancelled, or unloaded
+	std::vector<Sector*> candidates;
+	for (auto& sector : sectors_) {
+		float near_now = distance_(*sector, position);
+		float near_ahead = distance_(*sector, ahead);
+		sector->distance = std::min(near_now, near_ahead);
+		if (sector->state != SectorUnloaded && sector->distance > unload_radius) {
+			if (sector->state == SectorLoaded)
+				unload_(*sector);
+			else
+				cancel_(*sector);
+		}
+		else if (sector->state == SectorUnloaded && sector->distance <= load_radius)
+			candidates.push_back(sector.get());
+		else if (sector->state != SectorLoaded && sector->distance <= load_radius)
+			sector->wanted = true; //back in range while still being read
+	}
+
+	//nearest first, pushing out loaded sectors farther than the one coming in
+	std::sort(candidates.begin(), candidates.end(),
+		[](const Sector* a, const Sector* b) { return a->distance < b->distance; });
+	size_t committed = committedBytes();
+	for (Sector* sector : candidates) {
+		while (committed + sector->info.bytes > memory_budget) {
+			Sector* farthest = nullptr;
+			for (auto& loaded : sectors_) {
+				if (loaded->state == SectorLoaded && loaded->distance > sector->distance &&
+					(!farthest || loaded->distance > farthest->distance))
+					farthest = loaded.get();
+			}
+			if (!farthest)
+				break;
+			committed -= (size_t)farthest->info.bytes;
+			unload_(*farthest);
+		}
+		if (committed + sector->info.bytes > memory_budget)
+			break;
+		committed += (size_t)sector->info.bytes;
+		enqueue_(*sector);
+	}
+
+	//sectors read by the worker, nearest first
+	std::vector<Sector*> ready;
+	for (auto& sector : sectors_) {
+		if (sector->state != SectorReady)
+			continue;
+		if (sector->wanted)
+			ready.push_back(sector.get());
+		else
+			cancel_(*sector);
+	}
+	std::sort(ready.begin(), ready.end(),
+		[](const Sector* a, const Sector* b) { return a->distance < b->distance; });
+	for (int i = 0; i < (int)ready.size() && i < applies_per_frame; i++)
+		apply_(*ready[i]);
+}
+
+//geometries loaded sectors hold are left for the GL thread to share
+void SectorStreamer::enqueue_(Sector& sector) {
+	sector.resident.clear();
+	for (auto& geometry : geometry_refs_)
+		sector.resident.insert(geometry.first);
+	sector.wanted = true;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		sector.state = SectorQueued;
+		queue_.push_back(&sector);
+	}
+	queue_cv_.notify_one();
+}
+
+//a sector the worker is reading is left to finish, and dropped once ready
+void SectorStreamer::cancel_(Sector& sector) {
+	sector.wanted = false;
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (sector.state == SectorQueued) {
+		queue_.erase(std::find(queue_.begin(), queue_.end(), &sector));
+		sector.state = SectorUnloaded;
+	}
+	else if (sector.state == SectorReady) {
+		sector.contents.reset();
+		sector.state = SectorUnloaded;
+	}
+}
+
+void SectorStreamer::workerLoop_() {
+	for (;;) {
+		Sector* sector = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			queue_cv_.wait(lock, [this] { return quit_ || !queue_.empty(); });
+			if (quit_)
+				return;
+			sector = queue_.front();
+			queue_.pop_front();
+			sector->state = SectorReading;
+		}
+		read_(*sector);
+		sector->state = SectorReady;
+	}
+}
+
+//worker thread: the sector file, then every geometry not already resident
+void SectorStreamer::read_(Sector& sector) {
+	std::unique_ptr<SectorContents> contents(new SectorContents());
+	MappedFile file;
+	SectorHeader header;
+	bool ok = file.open(sector.file) && file.size() >= sizeof(header);
+	if (ok)
+		memcpy(&header, file.data(), sizeof(header));
+	size_t strings_offset = sizeof(header);
+	if (ok) {
+		strings_offset += (size_t)header.num_geometries * sizeof(uint32_t) +
+			(size_t)header.num_textures * sizeof(SectorTexture) +
+			(size_t)header.num_materials * sizeof(SectorMaterial) +
+			(size_t)header.num_entities * sizeof(SectorEntity);
+		ok = memcmp(header.magic, SECTOR_MAGIC, 4) == 0 && header.version == SECTOR_VERSION &&
+			strings_offset + header.strings_size == file.size() && header.strings_size > 0 &&
+			file.data()[file.size() - 1] == 0;
+	}
+	if (!ok) {
+		std::cerr << "ERROR: Could not read sector " << sector.file << std::endl;
+		contents->failed = true;
+		sector.contents = std::move(contents);
+		return;
+	}
+
+	const char* strings = file.data() + strings_offset;
+	auto string = [&](uint32_t offset) {
+		return offset < header.strings_size ? std::string(strings + offset) : std::string();
+	};
+	const char* data = file.data() + sizeof(header);
+	for (uint32_t i = 0; i < header.num_geometries; i++, data += sizeof(uint32_t)) {
+		uint32_t offset;
+		memcpy(&offset, data, sizeof(offset));
+		contents->geometries.push_back(string(offset));
+	}
+	for (uint32_t i = 0; i < header.num_textures; i++, data += sizeof(SectorTexture)) {
+		SectorTexture texture;
+		memcpy(&texture, data, sizeof(texture));
+		contents->textures.emplace_back();
+		for (uint32_t j = 0; j < texture.num_files && j < 6; j++)
+			contents->textures.back().push_back(string(texture.files[j]));
+	}
+	for (uint32_t i = 0; i < header.num_materials; i++, data += sizeof(SectorMaterial)) {
+		SectorMaterial material;
+		memcpy(&material, data, sizeof(material));
+		contents->materials.push_back(material);
+		contents->material_keys.push_back(string(material.key));
+		contents->vertex_shaders.push_back(string(material.vertex));
+		contents->fragment_shaders.push_back(string(material.fragment));
+	}
+	for (uint32_t i = 0; i < header.num_entities; i++, data += sizeof(SectorEntity)) {
+		SectorEntity entity;
+		memcpy(&entity, data, sizeof(entity));
+		contents->entities.push_back(entity);
+		contents->names.push_back(string(entity.name));
+	}
+
+	for (auto& geometry : contents->geometries) {
+		std::unique_ptr<GeometryImport> import;
+		if (!sector.resident.count(ResourceManager::canonicalPath(geometry))) {
+			import.reset(new GeometryImport());
+			import->filename = geometry;
+			graphics_system_->readGeometry(*import, nullptr);
+		}
+		contents->imports.push_back(std::move(import));
+	}
+	sector.contents = std::move(contents);
+}
+
+int SectorStreamer::takeEntity_(bool collider) {
+	std::vector<int>& free_entities = free_entities_[collider ? 1 : 0];
+	if (!free_entities.empty()) {
+		int entity = free_entities.back();
+		free_entities.pop_back();
+		return entity;
+	}
+	int entity = ECS.createEntity("");
+	ECS.createComponentForEntity<Mesh>(entity);
+	if (collider)
+		ECS.createComponentForEntity<Collider>(entity);
+	return entity;
+}
+
+//GL thread: uploads, then places the entities
+void SectorStreamer::apply_(Sector& sector) {
+	std::unique_ptr<SectorContents> contents = std::move(sector.contents);
+	sector.state = SectorUnloaded;
+	if (contents->failed)
+		return;
+	ResourceManager& resources = graphics_system_->getResources();
+
+	//geometries read by the worker, or shared with loaded sectors (loaded
+	//here if those went in the meantime)
+	for (size_t i = 0; i < contents->geometries.size(); i++) {
+		GeometryHandle handle = contents->imports[i] ? resources.loadGeometry(*contents->imports[i]) :
+			resources.loadGeometry(contents->geometries[i]);
+		std::string key = ResourceManager::canonicalPath(contents->geometries[i]);
+		if (handle.valid())
+			geometry_refs_[key]++;
+		sector.geometries.push_back(handle);
+		sector.geometry_keys.push_back(key);
+	}
+
+	//materials other sectors (or the level) made already are shared as they are
+	std::vector<int> material_ids;
+	for (size_t i = 0; i < contents->materials.size(); i++) {
+		const SectorMaterial& source = contents->materials[i];
+		bool created = false;
+		MaterialHandle handle = resources.createMaterial(contents->material_keys[i], &created);
+		int mat_id = resources.material(handle);
+		sector.materials.push_back(handle);
+		material_ids.push_back(mat_id);
+		if (!created)
+			continue;
+
+		Material& material = graphics_system_->getMaterial(mat_id);
+		ShaderHandle shader = resources.loadShader(contents->vertex_shaders[i], contents->fragment_shaders[i]);
+		material.shader_id = resources.shader(shader)->program;
+		material.diffuse = lm::vec3(source.diffuse[0], source.diffuse[1], source.diffuse[2]);
+		material.specular = lm::vec3(source.specular[0], source.specular[1], source.specular[2]);
+		material.ambient = lm::vec3(source.ambient[0], source.ambient[1], source.ambient[2]);
+		resources.addDependency(handle, shader);
+		resources.release(shader);
+
+		int maps[2] = { source.diffuse_map, source.cube_map };
+		for (int m = 0; m < 2; m++) {
+			//a texture listing no files is left off the material
+			if (maps[m] < 0 || maps[m] >= (int)contents->textures.size() || contents->textures[maps[m]].empty())
+				continue;
+			const std::vector<std::string>& files = contents->textures[maps[m]];
+			TextureHandle texture = files.size() == 6 ? resources.loadCubemap(files) : resources.loadTexture(files[0]);
+			(m == 0 ? material.diffuse_map : material.cube_map) = resources.texture(texture);
+			resources.addDependency(handle, texture);
+			resources.release(texture);
+		}
+	}
+
+	for (size_t i = 0; i < contents->entities.size(); i++) {
+		const SectorEntity& source = contents->entities[i];
+		bool has_collider = source.collider >= 0;
+		int entity = takeEntity_(has_collider);
+		ECS.entities[entity].name = contents->names[i];
+		ECS.entities[entity].active = true;
+
+		Transform& transform = ECS.getComponentFromEntity<Transform>(entity);
+		memcpy(transform.m, source.matrix, sizeof(source.matrix));
+		transform.parent = -1;
+
+		Mesh& mesh = ECS.getComponentFromEntity<Mesh>(entity);
+		mesh.geometry = source.geometry >= 0 && source.geometry < (int)sector.geometries.size() ?
+			resources.geometry(sector.geometries[source.geometry]) : -1;
+		mesh.material = source.material >= 0 && source.material < (int)material_ids.size() ?
+			material_ids[source.material] : 0;
+		mesh.render_mode = (RenderMode)source.render_mode;
+
+		if (has_collider) {
+			Collider& collider = ECS.getComponentFromEntity<Collider>(entity);
+			collider.collider_type = (ColliderType)source.collider;
+			collider.local_center = lm::vec3(source.collider_center[0], source.collider_center[1], source.collider_center[2]);
+			collider.local_halfwidth = lm::vec3(source.collider_halfwidth[0], source.collider_halfwidth[1], source.collider_halfwidth[2]);
+		}
+		//a mesh without geometry is never drawn
+		if (mesh.geometry < 0)
+			ECS.entities[entity].active = false;
+		sector.entities.push_back(entity);
+	}
+	sector.state = SectorLoaded;
+	num_loads_++;
+}
+
+void SectorStreamer::unload_(Sector& sector) {
+	ResourceManager& resources = graphics_system_->getResources();
+	for (int entity : sector.entities) {
+		ECS.entities[entity].active = false;
+		ECS.entities[entity].name = POOLED_ENTITY;
+		bool has_collider = ECS.entities[entity].components[type2int<Collider>::result] >= 0;
+		free_entities_[has_collider ? 1 : 0].push_back(entity);
+	}
+	for (size_t i = 0; i < sector.geometries.size(); i++) {
+		if (sector.geometries[i].valid() && --geometry_refs_[sector.geometry_keys[i]] == 0)
+			geometry_refs_.erase(sector.geometry_keys[i]);
+		resources.release(sector.geometries[i]);
+	}
+	for (auto& material : sector.materials)
+		resources.release(material);
+	sector.entities.clear();
+	sector.geometries.clear();
+	sector.geometry_keys.clear();
+	sector.materials.clear();
+	sector.wanted = false;
+	sector.state = SectorUnloaded;
+	num_unloads_++;
+}
@@ -0,0 +1,193 @@
+//
+//  SectorStreamer.h
+//
+//  Streams a world cut into square sectors on the xz plane. Each sector is
+//  cooked (AssetCooker::addWorld) from a level's entities into a file of its
+//  own, naming the geometries, textures, shaders and materials it needs.
+//
+//  update() loads the sectors within load_radius of the main camera, or of
+//  where the camera will be prefetch_seconds from now at its current
+//  velocity, and unloads those past unload_radius of both. A worker thread
+//  reads the sector file and its geometries; the GL thread then uploads
+//  them and places the entities, at most applies_per_frame sectors a frame.
+//
+//  The sectors loaded or loading never add up to more than memory_budget
+//  (their cooked estimate): nearer sectors push the farthest ones out, and
+//  those that still don't fit wait. Entities of unloaded sectors are kept
+//  inactive and reused by the next sector, as the ECS can't destroy them,
+//  and their resources are released. So neither the ECS nor GPU memory grow
+//  with the size of the world, only with what is in range.
+//
+//  World layout:  SectorWorldHeader, then SectorInfo per sector.
+//  Sector layout: SectorHeader, then uint32_t geometry file strings,
+//                 SectorTexture, SectorMaterial and SectorEntity arrays,
+//                 then the strings (each ended with a 0) they point into.
+//
+#pragma once
+#include "includes.h"
+#include "ResourceManager.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+class GraphicsSystem;
+
+//bump whenever the layout changes
+#define SECTOR_VERSION 1
+//string offset meaning none
+#define SECTOR_NO_STRING 0xffffffffu
+
+struct SectorWorldHeader {
+	char magic[4]; //"MVDW"
+	uint32_t version;
+	uint32_t num_sectors;
+	float sector_size;
+};
+
+struct SectorInfo {
+	int32_t x, z; //cell, covering [x, x+1) * sector_size
+	float min[3], max[3]; //of the entity positions
+	uint32_t num_entities;
+	uint32_t padding;
+	uint64_t bytes; //cooked geometries and textures it uses
+};
+
+struct SectorHeader {
+	char magic[4]; //"MVDC"
+	uint32_t version;
+	int32_t x, z;
+	uint32_t num_geometries;
+	uint32_t num_textures;
+	uint32_t num_materials;
+	uint32_t num_entities;
+	uint32_t strings_size;
+};
+
+//a 2D texture, or a cubemap from six faces
+struct SectorTexture {
+	uint32_t files[6];
+	uint32_t num_files;
+};
+
+struct SectorMaterial {
+	uint32_t key; //shared by sectors of the same level, as in parseJSONLevel
+	uint32_t vertex, fragment;
+	int32_t diffuse_map, cube_map; //textures, -1 for none
+	float diffuse[3], specular[3], ambient[3];
+};
+
+//the global matrix, the level's hierarchy is baked into it
+struct SectorEntity {
+	float matrix[16];
+	uint32_t name;
+	int32_t geometry, material;
+	int32_t render_mode;
+	int32_t collider; //ColliderTypeBox, or -1
+	float collider_center[3], collider_halfwidth[3];
+};
+
+class SectorStreamer {
+public:
+	~SectorStreamer();
+
+	//world: the level the sectors were cooked from
+	bool open(const std::string& world, GraphicsSystem* graphics_system);
+	void shutdown();
+	bool isActive() const { return worker_.joinable(); }
+	//unloads every sector and forgets the world, "" when none is open.
+	//Unloaded entities stay pooled for the next world. When the ECS was
+	//replaced since (a snapshot restored), adoptEntities pools the ones the
+	//snapshot holds instead
+	void close();
+	void adoptEntities();
+	const std::string& world() const { return world_; }
+
+	//GL thread, once a frame
+	void update(float dt);
+
+	float load_radius = 60.0f;
+	float unload_radius = 90.0f;
+	float prefetch_seconds = 2.0f;
+	size_t memory_budget = (size_t)256 << 20;
+	int applies_per_frame = 1;
+
+	int numSectors() const { return (int)sectors_.size(); }
+	int numLoaded() const;
+	size_t committedBytes() const;
+	int numLoads() const { return num_loads_; }
+	int numUnloads() const { return num_unloads_; }
+
+	static std::string worldPath(const std::string& level) { return level + ".world"; }
+	static std::string sectorPath(const std::string& level, int x, int z);
+
+private:
+	enum SectorState { SectorUnloaded, SectorQueued, SectorReading, SectorReady, SectorLoaded };
+
+	//what the worker reads
+	struct SectorContents {
+		std::vector<std::string> geometries;
+		std::vector<std::unique_ptr<GeometryImport>> imports; //null when resident
+		std::vector<std::vector<std::string>> textures;
+		std::vector<SectorMaterial> materials;
+		std::vector<std::string> material_keys, vertex_shaders, fragment_shaders;
+		std::vector<SectorEntity> entities;
+		std::vector<std::string> names;
+		bool failed = false;
+	};
+
+	struct Sector {
+		SectorInfo info;
+		std::string file;
+		std::atomic<int> state{ SectorUnloaded };
+		bool wanted = false; //GL thread only
+		float distance = 0.0f;
+
+		//filled by the worker before state becomes ready
+		std::unique_ptr<SectorContents> contents;
+		std::unordered_set<std::string> resident; //geometries not to read
+
+		//while loaded
+		std::vector<int> entities;
+		std::vector<GeometryHandle> geometries;
+		std::vector<std::string> geometry_keys;
+		std::vector<MaterialHandle> materials;
+	};
+
+	GraphicsSystem* graphics_system_ = nullptr;
+	std::string world_;
+	float sector_size_ = 0.0f;
+	std::vector<std::unique_ptr<Sector>> sectors_;
+
+	std::thread worker_;
+	std::mutex mutex_;
+	std::condition_variable queue_cv_;
+	std::deque<Sector*> queue_;
+	bool quit_ = false;
+
+	//entities of unloaded sectors, without and with a collider
+	std::vector<int> free_entities_[2];
+	//geometries held by loaded sectors, by key
+	std::unordered_map<std::string, int> geometry_refs_;
+
+	lm::vec3 last_position_;
+	lm::vec3 velocity_;
+	bool has_position_ = false;
+	int num_loads_ = 0;
+	int num_unloads_ = 0;
+
+	void workerLoop_();
+	void read_(Sector& sector);
+	void enqueue_(Sector& sector);
+	void cancel_(Sector& sector);
+	void apply_(Sector& sector);
+	void unload_(Sector& sector);
+	int takeEntity_(bool collider);
+	float distance_(const Sector& sector, const lm::vec3& point) const;
+};
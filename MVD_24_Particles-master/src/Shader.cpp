@@ -1,6 +1,8 @@
 #include "Shader.h"
+#include "MappedFile.h"
+#include "ShaderCache.h"
+#include <algorithm>
 #include <vector>
-#include <fstream>
 #include <sstream>
 
 
@@ -19,8 +21,35 @@ std::vector<std::string> split(const std::string &s, char delim) {
     return elems;
 }
 
+ShaderCache* Shader::cache_ = nullptr;
+bool Shader::parallel_compile_ = false;
+std::vector<Shader*> Shader::pending_;
+
 Shader::Shader() {}
 
+Shader::~Shader() {
+    pending_.erase(std::remove(pending_.begin(), pending_.end(), this), pending_.end());
+}
+
+void Shader::initCompiler() {
+    //as many threads as the driver likes
+    if (GLEW_KHR_parallel_shader_compile) {
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+        parallel_compile_ = true;
+    }
+    else if (GLEW_ARB_parallel_shader_compile) {
+        glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+        parallel_compile_ = true;
+    }
+}
+
+void Shader::pollPending() {
+    //ready() takes finished programs out of the list
+    std::vector<Shader*> pending = pending_;
+    for (Shader* shader : pending)
+        shader->ready();
+}
+
 
 //uniform setters
 //int
@@ -129,6 +158,17 @@ bool Shader::setTexture(UniformID id, GLuint tex_id, GLuint unit) {
     }
     return false;
 }
+//texture buffer
+bool Shader::setTextureBuffer(UniformID id, GLuint tex_id, GLuint unit) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_BUFFER, tex_id);
+    GLint loc = getUniformLocation(id);
+    if (loc != -1) {
+        glUniform1i(loc, unit);
+        return true;
+    }
+    return false;
+}
 //texture cube
 bool Shader::setTextureCube(UniformID id, GLuint tex_id, GLuint unit) {
     //get texture id and bind it
@@ -145,55 +185,57 @@ bool Shader::setTextureCube(UniformID id, GLuint tex_id, GLuint unit) {
 
 
 
+//through MappedFile, so shaders are also found in the mounted asset pack
 std::string Shader::readFile(std::string filename) {
-	std::ifstream f(filename);
-	std::stringstream buffer;
-	buffer << f.rdbuf();
-	std::string content = buffer.str();
-	return content;
+	MappedFile file;
+	if (!file.open(filename))
+		return std::string();
+	return std::string(file.data(), file.size());
 }
 
 Shader::Shader(std::string vertSource, std::string fragSource) {
     std::vector<std::string> result = split(fragSource, '/');
     name = result.back();
-	std::string vertexShaderSourceCode=readFile(vertSource);
-	std::string fragmentShaderSourceCode=readFile(fragSource);
-    makeShaderProgram(makeVertexShader(vertexShaderSourceCode.c_str()), makeFragmentShader(fragmentShaderSourceCode.c_str()));
+    build_(readFile(vertSource), readFile(fragSource));
 }
 
 Shader::Shader(std::string vertSource, std::string fragSource, const int num_feedback_varyings, const GLchar* feedback_varyings[]) {
-    std::string vertexShaderSourceCode = readFile(vertSource);
-    std::string fragmentShaderSourceCode = readFile(fragSource);
-    makeShaderProgram(makeVertexShader(vertexShaderSourceCode.c_str()), makeFragmentShader(fragmentShaderSourceCode.c_str()), num_feedback_varyings, feedback_varyings);
+    build_(readFile(vertSource), readFile(fragSource), num_feedback_varyings, feedback_varyings);
 }
 
 GLuint Shader::compileFromStrings(std::string vsh, std::string fsh) {
-	makeShaderProgram(makeVertexShader(vsh.c_str()), makeFragmentShader(fsh.c_str()));
+	build_(vsh, fsh);
 	return 1;
 }
 
+//from the cached binary if there is one, else compiled
+void Shader::build_(const std::string& vertex_source, const std::string& fragment_source,
+                    int num_feedback_varyings, const GLchar* feedback_varyings[]) {
+    cache_key_ = 0;
+    if (cache_ && cache_->enabled()) {
+        cache_key_ = cache_->key(vertex_source, fragment_source, num_feedback_varyings, feedback_varyings);
+        program = glCreateProgram();
+        if (cache_->load(cache_key_, program)) {
+            from_binary_ = true;
+            linked_ = false;
+            pending_.push_back(this);
+            return;
+        }
+        glDeleteProgram(program);
+    }
+    from_binary_ = false;
+    makeShaderProgram(makeVertexShader(vertex_source.c_str()), makeFragmentShader(fragment_source.c_str()),
+                      num_feedback_varyings, feedback_varyings);
+}
+
+//compile status is not asked for here, that would wait for the compile.
+//Errors are reported by finishLink
 GLuint Shader::makeVertexShader(const char* shaderSource)
 {
     GLuint vertexShaderID=glCreateShader(GL_VERTEX_SHADER);
     glShaderSource(vertexShaderID,1,(const GLchar**)&shaderSource, NULL);
     glCompileShader(vertexShaderID);
-    
-    GLint compile=0;
-    glGetShaderiv(vertexShaderID,GL_COMPILE_STATUS,&compile);
-    
-    //we want to see the compile log if we are in debug (to check warnings)
-    if (!compile)
-    {
-        saveShaderInfoLog(vertexShaderID);
-        std::cout << "Shader code:\n " << std::endl;
-        std::string code = shaderSource;
-        std::vector<std::string> lines = split( code, '\n' );
-        for( size_t i = 0; i < lines.size(); ++i)
-            std::cout << i << "  " << lines[i] << std::endl;
-    
-    }
-    
-    
+    sources_[0] = shaderSource;
     return vertexShaderID;
 }
 GLuint Shader::makeFragmentShader(const char* shaderSource)
@@ -201,23 +243,23 @@ GLuint Shader::makeFragmentShader(const char* shaderSource)
     GLuint fragmentShaderID=glCreateShader(GL_FRAGMENT_SHADER);
     glShaderSource(fragmentShaderID,1,(const GLchar**)&shaderSource, NULL);
     glCompileShader(fragmentShaderID);
-    
+    sources_[1] = shaderSource;
+    return fragmentShaderID;
+}
+
+void Shader::reportCompile_(GLuint shader_id, const std::string& source) {
     GLint compile=0;
-    glGetShaderiv(fragmentShaderID,GL_COMPILE_STATUS,&compile);
+    glGetShaderiv(shader_id,GL_COMPILE_STATUS,&compile);
     
     //we want to see the compile log if we are in debug (to check warnings)
     if (!compile)
     {
-        saveShaderInfoLog(fragmentShaderID);
+        saveShaderInfoLog(shader_id);
         std::cout << "Shader code:\n " << std::endl;
-        std::string code = shaderSource;
-        std::vector<std::string> lines = split( code, '\n' );
+        std::vector<std::string> lines = split( source, '\n' );
         for( size_t i = 0; i < lines.size(); ++i)
             std::cout << i << "  " << lines[i] << std::endl;
-        
     }
-    
-    return fragmentShaderID;
 }
 
 void Shader::saveShaderInfoLog(GLuint obj)
@@ -265,14 +307,56 @@ void Shader::makeShaderProgram(GLuint vertexShaderID, GLuint fragmentShaderID, c
     
     if (num_feedback_varyings > 0)
         glTransformFeedbackVaryings(program, num_feedback_varyings, feedback_varyings, GL_SEPARATE_ATTRIBS); //INTERLEAVED_ATTRIBS
+    if (cache_key_)
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     
+    //checked in finishLink
     glLinkProgram(program);
+    stages_[0] = vertexShaderID;
+    stages_[1] = fragmentShaderID;
+    linked_ = false;
+    pending_.push_back(this);
+}
+
+bool Shader::ready() {
+    if (linked_)
+        return true;
+    //without the extension asking would wait, so the link is finished anyway
+    if (parallel_compile_ && !from_binary_) {
+        GLint done = GL_FALSE;
+        glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &done);
+        if (!done)
+            return false;
+    }
+    finishLink();
+    return true;
+}
+
+void Shader::finishLink() {
+    if (linked_)
+        return;
+    linked_ = true;
+    pending_.erase(std::remove(pending_.begin(), pending_.end(), this), pending_.end());
+    
     GLint link_ok = GL_FALSE;
     glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
     if (!link_ok) {
+        for (int i = 0; i < 2; i++)
+            if (stages_[i]) reportCompile_(stages_[i], sources_[i]);
         fprintf(stderr, "glLinkProgram:");
         saveProgramInfoLog(program);
     }
+    else if (cache_ && cache_key_ && !from_binary_)
+        cache_->store(cache_key_, program);
+    
+    //the program keeps what it needs
+    for (int i = 0; i < 2; i++) {
+        if (!stages_[i]) continue;
+        glDetachShader(program, stages_[i]);
+        glDeleteShader(stages_[i]);
+        stages_[i] = 0;
+        sources_[i].clear();
+    }
     
     //init uniforms
     initUniforms_();
@@ -288,31 +372,60 @@ GLint Shader::bindAttribute(const char* attribute_name) {
 }
 
 //first initializes uniform location vector, then maps uniform locations
-//to each id, using the 
+//to each id. Only the uniforms the program actually has are looked up,
+//by walking its active uniforms and blocks
 void Shader::initUniforms_() {
     
 	//initialize uniform location vector to all -1 (not found) 
 	uniform_locations_ = std::vector<GLuint>(UNIFORMS_COUNT, -1);
 
-	//iterate map of all possible uniforms, asking shader if it has them
-	for (std::pair<std::string, UniformID> element : uniform_string2id_)
-	{
-		std::string uniform_name = element.first;
-		UniformID uniform_id = element.second;
-		uniform_locations_[uniform_id] = glGetUniformLocation(program, uniform_name.c_str());
+	GLint num_uniforms = 0, max_length = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &num_uniforms);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+	std::vector<GLchar> name_buffer(std::max(max_length, 1) + 16);
+	for (GLint i = 0; i < num_uniforms; i++) {
+		GLsizei length = 0;
+		GLint size = 0;
+		GLenum type;
+		glGetActiveUniform(program, i, (GLsizei)name_buffer.size(), &length, &size, &type, name_buffer.data());
+		std::string uniform_name(name_buffer.data(), length);
+		//arrays are listed once as "name[0]", known by that or the bare name.
+		//Some have an id per element ("u_shadow_map[3]")
+		std::string base_name = uniform_name;
+		if (base_name.size() > 3 && base_name.compare(base_name.size() - 3, 3, "[0]") == 0)
+			base_name.resize(base_name.size() - 3);
+		auto found = uniform_string2id_.find(uniform_name);
+		if (found == uniform_string2id_.end())
+			found = uniform_string2id_.find(base_name);
+		if (found != uniform_string2id_.end())
+			uniform_locations_[found->second] = glGetUniformLocation(program, uniform_name.c_str());
+		for (GLint element = 1; element < size; element++) {
+			std::string element_name = base_name + "[" + std::to_string(element) + "]";
+			found = uniform_string2id_.find(element_name);
+			if (found == uniform_string2id_.end())
+				break;
+			uniform_locations_[found->second] = glGetUniformLocation(program, element_name.c_str());
+		}
 	}
     
     //now do the same for uniform blocks
-    for (std::pair<std::string, UniformID> element : uniformblock_string2id_)
-    {
-        std::string uniform_name = element.first;
-        UniformID uniform_id = element.second;
-        uniform_locations_[uniform_id] = glGetUniformBlockIndex(program, uniform_name.c_str());
-    }
+	GLint num_blocks = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &num_blocks);
+	for (GLint i = 0; i < num_blocks; i++) {
+		GLchar block_name[256];
+		GLsizei length = 0;
+		glGetActiveUniformBlockName(program, i, sizeof(block_name), &length, block_name);
+		auto found = uniformblock_string2id_.find(std::string(block_name, length));
+		if (found != uniformblock_string2id_.end())
+			uniform_locations_[found->second] = i;
+	}
 }
 
-//Returns location of uniform with given enum
+//Returns location of uniform with given enum. The first use of a program
+//waits for its link
 GLuint Shader::getUniformLocation(UniformID uni_name) {
+	if (!linked_)
+		finishLink();
 	return uniform_locations_[uni_name];
 }
 
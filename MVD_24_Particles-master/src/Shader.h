@@ -1,9 +1,12 @@
 #pragma once
 
 #include "includes.h"
+#include <cstdint>
 #include <unordered_map>
 #include <vector>
 
+class ShaderCache;
+
 //Uniform IDs are global so that we can access them in Graphics System
 enum UniformID {
     U_VP,
@@ -36,12 +39,16 @@ enum UniformID {
 	U_USE_REFLECTION_MAP,
 	U_NUM_LIGHTS,
     U_LIGHTS_UBO,
+    U_SKIN_UBO,
+    U_MATERIAL_UBO,
 	U_SCREEN_TEXTURE,
 	U_NEAR_PLANE,
 	U_FAR_PLANE,
 	U_LIGHT_MATRIX,
 	U_SHADOW_MAP,
-    U_TEX_POSITION,
+    U_TEX_DEPTH,
+    U_INV_VP,
+    U_RENDER_SCALE,
     U_TEX_NORMAL,
     U_TEX_ALBEDO,
     U_SHADOW_MAP0,
@@ -57,7 +64,9 @@ enum UniformID {
     U_MAX_HEIGHT,
     U_SKIN_BIND_MATRIX,
     U_BLEND_WEIGHTS, //array!
+    U_BLEND_DELTAS,
     U_TIME,
+    U_ANIM_TEXTURE,
     U_POINT_SIZE,
     U_HEIGHT_NEAR_PLANE,
 	U_OPACITY,
@@ -98,7 +107,9 @@ const std::unordered_map<std::string, UniformID> uniform_string2id_ = {
 	{ "u_shadow_map", U_SHADOW_MAP },
     { "u_num_lights", U_NUM_LIGHTS },
 	{ "u_screen_texture", U_SCREEN_TEXTURE },
-    { "u_tex_position", U_TEX_POSITION },
+    { "u_tex_depth", U_TEX_DEPTH },
+    { "u_inv_vp", U_INV_VP },
+    { "u_render_scale", U_RENDER_SCALE },
     { "u_tex_normal", U_TEX_NORMAL },
     { "u_tex_albedo", U_TEX_ALBEDO },
     { "u_shadow_map[0]", U_SHADOW_MAP0 },
@@ -116,7 +127,9 @@ const std::unordered_map<std::string, UniformID> uniform_string2id_ = {
     { "u_use_transparency_map", U_USE_TRANSPARENCY_MAP},
     { "u_transparency_map", U_TRANSPARENCY_MAP},
     { "u_blend_weights", U_BLEND_WEIGHTS},
+    { "u_blend_deltas", U_BLEND_DELTAS},
     { "u_time", U_TIME},
+    { "u_anim_texture", U_ANIM_TEXTURE},
     { "u_point_size", U_POINT_SIZE},
     { "u_opacity", U_OPACITY },
 	{ "u_height_near_plane", U_HEIGHT_NEAR_PLANE}
@@ -124,18 +137,40 @@ const std::unordered_map<std::string, UniformID> uniform_string2id_ = {
 
 const std::unordered_map<std::string, UniformID> uniformblock_string2id_ = {
     { "u_lights_ubo", U_LIGHTS_UBO },
+    { "u_skin_ubo", U_SKIN_UBO },
+    { "u_material_ubo", U_MATERIAL_UBO },
 };
 
+//Programs are linked without waiting for the result, so with
+//KHR_parallel_shader_compile the driver compiles them all at once on its
+//own threads. The link is checked (and compile errors shown) on first use,
+//or earlier once pollPending sees the driver is done. Linked programs are
+//kept as binaries in the ShaderCache given to setCache
 class Shader {
 private:
 	//stores, for each uniform enum, it's location
 	std::vector<GLuint> uniform_locations_;
 	void initUniforms_();
+
+	//until finishLink
+	bool linked_ = true;
+	bool from_binary_ = false;
+	uint64_t cache_key_ = 0; //0 when not cached
+	GLuint stages_[2] = { 0, 0 }; //vertex, fragment
+	std::string sources_[2];
+	void build_(const std::string& vertex_source, const std::string& fragment_source,
+		int num_feedback_varyings = 0, const GLchar* feedback_varyings[] = nullptr);
+	void reportCompile_(GLuint shader_id, const std::string& source);
+
+	static ShaderCache* cache_;
+	static bool parallel_compile_;
+	static std::vector<Shader*> pending_;
     
 public:
     GLuint program;
 	std::string name;
 	Shader();
+	~Shader();
     Shader(std::string vertSource, std::string fragSource);
     Shader(std::string vertSource, std::string fragSource, const int num_feedback_varyings, const GLchar* feedback_varyings[]);
     std::string readFile(std::string filename);
@@ -147,6 +182,18 @@ public:
     void saveProgramInfoLog(GLuint obj);
     void saveShaderInfoLog(GLuint obj);
     std::string log;
+
+	//checks the link, reports errors, stores the binary and finds the
+	//uniforms. Waits for the driver if it is still compiling
+	void finishLink();
+	//finishes the link if the driver is done, without waiting
+	bool ready();
+
+	//once the GL context exists: asks the driver for compiler threads
+	static void initCompiler();
+	static void setCache(ShaderCache* cache) { cache_ = cache; }
+	//ready() on every program still linking
+	static void pollPending();
     
 	//
     GLuint getUniformLocation(UniformID name);
@@ -163,6 +210,7 @@ public:
     bool setUniformBlock(UniformID id, const int binding_point);
     bool setTexture(UniformID id, GLuint tex_id, GLuint unit);
     bool setTextureCube(UniformID id, GLuint tex_id, GLuint unit);
+    bool setTextureBuffer(UniformID id, GLuint tex_id, GLuint unit);
     
     
 };
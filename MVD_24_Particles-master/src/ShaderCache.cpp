@@ -0,0 +1,125 @@
+//
+//  ShaderCache.cpp
+//
+#include "ShaderCache.h"
+#include "MappedFile.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace {
+
+const char SHADER_CACHE_MAGIC[4] = { 'M', 'V', 'D', 'S' };
+
+//64 bit FNV-1a, strings are ended with a 0 so "ab"+"c" != "a"+"bc"
+void hashString(uint64_t& h, const char* s) {
+	for (; *s; s++)
+		h = (h ^ (unsigned char)*s) * 0x100000001b3ull;
+	h = h * 0x100000001b3ull;
+}
+
+} //namespace
+
+void ShaderCache::init(std::string directory) {
+	directory_ = directory;
+	if (!directory_.empty() && directory_.back() != '/' && directory_.back() != '\\')
+		directory_ += "/";
+	GLint num_formats = 0;
+	if (GLEW_ARB_get_program_binary)
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+	enabled_ = num_formats > 0;
+
+	const GLubyte* strings[] = { glGetString(GL_VENDOR), glGetString(GL_RENDERER), glGetString(GL_VERSION) };
+	driver_.clear();
+	for (const GLubyte* s : strings)
+		driver_ += std::string(s ? (const char*)s : "") + "\n";
+}
+
+uint64_t ShaderCache::key(const std::string& vertex, const std::string& fragment,
+	int num_feedback_varyings, const GLchar* feedback_varyings[]) const {
+	uint64_t h = 0xcbf29ce484222325ull;
+	hashString(h, driver_.c_str());
+	hashString(h, vertex.c_str());
+	hashString(h, fragment.c_str());
+	for (int i = 0; i < num_feedback_varyings; i++)
+		hashString(h, feedback_varyings[i]);
+	return h;
+}
+
+std::string ShaderCache::entryPath_(uint64_t key) const {
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+	return directory_ + name + ".program";
+}
+
+bool ShaderCache::load(uint64_t key, GLuint program) {
+	if (!enabled_)
+		return false;
+	MappedFile file;
+	if (!file.open(entryPath_(key)) || file.size() < sizeof(ShaderCacheHeader)) {
+		misses++;
+		return false;
+	}
+	ShaderCacheHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+	if (memcmp(header.magic, SHADER_CACHE_MAGIC, 4) != 0 || header.version != SHADER_CACHE_VERSION ||
+		header.key != key || header.size != file.size() - sizeof(ShaderCacheHeader)) {
+		misses++;
+		return false;
+	}
+
+	//the binary is linked straight away, a refusal is no error
+	glProgramBinary(program, header.format, file.data() + sizeof(ShaderCacheHeader), header.size);
+	GLint link_ok = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
+	if (!link_ok) {
+		misses++;
+		return false;
+	}
+	hits++;
+	return true;
+}
+
+void ShaderCache::store(uint64_t key, GLuint program) {
+	if (!enabled_)
+		return;
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &length, &format, binary.data());
+
+	ShaderCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SHADER_CACHE_MAGIC, 4);
+	header.version = SHADER_CACHE_VERSION;
+	header.key = key;
+	header.format = format;
+	header.size = (uint32_t)length;
+
+	//write beside the entry and rename, so a crash never leaves half of one
+	std::string path = entryPath_(key);
+	std::string temp_path = path + ".tmp";
+	std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		std::cerr << "ERROR: Could not write shader cache file " << temp_path << std::endl;
+		return;
+	}
+	file.write((const char*)&header, sizeof(header));
+	file.write(binary.data(), length);
+	file.close();
+	if (!file) {
+		std::remove(temp_path.c_str());
+		return;
+	}
+	std::remove(path.c_str());
+	std::rename(temp_path.c_str(), path.c_str());
+}
+
+void ShaderCache::printStats() {
+	std::cout << "Shader cache: " << hits << " programs loaded as binaries, " << misses << " compiled"
+		<< (enabled_ ? "" : " (no program binaries on this driver)") << std::endl;
+}
@@ -0,0 +1,54 @@
+//
+//  ShaderCache.h
+//
+//  Linked programs as the driver hands them back (glGetProgramBinary), so a
+//  shader is only compiled from source once per driver. Entries are named
+//  after a hash of everything the binary depends on: both sources, the
+//  transform feedback varyings and the GL vendor, renderer and version. An
+//  edited source or a driver update simply misses, and a binary the driver
+//  refuses anyway is compiled from source again.
+//
+//  Entry layout: ShaderCacheHeader, then the binary.
+//
+#pragma once
+#include "includes.h"
+#include <cstdint>
+
+//bump whenever the layout changes
+#define SHADER_CACHE_VERSION 1
+
+struct ShaderCacheHeader {
+	char magic[4]; //"MVDS"
+	uint32_t version;
+	uint64_t key;
+	uint32_t format; //as glGetProgramBinary returned it
+	uint32_t size;
+};
+
+class ShaderCache {
+public:
+	//entries go in directory (which must exist). Stays disabled when the
+	//driver has no ARB_get_program_binary, or no binary formats
+	void init(std::string directory);
+	bool enabled() const { return enabled_; }
+
+	uint64_t key(const std::string& vertex, const std::string& fragment,
+		int num_feedback_varyings, const GLchar* feedback_varyings[]) const;
+
+	//gives program the binary stored for key; false when there is none or
+	//the driver would not link it
+	bool load(uint64_t key, GLuint program);
+	//program must be linked, and have been linked retrievable
+	void store(uint64_t key, GLuint program);
+
+	//startup report
+	int hits = 0;
+	int misses = 0;
+	void printStats();
+
+private:
+	std::string directory_;
+	std::string driver_; //vendor, renderer and version strings
+	bool enabled_ = false;
+	std::string entryPath_(uint64_t key) const;
+};
@@ -0,0 +1,87 @@
+//
+//  TextParsing.cpp
+//
+#include "TextParsing.h"
+#include <cmath>
+#include <cstring>
+
+#ifndef __cpp_lib_to_chars
+//decimal and exponent digits are gathered as integers and scaled once
+const char* parseFloatFallback(const char* p, const char* end, float& value) {
+	static const double pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+	const char* start = p;
+	bool negative = false;
+	if (p < end && *p == '-') { negative = true; p++; }
+	double mantissa = 0.0;
+	int exponent = 0;
+	bool digits = false;
+	for (; p < end && isDigitChar(*p); p++, digits = true)
+		mantissa = mantissa * 10.0 + (*p - '0');
+	if (p < end && *p == '.') {
+		for (p++; p < end && isDigitChar(*p); p++, digits = true) {
+			mantissa = mantissa * 10.0 + (*p - '0');
+			exponent--;
+		}
+	}
+	if (!digits)
+		return start;
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		const char* q = p + 1;
+		bool negative_exponent = false;
+		if (q < end && (*q == '-' || *q == '+')) { negative_exponent = *q == '-'; q++; }
+		if (q < end && isDigitChar(*q)) {
+			int e = 0;
+			for (; q < end && isDigitChar(*q); q++)
+				if (e < 10000) e = e * 10 + (*q - '0');
+			exponent += negative_exponent ? -e : e;
+			p = q;
+		}
+	}
+	double scaled = exponent >= -22 && exponent <= 22 ?
+		(exponent < 0 ? mantissa / pow10[-exponent] : mantissa * pow10[exponent]) :
+		mantissa * std::pow(10.0, exponent);
+	value = (float)(negative ? -scaled : scaled);
+	return p;
+}
+#endif
+
+bool readFloatList(const char* text, std::vector<float>& result) {
+	if (!text) return true;
+	const char* end = text + strlen(text);
+	for (const char* p = text; ; ) {
+		while (p < end && isSpaceChar(*p)) p++;
+		if (p >= end) return true;
+		float value;
+		const char* q = readFloat(p, end, value);
+		if (q == p) return false;
+		result.push_back(value);
+		p = q;
+	}
+}
+
+bool readUIntList(const char* text, std::vector<unsigned int>& result) {
+	if (!text) return true;
+	const char* p = text;
+	for (;;) {
+		while (isSpaceChar(*p)) p++;
+		if (!*p) return true;
+		if (!isDigitChar(*p)) return false;
+		unsigned int value = 0;
+		for (; isDigitChar(*p); p++)
+			value = value * 10 + (unsigned int)(*p - '0');
+		result.push_back(value);
+	}
+}
+
+void readWordList(const char* text, std::vector<std::string>& result) {
+	if (!text) return;
+	const char* p = text;
+	for (;;) {
+		while (isSpaceChar(*p)) p++;
+		if (!*p) return;
+		const char* word = p;
+		while (*p && !isSpaceChar(*p)) p++;
+		result.emplace_back(word, p);
+	}
+}
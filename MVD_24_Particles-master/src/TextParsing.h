@@ -0,0 +1,59 @@
+//
+//  TextParsing.h
+//
+//  In place readers for numbers in text files (OBJ lines, Collada arrays),
+//  with no copies or allocation per number. Floats go through
+//  std::from_chars where the standard library supports it.
+//
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+#if defined(__has_include) && (__cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L))
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
+
+inline bool isBlankChar(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+inline bool isSpaceChar(char c) { return isBlankChar(c) || c == '\n'; }
+inline bool isDigitChar(char c) { return c >= '0' && c <= '9'; }
+
+#ifndef __cpp_lib_to_chars
+const char* parseFloatFallback(const char* p, const char* end, float& value);
+#endif
+
+//reads the float at p, returns where it ended (p, with value 0, if there is
+//no number there)
+inline const char* readFloat(const char* p, const char* end, float& value) {
+	const char* start = p;
+	if (p < end && *p == '+') p++; //from_chars does not take a plus sign
+	value = 0.0f;
+#ifdef __cpp_lib_to_chars
+	std::from_chars_result result = std::from_chars(p, end, value);
+	return result.ec == std::errc() ? result.ptr : start;
+#else
+	const char* q = parseFloatFallback(p, end, value);
+	return q == p ? start : q;
+#endif
+}
+
+//reads the integer at p, nullptr if there are no digits
+inline const char* readInt(const char* p, const char* end, int& value) {
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) { negative = *p == '-'; p++; }
+	if (p >= end || !isDigitChar(*p))
+		return nullptr;
+	int v = 0;
+	for (; p < end && isDigitChar(*p); p++)
+		v = v * 10 + (*p - '0');
+	value = negative ? -v : v;
+	return p;
+}
+
+//whitespace separated lists, as in a Collada <float_array> or <p>. Values
+//are appended to result; false if something other than a number is found.
+//A null text (empty xml element) is an empty list
+bool readFloatList(const char* text, std::vector<float>& result);
+bool readUIntList(const char* text, std::vector<unsigned int>& result);
+void readWordList(const char* text, std::vector<std::string>& result);
@@ -0,0 +1,526 @@
+//
+//  TextureCompression.cpp
+//
+#include "TextureCompression.h"
+#include "AssetPack.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+
+namespace {
+
+const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+struct KTXHeader {
+	unsigned char identifier[12];
+	uint32_t endianness;
+	uint32_t gl_type; //0 for compressed
+	uint32_t gl_type_size;
+	uint32_t gl_format; //0 for compressed
+	uint32_t gl_internal_format;
+	uint32_t gl_base_internal_format;
+	uint32_t pixel_width;
+	uint32_t pixel_height;
+	uint32_t pixel_depth;
+	uint32_t number_of_array_elements;
+	uint32_t number_of_faces;
+	uint32_t number_of_mipmap_levels;
+	uint32_t bytes_of_key_value_data;
+};
+
+int bytesPerBlock(GLenum internal_format) {
+	switch (internal_format) {
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGB8_ETC2:
+		return 8;
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+	case GL_COMPRESSED_RG_RGTC2:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+//the 4x4 block at (bx, by), clamped at the right and top edges
+void readBlock(const unsigned char* rgba, int width, int height, int bx, int by, unsigned char block[16][4]) {
+	for (int y = 0; y < 4; y++) {
+		int sy = std::min(by * 4 + y, height - 1);
+		for (int x = 0; x < 4; x++) {
+			int sx = std::min(bx * 4 + x, width - 1);
+			memcpy(block[y * 4 + x], rgba + (sy * width + sx) * 4, 4);
+		}
+	}
+}
+
+inline int colorDistance(const int a[3], const int b[3]) {
+	int dr = a[0] - b[0], dg = a[1] - b[1], db = a[2] - b[2];
+	return dr * dr + dg * dg + db * db;
+}
+
+inline uint16_t packRGB565(const float c[3]) {
+	int r = std::max(0, std::min(31, (int)(c[0] * 31.0f / 255.0f + 0.5f)));
+	int g = std::max(0, std::min(63, (int)(c[1] * 63.0f / 255.0f + 0.5f)));
+	int b = std::max(0, std::min(31, (int)(c[2] * 31.0f / 255.0f + 0.5f)));
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+inline void unpackRGB565(uint16_t c, int out[3]) {
+	int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+	out[0] = (r << 3) | (r >> 2);
+	out[1] = (g << 2) | (g >> 4);
+	out[2] = (b << 3) | (b >> 2);
+}
+
+//palette indices for two 565 endpoints (four colour mode), returns the error
+int bc1Indices(const unsigned char block[16][4], uint16_t c0, uint16_t c1, uint32_t& indices) {
+	int palette[4][3];
+	unpackRGB565(c0, palette[0]);
+	unpackRGB565(c1, palette[1]);
+	for (int k = 0; k < 3; k++) {
+		palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+		palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+	}
+	int error = 0;
+	indices = 0;
+	for (int i = 0; i < 16; i++) {
+		int pixel[3] = { block[i][0], block[i][1], block[i][2] };
+		int best = 0, best_distance = colorDistance(pixel, palette[0]);
+		for (int p = 1; p < 4; p++) {
+			int d = colorDistance(pixel, palette[p]);
+			if (d < best_distance) { best = p; best_distance = d; }
+		}
+		indices |= (uint32_t)best << (i * 2);
+		error += best_distance;
+	}
+	return error;
+}
+
+//endpoints along the principal axis of the block's colours, then one least
+//squares refit of them to the chosen indices
+void encodeBC1Block(const unsigned char block[16][4], unsigned char* out) {
+	float mean[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; i++)
+		for (int k = 0; k < 3; k++) mean[k] += block[i][k] / 16.0f;
+	float cov[6] = { 0, 0, 0, 0, 0, 0 };
+	for (int i = 0; i < 16; i++) {
+		float d[3] = { block[i][0] - mean[0], block[i][1] - mean[1], block[i][2] - mean[2] };
+		cov[0] += d[0] * d[0]; cov[1] += d[0] * d[1]; cov[2] += d[0] * d[2];
+		cov[3] += d[1] * d[1]; cov[4] += d[1] * d[2]; cov[5] += d[2] * d[2];
+	}
+	float axis[3] = { 1, 1, 1 };
+	for (int it = 0; it < 8; it++) {
+		float a[3] = { cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+					   cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+					   cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2] };
+		float length = std::max(std::fabs(a[0]), std::max(std::fabs(a[1]), std::fabs(a[2])));
+		if (length < 1e-6f) break;
+		for (int k = 0; k < 3; k++) axis[k] = a[k] / length;
+	}
+	float min_t = 1e9f, max_t = -1e9f;
+	for (int i = 0; i < 16; i++) {
+		float t = (block[i][0] - mean[0]) * axis[0] + (block[i][1] - mean[1]) * axis[1] + (block[i][2] - mean[2]) * axis[2];
+		min_t = std::min(min_t, t);
+		max_t = std::max(max_t, t);
+	}
+	float length2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+	float hi[3], lo[3];
+	for (int k = 0; k < 3; k++) {
+		hi[k] = mean[k] + axis[k] * max_t / length2;
+		lo[k] = mean[k] + axis[k] * min_t / length2;
+	}
+	uint16_t c0 = packRGB565(hi), c1 = packRGB565(lo);
+	uint32_t indices;
+	int error = bc1Indices(block, std::max(c0, c1), std::min(c0, c1), indices);
+	if (c0 < c1) std::swap(c0, c1);
+
+	//refit: minimise |a_i * e0 + b_i * e1 - p_i|^2 over both endpoints
+	static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+	float aa = 0, ab = 0, bb = 0, ap[3] = { 0, 0, 0 }, bp[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; i++) {
+		float a = weights[(indices >> (i * 2)) & 3], b = 1.0f - a;
+		aa += a * a; ab += a * b; bb += b * b;
+		for (int k = 0; k < 3; k++) { ap[k] += a * block[i][k]; bp[k] += b * block[i][k]; }
+	}
+	float det = aa * bb - ab * ab;
+	if (std::fabs(det) > 1e-6f) {
+		for (int k = 0; k < 3; k++) {
+			hi[k] = (ap[k] * bb - bp[k] * ab) / det;
+			lo[k] = (bp[k] * aa - ap[k] * ab) / det;
+		}
+		uint16_t r0 = packRGB565(hi), r1 = packRGB565(lo);
+		if (r0 < r1) std::swap(r0, r1);
+		uint32_t refit_indices;
+		int refit_error = bc1Indices(block, r0, r1, refit_indices);
+		if (refit_error < error) { c0 = r0; c1 = r1; indices = refit_indices; }
+	}
+	if (c0 == c1) indices = 0; //solid, any mode decodes index 0 the same
+
+	out[0] = (unsigned char)(c0 & 0xff); out[1] = (unsigned char)(c0 >> 8);
+	out[2] = (unsigned char)(c1 & 0xff); out[3] = (unsigned char)(c1 >> 8);
+	for (int k = 0; k < 4; k++) out[4 + k] = (unsigned char)(indices >> (k * 8));
+}
+
+//one 8 bit channel (BC3 alpha, BC4/BC5): max and min endpoints, eight values
+void encodeChannelBlock(const unsigned char block[16][4], int channel, unsigned char* out) {
+	int hi = 0, lo = 255;
+	for (int i = 0; i < 16; i++) {
+		hi = std::max(hi, (int)block[i][channel]);
+		lo = std::min(lo, (int)block[i][channel]);
+	}
+	out[0] = (unsigned char)hi;
+	out[1] = (unsigned char)lo;
+	uint64_t bits = 0;
+	if (hi > lo) {
+		int palette[8] = { hi, lo };
+		for (int p = 1; p < 7; p++) palette[p + 1] = ((7 - p) * hi + p * lo) / 7;
+		for (int i = 0; i < 16; i++) {
+			int value = block[i][channel], best = 0, best_distance = 256;
+			for (int p = 0; p < 8; p++) {
+				int d = std::abs(value - palette[p]);
+				if (d < best_distance) { best = p; best_distance = d; }
+			}
+			bits |= (uint64_t)best << (i * 3);
+		}
+	}
+	for (int k = 0; k < 6; k++) out[2 + k] = (unsigned char)(bits >> (k * 8));
+}
+
+//ETC1 modifier tables, as listed in the ETC2 specification
+const int ETC_MODIFIERS[8][4] = {
+	{ 2, 8, -2, -8 }, { 5, 17, -5, -17 }, { 9, 29, -9, -29 }, { 13, 42, -13, -42 },
+	{ 18, 60, -18, -60 }, { 24, 80, -24, -80 }, { 33, 106, -33, -106 }, { 47, 183, -47, -183 }
+};
+
+//best table and per pixel modifiers for one half block around base
+int etcHalfBlock(const unsigned char block[16][4], const int pixels[8], const int base[3], int& table, int modifiers[8]) {
+	int best_error = -1;
+	for (int t = 0; t < 8; t++) {
+		int error = 0, chosen[8];
+		for (int i = 0; i < 8; i++) {
+			const unsigned char* p = block[pixels[i]];
+			int best = 0, best_distance = -1;
+			for (int m = 0; m < 4; m++) {
+				int c[3];
+				for (int k = 0; k < 3; k++) c[k] = std::max(0, std::min(255, base[k] + ETC_MODIFIERS[t][m]));
+				int d = (c[0] - p[0]) * (c[0] - p[0]) + (c[1] - p[1]) * (c[1] - p[1]) + (c[2] - p[2]) * (c[2] - p[2]);
+				if (best_distance < 0 || d < best_distance) { best = m; best_distance = d; }
+			}
+			chosen[i] = best;
+			error += best_distance;
+		}
+		if (best_error < 0 || error < best_error) {
+			best_error = error;
+			table = t;
+			memcpy(modifiers, chosen, sizeof(chosen));
+		}
+	}
+	return best_error;
+}
+
+//ETC1 block, which every ETC2 decoder reads the same: the differential mode
+//when both halves' colours are close enough, otherwise two 4 bit colours.
+//Both ways of splitting the block are tried
+void encodeETCBlock(const unsigned char block[16][4], unsigned char* out) {
+	uint64_t best_bits = 0;
+	int best_error = -1;
+	for (int flip = 0; flip < 2; flip++) {
+		//pixels of each half, numbered as in the block (y * 4 + x)
+		int halves[2][8];
+		int count[2] = { 0, 0 };
+		for (int y = 0; y < 4; y++)
+			for (int x = 0; x < 4; x++) {
+				int half = flip ? (y >= 2) : (x >= 2);
+				halves[half][count[half]++] = y * 4 + x;
+			}
+		float average[2][3] = { { 0, 0, 0 }, { 0, 0, 0 } };
+		for (int h = 0; h < 2; h++)
+			for (int i = 0; i < 8; i++)
+				for (int k = 0; k < 3; k++) average[h][k] += block[halves[h][i]][k] / 8.0f;
+
+		int q5[2][3], q4[2][3];
+		bool differential = true;
+		for (int h = 0; h < 2; h++)
+			for (int k = 0; k < 3; k++) {
+				q5[h][k] = std::min(31, (int)(average[h][k] * 31.0f / 255.0f + 0.5f));
+				q4[h][k] = std::min(15, (int)(average[h][k] * 15.0f / 255.0f + 0.5f));
+			}
+		for (int k = 0; k < 3; k++) {
+			int delta = q5[1][k] - q5[0][k];
+			if (delta < -4 || delta > 3) differential = false;
+		}
+		int base[2][3];
+		for (int h = 0; h < 2; h++)
+			for (int k = 0; k < 3; k++)
+				base[h][k] = differential ? (q5[h][k] << 3) | (q5[h][k] >> 2) : (q4[h][k] << 4) | q4[h][k];
+
+		int tables[2], modifiers[2][8];
+		int error = etcHalfBlock(block, halves[0], base[0], tables[0], modifiers[0]) +
+			etcHalfBlock(block, halves[1], base[1], tables[1], modifiers[1]);
+		if (best_error >= 0 && error >= best_error) continue;
+		best_error = error;
+
+		uint64_t bits = 0;
+		for (int k = 0; k < 3; k++) {
+			uint64_t byte = differential ?
+				(uint64_t)((q5[0][k] << 3) | ((q5[1][k] - q5[0][k]) & 7)) :
+				(uint64_t)((q4[0][k] << 4) | q4[1][k]);
+			bits |= byte << (56 - k * 8);
+		}
+		bits |= (uint64_t)tables[0] << 37;
+		bits |= (uint64_t)tables[1] << 34;
+		bits |= (uint64_t)(differential ? 1 : 0) << 33;
+		bits |= (uint64_t)flip << 32;
+		//pixel index bits are numbered down columns: x * 4 + y, and modifier
+		//m of the table is stored as m (msb in the high half)
+		for (int h = 0; h < 2; h++)
+			for (int i = 0; i < 8; i++) {
+				int pixel = halves[h][i];
+				int column_index = (pixel % 4) * 4 + pixel / 4;
+				int value = modifiers[h][i];
+				bits |= (uint64_t)(value >> 1) << (16 + column_index);
+				bits |= (uint64_t)(value & 1) << column_index;
+			}
+		best_bits = bits;
+	}
+	for (int k = 0; k < 8; k++) out[k] = (unsigned char)(best_bits >> (56 - k * 8));
+}
+
+void encodeLevel(const unsigned char* rgba, int width, int height, TextureCodec codec, std::vector<unsigned char>& out) {
+	int blocks_x = (width + 3) / 4, blocks_y = (height + 3) / 4;
+	int block_bytes = (codec == TextureCodecBC3 || codec == TextureCodecBC5) ? 16 : 8;
+	out.assign((size_t)blocks_x * blocks_y * block_bytes, 0);
+	unsigned char block[16][4];
+	unsigned char* dst = out.data();
+	for (int by = 0; by < blocks_y; by++) {
+		for (int bx = 0; bx < blocks_x; bx++, dst += block_bytes) {
+			readBlock(rgba, width, height, bx, by, block);
+			switch (codec) {
+			case TextureCodecBC3:
+				encodeChannelBlock(block, 3, dst);
+				encodeBC1Block(block, dst + 8);
+				break;
+			case TextureCodecBC5:
+				encodeChannelBlock(block, 0, dst);
+				encodeChannelBlock(block, 1, dst + 8);
+				break;
+			case TextureCodecETC2:
+				encodeETCBlock(block, dst);
+				break;
+			default:
+				encodeBC1Block(block, dst);
+				break;
+			}
+		}
+	}
+}
+
+} //namespace
+
+size_t CompressedTexture::size() const {
+	size_t total = 0;
+	for (auto& level : levels) total += level.size();
+	return total;
+}
+
+bool KTXFile::open(const std::string& filename) {
+	level_data_.clear();
+	level_size_.clear();
+	if (!file_.open(filename) || file_.size() < sizeof(KTXHeader))
+		return false;
+	KTXHeader header;
+	memcpy(&header, file_.data(), sizeof(header));
+	if (memcmp(header.identifier, KTX_IDENTIFIER, 12) != 0 || header.endianness != 0x04030201) {
+		std::cerr << "ERROR: " << filename << " is not a KTX file" << std::endl;
+		return false;
+	}
+	if (header.gl_type != 0 || bytesPerBlock(header.gl_internal_format) == 0 ||
+		header.pixel_depth > 1 || header.number_of_array_elements > 0 || header.number_of_faces != 1) {
+		std::cerr << "ERROR: " << filename << " is not a compressed 2D texture in a known format" << std::endl;
+		return false;
+	}
+	internal_format = header.gl_internal_format;
+	width = (int)header.pixel_width;
+	height = (int)std::max(1u, header.pixel_height);
+
+	//each level is its size and then its blocks
+	size_t offset = sizeof(KTXHeader) + header.bytes_of_key_value_data;
+	int block_bytes = bytesPerBlock(internal_format);
+	int num_levels = (int)std::max(1u, header.number_of_mipmap_levels);
+	for (int level = 0; level < num_levels; level++) {
+		int w = std::max(1, width >> level), h = std::max(1, height >> level);
+		size_t expected = (size_t)((w + 3) / 4) * ((h + 3) / 4) * block_bytes;
+		uint32_t image_size = 0;
+		if (offset + 4 <= file_.size()) memcpy(&image_size, file_.data() + offset, 4);
+		if (offset + 4 + expected > file_.size() || image_size != expected) {
+			std::cerr << "ERROR: KTX file " << filename << " is truncated" << std::endl;
+			level_data_.clear();
+			level_size_.clear();
+			return false;
+		}
+		level_data_.push_back(file_.data() + offset + 4);
+		level_size_.push_back((GLsizei)image_size);
+		offset += 4 + ((image_size + 3) & ~(size_t)3);
+	}
+	return true;
+}
+
+bool TextureCompression::codecFromName(const std::string& name, TextureCodec& codec) {
+	if (name == "auto") codec = TextureCodecAuto;
+	else if (name == "bc1") codec = TextureCodecBC1;
+	else if (name == "bc3") codec = TextureCodecBC3;
+	else if (name == "bc5") codec = TextureCodecBC5;
+	else if (name == "etc2") codec = TextureCodecETC2;
+	else return false;
+	return true;
+}
+
+TextureCodec TextureCompression::chooseCodec(const std::string& filename, const unsigned char* rgba, int width, int height) {
+	//normal maps are named name_n, name_ddn, name_normal or name_Normal
+	std::string stem = filename.substr(0, filename.find_last_of('.'));
+	std::string lower = stem;
+	std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return (char)tolower(c); });
+	const char* suffixes[] = { "_n", "_ddn", "_nrm", "_normal" };
+	for (const char* suffix : suffixes) {
+		size_t length = strlen(suffix);
+		if (lower.size() > length && lower.compare(lower.size() - length, length, suffix) == 0)
+			return TextureCodecBC5;
+	}
+	for (size_t i = 0; i < (size_t)width * height; i++)
+		if (rgba[i * 4 + 3] != 255) return TextureCodecBC3;
+	return TextureCodecBC1;
+}
+
+void TextureCompression::encode(const unsigned char* rgba, int width, int height, TextureCodec codec, CompressedTexture& texture) {
+	switch (codec) {
+	case TextureCodecBC3:
+		texture.internal_format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		texture.base_format = GL_RGBA;
+		break;
+	case TextureCodecBC5:
+		texture.internal_format = GL_COMPRESSED_RG_RGTC2;
+		texture.base_format = GL_RG;
+		break;
+	case TextureCodecETC2:
+		texture.internal_format = GL_COMPRESSED_RGB8_ETC2;
+		texture.base_format = GL_RGB;
+		break;
+	default:
+		codec = TextureCodecBC1;
+		texture.internal_format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		texture.base_format = GL_RGB;
+		break;
+	}
+	texture.width = width;
+	texture.height = height;
+	texture.levels.clear();
+
+	std::vector<unsigned char> level(rgba, rgba + (size_t)width * height * 4), next;
+	int w = width, h = height;
+	for (;;) {
+		texture.levels.emplace_back();
+		encodeLevel(level.data(), w, h, codec, texture.levels.back());
+		if (w == 1 && h == 1) break;
+		TextureCompression::downsample(level, w, h, next);
+		level.swap(next);
+		w = std::max(1, w / 2);
+		h = std::max(1, h / 2);
+	}
+}
+
+//2x2 box filter, an odd last row or column is folded into the one before
+void TextureCompression::downsample(const std::vector<unsigned char>& src, int width, int height, std::vector<unsigned char>& dst) {
+	int w = std::max(1, width / 2), h = std::max(1, height / 2);
+	dst.assign((size_t)w * h * 4, 0);
+	for (int y = 0; y < h; y++) {
+		int y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+		for (int x = 0; x < w; x++) {
+			int x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+			for (int k = 0; k < 4; k++) {
+				int sum = src[(y0 * width + x0) * 4 + k] + src[(y0 * width + x1) * 4 + k] +
+					src[(y1 * width + x0) * 4 + k] + src[(y1 * width + x1) * 4 + k];
+				dst[(y * w + x) * 4 + k] = (unsigned char)((sum + 2) / 4);
+			}
+		}
+	}
+}
+
+bool TextureCompression::writeKTX(const std::string& filename, const CompressedTexture& texture) {
+	//orientation, so tools show the rows the right way up
+	const char orientation[] = "KTXorientation\0S=r,T=u";
+	uint32_t pair_size = (uint32_t)sizeof(orientation);
+	uint32_t key_value_bytes = 4 + ((pair_size + 3) & ~3u);
+
+	KTXHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.identifier, KTX_IDENTIFIER, 12);
+	header.endianness = 0x04030201;
+	header.gl_type_size = 1;
+	header.gl_internal_format = texture.internal_format;
+	header.gl_base_internal_format = texture.base_format;
+	header.pixel_width = (uint32_t)texture.width;
+	header.pixel_height = (uint32_t)texture.height;
+	header.number_of_faces = 1;
+	header.number_of_mipmap_levels = (uint32_t)texture.levels.size();
+	header.bytes_of_key_value_data = key_value_bytes;
+
+	//write beside the file and rename, so a crash never leaves half of one
+	std::string temp_path = filename + ".tmp";
+	std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		std::cerr << "ERROR: Could not write KTX file " << temp_path << std::endl;
+		return false;
+	}
+	static const char zeros[4] = { 0, 0, 0, 0 };
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)&pair_size, 4);
+	file.write(orientation, pair_size);
+	file.write(zeros, key_value_bytes - 4 - pair_size);
+	for (auto& level : texture.levels) {
+		uint32_t image_size = (uint32_t)level.size();
+		file.write((const char*)&image_size, 4);
+		file.write((const char*)level.data(), level.size());
+		file.write(zeros, ((image_size + 3) & ~3u) - image_size);
+	}
+	file.close();
+	if (!file) {
+		std::cerr << "ERROR: Could not write KTX file " << temp_path << std::endl;
+		std::remove(temp_path.c_str());
+		return false;
+	}
+	std::remove(filename.c_str());
+	return std::rename(temp_path.c_str(), filename.c_str()) == 0;
+}
+
+std::string TextureCompression::compressedPath(const std::string& source) {
+	size_t dot = source.find_last_of('.');
+	size_t slash = source.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return source + ".ktx";
+	return source.substr(0, dot) + ".ktx";
+}
+
+bool TextureCompression::hasCompressedCopy(const std::string& source) {
+	//cooked copies in the mounted asset pack are current by construction
+	if (AssetPack::mounted() && AssetPack::mounted()->contains(compressedPath(source)))
+		return true;
+	struct stat source_stat, copy_stat;
+	if (stat(compressedPath(source).c_str(), &copy_stat) != 0)
+		return false;
+	return stat(source.c_str(), &source_stat) != 0 || copy_stat.st_mtime >= source_stat.st_mtime;
+}
+
+bool TextureCompression::canSample(GLenum internal_format) {
+	switch (internal_format) {
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+		return GLEW_EXT_texture_compression_s3tc != 0;
+	case GL_COMPRESSED_RGB8_ETC2:
+		return GLEW_ARB_ES3_compatibility != 0;
+	default: //RGTC is core since 3.0
+		return true;
+	}
+}
@@ -0,0 +1,77 @@
+//
+//  TextureCompression.h
+//
+//  Offline block compression of textures, and the KTX (1.1) files it writes.
+//  A compressed copy holds every mip level already encoded, so loading it is
+//  one glCompressedTexImage2D per level: no decode, no glGenerateMipmap.
+//
+//  Codecs, bytes per 4x4 block:
+//    BC1 (DXT1)  8  rgb
+//    BC3 (DXT5)  16 rgb + alpha
+//    BC5 (RGTC2) 16 two channels, for normal maps (z is rebuilt in the shader)
+//    ETC2 RGB8   8  rgb, written as ETC1 blocks (a subset of ETC2). Needs
+//                GL 4.3 / ARB_ES3_compatibility to load
+//
+//  Data keeps the row order of the source, bottom row first like TGA and
+//  glTexImage2D, so the container says "KTXorientation S=r,T=u".
+//
+#pragma once
+#include "includes.h"
+#include "MappedFile.h"
+#include <vector>
+
+enum TextureCodec {
+	TextureCodecAuto = 0, //BC5 for normal maps (by name), BC3 with alpha, else BC1
+	TextureCodecBC1,
+	TextureCodecBC3,
+	TextureCodecBC5,
+	TextureCodecETC2
+};
+
+//an encoded mip chain, largest level first
+struct CompressedTexture {
+	GLenum internal_format = 0;
+	GLenum base_format = 0;
+	int width = 0;
+	int height = 0;
+	std::vector<std::vector<unsigned char>> levels;
+	size_t size() const;
+};
+
+//a KTX file mapped for upload. Only compressed 2D textures are accepted
+class KTXFile {
+public:
+	bool open(const std::string& filename);
+	GLenum internal_format = 0;
+	int width = 0;
+	int height = 0;
+	int numLevels() const { return (int)level_data_.size(); }
+	const char* levelData(int level) const { return level_data_[level]; }
+	GLsizei levelSize(int level) const { return level_size_[level]; }
+private:
+	MappedFile file_;
+	std::vector<const char*> level_data_;
+	std::vector<GLsizei> level_size_;
+};
+
+class TextureCompression {
+public:
+	//"bc1", "bc3", "bc5", "etc2" or "auto"
+	static bool codecFromName(const std::string& name, TextureCodec& codec);
+	//what TextureCodecAuto resolves to for a file
+	static TextureCodec chooseCodec(const std::string& filename, const unsigned char* rgba, int width, int height);
+
+	//encodes rgba (4 bytes per pixel) and its box filtered mips down to 1x1
+	static void encode(const unsigned char* rgba, int width, int height, TextureCodec codec, CompressedTexture& texture);
+	static bool writeKTX(const std::string& filename, const CompressedTexture& texture);
+
+	//"path/name.tga" -> "path/name.ktx"
+	static std::string compressedPath(const std::string& source);
+	//true if the compressed copy of source exists and is not older than it
+	static bool hasCompressedCopy(const std::string& source);
+	//whether this GL has the extension a compressed format needs
+	static bool canSample(GLenum internal_format);
+
+	//2x2 box filter of rgba (4 bytes per pixel) to the next mip level
+	static void downsample(const std::vector<unsigned char>& src, int width, int height, std::vector<unsigned char>& dst);
+};
@@ -0,0 +1,325 @@
+//
+//  TextureStreamer.cpp
+//
+#include "TextureStreamer.h"
+#include "Parsers.h"
+#include "TextureCompression.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace {
+
+double nowMs() {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} //namespace
+
+TextureStreamer::~TextureStreamer() {
+	shutdown();
+}
+
+void TextureStreamer::init(int num_threads, size_t bytes_per_frame_budget) {
+	shutdown();
+	bytes_per_frame = bytes_per_frame_budget;
+	quit_ = false;
+	glGenBuffers(3, pbos_);
+	for (int i = 0; i < std::max(1, num_threads); i++)
+		workers_.emplace_back(&TextureStreamer::workerLoop_, this);
+}
+
+void TextureStreamer::shutdown() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		quit_ = true;
+		queue_.clear();
+	}
+	queue_cv_.notify_all();
+	for (auto& worker : workers_)
+		worker.join();
+	workers_.clear();
+	pending_.clear();
+	cancelled_.clear();
+	if (pbos_[0]) {
+		glDeleteBuffers(3, pbos_);
+		memset(pbos_, 0, sizeof(pbos_));
+	}
+}
+
+//1x1 mid grey, on every face for a cubemap
+GLuint TextureStreamer::createPlaceholder_(bool cubemap) {
+	const GLubyte grey[4] = { 128, 128, 128, 255 };
+	GLuint texture;
+	glGenTextures(1, &texture);
+	if (cubemap) {
+		glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+		for (GLenum face = 0; face < 6; face++)
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, 0);
+	}
+	else {
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 4);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	}
+	return texture;
+}
+
+TextureStreamer::Request* TextureStreamer::enqueue_(GLuint texture, bool cubemap, const std::vector<std::string>& files) {
+	if (first_request_ms_ < 0.0)
+		first_request_ms_ = nowMs();
+	Request* request = new Request();
+	request->texture = texture;
+	request->cubemap = cubemap;
+	request->files = files;
+	pending_[texture].reset(request);
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		queue_.push_back(request);
+	}
+	queue_cv_.notify_one();
+	return request;
+}
+
+GLuint TextureStreamer::request(const std::string& filename) {
+	GLuint texture = createPlaceholder_(false);
+	enqueue_(texture, false, { filename });
+	return texture;
+}
+
+GLuint TextureStreamer::requestCubemap(const std::vector<std::string>& faces) {
+	if (faces.size() != 6) {
+		std::cerr << "ERROR: A cubemap needs six faces" << std::endl;
+		return 0;
+	}
+	GLuint texture = createPlaceholder_(true);
+	enqueue_(texture, true, faces);
+	return texture;
+}
+
+void TextureStreamer::setScreenSize(GLuint texture, float pixels) {
+	auto found = pending_.find(texture);
+	if (found != pending_.end())
+		found->second->frame_screen_size = std::max(found->second->frame_screen_size, pixels);
+}
+
+void TextureStreamer::cancel(GLuint texture) {
+	auto found = pending_.find(texture);
+	if (found == pending_.end()) return;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto queued = std::find(queue_.begin(), queue_.end(), found->second.get());
+		if (queued != queue_.end())
+			queue_.erase(queued);
+		else if (found->second->state == RequestDecoding)
+			cancelled_.push_back(std::move(found->second));
+	}
+	pending_.erase(found);
+}
+
+//decodes the largest texture on screen first
+void TextureStreamer::workerLoop_() {
+	for (;;) {
+		Request* request = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			queue_cv_.wait(lock, [this] { return quit_ || !queue_.empty(); });
+			if (quit_) return;
+			auto best = queue_.begin();
+			for (auto it = queue_.begin(); it != queue_.end(); ++it)
+				if ((*it)->priority.load() > (*best)->priority.load()) best = it;
+			request = *best;
+			queue_.erase(best);
+			request->state = RequestDecoding;
+		}
+		decode_(*request);
+	}
+}
+
+//every level of every face, from the compressed copy when there is one this
+//GL can sample, else from the TGA with box filtered mips
+void TextureStreamer::decode_(Request& request) {
+	int num_faces = (int)request.files.size();
+	for (int face = 0; face < num_faces; face++) {
+		const std::string& file = request.files[face];
+		bool loaded = false;
+
+		if (TextureCompression::hasCompressedCopy(file)) {
+			KTXFile ktx;
+			if (ktx.open(TextureCompression::compressedPath(file)) && TextureCompression::canSample(ktx.internal_format) &&
+				(face == 0 || (request.compressed && ktx.internal_format == request.internal_format &&
+					ktx.width == request.width && ktx.height == request.height && ktx.numLevels() == request.num_levels))) {
+				if (face == 0) {
+					request.compressed = true;
+					request.internal_format = ktx.internal_format;
+					request.width = ktx.width;
+					request.height = ktx.height;
+					request.num_levels = ktx.numLevels();
+					request.levels.resize(num_faces * request.num_levels);
+				}
+				for (int level = 0; level < request.num_levels; level++) {
+					const char* data = ktx.levelData(level);
+					request.levels[face * request.num_levels + level].assign(data, data + ktx.levelSize(level));
+				}
+				loaded = true;
+			}
+		}
+
+		if (!loaded && !request.compressed) {
+			std::vector<unsigned char> rgba;
+			int width, height;
+			if (Parsers::decodeTGA(file, rgba, width, height) && (face == 0 || (width == request.width && height == request.height))) {
+				if (face == 0) {
+					request.internal_format = GL_RGBA8;
+					request.width = width;
+					request.height = height;
+					request.num_levels = 1;
+					for (int size = std::max(width, height); size > 1; size /= 2) request.num_levels++;
+					request.levels.resize(num_faces * request.num_levels);
+				}
+				int w = width, h = height;
+				for (int level = 0; level < request.num_levels; level++) {
+					std::vector<unsigned char>& out = request.levels[face * request.num_levels + level];
+					if (level == 0) out.swap(rgba);
+					else TextureCompression::downsample(request.levels[face * request.num_levels + level - 1], w, h, out);
+					if (level > 0) { w = std::max(1, w / 2); h = std::max(1, h / 2); }
+				}
+				loaded = true;
+			}
+		}
+
+		if (!loaded) {
+			std::cerr << "ERROR: Could not stream texture " << file << std::endl;
+			request.levels.clear();
+			request.state = RequestFailed;
+			return;
+		}
+	}
+	request.next_level = request.num_levels - 1;
+	request.state = RequestReady;
+}
+
+//one level (on every face) through the pbo ring, then it becomes the base
+//level. Orphaning each buffer keeps the copy from waiting on the last upload
+size_t TextureStreamer::uploadLevel_(Request& request) {
+	int level = request.next_level;
+	int num_faces = (int)request.files.size();
+	GLenum binding = request.cubemap ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+	GLsizei w = std::max(1, request.width >> level), h = std::max(1, request.height >> level);
+	size_t bytes = 0;
+
+	glBindTexture(binding, request.texture);
+	for (int face = 0; face < num_faces; face++) {
+		std::vector<unsigned char>& data = request.levels[face * request.num_levels + level];
+		GLenum target = request.cubemap ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : GL_TEXTURE_2D;
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos_[next_pbo_]);
+		next_pbo_ = (next_pbo_ + 1) % 3;
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, data.size(), nullptr, GL_STREAM_DRAW);
+		void* staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, data.size(), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (staging) {
+			memcpy(staging, data.data(), data.size());
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			if (request.compressed)
+				glCompressedTexImage2D(target, level, request.internal_format, w, h, 0, (GLsizei)data.size(), nullptr);
+			else
+				glTexImage2D(target, level, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		}
+		else { //no staging memory, upload straight from ours
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			if (request.compressed)
+				glCompressedTexImage2D(target, level, request.internal_format, w, h, 0, (GLsizei)data.size(), data.data());
+			else
+				glTexImage2D(target, level, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, data.data());
+		}
+		bytes += data.size();
+		std::vector<unsigned char>().swap(data);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	//sample only the levels that are there
+	if (level == request.num_levels - 1)
+		glTexParameteri(binding, GL_TEXTURE_MAX_LEVEL, request.num_levels - 1);
+	glTexParameteri(binding, GL_TEXTURE_BASE_LEVEL, level);
+	request.next_level--;
+	return bytes;
+}
+
+//uploads levels, most needed first, until budget bytes have gone.
+//A level is needed while it is no bigger than twice the texture's size on
+//screen; after those, larger textures on screen go first
+void TextureStreamer::upload_(size_t budget) {
+	size_t sent = 0;
+	for (;;) {
+		Request* best = nullptr;
+		bool best_needed = false;
+		for (auto& entry : pending_) {
+			Request& request = *entry.second;
+			if (request.state != RequestReady || request.next_level < 0) continue;
+			int level_size = std::max(request.width, request.height) >> request.next_level;
+			bool needed = level_size <= 2.0f * request.priority.load() || request.next_level == request.num_levels - 1;
+			if (!best || (needed && !best_needed) ||
+				(needed == best_needed && request.priority.load() > best->priority.load())) {
+				best = &request;
+				best_needed = needed;
+			}
+		}
+		if (!best) break;
+		//one level always goes, however big, so nothing stalls
+		size_t level_bytes = best->levels[best->next_level].size() * best->files.size();
+		if (sent > 0 && sent + level_bytes > budget) break;
+		sent += uploadLevel_(*best);
+	}
+	bytes_uploaded_ += sent;
+}
+
+void TextureStreamer::update() {
+	//this frame's screen sizes become the priorities, for upload and decode
+	for (auto& entry : pending_) {
+		entry.second->priority = entry.second->frame_screen_size;
+		entry.second->frame_screen_size = 0.0f;
+	}
+
+	upload_(bytes_per_frame);
+
+	cancelled_.erase(std::remove_if(cancelled_.begin(), cancelled_.end(),
+		[](const std::unique_ptr<Request>& request) { return request->state != RequestDecoding; }), cancelled_.end());
+
+	//forget finished requests, the textures stay
+	bool removed = false;
+	for (auto it = pending_.begin(); it != pending_.end();) {
+		int state = it->second->state;
+		if (state == RequestFailed || (state == RequestReady && it->second->next_level < 0)) {
+			it = pending_.erase(it);
+			removed = true;
+		}
+		else ++it;
+	}
+	if (removed && pending_.empty()) {
+		printf("Texture streaming: %.2f MB uploaded, done %.0f ms after the first request\n",
+			bytes_uploaded_ / 1048576.0, nowMs() - first_request_ms_);
+		first_request_ms_ = -1.0;
+	}
+}
+
+void TextureStreamer::finish() {
+	while (!pending_.empty()) {
+		bool waiting = false;
+		for (auto& entry : pending_) {
+			int state = entry.second->state;
+			if (state == RequestQueued || state == RequestDecoding) waiting = true;
+		}
+		upload_((size_t)-1);
+		update();
+		if (waiting) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
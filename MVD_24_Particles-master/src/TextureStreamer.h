@@ -0,0 +1,99 @@
+//
+//  TextureStreamer.h
+//
+//  Loads textures in the background. request() returns a texture name at
+//  once, holding a 1x1 grey placeholder (also a flat normal, as normal maps
+//  only use xy). Worker threads read the file and build its mip chain (or
+//  read the precompressed one, see TextureCompression.h), then update()
+//  uploads it on the GL thread through pixel buffer objects, at most
+//  bytes_per_frame a frame.
+//
+//  Levels arrive coarse to fine: each one uploaded becomes the texture's
+//  base level, so the texture sharpens as it streams and is never sampled
+//  from a level that isn't there. Textures drawn larger on screen go first,
+//  both for decode and upload, and a level bigger than the texture is drawn
+//  waits behind the levels other textures still need.
+//
+#pragma once
+#include "includes.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class TextureStreamer {
+public:
+	~TextureStreamer();
+
+	void init(int num_threads = 2, size_t bytes_per_frame = 4 << 20);
+	void shutdown();
+	bool isActive() const { return !workers_.empty(); }
+
+	//2D texture, or cubemap from six faces (+x, -x, +y, -y, +z, -z)
+	GLuint request(const std::string& filename);
+	GLuint requestCubemap(const std::vector<std::string>& faces);
+
+	//how big the texture was drawn this frame, in pixels across the screen.
+	//The largest report of the frame is its priority
+	void setScreenSize(GLuint texture, float pixels);
+	//call before deleting a texture that may still be streaming
+	void cancel(GLuint texture);
+
+	//GL thread, once a frame: uploads decoded levels within the budget
+	void update();
+	//uploads everything still pending, ignoring the budget
+	void finish();
+
+	size_t bytes_per_frame = 4 << 20;
+	int numPending() const { return (int)pending_.size(); }
+	size_t bytesUploaded() const { return bytes_uploaded_; }
+
+private:
+	enum RequestState { RequestQueued, RequestDecoding, RequestReady, RequestFailed };
+
+	struct Request {
+		GLuint texture = 0;
+		bool cubemap = false;
+		std::vector<std::string> files;
+		std::atomic<float> priority{ 0.0f }; //read by workers to order decodes
+		float frame_screen_size = 0.0f; //GL thread only
+		std::atomic<int> state{ RequestQueued };
+
+		//filled by the worker before state becomes ready
+		bool compressed = false;
+		GLenum internal_format = GL_RGBA8;
+		int width = 0;
+		int height = 0;
+		int num_levels = 0;
+		std::vector<std::vector<unsigned char>> levels; //[face * num_levels + level]
+
+		int next_level = -1; //next to upload, counting down to 0
+	};
+
+	std::vector<std::thread> workers_;
+	std::mutex mutex_;
+	std::condition_variable queue_cv_;
+	std::deque<Request*> queue_; //not yet decoded
+	bool quit_ = false;
+
+	//every request not fully uploaded, by texture name. GL thread only
+	std::unordered_map<GLuint, std::unique_ptr<Request>> pending_;
+	//cancelled while a worker was decoding them, freed once it is done
+	std::vector<std::unique_ptr<Request>> cancelled_;
+
+	GLuint pbos_[3] = { 0, 0, 0 };
+	int next_pbo_ = 0;
+	size_t bytes_uploaded_ = 0;
+	double first_request_ms_ = -1.0;
+
+	GLuint createPlaceholder_(bool cubemap);
+	Request* enqueue_(GLuint texture, bool cubemap, const std::vector<std::string>& files);
+	void workerLoop_();
+	static void decode_(Request& request);
+	size_t uploadLevel_(Request& request);
+	void upload_(size_t budget);
+};
@@ -6,6 +6,13 @@
 #include "includes.h"
 #include "extern.h"
 #include "Game.h"
+#include "HeadlessContext.h"
+#include "Parsers.h"
+#include "AssetCooker.h"
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <cstring>
 
 
 
@@ -51,11 +58,255 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 	GAME->mouse_button_callback(button, action, mods);
 }
 
-int main(void)
+//times count entities with a mesh and a collider created one by one, then
+//as copies of a prefab. Needs no window, and leaves the ECS empty
+void benchmarkSpawn(int count) {
+	auto elapsed_ms = [](std::chrono::steady_clock::time_point since) {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+	};
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < count; i++) {
+		int ent = ECS.createEntity("crate_" + std::to_string(i));
+		ECS.getComponentFromEntity<Transform>(ent).translate((float)i, 0.0f, 0.0f);
+		ECS.createComponentForEntity<Mesh>(ent);
+		ECS.createComponentForEntity<Collider>(ent);
+	}
+	double one_by_one_ms = elapsed_ms(start);
+	ECS = EntityComponentStore();
+
+	start = std::chrono::steady_clock::now();
+	Prefab crate("crate");
+	crate.add<Mesh>();
+	crate.add<Collider>();
+	std::vector<lm::mat4> transforms(count);
+	for (int i = 0; i < count; i++)
+		transforms[i].translate((float)i, 0.0f, 0.0f);
+	ECS.instantiate(crate, count, transforms);
+	double prefab_ms = elapsed_ms(start);
+	ECS = EntityComponentStore();
+
+	printf("Spawned %d entities: one by one %.2f ms, from a prefab %.2f ms\n", count, one_by_one_ms, prefab_ms);
+}
+
+//runs the game offscreen at a fixed resolution for num_frames with a fixed dt,
+//then prints a timing report. Each frame ends with glFinish so GPU work is
+//included in the frame time (there is no vsync'd swap to wait on).
+//If camera_path is set, the main camera follows it, the run lasts as long
+//as the path (unless num_frames > 0) and per system/pass timings are written
+//to report_file
+int runHeadless(int width, int height, int num_frames, float fixed_dt,
+	std::string camera_path, std::string report_file, bool anim_benchmark, int anim_crowd, int skinned_crowd,
+	std::string world, std::string snapshot_load, std::string snapshot_save) {
+
+	HeadlessContext context;
+	if (!context.init(width, height))
+		return -1;
+
+	//with EGL, glew may complain there is no GLX display - GL entry points
+	//are loaded before that check, so the error is ignored
+	glewExperimental = GL_TRUE;
+	glewInit();
+	glGetError();
+
+	const GLubyte* renderer = glGetString(GL_RENDERER);
+	const GLubyte* version = glGetString(GL_VERSION);
+	std::cout << "Renderer: " << renderer << "; version: " << version << "; context: " << context.getBackendName() << std::endl;
+
+	//debug gui is never shown, but the system expects a context to exist
+	IMGUI_CHECKVERSION();
+	ImGui::CreateContext();
+
+	GAME = new Game();
+	GAME->init(width, height);
+	GAME->update_viewports(width, height);
+	if (world != "" && !GAME->loadWorld(world))
+		return -1;
+	//full textures from the first frame, so runs stay comparable
+	GAME->finishLoading();
+
+	//clip memory and sampling speed, measured on the loaded clips
+	if (anim_benchmark)
+		GAME->benchmarkAnimation(10000);
+	//pose evaluation scaling on a crowd of copies of the skinned meshes
+	if (anim_crowd > 0) {
+		GAME->createAnimationCrowd(anim_crowd);
+		GAME->benchmarkPoses(300);
+	}
+	//instanced crowd drawn from baked animation, measured by the frame loop
+	if (skinned_crowd > 0)
+		printf("Skinned crowd: %d instances\n", GAME->createSkinnedCrowd(skinned_crowd));
+	//state captured by an earlier run, e.g. just before a slow frame
+	if (snapshot_load != "" && !GAME->loadSnapshot(snapshot_load))
+		return -1;
+
+	//fixed quality, so runs are comparable
+	GAME->getGovernor().enabled = false;
+
+	bool benchmark = camera_path != "";
+	if (benchmark) {
+		if (!GAME->playCameraPath(camera_path))
+			return -1;
+		GAME->getProfiler().enabled = true;
+	}
+	FrameProfiler& profiler = GAME->getProfiler();
+
+	//path runs until finished, so pick a large cap
+	if (num_frames <= 0)
+		num_frames = benchmark ? 1000000 : 300;
+	std::vector<double> frame_ms;
+	frame_ms.reserve(benchmark ? 4096 : num_frames);
+	auto run_start = std::chrono::steady_clock::now();
+	for (int i = 0; i < num_frames; i++) {
+		if (benchmark && GAME->isCameraPathFinished())
+			break;
+		auto frame_start = std::chrono::steady_clock::now();
+		profiler.beginFrame();
+		GAME->update(fixed_dt);
+		glFinish();
+		context.swapBuffers();
+		profiler.endFrame();
+		frame_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count());
+	}
+	num_frames = (int)frame_ms.size();
+	double total_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - run_start).count();
+
+	//first frame compiles shaders and uploads lazily, report it separately
+	double first_ms = num_frames > 0 ? frame_ms[0] : 0.0;
+	std::vector<double> steady(frame_ms.begin() + (num_frames > 1 ? 1 : 0), frame_ms.end());
+	double sum = 0.0, min_ms = 0.0, max_ms = 0.0;
+	if (!steady.empty()) {
+		min_ms = *std::min_element(steady.begin(), steady.end());
+		max_ms = *std::max_element(steady.begin(), steady.end());
+		for (double ms : steady) sum += ms;
+	}
+	double avg_ms = steady.empty() ? 0.0 : sum / steady.size();
+
+	printf("HEADLESS REPORT\n");
+	printf("  resolution: %dx%d, frames: %d, fixed dt: %.2f ms\n", width, height, num_frames, fixed_dt * 1000.0f);
+	printf("  first frame: %.3f ms\n", first_ms);
+	printf("  average: %.3f ms/frame (%.1f fps), min: %.3f ms, max: %.3f ms\n",
+		avg_ms, avg_ms > 0.0 ? 1000.0 / avg_ms : 0.0, min_ms, max_ms);
+	printf("  total: %.3f s\n", total_s);
+	if (benchmark) {
+		profiler.finish();
+		profiler.printSummary();
+		if (profiler.writeReport(report_file, fixed_dt))
+			printf("  report written to %s\n", report_file.c_str());
+	}
+	if (snapshot_save != "")
+		GAME->saveSnapshot(snapshot_save);
+	bool gl_ok = glCheckError();
+
+	delete GAME;
+	ImGui::DestroyContext();
+	context.shutdown();
+	return gl_ok ? 0 : 1;
+}
+
+//usage: 24-Particles [--headless] [--frames N] [--width W] [--height H]
+//                    [--benchmark path.campath] [--report out.json|out.csv] [--dt seconds]
+//                    [--anim-benchmark] [--anim-stress N] [--crowd N]
+//                    [--obj-benchmark file.obj]
+//                    [--codec auto|bc1|bc3|bc5|etc2] [--compress-texture file.tga]...
+//                    [--cook-level level.json]... [--cook-file file]... [--pack out.pack]
+//                    [--cook-world level.json]... [--sector-size units] [--world level.json]
+//                    [--load-snapshot file] [--save-snapshot file] [--spawn-benchmark N]
+//--benchmark, --anim-benchmark and --anim-stress imply --headless,
+//--obj-benchmark only times the OBJ readers and needs no window, as does
+//--spawn-benchmark for creating entities,
+//--compress-texture writes file.ktx (see TextureCompression.h) and exits,
+//--cook-level and --cook-file write an asset pack (see AssetCooker.h, by
+//default data/assets.pack, which the game mounts at startup) and exit,
+//--cook-world does too, with the level's entities cut into sectors that
+//--world then streams around the camera (see SectorStreamer.h),
+//--load-snapshot restores scene state after init and --save-snapshot
+//writes it when a headless run ends (see SceneSnapshot.h)
+int main(int argc, char** argv)
 {
 	int WINDOW_WIDTH = 800;
 	int WINDOW_HEIGHT = 600;
 
+	bool headless = false;
+	int headless_frames = 0;
+	float fixed_dt = 1.0f / 60.0f;
+	std::string camera_path = "";
+	std::string report_file = "benchmark.json";
+	bool anim_benchmark = false;
+	int anim_crowd = 0;
+	int skinned_crowd = 0;
+	std::string obj_benchmark = "";
+	int spawn_benchmark = 0;
+	std::vector<std::string> compress_textures;
+	std::vector<std::string> cook_levels, cook_files, cook_worlds;
+	float sector_size = 50.0f;
+	std::string world = "";
+	std::string snapshot_load = "", snapshot_save = "";
+	std::string pack_file = "data/assets.pack";
+	TextureCodec codec = TextureCodecAuto;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--headless") == 0) headless = true;
+		else if (strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc) { camera_path = argv[++i]; headless = true; }
+		else if (strcmp(argv[i], "--anim-benchmark") == 0) { anim_benchmark = true; headless = true; }
+		else if (strcmp(argv[i], "--anim-stress") == 0 && i + 1 < argc) { anim_crowd = atoi(argv[++i]); headless = true; }
+		else if (strcmp(argv[i], "--crowd") == 0 && i + 1 < argc) skinned_crowd = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--obj-benchmark") == 0 && i + 1 < argc) obj_benchmark = argv[++i];
+		else if (strcmp(argv[i], "--spawn-benchmark") == 0 && i + 1 < argc) spawn_benchmark = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--compress-texture") == 0 && i + 1 < argc) compress_textures.push_back(argv[++i]);
+		else if (strcmp(argv[i], "--cook-level") == 0 && i + 1 < argc) cook_levels.push_back(argv[++i]);
+		else if (strcmp(argv[i], "--cook-file") == 0 && i + 1 < argc) cook_files.push_back(argv[++i]);
+		else if (strcmp(argv[i], "--pack") == 0 && i + 1 < argc) pack_file = argv[++i];
+		else if (strcmp(argv[i], "--cook-world") == 0 && i + 1 < argc) cook_worlds.push_back(argv[++i]);
+		else if (strcmp(argv[i], "--sector-size") == 0 && i + 1 < argc) sector_size = (float)atof(argv[++i]);
+		else if (strcmp(argv[i], "--world") == 0 && i + 1 < argc) world = argv[++i];
+		else if (strcmp(argv[i], "--load-snapshot") == 0 && i + 1 < argc) snapshot_load = argv[++i];
+		else if (strcmp(argv[i], "--save-snapshot") == 0 && i + 1 < argc) snapshot_save = argv[++i];
+		else if (strcmp(argv[i], "--codec") == 0 && i + 1 < argc) {
+			if (!TextureCompression::codecFromName(argv[++i], codec)) std::cerr << "Unknown codec: " << argv[i] << std::endl;
+		}
+		else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) report_file = argv[++i];
+		else if (strcmp(argv[i], "--dt") == 0 && i + 1 < argc) fixed_dt = (float)atof(argv[++i]);
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) headless_frames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--width") == 0 && i + 1 < argc) WINDOW_WIDTH = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--height") == 0 && i + 1 < argc) WINDOW_HEIGHT = atoi(argv[++i]);
+		else std::cerr << "Unknown argument: " << argv[i] << std::endl;
+	}
+	//zero, negative or non numeric dt would never advance the camera path
+	if (!(fixed_dt > 0.0f)) {
+		std::cerr << "ERROR: --dt must be a positive number of seconds" << std::endl;
+		return 1;
+	}
+	if (obj_benchmark != "") {
+		JobSystem jobs;
+		jobs.init();
+		Parsers::setJobSystem(&jobs);
+		Parsers::benchmarkOBJ(obj_benchmark);
+		Parsers::setJobSystem(nullptr);
+		return 0;
+	}
+	if (spawn_benchmark > 0) {
+		benchmarkSpawn(spawn_benchmark);
+		return 0;
+	}
+	if (!compress_textures.empty()) {
+		int failed = 0;
+		for (auto& file : compress_textures)
+			if (!Parsers::compressTexture(file, codec)) failed++;
+		return failed ? 1 : 0;
+	}
+	if (!cook_levels.empty() || !cook_files.empty() || !cook_worlds.empty()) {
+		AssetCooker cooker;
+		cooker.codec = codec;
+		for (auto& level : cook_levels)
+			cooker.addLevel(level);
+		for (auto& file : cook_files)
+			cooker.addFile(file);
+		for (auto& level : cook_worlds)
+			cooker.addWorld(level, sector_size);
+		return cooker.write(pack_file) ? 0 : 1;
+	}
+	if (headless)
+		return runHeadless(WINDOW_WIDTH, WINDOW_HEIGHT, headless_frames, fixed_dt, camera_path, report_file, anim_benchmark, anim_crowd, skinned_crowd, world, snapshot_load, snapshot_save);
+
 
     // register the error call-back function before doing anything else
     glfwSetErrorCallback(glfw_error_callback);
@@ -127,6 +378,12 @@ int main(void)
 	GAME = new Game();
 	GAME->init(WINDOW_WIDTH, WINDOW_HEIGHT);
 	GAME->update_viewports(WINDOW_WIDTH, WINDOW_HEIGHT);
+	if (world != "")
+		GAME->loadWorld(world);
+	if (skinned_crowd > 0)
+		GAME->createSkinnedCrowd(skinned_crowd);
+	if (snapshot_load != "")
+		GAME->loadSnapshot(snapshot_load);
 	//stores difference in time between each frame
 	float dt = 0.0f;
 	double curr_time = 0.0, prev_time = glfwGetTime();